@@ -12,7 +12,7 @@
 int main(int argc, char** argv)
 {
     const std::vector<const char*> args(argv, argv + argc);
-    return odfsig::main(args, std::cerr);
+    return odfsig::main(args, std::cerr, std::cout);
 }
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
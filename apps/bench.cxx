@@ -0,0 +1,914 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <libxml/xmlerror.h>
+#include <libxml/xmlmemory.h>
+#include <xmlsec/base64.h>
+
+#include <odfsig/base64.hxx>
+#include <odfsig/c14n.hxx>
+#include <odfsig/crc32.hxx>
+#include <odfsig/digest.hxx>
+#include <odfsig/lib.hxx>
+#include <odfsig/reader.hxx>
+
+namespace
+{
+/// Heap allocations of C++ code and of libxml, see countXmlAllocations().
+std::atomic<size_t> allocations{0};
+} // namespace
+
+void* operator new(size_t size)
+{
+    ++allocations;
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+
+void operator delete(void* memory, size_t /*size*/) noexcept
+{
+    std::free(memory);
+}
+
+namespace
+{
+/// Error handler to avoid spam of error messages from libxml and xmlsec.
+void ignore(void* /*ctx*/, const char* /*msg*/, ...) {}
+
+void* xmlMallocCounted(size_t size)
+{
+    ++allocations;
+    return std::malloc(size);
+}
+
+void* xmlReallocCounted(void* memory, size_t size)
+{
+    ++allocations;
+    return std::realloc(memory, size);
+}
+
+char* xmlStrdupCounted(const char* string)
+{
+    ++allocations;
+    return strdup(string);
+}
+
+/**
+ * Makes libxml (and so xmlsec) allocate via counting functions. Call before
+ * libxml is initialized.
+ */
+void countXmlAllocations()
+{
+    xmlMemSetup(std::free, xmlMallocCounted, xmlReallocCounted,
+                xmlStrdupCounted);
+}
+
+/// Verifies an opened document, returns false if it has no valid signatures.
+bool verifyOpened(odfsig::Verifier& verifier)
+{
+    if (!verifier.parseSignatures() || verifier.getSignatures().empty())
+    {
+        return false;
+    }
+
+    for (const auto& signature : verifier.getSignatures())
+    {
+        if (!signature->verify())
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Opens and verifies a document with verifier. Returns false if the document
+ * has no valid signatures.
+ */
+bool verifyDocument(odfsig::Verifier& verifier, const std::string& path)
+{
+    return verifier.openZip(path) && verifyOpened(verifier);
+}
+
+/**
+ * Opens and verifies a document with a new verifier. Without a live session,
+ * the crypto init and shutdown is part of the measurement. Returns false if
+ * the document has no valid signatures.
+ */
+bool verifyCold(const std::string& cryptoConfig,
+                const std::vector<std::string>& trustedDers,
+                const std::string& path,
+                std::optional<size_t> prefetchMemory = std::nullopt)
+{
+    std::unique_ptr<odfsig::Verifier> verifier(
+        odfsig::Verifier::create(cryptoConfig));
+    verifier->setTrustedDers(trustedDers);
+    if (prefetchMemory)
+    {
+        verifier->setPrefetchMemory(*prefetchMemory);
+    }
+    return verifyDocument(*verifier, path);
+}
+
+/// Compares the startup latency with and without the system crypto DB.
+int benchStartup(const std::vector<std::string>& args)
+{
+    if (args.size() < 2)
+    {
+        std::cerr << "Usage: odfsigbench startup <ODF-file> <trusted-der> "
+                     "[iterations]\n";
+        return 1;
+    }
+
+    const std::string& path = args[0];
+    const std::vector<std::string> trustedDers{args[1]};
+    int iterations = 100;
+    if (args.size() > 2)
+    {
+        iterations = std::atoi(args[2].c_str());
+    }
+
+    std::string home;
+    const char* homeEnv = getenv("HOME");
+    if (homeEnv != nullptr)
+    {
+        home = homeEnv;
+    }
+
+    const std::vector<std::pair<std::string, std::string>> modes{
+        {"system trust", home}, {"no system trust", std::string()}};
+    for (const auto& mode : modes)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            if (!verifyCold(mode.second, trustedDers, path))
+            {
+                std::cerr << "Verification failed: " << mode.first << '\n';
+                return 1;
+            }
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "startup, " << mode.first << ": "
+                  << elapsed.count() / iterations << " ms\n";
+    }
+
+    return 0;
+}
+
+/**
+ * Measures the verification of a document with a live session, so only the
+ * per-document work is part of the measurement, e.g. reading the streams.
+ * Compares the latency with and without the read-ahead of the streams.
+ */
+int benchVerify(const std::vector<std::string>& args)
+{
+    if (args.size() < 2)
+    {
+        std::cerr << "Usage: odfsigbench verify <ODF-file> <trusted-der> "
+                     "[iterations]\n";
+        return 1;
+    }
+
+    const std::string& path = args[0];
+    const std::vector<std::string> trustedDers{args[1]};
+    int iterations = 100;
+    if (args.size() > 2)
+    {
+        iterations = std::atoi(args[2].c_str());
+    }
+
+    std::unique_ptr<odfsig::Session> session = odfsig::Session::create();
+    // Warm up, e.g. the page cache.
+    if (!verifyCold(std::string(), trustedDers, path))
+    {
+        std::cerr << "Verification failed\n";
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, std::optional<size_t>>> modes{
+        {"read-ahead", std::nullopt}, {"no read-ahead", 0}};
+    for (const auto& mode : modes)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            if (!verifyCold(std::string(), trustedDers, path, mode.second))
+            {
+                std::cerr << "Verification failed: " << mode.first << '\n';
+                return 1;
+            }
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "verify, " << mode.first << ": "
+                  << elapsed.count() / iterations << " ms\n";
+    }
+
+    return 0;
+}
+
+/**
+ * Compares the latency and the heap allocations per document of new, reset and
+ * pooled verifiers.
+ */
+int benchReuse(const std::vector<std::string>& args)
+{
+    if (args.size() < 2)
+    {
+        std::cerr << "Usage: odfsigbench reuse <ODF-file> <trusted-der> "
+                     "[iterations]\n";
+        return 1;
+    }
+
+    countXmlAllocations();
+    const std::string& path = args[0];
+    const std::vector<std::string> trustedDers{args[1]};
+    int iterations = 100;
+    if (args.size() > 2)
+    {
+        iterations = std::atoi(args[2].c_str());
+    }
+
+    auto measure = [iterations](const std::string& name,
+                                const std::function<bool()>& verify)
+    {
+        // Warm up, e.g. the page cache and the buffers.
+        if (!verify())
+        {
+            std::cerr << "Verification failed: " << name << '\n';
+            return false;
+        }
+
+        const size_t allocationsBefore = allocations;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            if (!verify())
+            {
+                std::cerr << "Verification failed: " << name << '\n';
+                return false;
+            }
+        }
+        const std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "reuse, " << name << ": " << elapsed.count() / iterations
+                  << " ms, "
+                  << static_cast<double>(allocations - allocationsBefore) /
+                         iterations
+                  << " allocations\n";
+        return true;
+    };
+
+    if (!measure("new verifier",
+                 [&trustedDers, &path]()
+                 { return verifyCold(std::string(), trustedDers, path); }))
+    {
+        return 1;
+    }
+
+    std::unique_ptr<odfsig::Session> session = odfsig::Session::create();
+    if (!measure("new verifier, session",
+                 [&trustedDers, &path]()
+                 { return verifyCold(std::string(), trustedDers, path); }))
+    {
+        return 1;
+    }
+
+    std::unique_ptr<odfsig::Verifier> verifier(
+        odfsig::Verifier::create(std::string()));
+    verifier->setTrustedDers(trustedDers);
+    if (!measure("reset verifier",
+                 [&verifier, &path]()
+                 {
+                     const bool ok = verifyDocument(*verifier, path);
+                     verifier->reset();
+                     return ok;
+                 }))
+    {
+        return 1;
+    }
+    verifier.reset();
+
+    std::unique_ptr<odfsig::VerifierPool> pool = odfsig::VerifierPool::create(
+        std::string(),
+        [&trustedDers](odfsig::Verifier& pooled)
+        { pooled.setTrustedDers(trustedDers); },
+        /*capacity=*/1);
+    if (!measure("pool",
+                 [&pool, &path]()
+                 {
+                     std::unique_ptr<odfsig::Verifier> pooled =
+                         pool->checkout();
+                     const bool ok = verifyDocument(*pooled, path);
+                     pool->checkin(std::move(pooled));
+                     return ok;
+                 }))
+    {
+        return 1;
+    }
+
+    return 0;
+}
+
+/**
+ * Compares the throughput of the digest kernels. The document is only used to
+ * initialize the crypto backend.
+ */
+int benchDigest(const std::vector<std::string>& args)
+{
+    if (args.empty())
+    {
+        std::cerr << "Usage: odfsigbench digest <ODF-file> [MiB] "
+                     "[iterations]\n";
+        return 1;
+    }
+
+    size_t size = 64;
+    if (args.size() > 1)
+    {
+        size = std::strtoul(args[1].c_str(), nullptr, 10);
+    }
+    size *= 1024 * 1024;
+    int iterations = 5;
+    if (args.size() > 2)
+    {
+        iterations = std::atoi(args[2].c_str());
+    }
+
+    std::unique_ptr<odfsig::Session> session = odfsig::Session::create();
+    std::unique_ptr<odfsig::Verifier> verifier(
+        odfsig::Verifier::create(std::string()));
+    verifier->setInsecure(true);
+    if (!verifier->openZip(args[0]) || !verifier->parseSignatures())
+    {
+        std::cerr << "Failed to initialize the crypto backend\n";
+        return 1;
+    }
+
+    const std::vector<unsigned char> input(size, 'x');
+    const std::vector<std::pair<odfsig::DigestAlgorithm, std::string>>
+        algorithms{{odfsig::DigestAlgorithm::Sha1, "sha1"},
+                   {odfsig::DigestAlgorithm::Sha256, "sha256"},
+                   {odfsig::DigestAlgorithm::Sha512, "sha512"}};
+    for (const auto& algorithm : algorithms)
+    {
+        for (const odfsig::DigestKernel kernel :
+             {odfsig::DigestKernel::Backend, odfsig::DigestKernel::Portable,
+              odfsig::DigestKernel::Avx2, odfsig::DigestKernel::ShaNi})
+        {
+            if (!odfsig::Digest::create(algorithm.first, kernel))
+            {
+                continue;
+            }
+
+            const auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i)
+            {
+                std::unique_ptr<odfsig::Digest> digest =
+                    odfsig::Digest::create(algorithm.first, kernel);
+                digest->update(input.data(), input.size());
+                std::vector<unsigned char> result;
+                if (!digest->finish(result))
+                {
+                    std::cerr << "Digest failed\n";
+                    return 1;
+                }
+            }
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start;
+            const double mibs = static_cast<double>(size) * iterations /
+                                (1024 * 1024) / elapsed.count();
+            std::cout << "digest, " << algorithm.second << ", "
+                      << odfsig::Digest::getKernelName(kernel) << ": " << mibs
+                      << " MiB/s";
+            if (kernel == odfsig::Digest::getBestKernel(algorithm.first))
+            {
+                std::cout << " (default)";
+            }
+            std::cout << '\n';
+        }
+    }
+
+    return 0;
+}
+
+/// Compares the SHA-256 kernels on many small messages, see hashBatch().
+int benchDigestBatch(const std::vector<std::string>& args)
+{
+    size_t count = 8192;
+    if (!args.empty())
+    {
+        count = std::strtoul(args[0].c_str(), nullptr, 10);
+    }
+    size_t size = 1024;
+    if (args.size() > 1)
+    {
+        size = std::strtoul(args[1].c_str(), nullptr, 10);
+    }
+    int iterations = 20;
+    if (args.size() > 2)
+    {
+        iterations = std::atoi(args[2].c_str());
+    }
+
+    const std::vector<std::vector<unsigned char>> messages(
+        count, std::vector<unsigned char>(size, 'x'));
+    for (const odfsig::DigestKernel kernel :
+         {odfsig::DigestKernel::Portable, odfsig::DigestKernel::Avx2,
+          odfsig::DigestKernel::ShaNi})
+    {
+        if (!odfsig::Digest::create(odfsig::DigestAlgorithm::Sha256, kernel))
+        {
+            continue;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            std::vector<std::vector<unsigned char>> digests;
+            if (!odfsig::Digest::hashBatch(odfsig::DigestAlgorithm::Sha256,
+                                           kernel, messages, digests))
+            {
+                std::cerr << "Digest failed\n";
+                return 1;
+            }
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        const double mibs = static_cast<double>(size) * count * iterations /
+                            (1024 * 1024) / elapsed.count();
+        std::cout << "digest-batch, sha256, "
+                  << odfsig::Digest::getKernelName(kernel) << ": " << mibs
+                  << " MiB/s";
+        if (kernel ==
+            odfsig::Digest::getBestBatchKernel(odfsig::DigestAlgorithm::Sha256))
+        {
+            std::cout << " (default)";
+        }
+        std::cout << '\n';
+    }
+
+    return 0;
+}
+
+/**
+ * Compares the base64 kernels and the xmlsec decoder on input wrapped at 64
+ * columns, like the certificates in signatures.
+ */
+int benchBase64(const std::vector<std::string>& args)
+{
+    size_t size = 4;
+    if (!args.empty())
+    {
+        size = std::strtoul(args[0].c_str(), nullptr, 10);
+    }
+    size *= 1024 * 1024;
+    int iterations = 20;
+    if (args.size() > 1)
+    {
+        iterations = std::atoi(args[1].c_str());
+    }
+
+    const std::string alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string input;
+    input.reserve(size + size / 64 + 1);
+    for (size_t i = 0; i < size; ++i)
+    {
+        input += alphabet[(i * 7 + i / 64) % alphabet.size()];
+        if (i % 64 == 63)
+        {
+            input += '\n';
+        }
+    }
+
+    const auto report = [size,
+                         iterations](const std::string& name,
+                                     std::chrono::duration<double> elapsed,
+                                     bool best) {
+        std::cout << "base64, " << name << ": "
+                  << static_cast<double>(size) * iterations / (1024 * 1024) /
+                         elapsed.count()
+                  << " MiB/s" << (best ? " (default)" : "") << '\n';
+    };
+
+    std::vector<unsigned char> output(input.size());
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i)
+    {
+        xmlSecSize outputSize = 0;
+        if (xmlSecBase64Decode_ex(BAD_CAST(input.c_str()), output.data(),
+                                  static_cast<xmlSecSize>(output.size()),
+                                  &outputSize) < 0)
+        {
+            std::cerr << "Decode failed\n";
+            return 1;
+        }
+    }
+    report("xmlsec", std::chrono::steady_clock::now() - start, false);
+
+    for (const auto& kernel :
+         std::vector<std::pair<odfsig::Base64Kernel, std::string>>{
+             {odfsig::Base64Kernel::Portable, "portable"},
+             {odfsig::Base64Kernel::Avx2, "avx2"}})
+    {
+        if (!odfsig::base64Decode("", output, kernel.first))
+        {
+            continue;
+        }
+
+        start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            if (!odfsig::base64Decode(input, output, kernel.first))
+            {
+                std::cerr << "Decode failed\n";
+                return 1;
+            }
+        }
+        report(kernel.second, std::chrono::steady_clock::now() - start,
+               kernel.first == odfsig::getBestBase64Kernel());
+    }
+
+    return 0;
+}
+
+/// Compares the CRC-32 kernels, as used by the integrity check.
+int benchCrc32(const std::vector<std::string>& args)
+{
+    size_t size = 64;
+    if (!args.empty())
+    {
+        size = std::strtoul(args[0].c_str(), nullptr, 10);
+    }
+    size *= 1024 * 1024;
+    int iterations = 20;
+    if (args.size() > 1)
+    {
+        iterations = std::atoi(args[1].c_str());
+    }
+
+    std::vector<unsigned char> input(size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        input[i] = static_cast<unsigned char>(i * 7 + i / 256);
+    }
+
+    for (const auto& kernel :
+         std::vector<std::pair<odfsig::Crc32Kernel, std::string>>{
+             {odfsig::Crc32Kernel::Portable, "portable"},
+             {odfsig::Crc32Kernel::Pclmul, "pclmul"}})
+    {
+        uint32_t crc = 0;
+        if (!odfsig::crc32Update(nullptr, 0, crc, kernel.first))
+        {
+            continue;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            odfsig::crc32Update(input.data(), input.size(), crc, kernel.first);
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "crc32, " << kernel.second << ": "
+                  << static_cast<double>(size) * iterations / (1024 * 1024) /
+                         elapsed.count()
+                  << " MiB/s"
+                  << (kernel.first == odfsig::getBestCrc32Kernel()
+                          ? " (default)"
+                          : "")
+                  << ", crc " << crc << '\n';
+    }
+
+    return 0;
+}
+
+/// Drops the cached pages of the files, so they are read from the storage.
+bool evictFromPageCache(const std::vector<std::string>& paths)
+{
+    for (const auto& path : paths)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        const int result = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        if (result != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Verifies a batch of documents from cold-cache storage, e.g. many medium-sized
+ * files on a network volume. Compares blocking reads with the read-ahead of the
+ * thread pool and the io_uring readers.
+ */
+int benchRead(const std::vector<std::string>& args)
+{
+    if (args.size() < 3)
+    {
+        std::cerr << "Usage: odfsigbench read <trusted-der> <in-flight> "
+                     "<ODF-file>...\n";
+        return 1;
+    }
+
+    const std::vector<std::string> trustedDers{args[0]};
+    const size_t inFlight = std::strtoul(args[1].c_str(), nullptr, 10);
+    const std::vector<std::string> paths(args.begin() + 2, args.end());
+    size_t totalSize = 0;
+    for (const auto& path : paths)
+    {
+        std::ifstream stream(path, std::ios::binary | std::ios::ate);
+        totalSize += static_cast<size_t>(stream.tellg());
+    }
+
+    std::unique_ptr<odfsig::Session> session = odfsig::Session::create();
+    // Warm up the crypto state, not the files.
+    if (!verifyCold(std::string(), trustedDers, paths[0]))
+    {
+        std::cerr << "Verification failed\n";
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, std::optional<odfsig::ReaderKind>>>
+        modes{{"blocking", std::nullopt},
+              {"threads", odfsig::ReaderKind::Threads},
+              {"io_uring", odfsig::ReaderKind::Uring}};
+    for (const auto& mode : modes)
+    {
+        if (!evictFromPageCache(paths))
+        {
+            std::cerr << "Failed to evict the files from the page cache\n";
+            return 1;
+        }
+
+        std::unique_ptr<odfsig::DocumentReader> reader;
+        if (mode.second)
+        {
+            reader =
+                odfsig::DocumentReader::create(*mode.second, paths, inFlight);
+            if (!reader)
+            {
+                std::cout << "read, " << mode.first << ": not available\n";
+                continue;
+            }
+        }
+
+        size_t valid = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (const auto& path : paths)
+        {
+            std::unique_ptr<odfsig::Verifier> verifier(
+                odfsig::Verifier::create(std::string()));
+            verifier->setTrustedDers(trustedDers);
+            if (!reader)
+            {
+                valid += verifyDocument(*verifier, path) ? 1 : 0;
+                continue;
+            }
+
+            odfsig::ReadDocument document;
+            reader->next(document);
+            if (document._error.empty() &&
+                verifier->openZipMemory(document._buffer.data(),
+                                        document._size) &&
+                verifyOpened(*verifier))
+            {
+                ++valid;
+            }
+            verifier.reset();
+            reader->recycle(std::move(document._buffer));
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "read, " << mode.first << ": "
+                  << static_cast<double>(paths.size()) / elapsed.count()
+                  << " documents/s, "
+                  << static_cast<double>(totalSize) / (1024 * 1024) /
+                         elapsed.count()
+                  << " MiB/s, " << valid << " valid\n";
+    }
+
+    return 0;
+}
+
+/**
+ * Compares verifying a batch in-process with --isolate, which verifies each
+ * document in a forked worker and copies its result back.
+ */
+int benchIsolate(const std::vector<std::string>& args)
+{
+    if (args.size() < 3)
+    {
+        std::cerr << "Usage: odfsigbench isolate <trusted-der> <workers> "
+                     "<ODF-file>...\n";
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, std::vector<const char*>>> modes{
+        {"in-process", {}},
+        {"1 worker", {"--isolate", "--workers", "1"}},
+        {args[1] + " workers", {"--isolate", "--workers", args[1].c_str()}}};
+    for (const auto& mode : modes)
+    {
+        std::vector<const char*> cmdline{"odfsig", "--format=ndjson",
+                                         "--trusted-der", args[0].c_str()};
+        cmdline.insert(cmdline.end(), mode.second.begin(), mode.second.end());
+        for (auto it = args.begin() + 2; it != args.end(); ++it)
+        {
+            cmdline.push_back(it->c_str());
+        }
+
+        std::ostringstream ostream;
+        std::ostringstream results;
+        const auto start = std::chrono::steady_clock::now();
+        if (odfsig::main(cmdline, ostream, results) == 2)
+        {
+            std::cerr << "Verification failed: " << ostream.str();
+            return 1;
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        std::cout << "isolate, " << mode.first << ": "
+                  << static_cast<double>(args.size() - 2) / elapsed.count()
+                  << " documents/s\n";
+    }
+
+    return 0;
+}
+
+/**
+ * Compares the canonicalizers on an XML file, e.g. a content.xml, pushed in
+ * the chunk size of the zip reads.
+ */
+int benchC14N(const std::vector<std::string>& args)
+{
+    if (args.empty())
+    {
+        std::cerr << "Usage: odfsigbench c14n <XML-file> [iterations]\n";
+        return 1;
+    }
+
+    int iterations = 5;
+    if (args.size() > 1)
+    {
+        iterations = std::atoi(args[1].c_str());
+    }
+
+    std::ifstream stream(args[0], std::ios::binary);
+    const std::string input((std::istreambuf_iterator<char>(stream)),
+                            std::istreambuf_iterator<char>());
+    if (!stream)
+    {
+        std::cerr << "Failed to read " << args[0] << '\n';
+        return 1;
+    }
+
+    const size_t chunkSize = 64 * 1024;
+    const std::vector<std::pair<odfsig::CanonicalizerKind, std::string>> kinds{
+        {odfsig::CanonicalizerKind::Tree, "tree"},
+        {odfsig::CanonicalizerKind::Streaming, "streaming"}};
+    for (const auto& kind : kinds)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            std::unique_ptr<odfsig::Canonicalizer> canonicalizer =
+                odfsig::Canonicalizer::create(kind.first,
+                                              /*withComments=*/false);
+            std::string output;
+            bool ok = true;
+            for (size_t offset = 0; ok && offset < input.size();
+                 offset += chunkSize)
+            {
+                const size_t size = std::min(chunkSize, input.size() - offset);
+                ok = canonicalizer->push(input.data() + offset, size,
+                                         /*final=*/false, output);
+                // Like a digest, don't keep the output.
+                output.clear();
+            }
+            if (!ok || !canonicalizer->push(nullptr, 0, /*final=*/true, output))
+            {
+                std::cerr << "Canonicalization failed\n";
+                return 1;
+            }
+        }
+        const std::chrono::duration<double> elapsed =
+            std::chrono::steady_clock::now() - start;
+        const double mibs = static_cast<double>(input.size()) * iterations /
+                            (1024 * 1024) / elapsed.count();
+        std::cout << "c14n, " << kind.second << ": " << mibs << " MiB/s\n";
+    }
+
+    return 0;
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const std::vector<std::string> args(argv, argv + argc);
+    if (args.size() < 2)
+    {
+        std::cerr << "Usage: odfsigbench <benchmark> [args]\n";
+        std::cerr << "Benchmarks: startup, verify, reuse, digest, "
+                     "digest-batch, base64, crc32, c14n, read, isolate\n";
+        return 1;
+    }
+
+    xmlSetGenericErrorFunc(nullptr, &ignore);
+
+    const std::vector<std::string> benchArgs(args.begin() + 2, args.end());
+    if (args[1] == "startup")
+    {
+        return benchStartup(benchArgs);
+    }
+
+    if (args[1] == "verify")
+    {
+        return benchVerify(benchArgs);
+    }
+
+    if (args[1] == "reuse")
+    {
+        return benchReuse(benchArgs);
+    }
+
+    if (args[1] == "digest")
+    {
+        return benchDigest(benchArgs);
+    }
+
+    if (args[1] == "digest-batch")
+    {
+        return benchDigestBatch(benchArgs);
+    }
+
+    if (args[1] == "base64")
+    {
+        return benchBase64(benchArgs);
+    }
+
+    if (args[1] == "crc32")
+    {
+        return benchCrc32(benchArgs);
+    }
+
+    if (args[1] == "c14n")
+    {
+        return benchC14N(benchArgs);
+    }
+
+    if (args[1] == "read")
+    {
+        return benchRead(benchArgs);
+    }
+
+    if (args[1] == "isolate")
+    {
+        return benchIsolate(benchArgs);
+    }
+
+    std::cerr << "Unknown benchmark: " << args[1] << '\n';
+    return 1;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
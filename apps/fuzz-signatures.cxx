@@ -0,0 +1,46 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "fuzzsession.hxx"
+
+extern "C" int LLVMFuzzerInitialize(int* /*argc*/, char*** /*argv*/)
+{
+    odfsig::fuzz::initialize();
+    return 0;
+}
+
+/// Fuzzes the ZIP open and the signatures parse, without verification.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    std::unique_ptr<odfsig::Verifier> verifier =
+        odfsig::fuzz::createVerifier();
+
+    if (!verifier->openZipMemory(data, size))
+    {
+        return 0;
+    }
+
+    if (!verifier->parseSignatures())
+    {
+        return 0;
+    }
+
+    for (const auto& signature : verifier->getSignatures())
+    {
+        signature->getSubjectName();
+        signature->getDate();
+        signature->getMethod();
+        signature->getType();
+        signature->getSignedStreams();
+    }
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
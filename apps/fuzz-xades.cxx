@@ -0,0 +1,42 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "fuzzsession.hxx"
+
+extern "C" int LLVMFuzzerInitialize(int* /*argc*/, char*** /*argv*/)
+{
+    odfsig::fuzz::initialize();
+    return 0;
+}
+
+/// Fuzzes the XAdES checks, without verifying the signature values.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    std::unique_ptr<odfsig::Verifier> verifier =
+        odfsig::fuzz::createVerifier();
+
+    if (!verifier->openZipMemory(data, size))
+    {
+        return 0;
+    }
+
+    if (!verifier->parseSignatures())
+    {
+        return 0;
+    }
+
+    for (const auto& signature : verifier->getSignatures())
+    {
+        signature->verifyXAdES();
+    }
+
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
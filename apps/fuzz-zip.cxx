@@ -0,0 +1,27 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#include "fuzzsession.hxx"
+
+extern "C" int LLVMFuzzerInitialize(int* /*argc*/, char*** /*argv*/)
+{
+    odfsig::fuzz::initialize();
+    return 0;
+}
+
+/// Fuzzes only the ZIP open.
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    std::unique_ptr<odfsig::Verifier> verifier =
+        odfsig::fuzz::createVerifier();
+    verifier->openZipMemory(data, size);
+    return 0;
+}
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
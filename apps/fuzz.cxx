@@ -4,20 +4,22 @@
  * SPDX-License-Identifier: MIT
  */
 
-#include <libxml/xmlerror.h>
+#include <cstddef>
+#include <cstdint>
 
-#include <odfsig/lib.hxx>
+#include "fuzzsession.hxx"
 
-/// Error handler to avoid spam of error messages from libxml parser.
-void ignore(void* /*ctx*/, const char* /*msg*/, ...) {}
+extern "C" int LLVMFuzzerInitialize(int* /*argc*/, char*** /*argv*/)
+{
+    odfsig::fuzz::initialize();
+    return 0;
+}
 
+/// Fuzzes the whole verification: ZIP open, signatures parse and verify.
 extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
 {
-    std::unique_ptr<odfsig::Verifier> verifier(
-        odfsig::Verifier::create(std::string()));
-    verifier->setInsecure(true);
-
-    xmlSetGenericErrorFunc(nullptr, &ignore);
+    std::unique_ptr<odfsig::Verifier> verifier =
+        odfsig::fuzz::createVerifier();
 
     if (!verifier->openZipMemory(data, size))
     {
@@ -0,0 +1,41 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "fuzzsession.hxx"
+
+#include <string>
+
+#include <libxml/xmlerror.h>
+
+namespace
+{
+/// Error handler to avoid spam of error messages from libxml parser.
+void ignore(void* /*ctx*/, const char* /*msg*/, ...) {}
+
+/// Keeps NSS, libxml2 and xmlsec initialized till the fuzzer exits.
+std::unique_ptr<odfsig::Session> session;
+} // namespace
+
+namespace odfsig::fuzz
+{
+void initialize()
+{
+    session = Session::create();
+    xmlSetGenericErrorFunc(nullptr, &ignore);
+}
+
+std::unique_ptr<Verifier> createVerifier()
+{
+    // Errors of the previous input must not leak into this one.
+    xmlResetLastError();
+
+    std::unique_ptr<Verifier> verifier(Verifier::create(std::string()));
+    verifier->setInsecure(true);
+    return verifier;
+}
+} // namespace odfsig::fuzz
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,26 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#pragma once
+
+#include <memory>
+
+#include <odfsig/lib.hxx>
+
+namespace odfsig::fuzz
+{
+/**
+ * Sets up the state shared by all fuzz iterations: a session, so the crypto
+ * libraries are initialized only once, and a quiet libxml error handler.
+ * Called from LLVMFuzzerInitialize().
+ */
+void initialize();
+
+/// Resets the per-iteration state and creates a verifier for one input.
+std::unique_ptr<Verifier> createVerifier();
+} // namespace odfsig::fuzz
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,36 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <string_view>
+#include <vector>
+
+namespace odfsig
+{
+/// Implementations of the base64 decoder.
+enum class Base64Kernel
+{
+    /// Plain C++ code.
+    Portable,
+    /// 32 characters at a time.
+    Avx2,
+};
+
+/**
+ * Decodes base64, skipping the whitespace and line breaks of wrapped input.
+ * Returns false on invalid input, or if the CPU does not support the kernel.
+ */
+bool base64Decode(std::string_view input, std::vector<unsigned char>& output,
+                  Base64Kernel kernel);
+
+/// Same as the above, with the best kernel.
+bool base64Decode(std::string_view input, std::vector<unsigned char>& output);
+
+/// Picks the fastest kernel the CPU supports, at runtime.
+Base64Kernel getBestBase64Kernel();
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,46 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <memory>
+#include <string>
+
+namespace odfsig
+{
+/// Implementations of the inclusive XML canonicalization (C14N 1.0).
+enum class CanonicalizerKind
+{
+    /// Parses the whole document to a libxml2 tree first, like xmlsec.
+    Tree,
+    /**
+     * Canonicalizes the SAX events as the input arrives, only the namespaces
+     * of the open elements are kept in memory. Documents with a DTD are
+     * parsed to a tree.
+     */
+    Streaming,
+};
+
+/// Canonicalizes a whole XML document incrementally.
+class Canonicalizer
+{
+  public:
+    virtual ~Canonicalizer() = default;
+
+    /**
+     * Parses the next part of the document and appends the canonical form
+     * available so far to output, final marks the end of the document.
+     * Returns false if the document is not well-formed.
+     */
+    virtual bool push(const char* data, size_t size, bool final,
+                      std::string& output) = 0;
+
+    static std::unique_ptr<Canonicalizer> create(CanonicalizerKind kind,
+                                                 bool withComments);
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,36 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+namespace odfsig
+{
+/// Implementations of the CRC-32 of zip entries.
+enum class Crc32Kernel
+{
+    /// Plain C++ code, 8 bytes at a time.
+    Portable,
+    /// Folds 64 bytes at a time with carry-less multiplications.
+    Pclmul,
+};
+
+/**
+ * Continues the CRC-32 crc (0 for no data yet) with data, like zlib's crc32().
+ * Returns false if the CPU does not support the kernel.
+ */
+bool crc32Update(const unsigned char* data, size_t size, uint32_t& crc,
+                 Crc32Kernel kernel);
+
+/// Same as the above, with the best kernel.
+void crc32Update(const unsigned char* data, size_t size, uint32_t& crc);
+
+/// Picks the fastest kernel the CPU supports, at runtime.
+Crc32Kernel getBestCrc32Kernel();
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
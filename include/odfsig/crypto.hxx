@@ -5,10 +5,12 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <chrono>
 #include <memory>
 #include <string>
 #include <vector>
 
+struct _xmlSecKey;
 struct _xmlSecKeysMngr;
 struct _xmlSecDSigCtx;
 
@@ -23,6 +25,12 @@ class Crypto
     /// Initializes the crypto itself.
     virtual bool initialize(const std::string& cryptoConfig) = 0;
 
+    /**
+     * Makes the crypto DB of cryptoConfig available too, after initialize()
+     * was called with an other one.
+     */
+    virtual bool openDatabase(const std::string& cryptoConfig) = 0;
+
     /// Initializes the crypto backend of xmlsec.
     virtual bool xmlSecInitialize() = 0;
 
@@ -32,10 +40,10 @@ class Crypto
     /// Shuts down the crypto itself.
     virtual bool shutdown() = 0;
 
-    /// Performs the crypto init of a keys manager.
-    virtual bool
-    initializeKeysManager(_xmlSecKeysMngr* keysManager,
-                          std::vector<std::string> trustedDers) = 0;
+    /// Performs the crypto init of a keys manager, trusting DER certificates.
+    virtual bool initializeKeysManager(
+        _xmlSecKeysMngr* keysManager,
+        const std::vector<std::vector<unsigned char>>& trustedCertificates) = 0;
 
     /// Performs the crypto init of a signature context.
     virtual bool
@@ -45,6 +53,41 @@ class Crypto
     virtual std::string getCertificateSubjectName(unsigned char* certificate,
                                                   size_t size) = 0;
 
+    /**
+     * Creates an xmlsec key from the public key of an X509 certificate. The
+     * caller owns the result, returns nullptr on failure.
+     */
+    virtual _xmlSecKey* createCertificateKey(unsigned char* certificate,
+                                             size_t size) = 0;
+
+    /**
+     * Validates the certificate of key, created by createCertificateKey(),
+     * with the keys manager of signatureContext, like reading the key info
+     * would.
+     */
+    virtual bool verifyCertificateKey(_xmlSecDSigCtx* signatureContext,
+                                      _xmlSecKey* key) = 0;
+
+    /**
+     * Returns the DER certificates of the chain of the certificate of key,
+     * the signing certificate first. Empty if it can't be built.
+     */
+    virtual std::vector<std::vector<unsigned char>>
+    getCertificateChain(_xmlSecKey* key) = 0;
+
+    /// Extracts the end of the validity period of an X509 certificate.
+    virtual bool
+    getCertificateNotAfter(unsigned char* certificate, size_t size,
+                           std::chrono::system_clock::time_point& notAfter) = 0;
+
+    /**
+     * Returns the files the trust decisions of cryptoConfig depend on, besides
+     * the trusted DERs (e.g. the certificate database), to detect changes of
+     * them.
+     */
+    virtual std::vector<std::string>
+    getTrustStoreFiles(const std::string& cryptoConfig) = 0;
+
     static std::unique_ptr<Crypto> create();
 };
 } // namespace odfsig
@@ -0,0 +1,74 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace odfsig
+{
+enum class DigestAlgorithm
+{
+    Sha1,
+    Sha256,
+    Sha512,
+};
+
+/// Implementations of the digest algorithms.
+enum class DigestKernel
+{
+    /// The digest transform of the xmlsec crypto backend, e.g. NSS.
+    Backend,
+    /// Plain C++ code.
+    Portable,
+    /// Vectorized message schedule, SHA-256 and SHA-512 only.
+    Avx2,
+    /// SHA extensions, SHA-1 and SHA-256 only.
+    ShaNi,
+};
+
+/// Calculates a message digest incrementally.
+class Digest
+{
+  public:
+    virtual ~Digest() = default;
+
+    virtual void update(const unsigned char* data, size_t size) = 0;
+
+    /// Finishes the calculation, the digest can't be updated afterwards.
+    virtual bool finish(std::vector<unsigned char>& digest) = 0;
+
+    /**
+     * Returns nullptr if the kernel does not implement the algorithm, or the
+     * CPU does not support it. The backend kernel needs an initialized xmlsec.
+     */
+    static std::unique_ptr<Digest> create(DigestAlgorithm algorithm,
+                                          DigestKernel kernel);
+
+    /// Picks the fastest kernel the CPU supports, at runtime.
+    static DigestKernel getBestKernel(DigestAlgorithm algorithm);
+
+    /**
+     * Hashes independent messages at once. The AVX2 kernel processes SHA-256
+     * messages in parallel, in the 8 lanes of vectors (multi-buffer), other
+     * kernels process them one by one. Returns false if the kernel does not
+     * implement the algorithm.
+     */
+    static bool
+    hashBatch(DigestAlgorithm algorithm, DigestKernel kernel,
+              const std::vector<std::vector<unsigned char>>& messages,
+              std::vector<std::vector<unsigned char>>& digests);
+
+    /// Picks the fastest kernel for hashBatch().
+    static DigestKernel getBestBatchKernel(DigestAlgorithm algorithm);
+
+    static std::string getKernelName(DigestKernel kernel);
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
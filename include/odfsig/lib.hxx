@@ -5,6 +5,9 @@
  * SPDX-License-Identifier: MIT
  */
 
+#include <chrono>
+#include <functional>
+#include <istream>
 #include <memory>
 #include <ostream>
 #include <set>
@@ -12,9 +15,71 @@
 #include <vector>
 
 #include <cstddef>
+#include <cstdint>
 
 namespace odfsig
 {
+/// Hit and miss counters of a cache.
+struct CacheStatistics
+{
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+};
+
+/// Counters of the process-wide state shared by verifiers.
+struct Statistics
+{
+    CacheStatistics _certificateCache;
+    CacheStatistics _chainCache;
+    CacheStatistics _verdictStore;
+    /// Digests of streams, shared by the signatures of a document.
+    CacheStatistics _streamDigests;
+};
+
+/**
+ * Resource limits for untrusted documents, 0 means no limit. The zip limits
+ * are checked from the central directory, before decompressing anything.
+ */
+struct Limits
+{
+    /// Number of entries in the zip package.
+    uint64_t _maxEntries = 0;
+    /// Sum of the uncompressed sizes of the entries.
+    uint64_t _maxTotalSize = 0;
+    /// Uncompressed size divided by compressed size, for entries over 64 KiB.
+    uint64_t _maxCompressionRatio = 0;
+    /// Uncompressed size of the signatures stream.
+    uint64_t _maxSignaturesSize = 0;
+    /// Element nesting depth of the signatures stream.
+    uint64_t _maxXmlDepth = 0;
+    /// Number of references in one signature.
+    uint64_t _maxReferences = 0;
+};
+
+/**
+ * Keeps the process-wide state of verifiers (libxml2, libxmlsec and crypto
+ * init, signature contexts, caches) alive while it exists. The state is still
+ * initialized lazily, but it's not shut down when the last verifier is
+ * destroyed, so it can be reused by the next one. The state of each crypto
+ * config and trusted DERs combination in use is kept.
+ */
+class Session
+{
+  public:
+    virtual ~Session() = default;
+
+    static std::unique_ptr<Session> create();
+};
+
+/// Kind of a signature, depending on the stream it's stored in.
+enum class SignatureKind
+{
+    /// In META-INF/documentsignatures.xml, signs the whole document.
+    Document,
+    /// In META-INF/macrosignatures.xml, signs the macros and scripts.
+    Macro,
+};
+
 /// Represents one specific signature in the document.
 class Signature
 {
@@ -36,6 +101,8 @@ class Signature
     [[nodiscard]] virtual std::string getType() const = 0;
 
     [[nodiscard]] virtual std::set<std::string> getSignedStreams() const = 0;
+
+    [[nodiscard]] virtual SignatureKind getKind() const = 0;
 };
 
 /// Verifies signatures of an ODF document.
@@ -47,14 +114,34 @@ class Verifier
     /// Opens a file, wrapper around openZipMemory().
     virtual bool openZip(const std::string& path) = 0;
 
+    /**
+     * Opens a stream (e.g. stdin or a pipe), wrapper around openZipMemory().
+     * sizeHint is the expected input size (e.g. from Content-Length) or 0 if
+     * unknown, it's only used to size the buffer upfront.
+     */
+    virtual bool openStream(std::istream& stream, size_t sizeHint) = 0;
+
     /// Opens in-memory data.
     virtual bool openZipMemory(const void* data, size_t size) = 0;
 
     [[nodiscard]] virtual const std::string& getErrorString() const = 0;
 
+    /**
+     * Returns if the last failure of openZipMemory() or parseSignatures() was
+     * caused by a limit, see setLimits().
+     */
+    [[nodiscard]] virtual bool isLimitExceeded() const = 0;
+
+    /**
+     * Returns if the last failure of parseSignatures() was caused by a damaged
+     * package, see setIntegrityCheck().
+     */
+    [[nodiscard]] virtual bool isDamaged() const = 0;
+
     /**
      * List of file paths representing DER CA chains to trust, useful when the
-     * crypto config is empty.
+     * crypto config is empty. A path can be also a PEM file, a bundle of
+     * multiple DER or PEM certificates, or a directory of such files.
      */
     virtual void
     setTrustedDers(const std::vector<std::string>& trustedDers) = 0;
@@ -62,25 +149,148 @@ class Verifier
     /// Sets if the certificate should be validated.
     virtual void setInsecure(bool insecure) = 0;
 
+    /**
+     * Sets how long a successful certificate chain validation is reused for
+     * other signatures with the same certificates, 0 disables the reuse.
+     */
+    virtual void setChainCacheTtl(std::chrono::seconds ttl) = 0;
+
+    /**
+     * Enables incremental verification, using the file at path to remember
+     * valid signatures. A signature is identified by its canonical SignedInfo,
+     * SignatureValue and certificates; for signatures verified earlier only
+     * the digests of the signed streams are checked.
+     */
+    virtual void setVerdictStore(const std::string& path) = 0;
+
+    /**
+     * Sets how much decompressed data of the signed streams may be read ahead
+     * on a background thread, while the previous streams are hashed. 0
+     * disables the read-ahead.
+     */
+    virtual void setPrefetchMemory(size_t bytes) = 0;
+
+    /// Sets the resource limits, call before opening the document.
+    virtual void setLimits(const Limits& limits) = 0;
+
+    /**
+     * Makes parseSignatures() decompress all zip entries and compare their
+     * CRC-32 with the one in the central directory, so a truncated or
+     * corrupted package fails before its signatures are verified. The signed
+     * streams are digested in the same pass, verification reuses that.
+     */
+    virtual void setIntegrityCheck(bool integrityCheck) = 0;
+
+    /**
+     * Makes signature verification fail with a "timed out" error once
+     * deadline passes, even if it's already running. Checked between
+     * signatures, between references and between reads of the signed
+     * streams.
+     */
+    virtual void
+    setDeadline(std::chrono::steady_clock::time_point deadline) = 0;
+
+    /**
+     * Makes running and later signature verifications fail with a "cancelled"
+     * error, can be called from any thread.
+     */
+    virtual void cancel() = 0;
+
+    /**
+     * Parses both the document and the macro signatures, they share the
+     * opened package, the crypto state and the digests of the signed streams.
+     */
     virtual bool parseSignatures() = 0;
 
+    /// Returns the document signatures, then the macro signatures.
     virtual std::vector<std::unique_ptr<Signature>>& getSignatures() = 0;
 
+    /**
+     * Verifies all signatures, like calling Signature::verify() for each of
+     * them, but up to parallelism signatures are verified concurrently. 0
+     * means the number of hardware threads. Returns the results in document
+     * order.
+     */
+    virtual std::vector<bool> verifyAll(size_t parallelism) = 0;
+
     /**
      * Returns all streams in an ODF document (except the signature stream
      * itself).
      */
     [[nodiscard]] virtual std::set<std::string> getStreams() const = 0;
 
+    /**
+     * Returns the streams of the macro and script storages (Basic, Dialogs and
+     * Scripts), a macro signature has to sign all of them.
+     */
+    [[nodiscard]] virtual std::set<std::string> getMacroStreams() const = 0;
+
+    /// Returns the counters of the process-wide state.
+    static Statistics getStatistics();
+
+    /**
+     * Forgets the document, so the verifier can open the next one. The
+     * settings, the capacity of the buffers and the crypto state are kept, a
+     * deadline or cancel() is forgotten.
+     */
+    virtual void reset() = 0;
+
+    /**
+     * Initializes the crypto state now, instead of on the first
+     * parseSignatures(), e.g. before forking worker processes which should
+     * inherit it.
+     */
+    virtual bool initializeCrypto() = 0;
+
     /**
      * cryptoConfig can be a path to a crypto DB, in which case no need to
-     * trust DER CA chains manually.
+     * trust DER CA chains manually. With NSS, it can be also a home directory,
+     * then the crypto DB of the default Firefox profile is used. An empty
+     * cryptoConfig means no crypto DB, which is the fastest to initialize.
+     *
+     * Verifiers with different crypto configs or trusted DERs can be alive at
+     * the same time, a certificate chain trusted only by the trusted DERs of
+     * an other verifier is not trusted. With NSS, the crypto DBs of the
+     * crypto configs in use are all open, so they trust the same chains.
      */
     static std::unique_ptr<Verifier> create(const std::string& cryptoConfig);
 };
 
+/**
+ * Thread-safe pool of verifiers with the same settings, e.g. for a server:
+ * a verifier is reset when it's returned, so the next document reuses its
+ * buffers and crypto state.
+ */
+class VerifierPool
+{
+  public:
+    virtual ~VerifierPool() = default;
+
+    /// Hands out an idle verifier, or creates a new one.
+    virtual std::unique_ptr<Verifier> checkout() = 0;
+
+    /// Resets verifier and keeps it for a later checkout(), if there is room.
+    virtual void checkin(std::unique_ptr<Verifier> verifier) = 0;
+
+    /**
+     * See Verifier::create() for cryptoConfig. configure is called once for
+     * each new verifier, e.g. to set the trusted DERs. At most capacity idle
+     * verifiers are kept.
+     */
+    static std::unique_ptr<VerifierPool>
+    create(const std::string& cryptoConfig,
+           std::function<void(Verifier&)> configure, size_t capacity);
+};
+
 /// CLI wrapper around the C++ API.
 int main(const std::vector<const char*>& args, std::ostream& ostream);
+
+/**
+ * CLI wrapper around the C++ API, writing the results in machine-readable
+ * formats (see --format) to resultStream, and everything else to ostream.
+ */
+int main(const std::vector<const char*>& args, std::ostream& ostream,
+         std::ostream& resultStream);
 } // namespace odfsig
 
 /* vim:set shiftwidth=4 softtabstop=4 expandtab: */
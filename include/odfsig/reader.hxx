@@ -0,0 +1,75 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace odfsig
+{
+/// Upper bound of the reads in flight of a DocumentReader.
+const size_t maxReadsInFlight = 256;
+
+/// Implementations of DocumentReader.
+enum class ReaderKind
+{
+    /// Submits the reads to io_uring, no thread waits for the storage.
+    Uring,
+    /// Blocking reads on a pool of threads.
+    Threads,
+};
+
+/// A document read by DocumentReader.
+struct ReadDocument
+{
+    std::string _path;
+    /// The first _size bytes are the contents.
+    std::vector<char> _buffer;
+    size_t _size = 0;
+    /// Set if the document could not be read.
+    std::string _error;
+};
+
+/**
+ * Reads whole documents ahead of their verification, for batches: the reads of
+ * the next few documents are in flight while the current one is verified, then
+ * the buffers can be passed to Verifier::openZipMemory().
+ */
+class DocumentReader
+{
+  public:
+    virtual ~DocumentReader() = default;
+
+    /**
+     * Returns the next document in the order of the paths, waits till it's
+     * read. Returns false after the last one.
+     */
+    virtual bool next(ReadDocument& document) = 0;
+
+    /// Gives back the buffer of a document which is not used anymore.
+    virtual void recycle(std::vector<char> buffer) = 0;
+
+    /**
+     * Reads paths, at most inFlight documents ahead of next(), which is
+     * clamped to the number of paths and to maxReadsInFlight. Returns nullptr
+     * if kind is not available, e.g. io_uring is not supported or disabled,
+     * or no reader thread could be started.
+     */
+    static std::unique_ptr<DocumentReader>
+    create(ReaderKind kind, std::vector<std::string> paths, size_t inFlight);
+
+    /**
+     * Same as the above, with io_uring if available, threads otherwise.
+     * Returns nullptr if neither is available.
+     */
+    static std::unique_ptr<DocumentReader>
+    create(std::vector<std::string> paths, size_t inFlight);
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
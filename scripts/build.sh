@@ -42,6 +42,9 @@ do
 	    export CCACHE_CPP2=YES
             cmake_args+=" -DODFSIG_INTERNAL_XMLSEC=ON -DODFSIG_INTERNAL_LIBXML2=ON -DODFSIG_FUZZ=ON"
             ;;
+        --bench)
+            cmake_args+=" -DODFSIG_BENCH=ON"
+            ;;
         --tidy)
             export CC=clang
             export CXX=clang++
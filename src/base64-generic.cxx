@@ -0,0 +1,18 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "base64.hxx"
+
+namespace odfsig
+{
+Base64Block getCpuBase64Block(Base64Kernel /*kernel*/)
+{
+    // No CPU specific kernels, the portable one is used.
+    return nullptr;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "base64.hxx"
+
+#include <immintrin.h>
+
+#include "cpu.hxx"
+
+namespace
+{
+/**
+ * Validates and translates the characters with nibble lookups, then packs the
+ * 6-bit values with multiply-adds, see "Faster Base64 Encoding and Decoding
+ * using AVX2 Instructions" by Muła and Lemire.
+ */
+__attribute__((target("avx2"))) bool
+base64DecodeBlockAvx2(const unsigned char* input, unsigned char* output)
+{
+    const __m256i lowLookup = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+        0x1b, 0x1b, 0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+    const __m256i highLookup = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    // Offsets from the characters to their values, by high nibble; '/' is
+    // the only character of its range.
+    const __m256i rollLookup =
+        _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0,
+                         0, 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0,
+                         0, 0);
+    const __m256i slash = _mm256_set1_epi8(0x2f);
+
+    const __m256i characters =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(input));
+    const __m256i highNibbles =
+        _mm256_and_si256(_mm256_srli_epi32(characters, 4), slash);
+    const __m256i lowNibbles = _mm256_and_si256(characters, slash);
+    const __m256i low = _mm256_shuffle_epi8(lowLookup, lowNibbles);
+    const __m256i high = _mm256_shuffle_epi8(highLookup, highNibbles);
+    if (_mm256_testz_si256(low, high) == 0)
+    {
+        return false;
+    }
+
+    const __m256i isSlash = _mm256_cmpeq_epi8(characters, slash);
+    const __m256i roll = _mm256_shuffle_epi8(
+        rollLookup, _mm256_add_epi8(isSlash, highNibbles));
+    const __m256i values = _mm256_add_epi8(characters, roll);
+
+    // 4 x 6 bits to 3 bytes in each 32-bit word, then drop the gaps.
+    const __m256i pairs =
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140));
+    const __m256i words =
+        _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+    const __m256i bytes = _mm256_shuffle_epi8(
+        words, _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1,
+                                -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12,
+                                -1, -1, -1, -1));
+    const __m256i packed = _mm256_permutevar8x32_epi32(
+        bytes, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(output), packed);
+    return true;
+}
+} // namespace
+
+namespace odfsig
+{
+Base64Block getCpuBase64Block(Base64Kernel kernel)
+{
+    if (kernel == Base64Kernel::Avx2 && getCpuFeatures()._avx2)
+    {
+        return base64DecodeBlockAvx2;
+    }
+
+    return nullptr;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "base64.hxx"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace
+{
+/// Markers in the decode table, base64 characters have values below 64.
+constexpr unsigned char invalidCharacter = 0xff;
+constexpr unsigned char whitespaceCharacter = 0xfe;
+constexpr unsigned char paddingCharacter = 0xfd;
+
+constexpr std::array<unsigned char, 256> createDecodeTable()
+{
+    std::array<unsigned char, 256> table{};
+    for (unsigned char& value : table)
+    {
+        value = invalidCharacter;
+    }
+    const char* alphabet =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (unsigned char i = 0; i < 64; ++i)
+    {
+        table[static_cast<unsigned char>(alphabet[i])] = i;
+    }
+    for (const char character : {' ', '\t', '\n', '\r'})
+    {
+        table[static_cast<unsigned char>(character)] = whitespaceCharacter;
+    }
+    table['='] = paddingCharacter;
+    return table;
+}
+
+constexpr std::array<unsigned char, 256> decodeTable = createDecodeTable();
+
+/// Writes the count - 1 bytes of a quantum which has count characters.
+unsigned char* writeQuantum(uint32_t quantum, size_t count,
+                            unsigned char* output)
+{
+    quantum <<= 6 * (4 - count);
+    for (size_t i = 0; i < count - 1; ++i)
+    {
+        *output++ = static_cast<unsigned char>(quantum >> (16 - i * 8));
+    }
+    return output;
+}
+} // namespace
+
+namespace odfsig
+{
+bool base64Decode(std::string_view input, std::vector<unsigned char>& output,
+                  Base64Kernel kernel)
+{
+    Base64Block block = nullptr;
+    if (kernel != Base64Kernel::Portable)
+    {
+        block = getCpuBase64Block(kernel);
+        if (block == nullptr)
+        {
+            return false;
+        }
+    }
+
+    // Blocks write 32 bytes for 24 decoded ones.
+    output.resize((input.size() + 3) / 4 * 3 + 32);
+    const auto* data = reinterpret_cast<const unsigned char*>(input.data());
+    const size_t size = input.size();
+    unsigned char* out = output.data();
+    uint32_t quantum = 0;
+    size_t count = 0;
+    size_t padding = 0;
+    bool finished = false;
+    size_t i = 0;
+    while (i < size)
+    {
+        if (count == 0 && !finished)
+        {
+            // Fast paths at the start of a quantum, they give up on
+            // whitespace and padding.
+            if (block != nullptr && size - i >= 32 && block(data + i, out))
+            {
+                i += 32;
+                out += 24;
+                continue;
+            }
+
+            if (size - i >= 4)
+            {
+                const unsigned char a = decodeTable[data[i]];
+                const unsigned char b = decodeTable[data[i + 1]];
+                const unsigned char c = decodeTable[data[i + 2]];
+                const unsigned char d = decodeTable[data[i + 3]];
+                if ((a | b | c | d) < 64)
+                {
+                    const uint32_t value = (static_cast<uint32_t>(a) << 18) |
+                                           (static_cast<uint32_t>(b) << 12) |
+                                           (static_cast<uint32_t>(c) << 6) | d;
+                    out = writeQuantum(value, 4, out);
+                    i += 4;
+                    continue;
+                }
+            }
+        }
+
+        const unsigned char value = decodeTable[data[i++]];
+        if (value == whitespaceCharacter)
+        {
+            continue;
+        }
+
+        if (value == paddingCharacter)
+        {
+            // Only 1 or 2 padding characters, after at least 2 characters.
+            if (count < 2)
+            {
+                return false;
+            }
+
+            ++padding;
+            if (count + padding == 4)
+            {
+                out = writeQuantum(quantum, count, out);
+                count = 0;
+                finished = true;
+            }
+            continue;
+        }
+
+        if (value == invalidCharacter || padding > 0 || finished)
+        {
+            return false;
+        }
+
+        quantum = (quantum << 6) | value;
+        if (++count == 4)
+        {
+            out = writeQuantum(quantum, 4, out);
+            quantum = 0;
+            count = 0;
+        }
+    }
+
+    // Tolerate missing padding.
+    if (count == 1)
+    {
+        return false;
+    }
+    if (count > 1)
+    {
+        out = writeQuantum(quantum, count, out);
+    }
+
+    output.resize(out - output.data());
+    return true;
+}
+
+bool base64Decode(std::string_view input, std::vector<unsigned char>& output)
+{
+    return base64Decode(input, output, getBestBase64Kernel());
+}
+
+Base64Kernel getBestBase64Kernel()
+{
+    static const bool avx2 = getCpuBase64Block(Base64Kernel::Avx2) != nullptr;
+    return avx2 ? Base64Kernel::Avx2 : Base64Kernel::Portable;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,27 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <odfsig/base64.hxx>
+
+namespace odfsig
+{
+/**
+ * Decodes 32 base64 characters to 24 bytes, writing 32 bytes to output.
+ * Returns false if a character is not in the alphabet, e.g. whitespace or
+ * padding, the caller decodes those.
+ */
+using Base64Block = bool (*)(const unsigned char* input,
+                             unsigned char* output);
+
+/**
+ * Returns the CPU specific kernel, nullptr if the CPU doesn't support it.
+ * Implemented in base64-x86.cxx or base64-generic.cxx.
+ */
+Base64Block getCpuBase64Block(Base64Kernel kernel);
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,954 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "c14n.hxx"
+
+#include "digest.hxx"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <new>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <libxml/SAX2.h>
+#include <libxml/c14n.h>
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+#include <libxml/uri.h>
+#include <xmlsec/io.h>
+#include <xmlsec/list.h>
+#include <xmlsec/nodeset.h>
+#include <xmlsec/parser.h>
+#include <xmlsec/transforms.h>
+
+namespace std
+{
+template <> struct default_delete<xmlParserCtxt>
+{
+    void operator()(xmlParserCtxtPtr ptr)
+    {
+        // The SAX handlers may leave a document behind, e.g. on error.
+        xmlFreeDoc(ptr->myDoc);
+        xmlFreeParserCtxt(ptr);
+    }
+};
+template <> struct default_delete<xmlDoc>
+{
+    void operator()(xmlDocPtr ptr) { xmlFreeDoc(ptr); }
+};
+template <> struct default_delete<xmlOutputBuffer>
+{
+    void operator()(xmlOutputBufferPtr ptr) { xmlOutputBufferClose(ptr); }
+};
+} // namespace std
+
+namespace odfsig
+{
+namespace
+{
+/// Larger input is parsed in multiple chunks, libxml2 takes an int size.
+const size_t maxParseChunkSize = 1024 * 1024 * 1024;
+
+/// Size of the reads from the previous transform, in pop mode.
+const size_t popChunkSize = 64 * 1024;
+
+/// The escaping rules of libxml2's C14N.
+enum class EscapeMode
+{
+    Text,
+    Attribute,
+    /// Comments and processing instructions.
+    Misc,
+};
+
+std::string_view getEscape(char c, EscapeMode mode)
+{
+    switch (c)
+    {
+        case '&':
+            return mode == EscapeMode::Misc ? std::string_view()
+                                            : std::string_view("&amp;");
+        case '<':
+            return mode == EscapeMode::Misc ? std::string_view()
+                                            : std::string_view("&lt;");
+        case '>':
+            return mode == EscapeMode::Text ? std::string_view("&gt;")
+                                            : std::string_view();
+        case '"':
+            return mode == EscapeMode::Attribute ? std::string_view("&quot;")
+                                                 : std::string_view();
+        case '\t':
+            return mode == EscapeMode::Attribute ? std::string_view("&#x9;")
+                                                 : std::string_view();
+        case '\n':
+            return mode == EscapeMode::Attribute ? std::string_view("&#xA;")
+                                                 : std::string_view();
+        case '\r':
+            return "&#xD;";
+        default:
+            return {};
+    }
+}
+
+void appendEscaped(std::string& output, std::string_view text,
+                   EscapeMode mode)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        const std::string_view escape = getEscape(text[i], mode);
+        if (escape.empty())
+        {
+            continue;
+        }
+
+        output.append(text.data() + start, i - start);
+        output.append(escape);
+        start = i + 1;
+    }
+    output.append(text.data() + start, text.size() - start);
+}
+
+/// C14N fails on relative namespace URIs, like xmlC14NProcessElementNode().
+bool isAbsoluteUri(const xmlChar* uri)
+{
+    if (uri == nullptr || uri[0] == '\0')
+    {
+        return true;
+    }
+
+    xmlURIPtr parsed = xmlParseURI(reinterpret_cast<const char*>(uri));
+    if (parsed == nullptr)
+    {
+        return false;
+    }
+
+    const bool absolute =
+        parsed->scheme != nullptr && parsed->scheme[0] != '\0';
+    xmlFreeURI(parsed);
+    return absolute;
+}
+
+std::string_view toView(const xmlChar* string)
+{
+    if (string == nullptr)
+    {
+        return {};
+    }
+
+    return reinterpret_cast<const char*>(string);
+}
+
+void appendQName(std::string& output, const xmlChar* prefix,
+                 const xmlChar* localName)
+{
+    if (prefix != nullptr)
+    {
+        output.append(toView(prefix)).append(1, ':');
+    }
+    output.append(toView(localName));
+}
+
+/**
+ * Parses the whole document to a tree and canonicalizes that, what the xmlsec
+ * parser and C14N transforms do.
+ */
+class TreeCanonicalizer : public Canonicalizer
+{
+  public:
+    explicit TreeCanonicalizer(bool withComments)
+        : _withComments(withComments)
+    {
+    }
+
+    bool push(const char* data, size_t size, bool final,
+              std::string& output) override;
+
+  private:
+    bool _withComments;
+
+    std::unique_ptr<xmlParserCtxt> _parser;
+};
+
+bool TreeCanonicalizer::push(const char* data, size_t size, bool final,
+                             std::string& output)
+{
+    if (!_parser)
+    {
+        _parser.reset(
+            xmlCreatePushParserCtxt(nullptr, nullptr, nullptr, 0, nullptr));
+        if (!_parser)
+        {
+            return false;
+        }
+
+        xmlSecParsePrepareCtxt(_parser.get());
+    }
+
+    while (size > 0)
+    {
+        const size_t chunkSize = std::min(size, maxParseChunkSize);
+        if (xmlParseChunk(_parser.get(), data, static_cast<int>(chunkSize),
+                          0) != 0)
+        {
+            return false;
+        }
+
+        data += chunkSize;
+        size -= chunkSize;
+    }
+
+    if (!final)
+    {
+        return true;
+    }
+
+    if (xmlParseChunk(_parser.get(), nullptr, 0, 1) != 0 ||
+        _parser->myDoc == nullptr)
+    {
+        return false;
+    }
+
+    const std::unique_ptr<xmlDoc> doc(_parser->myDoc);
+    _parser->myDoc = nullptr;
+    _parser.reset();
+
+    std::unique_ptr<xmlOutputBuffer> buffer(xmlAllocOutputBuffer(nullptr));
+    if (!buffer ||
+        xmlC14NExecute(doc.get(), nullptr, nullptr, XML_C14N_1_0, nullptr,
+                       _withComments ? 1 : 0, buffer.get()) < 0)
+    {
+        return false;
+    }
+
+    output.append(
+        reinterpret_cast<const char*>(xmlOutputBufferGetContent(buffer.get())),
+        xmlOutputBufferGetSize(buffer.get()));
+    return true;
+}
+
+/// Canonicalizes SAX events, without building a tree.
+class StreamingCanonicalizer : public Canonicalizer
+{
+  public:
+    explicit StreamingCanonicalizer(bool withComments)
+        : _withComments(withComments)
+    {
+    }
+
+    bool push(const char* data, size_t size, bool final,
+              std::string& output) override;
+
+  private:
+    struct Attribute
+    {
+        /// Attributes without a namespace are sorted first.
+        bool _hasNamespace = false;
+        std::string_view _namespace;
+        std::string_view _localName;
+        const xmlChar* _prefix = nullptr;
+        std::string_view _value;
+    };
+
+    bool createParser();
+
+    bool parse(const char* data, size_t size, bool final);
+
+    static StreamingCanonicalizer& get(void* context);
+
+    /// Where the callbacks write: the prolog output is written only once it's
+    /// known that the tree canonicalizer is not needed.
+    std::string& getOutput();
+
+    /// Finds the URI of prefix in the scope of the parent element.
+    [[nodiscard]] const std::string* findNamespace(std::string_view prefix,
+                                                   size_t end) const;
+
+    /// Comments and processing instructions, may be outside the root element.
+    void appendMisc(std::string_view markup);
+
+    static void startElement(void* context, const xmlChar* localName,
+                             const xmlChar* prefix, const xmlChar* uri,
+                             int namespaceCount, const xmlChar** namespaces,
+                             int attributeCount, int defaultedCount,
+                             const xmlChar** attributes);
+
+    static void endElement(void* context, const xmlChar* localName,
+                           const xmlChar* prefix, const xmlChar* uri);
+
+    static void characters(void* context, const xmlChar* text, int length);
+
+    static void comment(void* context, const xmlChar* value);
+
+    static void processingInstruction(void* context, const xmlChar* target,
+                                      const xmlChar* data);
+
+    static void internalSubset(void* context, const xmlChar* name,
+                               const xmlChar* externalId,
+                               const xmlChar* systemId);
+
+    static void reference(void* context, const xmlChar* name);
+
+    bool _withComments;
+
+    std::unique_ptr<xmlParserCtxt> _parser;
+
+    /// The output of the current push().
+    std::string* _output = nullptr;
+
+    /// Namespace declarations of the open elements: prefix and URI.
+    std::vector<std::pair<std::string, std::string>> _namespaces;
+
+    /// Start of the declarations of each open element in _namespaces.
+    std::vector<size_t> _scopes;
+
+    bool _inProlog = true;
+
+    /// The input before the root element, in case it has a DTD.
+    std::string _prolog;
+
+    /// The output before the root element.
+    std::string _prologOutput;
+
+    bool _afterRoot = false;
+
+    /// Set when a DTD is found: entities and default attributes need a tree.
+    bool _needsTree = false;
+
+    bool _failed = false;
+
+    /// Parses the document from the start if a DTD is found.
+    std::unique_ptr<Canonicalizer> _tree;
+
+    /// Reused between elements.
+    std::vector<std::pair<std::string_view, std::string_view>> _declarations;
+
+    std::vector<Attribute> _attributes;
+};
+
+bool StreamingCanonicalizer::push(const char* data, size_t size, bool final,
+                                  std::string& output)
+{
+    if (_tree)
+    {
+        return _tree->push(data, size, final, output);
+    }
+
+    if (!_parser && !createParser())
+    {
+        return false;
+    }
+
+    if (_inProlog)
+    {
+        _prolog.append(data, size);
+    }
+
+    _output = &output;
+    const bool ok = parse(data, size, final);
+    _output = nullptr;
+    if (_needsTree)
+    {
+        _parser.reset();
+        _tree = Canonicalizer::create(CanonicalizerKind::Tree, _withComments);
+        const std::string prolog = std::move(_prolog);
+        return _tree->push(prolog.data(), prolog.size(), final, output);
+    }
+
+    if (!ok || _failed)
+    {
+        return false;
+    }
+
+    if (final)
+    {
+        _parser.reset();
+        return _afterRoot;
+    }
+
+    return true;
+}
+
+bool StreamingCanonicalizer::createParser()
+{
+    xmlSAXHandler sax{};
+    xmlSAXVersion(&sax, 2);
+    sax.startElementNs = startElement;
+    sax.endElementNs = endElement;
+    sax.characters = characters;
+    sax.ignorableWhitespace = characters;
+    sax.cdataBlock = characters;
+    sax.comment = comment;
+    sax.processingInstruction = processingInstruction;
+    sax.internalSubset = internalSubset;
+    sax.reference = reference;
+    _parser.reset(xmlCreatePushParserCtxt(&sax, nullptr, nullptr, 0, nullptr));
+    if (!_parser)
+    {
+        return false;
+    }
+
+    _parser->_private = this;
+    // Same options as the xmlsec parser.
+    xmlSecParsePrepareCtxt(_parser.get());
+    // Attribute values have no entity references without a DTD, but '&' would
+    // be passed as a character reference, for the tree builder.
+    _parser->replaceEntities = 1;
+    return true;
+}
+
+bool StreamingCanonicalizer::parse(const char* data, size_t size, bool final)
+{
+    while (size > 0)
+    {
+        const size_t chunkSize = std::min(size, maxParseChunkSize);
+        if (xmlParseChunk(_parser.get(), data, static_cast<int>(chunkSize),
+                          0) != 0)
+        {
+            return false;
+        }
+
+        data += chunkSize;
+        size -= chunkSize;
+    }
+
+    return !final || xmlParseChunk(_parser.get(), nullptr, 0, 1) == 0;
+}
+
+StreamingCanonicalizer& StreamingCanonicalizer::get(void* context)
+{
+    auto* parser = static_cast<xmlParserCtxtPtr>(context);
+    return *static_cast<StreamingCanonicalizer*>(parser->_private);
+}
+
+std::string& StreamingCanonicalizer::getOutput()
+{
+    return _inProlog ? _prologOutput : *_output;
+}
+
+const std::string*
+StreamingCanonicalizer::findNamespace(std::string_view prefix,
+                                      size_t end) const
+{
+    for (size_t i = end; i > 0; --i)
+    {
+        if (_namespaces[i - 1].first == prefix)
+        {
+            return &_namespaces[i - 1].second;
+        }
+    }
+
+    return nullptr;
+}
+
+void StreamingCanonicalizer::appendMisc(std::string_view markup)
+{
+    std::string& output = getOutput();
+    if (!_scopes.empty())
+    {
+        output.append(markup);
+    }
+    else if (_afterRoot)
+    {
+        output.append(1, '\n').append(markup);
+    }
+    else
+    {
+        output.append(markup).append(1, '\n');
+    }
+}
+
+void StreamingCanonicalizer::startElement(
+    void* context, const xmlChar* localName, const xmlChar* prefix,
+    const xmlChar* /*uri*/, int namespaceCount, const xmlChar** namespaces,
+    int attributeCount, int /*defaultedCount*/, const xmlChar** attributes)
+{
+    StreamingCanonicalizer& self = get(context);
+    if (self._inProlog)
+    {
+        self._inProlog = false;
+        self._output->append(self._prologOutput);
+        self._prolog = std::string();
+        self._prologOutput = std::string();
+    }
+
+    std::string& output = self.getOutput();
+    output += '<';
+    appendQName(output, prefix, localName);
+
+    // Only declarations which change the scope of the parent are rendered,
+    // xmlns="" only if the parent has a default namespace.
+    const size_t scopeStart = self._namespaces.size();
+    self._declarations.clear();
+    for (int i = 0; i < namespaceCount; ++i)
+    {
+        if (!isAbsoluteUri(namespaces[2 * i + 1]))
+        {
+            self._failed = true;
+            xmlStopParser(self._parser.get());
+            return;
+        }
+
+        const std::string_view declarationPrefix = toView(namespaces[2 * i]);
+        const std::string_view declarationUri = toView(namespaces[2 * i + 1]);
+        const std::string* parentUri =
+            self.findNamespace(declarationPrefix, scopeStart);
+        const bool rendered =
+            declarationPrefix.empty() && declarationUri.empty()
+                ? parentUri != nullptr && !parentUri->empty()
+                : parentUri == nullptr || *parentUri != declarationUri;
+        if (rendered)
+        {
+            self._declarations.emplace_back(declarationPrefix, declarationUri);
+        }
+    }
+    std::sort(self._declarations.begin(), self._declarations.end());
+    for (const auto& declaration : self._declarations)
+    {
+        output += " xmlns";
+        if (!declaration.first.empty())
+        {
+            output.append(1, ':').append(declaration.first);
+        }
+        // A valid URI has no quotes.
+        output.append("=\"").append(declaration.second).append(1, '"');
+    }
+    for (int i = 0; i < namespaceCount; ++i)
+    {
+        self._namespaces.emplace_back(toView(namespaces[2 * i]),
+                                      toView(namespaces[2 * i + 1]));
+    }
+    self._scopes.push_back(scopeStart);
+
+    // Each attribute is localname, prefix, URI, value and end.
+    self._attributes.clear();
+    for (int i = 0; i < attributeCount; ++i)
+    {
+        const xmlChar** fields = attributes + 5 * static_cast<ptrdiff_t>(i);
+        Attribute attribute;
+        attribute._hasNamespace = fields[2] != nullptr;
+        attribute._namespace = toView(fields[2]);
+        attribute._localName = toView(fields[0]);
+        attribute._prefix = fields[1];
+        attribute._value = std::string_view(
+            reinterpret_cast<const char*>(fields[3]), fields[4] - fields[3]);
+        self._attributes.push_back(attribute);
+    }
+    // An undeclared prefix is part of the name, like in the tree.
+    auto getName = [](const Attribute& attribute)
+    {
+        std::string name;
+        if (attribute._prefix != nullptr)
+        {
+            name.append(toView(attribute._prefix)).append(1, ':');
+        }
+        return name.append(attribute._localName);
+    };
+    std::sort(self._attributes.begin(), self._attributes.end(),
+              [&getName](const Attribute& lhs, const Attribute& rhs)
+              {
+                  if (lhs._hasNamespace != rhs._hasNamespace)
+                  {
+                      return !lhs._hasNamespace;
+                  }
+
+                  if (!lhs._hasNamespace)
+                  {
+                      if (lhs._prefix == nullptr && rhs._prefix == nullptr)
+                      {
+                          return lhs._localName < rhs._localName;
+                      }
+
+                      return getName(lhs) < getName(rhs);
+                  }
+
+                  if (lhs._namespace != rhs._namespace)
+                  {
+                      return lhs._namespace < rhs._namespace;
+                  }
+
+                  return lhs._localName < rhs._localName;
+              });
+    for (const auto& attribute : self._attributes)
+    {
+        output += ' ';
+        if (attribute._prefix != nullptr)
+        {
+            output.append(toView(attribute._prefix)).append(1, ':');
+        }
+        output.append(attribute._localName).append("=\"");
+        appendEscaped(output, attribute._value, EscapeMode::Attribute);
+        output += '"';
+    }
+    output += '>';
+}
+
+void StreamingCanonicalizer::endElement(void* context,
+                                        const xmlChar* localName,
+                                        const xmlChar* prefix,
+                                        const xmlChar* /*uri*/)
+{
+    StreamingCanonicalizer& self = get(context);
+    std::string& output = self.getOutput();
+    output += "</";
+    appendQName(output, prefix, localName);
+    output += '>';
+
+    self._namespaces.resize(self._scopes.back());
+    self._scopes.pop_back();
+    if (self._scopes.empty())
+    {
+        self._afterRoot = true;
+    }
+}
+
+void StreamingCanonicalizer::characters(void* context, const xmlChar* text,
+                                        int length)
+{
+    StreamingCanonicalizer& self = get(context);
+    if (self._scopes.empty())
+    {
+        return;
+    }
+
+    appendEscaped(self.getOutput(),
+                  std::string_view(reinterpret_cast<const char*>(text),
+                                   static_cast<size_t>(length)),
+                  EscapeMode::Text);
+}
+
+void StreamingCanonicalizer::comment(void* context, const xmlChar* value)
+{
+    StreamingCanonicalizer& self = get(context);
+    if (!self._withComments)
+    {
+        return;
+    }
+
+    std::string markup("<!--");
+    appendEscaped(markup, toView(value), EscapeMode::Misc);
+    markup += "-->";
+    self.appendMisc(markup);
+}
+
+void StreamingCanonicalizer::processingInstruction(void* context,
+                                                   const xmlChar* target,
+                                                   const xmlChar* data)
+{
+    StreamingCanonicalizer& self = get(context);
+    std::string markup("<?");
+    markup.append(toView(target));
+    if (data != nullptr && data[0] != '\0')
+    {
+        markup += ' ';
+        appendEscaped(markup, toView(data), EscapeMode::Misc);
+    }
+    markup += "?>";
+    self.appendMisc(markup);
+}
+
+void StreamingCanonicalizer::internalSubset(void* context,
+                                            const xmlChar* /*name*/,
+                                            const xmlChar* /*externalId*/,
+                                            const xmlChar* /*systemId*/)
+{
+    StreamingCanonicalizer& self = get(context);
+    self._needsTree = true;
+    xmlStopParser(self._parser.get());
+}
+
+void StreamingCanonicalizer::reference(void* context,
+                                       const xmlChar* /*name*/)
+{
+    // Not expected without a DTD.
+    StreamingCanonicalizer& self = get(context);
+    self._failed = true;
+    xmlStopParser(self._parser.get());
+}
+
+/// State of a C14N transform, stored after the state of the xmlsec one.
+struct C14NTransformData
+{
+    /// Created on the first binary input.
+    std::unique_ptr<Canonicalizer> _canonicalizer;
+    std::string _output;
+    /// Read position in _output, in pop mode.
+    size_t _outputOffset = 0;
+    std::vector<xmlSecByte> _input;
+};
+
+/// The xmlsec transforms: without and with comments.
+std::array<xmlSecTransformId, 2> backendC14NTransforms{};
+
+/// The replacements of backendC14NTransforms, set up at registration.
+std::array<struct _xmlSecTransformKlass, 2> c14nTransformKlasses{};
+
+size_t getC14NTransformIndex(xmlSecTransformId id)
+{
+    return id == &c14nTransformKlasses[0] ? 0 : 1;
+}
+
+size_t getC14NTransformDataOffset(xmlSecTransformId backend)
+{
+    const size_t alignment = alignof(C14NTransformData);
+    return (backend->objSize + alignment - 1) / alignment * alignment;
+}
+
+C14NTransformData* getC14NTransformData(xmlSecTransformPtr transform)
+{
+    const xmlSecTransformId backend =
+        backendC14NTransforms[getC14NTransformIndex(transform->id)];
+    return std::launder(reinterpret_cast<C14NTransformData*>(
+        reinterpret_cast<unsigned char*>(transform) +
+        getC14NTransformDataOffset(backend)));
+}
+
+/// Calls a method of the xmlsec transform, which checks the transform id.
+template <typename Function>
+int callBackend(xmlSecTransformPtr transform, Function function)
+{
+    const xmlSecTransformId id = transform->id;
+    transform->id = backendC14NTransforms[getC14NTransformIndex(id)];
+    const int ret = function(transform->id);
+    transform->id = id;
+    return ret;
+}
+
+int c14nTransformInitialize(xmlSecTransformPtr transform)
+{
+    new (getC14NTransformData(transform)) C14NTransformData;
+    return callBackend(transform,
+                       [transform](xmlSecTransformId backend)
+                       {
+                           return backend->initialize != nullptr
+                                      ? backend->initialize(transform)
+                                      : 0;
+                       });
+}
+
+void c14nTransformFinalize(xmlSecTransformPtr transform)
+{
+    getC14NTransformData(transform)->~C14NTransformData();
+    callBackend(transform,
+                [transform](xmlSecTransformId backend)
+                {
+                    if (backend->finalize != nullptr)
+                    {
+                        backend->finalize(transform);
+                    }
+                    return 0;
+                });
+}
+
+int c14nTransformReadNode(xmlSecTransformPtr transform, xmlNodePtr node,
+                          xmlSecTransformCtxPtr transformCtx)
+{
+    return callBackend(
+        transform, [transform, node, transformCtx](xmlSecTransformId backend)
+        { return backend->readNode(transform, node, transformCtx); });
+}
+
+int c14nTransformPushXml(xmlSecTransformPtr transform, xmlSecNodeSetPtr nodes,
+                         xmlSecTransformCtxPtr transformCtx)
+{
+    return callBackend(
+        transform, [transform, nodes, transformCtx](xmlSecTransformId backend)
+        { return backend->pushXml(transform, nodes, transformCtx); });
+}
+
+/// Feeds binary input to the canonicalizer of the transform.
+bool canonicalize(xmlSecTransformPtr transform, const xmlSecByte* data,
+                  xmlSecSize dataSize, bool final)
+{
+    C14NTransformData* transformData = getC14NTransformData(transform);
+    if (transform->status == xmlSecTransformStatusNone)
+    {
+        const bool withComments = getC14NTransformIndex(transform->id) == 1;
+        transformData->_canonicalizer = Canonicalizer::create(
+            CanonicalizerKind::Streaming, withComments);
+        transform->status = xmlSecTransformStatusWorking;
+    }
+    else if (transform->status != xmlSecTransformStatusWorking)
+    {
+        return false;
+    }
+
+    transformData->_output.clear();
+    transformData->_outputOffset = 0;
+    if (!transformData->_canonicalizer->push(
+            reinterpret_cast<const char*>(data), dataSize, final,
+            transformData->_output))
+    {
+        return false;
+    }
+
+    if (final)
+    {
+        transform->status = xmlSecTransformStatusFinished;
+    }
+    return true;
+}
+
+/**
+ * Finishes the transform without output if the digest of its stream is
+ * precomputed: then the stream is empty, it's not parsed.
+ */
+bool skipPrecomputed(xmlSecTransformPtr transform,
+                     xmlSecTransformCtxPtr transformCtx)
+{
+    const PrecomputedDigests* digests = PrecomputedDigests::getCurrent();
+    if (transform->status != xmlSecTransformStatusNone || digests == nullptr ||
+        transformCtx->uri == nullptr || transform->prev == nullptr ||
+        transform->prev->id != xmlSecTransformInputURIId ||
+        !digests->contains(reinterpret_cast<const char*>(transformCtx->uri)))
+    {
+        return false;
+    }
+
+    C14NTransformData* transformData = getC14NTransformData(transform);
+    transformData->_output.clear();
+    transformData->_outputOffset = 0;
+    transform->status = xmlSecTransformStatusFinished;
+    return true;
+}
+
+int c14nTransformPushBin(xmlSecTransformPtr transform, const xmlSecByte* data,
+                         xmlSecSize dataSize, int final,
+                         xmlSecTransformCtxPtr transformCtx)
+{
+    if (transform->status == xmlSecTransformStatusFinished)
+    {
+        return 0;
+    }
+
+    if (skipPrecomputed(transform, transformCtx))
+    {
+        return transform->next == nullptr
+                   ? -1
+                   : xmlSecTransformPushBin(transform->next, nullptr, 0,
+                                            /*final=*/1, transformCtx);
+    }
+
+    if (transform->next == nullptr ||
+        !canonicalize(transform, data, dataSize, final != 0))
+    {
+        return -1;
+    }
+
+    const std::string& output = getC14NTransformData(transform)->_output;
+    if (output.empty() && final == 0)
+    {
+        return 0;
+    }
+
+    return xmlSecTransformPushBin(
+        transform->next, reinterpret_cast<const xmlSecByte*>(output.data()),
+        static_cast<xmlSecSize>(output.size()), final, transformCtx);
+}
+
+int c14nTransformPopBin(xmlSecTransformPtr transform, xmlSecByte* data,
+                        xmlSecSize maxDataSize, xmlSecSize* dataSize,
+                        xmlSecTransformCtxPtr transformCtx)
+{
+    if (transform->prev == nullptr ||
+        (xmlSecTransformGetDataType(transform->prev, xmlSecTransformModePop,
+                                    transformCtx) &
+         xmlSecTransformDataTypeXml) != 0)
+    {
+        return callBackend(
+            transform,
+            [transform, data, maxDataSize, dataSize,
+             transformCtx](xmlSecTransformId backend)
+            {
+                return backend->popBin(transform, data, maxDataSize, dataSize,
+                                       transformCtx);
+            });
+    }
+
+    // Binary input: pop and canonicalize it till there is some output.
+    skipPrecomputed(transform, transformCtx);
+    C14NTransformData* transformData = getC14NTransformData(transform);
+    while (transformData->_outputOffset == transformData->_output.size() &&
+           transform->status != xmlSecTransformStatusFinished)
+    {
+        std::vector<xmlSecByte>& input = transformData->_input;
+        input.resize(popChunkSize);
+        xmlSecSize inputSize = 0;
+        if (xmlSecTransformPopBin(transform->prev, input.data(),
+                                  static_cast<xmlSecSize>(input.size()),
+                                  &inputSize, transformCtx) < 0 ||
+            !canonicalize(transform, input.data(), inputSize, inputSize == 0))
+        {
+            return -1;
+        }
+    }
+
+    const size_t size =
+        std::min(static_cast<size_t>(maxDataSize),
+                 transformData->_output.size() - transformData->_outputOffset);
+    std::memcpy(data,
+                transformData->_output.data() + transformData->_outputOffset,
+                size);
+    transformData->_outputOffset += size;
+    *dataSize = static_cast<xmlSecSize>(size);
+    return 0;
+}
+} // namespace
+
+std::unique_ptr<Canonicalizer> Canonicalizer::create(CanonicalizerKind kind,
+                                                     bool withComments)
+{
+    if (kind == CanonicalizerKind::Tree)
+    {
+        return std::make_unique<TreeCanonicalizer>(withComments);
+    }
+
+    return std::make_unique<StreamingCanonicalizer>(withComments);
+}
+
+void registerC14NTransforms()
+{
+    const std::array<xmlSecTransformId, 2> backends{
+        xmlSecTransformInclC14NGetKlass(),
+        xmlSecTransformInclC14NWithCommentsGetKlass()};
+    xmlSecPtrListPtr transformIds = xmlSecTransformIdsGet();
+    for (size_t index = 0; index < backends.size(); ++index)
+    {
+        const xmlSecTransformId backend = backends[index];
+        backendC14NTransforms[index] = backend;
+
+        struct _xmlSecTransformKlass& klass = c14nTransformKlasses[index];
+        klass = *backend;
+        klass.objSize = static_cast<xmlSecSize>(
+            getC14NTransformDataOffset(backend) + sizeof(C14NTransformData));
+        klass.initialize = c14nTransformInitialize;
+        klass.finalize = c14nTransformFinalize;
+        if (backend->readNode != nullptr)
+        {
+            klass.readNode = c14nTransformReadNode;
+        }
+        // Accepting binary input avoids the xmlsec parser transform.
+        klass.pushBin = c14nTransformPushBin;
+        klass.popBin = c14nTransformPopBin;
+        klass.pushXml = c14nTransformPushXml;
+
+        // Replace in place, so lookups by href find this one.
+        const xmlSecSize size = xmlSecPtrListGetSize(transformIds);
+        for (xmlSecSize i = 0; i < size; ++i)
+        {
+            if (xmlSecPtrListGetItem(transformIds, i) == backend)
+            {
+                xmlSecPtrListSet(transformIds, &klass, i);
+            }
+        }
+    }
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
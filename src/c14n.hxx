@@ -0,0 +1,21 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <odfsig/c14n.hxx>
+
+namespace odfsig
+{
+/**
+ * Replaces the inclusive C14N 1.0 transforms of xmlsec with ones which also
+ * accept binary input, e.g. a stream of the zip package: then the stream is
+ * canonicalized while it's read, without parsing it to a tree. Node set input
+ * is still handled by the xmlsec transforms. Call after xmlsec is initialized.
+ */
+void registerC14NTransforms();
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
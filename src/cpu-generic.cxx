@@ -0,0 +1,19 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cpu.hxx"
+
+namespace odfsig
+{
+const CpuFeatures& getCpuFeatures()
+{
+    // No CPU specific kernels are built.
+    static const CpuFeatures features;
+    return features;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
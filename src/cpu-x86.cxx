@@ -0,0 +1,66 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "cpu.hxx"
+
+#include <cstdint>
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+namespace
+{
+__attribute__((target("xsave"))) uint64_t getExtendedControlRegister()
+{
+    return _xgetbv(0);
+}
+
+odfsig::CpuFeatures detectCpuFeatures()
+{
+    odfsig::CpuFeatures features;
+    unsigned eax = 0;
+    unsigned ebx = 0;
+    unsigned ecx = 0;
+    unsigned edx = 0;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return features;
+    }
+    const bool ssse3 = (ecx & bit_SSSE3) != 0;
+    const bool sse41 = (ecx & bit_SSE4_1) != 0;
+    const bool avx = (ecx & bit_AVX) != 0;
+    const bool osxsave = (ecx & bit_OSXSAVE) != 0;
+    const bool pclmul = (ecx & bit_PCLMUL) != 0;
+
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return features;
+    }
+    const bool sha = (ebx & bit_SHA) != 0;
+    const bool avx2 = (ebx & bit_AVX2) != 0;
+    const bool bmi2 = (ebx & bit_BMI2) != 0;
+
+    // The OS has to save the YMM registers as well.
+    const bool ymm =
+        avx && osxsave && (getExtendedControlRegister() & 0x6) == 0x6;
+
+    features._shaNi = sha && ssse3 && sse41;
+    features._avx2 = avx2 && bmi2 && ymm;
+    features._pclmul = pclmul && sse41;
+    return features;
+}
+} // namespace
+
+namespace odfsig
+{
+const CpuFeatures& getCpuFeatures()
+{
+    static const CpuFeatures features = detectCpuFeatures();
+    return features;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
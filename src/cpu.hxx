@@ -0,0 +1,25 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+namespace odfsig
+{
+/// CPU extensions used by the kernels, the OS supports their registers.
+struct CpuFeatures
+{
+    bool _shaNi = false;
+    bool _avx2 = false;
+    bool _pclmul = false;
+};
+
+/**
+ * Detects the features of the CPU once. Implemented in cpu-x86.cxx or
+ * cpu-generic.cxx.
+ */
+const CpuFeatures& getCpuFeatures();
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
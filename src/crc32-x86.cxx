@@ -0,0 +1,84 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "crc32.hxx"
+
+#include <immintrin.h>
+
+#include "cpu.hxx"
+
+namespace
+{
+/// Multiplies both halves of value with the matching constant, then adds data.
+__attribute__((target("pclmul,sse4.1"))) __m128i
+fold(__m128i value, __m128i constants, __m128i data)
+{
+    const __m128i low = _mm_clmulepi64_si128(value, constants, 0x00);
+    const __m128i high = _mm_clmulepi64_si128(value, constants, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(low, high), data);
+}
+
+__attribute__((target("pclmul,sse4.1"))) __m128i load(const unsigned char* data)
+{
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+}
+
+/**
+ * Folds 4 x 16 bytes in parallel, then into 16 bytes, which have the same CRC
+ * as the processed data, see "Fast CRC Computation for Generic Polynomials
+ * Using PCLMULQDQ Instruction" by Gopal et al. The constants are x^n mod P for
+ * the folding distances, bit-reflected.
+ */
+__attribute__((target("pclmul,sse4.1"))) size_t
+crc32FoldPclmul(const unsigned char* data, size_t size, uint32_t& state)
+{
+    const __m128i fold512 = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+    const __m128i fold128 = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+
+    __m128i x0 = _mm_xor_si128(load(data),
+                               _mm_cvtsi32_si128(static_cast<int>(state)));
+    __m128i x1 = load(data + 16);
+    __m128i x2 = load(data + 32);
+    __m128i x3 = load(data + 48);
+    size_t offset = 64;
+    for (; size - offset >= 64; offset += 64)
+    {
+        x0 = fold(x0, fold512, load(data + offset));
+        x1 = fold(x1, fold512, load(data + offset + 16));
+        x2 = fold(x2, fold512, load(data + offset + 32));
+        x3 = fold(x3, fold512, load(data + offset + 48));
+    }
+
+    x0 = fold(x0, fold128, x1);
+    x0 = fold(x0, fold128, x2);
+    x0 = fold(x0, fold128, x3);
+    for (; size - offset >= 16; offset += 16)
+    {
+        x0 = fold(x0, fold128, load(data + offset));
+    }
+
+    // The rest of the reduction is left to the tables.
+    alignas(16) unsigned char folded[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(folded), x0);
+    state = odfsig::crc32Portable(folded, sizeof(folded), 0);
+    return offset;
+}
+} // namespace
+
+namespace odfsig
+{
+Crc32Fold getCpuCrc32Fold(Crc32Kernel kernel)
+{
+    if (kernel == Crc32Kernel::Pclmul && getCpuFeatures()._pclmul)
+    {
+        return crc32FoldPclmul;
+    }
+
+    return nullptr;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "crc32.hxx"
+
+#include <array>
+
+namespace
+{
+/// The zip polynomial, bit-reflected.
+constexpr uint32_t crc32Polynomial = 0xedb88320;
+
+using Crc32Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+/**
+ * tables[0] is the classic byte at a time table, tables[n] continues it with n
+ * zero bytes, so 8 bytes can be looked up independently.
+ */
+constexpr Crc32Tables createCrc32Tables()
+{
+    Crc32Tables tables{};
+    for (uint32_t byte = 0; byte < 256; ++byte)
+    {
+        uint32_t value = byte;
+        for (int bit = 0; bit < 8; ++bit)
+        {
+            value = (value >> 1) ^ ((value & 1) != 0 ? crc32Polynomial : 0);
+        }
+        tables[0][byte] = value;
+    }
+    for (size_t table = 1; table < tables.size(); ++table)
+    {
+        for (uint32_t byte = 0; byte < 256; ++byte)
+        {
+            const uint32_t previous = tables[table - 1][byte];
+            tables[table][byte] =
+                (previous >> 8) ^ tables[0][previous & 0xff];
+        }
+    }
+    return tables;
+}
+
+constexpr Crc32Tables crc32Tables = createCrc32Tables();
+} // namespace
+
+namespace odfsig
+{
+uint32_t crc32Portable(const unsigned char* data, size_t size, uint32_t state)
+{
+    while (size >= 8)
+    {
+        const uint32_t low = state ^ (static_cast<uint32_t>(data[0]) |
+                                      static_cast<uint32_t>(data[1]) << 8 |
+                                      static_cast<uint32_t>(data[2]) << 16 |
+                                      static_cast<uint32_t>(data[3]) << 24);
+        state = crc32Tables[7][low & 0xff] ^ crc32Tables[6][(low >> 8) & 0xff] ^
+                crc32Tables[5][(low >> 16) & 0xff] ^ crc32Tables[4][low >> 24] ^
+                crc32Tables[3][data[4]] ^ crc32Tables[2][data[5]] ^
+                crc32Tables[1][data[6]] ^ crc32Tables[0][data[7]];
+        data += 8;
+        size -= 8;
+    }
+
+    while (size > 0)
+    {
+        state = (state >> 8) ^ crc32Tables[0][(state ^ *data) & 0xff];
+        ++data;
+        --size;
+    }
+    return state;
+}
+
+bool crc32Update(const unsigned char* data, size_t size, uint32_t& crc,
+                 Crc32Kernel kernel)
+{
+    Crc32Fold fold = nullptr;
+    if (kernel != Crc32Kernel::Portable)
+    {
+        fold = getCpuCrc32Fold(kernel);
+        if (fold == nullptr)
+        {
+            return false;
+        }
+    }
+
+    uint32_t state = ~crc;
+    if (fold != nullptr && size >= 64)
+    {
+        const size_t folded = fold(data, size, state);
+        data += folded;
+        size -= folded;
+    }
+    crc = ~crc32Portable(data, size, state);
+    return true;
+}
+
+void crc32Update(const unsigned char* data, size_t size, uint32_t& crc)
+{
+    crc32Update(data, size, crc, getBestCrc32Kernel());
+}
+
+Crc32Kernel getBestCrc32Kernel()
+{
+    static const bool pclmul = getCpuCrc32Fold(Crc32Kernel::Pclmul) != nullptr;
+    return pclmul ? Crc32Kernel::Pclmul : Crc32Kernel::Portable;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
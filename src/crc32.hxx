@@ -0,0 +1,29 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <odfsig/crc32.hxx>
+
+namespace odfsig
+{
+/**
+ * Continues the CRC register state (the inverted CRC) with data, at least 64
+ * bytes. Returns how many bytes were processed, the caller processes the rest.
+ */
+using Crc32Fold = size_t (*)(const unsigned char* data, size_t size,
+                             uint32_t& state);
+
+/// Continues the CRC register state with data, using tables.
+uint32_t crc32Portable(const unsigned char* data, size_t size, uint32_t state);
+
+/**
+ * Returns the CPU specific kernel, nullptr if the CPU doesn't support it.
+ * Implemented in crc32-x86.cxx or crc32-generic.cxx.
+ */
+Crc32Fold getCpuCrc32Fold(Crc32Kernel kernel);
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
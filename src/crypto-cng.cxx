@@ -6,8 +6,10 @@
 
 #include <odfsig/crypto.hxx>
 
+#include <chrono>
 #include <codecvt>
 
+#include <xmlsec/keys.h>
 #include <xmlsec/keysdata.h>
 #include <xmlsec/mscng/app.h>
 #include <xmlsec/mscng/crypto.h>
@@ -39,6 +41,8 @@ class CngCrypto : public Crypto
   public:
     bool initialize(const std::string& cryptoConfig) override;
 
+    bool openDatabase(const std::string& cryptoConfig) override;
+
     bool xmlSecInitialize() override;
 
     bool xmlSecShutdown() override;
@@ -46,38 +50,67 @@ class CngCrypto : public Crypto
     bool shutdown() override;
 
     bool initializeKeysManager(xmlSecKeysMngr* keysManager,
-                               std::vector<std::string> trustedDers) override;
+                               const std::vector<std::vector<unsigned char>>&
+                                   trustedCertificates) override;
 
     bool initializeSignatureContext(_xmlSecDSigCtx* signatureContext) override;
 
     std::string getCertificateSubjectName(unsigned char* certificate,
                                           size_t size) override;
+
+    xmlSecKey* createCertificateKey(unsigned char* certificate,
+                                    size_t size) override;
+
+    bool verifyCertificateKey(_xmlSecDSigCtx* signatureContext,
+                              xmlSecKey* key) override;
+
+    std::vector<std::vector<unsigned char>>
+    getCertificateChain(xmlSecKey* key) override;
+
+    bool getCertificateNotAfter(
+        unsigned char* certificate, size_t size,
+        std::chrono::system_clock::time_point& notAfter) override;
+
+    std::vector<std::string>
+    getTrustStoreFiles(const std::string& cryptoConfig) override;
+
+  private:
+    std::string _cryptoConfig;
 };
 
 bool CngCrypto::initialize(const std::string& cryptoConfig)
 {
+    _cryptoConfig = cryptoConfig;
     return xmlSecMSCngAppInit(cryptoConfig.c_str()) >= 0;
 }
 
+bool CngCrypto::openDatabase(const std::string& cryptoConfig)
+{
+    // The certificate store is opened by the init of xmlsec.
+    return cryptoConfig == _cryptoConfig;
+}
+
 bool CngCrypto::xmlSecInitialize() { return xmlSecMSCngInit() >= 0; }
 
 bool CngCrypto::xmlSecShutdown() { return xmlSecMSCngShutdown() >= 0; }
 
 bool CngCrypto::shutdown() { return xmlSecMSCngAppShutdown() >= 0; }
 
-bool CngCrypto::initializeKeysManager(xmlSecKeysMngr* keysManager,
-                                      std::vector<std::string> trustedDers)
+bool CngCrypto::initializeKeysManager(
+    xmlSecKeysMngr* keysManager,
+    const std::vector<std::vector<unsigned char>>& trustedCertificates)
 {
     if (xmlSecMSCngAppDefaultKeysMngrInit(keysManager) < 0)
     {
         return false;
     }
 
-    for (const auto& trustedDer : trustedDers)
+    for (const auto& trustedCertificate : trustedCertificates)
     {
-        if (xmlSecMSCngAppKeysMngrCertLoad(keysManager, trustedDer.c_str(),
-                                           xmlSecKeyDataFormatDer,
-                                           xmlSecKeyDataTypeTrusted) < 0)
+        if (xmlSecMSCngAppKeysMngrCertLoadMemory(
+                keysManager, trustedCertificate.data(),
+                static_cast<xmlSecSize>(trustedCertificate.size()),
+                xmlSecKeyDataFormatDer, xmlSecKeyDataTypeTrusted) < 0)
         {
             return false;
         }
@@ -124,6 +157,63 @@ std::string CngCrypto::getCertificateSubjectName(unsigned char* certificate,
     return convert.to_bytes(subject.data());
 }
 
+xmlSecKey* CngCrypto::createCertificateKey(unsigned char* certificate,
+                                           size_t size)
+{
+    return xmlSecMSCngAppKeyLoadMemory(
+        certificate, static_cast<xmlSecSize>(size), xmlSecKeyDataFormatCertDer,
+        nullptr, nullptr, nullptr);
+}
+
+bool CngCrypto::verifyCertificateKey(_xmlSecDSigCtx* /*signatureContext*/,
+                                     xmlSecKey* /*key*/)
+{
+    // Not implemented, xmlsec reads the key info instead.
+    return false;
+}
+
+std::vector<std::vector<unsigned char>>
+CngCrypto::getCertificateChain(xmlSecKey* /*key*/)
+{
+    // Not implemented, only the trust of a single session can be checked.
+    return {};
+}
+
+bool CngCrypto::getCertificateNotAfter(
+    unsigned char* certificate, size_t size,
+    std::chrono::system_clock::time_point& notAfter)
+{
+    std::unique_ptr<const CERT_CONTEXT> context(CertCreateCertificateContext(
+        X509_ASN_ENCODING, certificate, static_cast<DWORD>(size)));
+    if (!context || context->pCertInfo == nullptr)
+    {
+        return false;
+    }
+
+    // FILETIME is 100 nanoseconds since 1601-01-01.
+    const FILETIME& fileTime = context->pCertInfo->NotAfter;
+    const uint64_t ticks =
+        (static_cast<uint64_t>(fileTime.dwHighDateTime) << 32) |
+        fileTime.dwLowDateTime;
+    const uint64_t epochTicks = 116444736000000000ULL;
+    if (ticks < epochTicks)
+    {
+        return false;
+    }
+
+    notAfter = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::microseconds((ticks - epochTicks) / 10)));
+    return true;
+}
+
+std::vector<std::string>
+CngCrypto::getTrustStoreFiles(const std::string& /*cryptoConfig*/)
+{
+    // The system certificate stores are not files.
+    return {};
+}
+
 std::unique_ptr<Crypto> Crypto::create()
 {
     return std::unique_ptr<Crypto>(new CngCrypto());
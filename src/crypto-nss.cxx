@@ -7,19 +7,28 @@
 #include <odfsig/crypto.hxx>
 
 #include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <filesystem>
 #include <fstream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <system_error>
 #include <vector>
 
 #include <cert.h>
 #include <certt.h>
 #include <libxml/xmlstring.h>
+#include <pk11pub.h>
+#include <prtime.h>
 #include <prtypes.h>
 #include <seccomon.h>
+#include <secmod.h>
 #include <xmlsec/keyinfo.h>
+#include <xmlsec/keys.h>
 #include <xmlsec/keysdata.h>
 #include <xmlsec/list.h>
 #include <xmlsec/nss/app.h>
@@ -34,6 +43,11 @@ template <> struct default_delete<CERTCertificate>
 {
     void operator()(CERTCertificate* ptr) { CERT_DestroyCertificate(ptr); }
 };
+
+template <> struct default_delete<CERTCertList>
+{
+    void operator()(CERTCertList* ptr) { CERT_DestroyCertList(ptr); }
+};
 } // namespace std
 
 namespace
@@ -78,6 +92,44 @@ std::string getFirefoxProfile(const std::string& cryptoConfig)
 
     return {};
 }
+
+/**
+ * Finds the NSS database for a crypto config: either the config itself is a
+ * database directory or the default Firefox profile of a home directory is
+ * used. The result is only kept in memory, for the verifiers of one process;
+ * a new process parses profiles.ini again, unless --nss-db is given.
+ */
+std::string getNssDb(const std::string& cryptoConfig)
+{
+    if (cryptoConfig.empty())
+    {
+        return {};
+    }
+
+    static std::mutex mutex;
+    static std::map<std::string, std::string> nssDbs;
+    const std::lock_guard<std::mutex> lock(mutex);
+    auto it = nssDbs.find(cryptoConfig);
+    if (it != nssDbs.end())
+    {
+        return it->second;
+    }
+
+    std::string nssDb;
+    std::error_code errorCode;
+    if (std::filesystem::exists(cryptoConfig + "/cert9.db", errorCode) ||
+        std::filesystem::exists(cryptoConfig + "/cert8.db", errorCode))
+    {
+        nssDb = cryptoConfig;
+    }
+    else
+    {
+        nssDb = getFirefoxProfile(cryptoConfig);
+    }
+
+    nssDbs[cryptoConfig] = nssDb;
+    return nssDb;
+}
 } // namespace
 
 namespace odfsig
@@ -88,6 +140,8 @@ class NssCrypto : public Crypto
   public:
     bool initialize(const std::string& cryptoConfig) override;
 
+    bool openDatabase(const std::string& cryptoConfig) override;
+
     bool xmlSecInitialize() override;
 
     bool xmlSecShutdown() override;
@@ -95,50 +149,109 @@ class NssCrypto : public Crypto
     bool shutdown() override;
 
     bool initializeKeysManager(xmlSecKeysMngr* keysManager,
-                               std::vector<std::string> trustedDers) override;
+                               const std::vector<std::vector<unsigned char>>&
+                                   trustedCertificates) override;
 
     bool initializeSignatureContext(_xmlSecDSigCtx* signatureContext) override;
 
     std::string getCertificateSubjectName(unsigned char* certificate,
                                           size_t size) override;
+
+    xmlSecKey* createCertificateKey(unsigned char* certificate,
+                                    size_t size) override;
+
+    bool verifyCertificateKey(_xmlSecDSigCtx* signatureContext,
+                              xmlSecKey* key) override;
+
+    std::vector<std::vector<unsigned char>>
+    getCertificateChain(xmlSecKey* key) override;
+
+    bool getCertificateNotAfter(
+        unsigned char* certificate, size_t size,
+        std::chrono::system_clock::time_point& notAfter) override;
+
+    std::vector<std::string>
+    getTrustStoreFiles(const std::string& cryptoConfig) override;
+
+  private:
+    std::string _nssDb;
+
+    /// Databases opened by openDatabase(), by their directory.
+    std::map<std::string, PK11SlotInfo*> _userDbs;
 };
 
 bool NssCrypto::initialize(const std::string& cryptoConfig)
 {
-    const std::string firefoxProfile = getFirefoxProfile(cryptoConfig);
+    _nssDb = getNssDb(cryptoConfig);
     const char* nssDb = nullptr;
-    if (!firefoxProfile.empty())
+    if (!_nssDb.empty())
     {
-        nssDb = firefoxProfile.c_str();
+        nssDb = _nssDb.c_str();
     }
 
+    // Without a database, this initializes NSS without opening any files.
     return xmlSecNssAppInit(nssDb) >= 0;
 }
 
+bool NssCrypto::openDatabase(const std::string& cryptoConfig)
+{
+    const std::string nssDb = getNssDb(cryptoConfig);
+    if (nssDb.empty() || nssDb == _nssDb || _userDbs.count(nssDb) > 0)
+    {
+        return true;
+    }
+
+    // NSS has one main database, the others are opened as user databases.
+    const std::string spec = "configdir='" + nssDb +
+                             "' tokenDescription='odfsig " +
+                             std::to_string(_userDbs.size() + 1) +
+                             "' flags=readOnly";
+    PK11SlotInfo* slot = SECMOD_OpenUserDB(spec.c_str());
+    if (slot == nullptr)
+    {
+        return false;
+    }
+
+    _userDbs[nssDb] = slot;
+    return true;
+}
+
 bool NssCrypto::xmlSecInitialize() { return xmlSecNssInit() >= 0; }
 
 bool NssCrypto::xmlSecShutdown() { return xmlSecNssShutdown() >= 0; }
 
-bool NssCrypto::shutdown() { return xmlSecNssAppShutdown() >= 0; }
+bool NssCrypto::shutdown()
+{
+    for (const auto& userDb : _userDbs)
+    {
+        SECMOD_CloseUserDB(userDb.second);
+        PK11_FreeSlot(userDb.second);
+    }
+    _userDbs.clear();
+
+    return xmlSecNssAppShutdown() >= 0;
+}
 
-bool NssCrypto::initializeKeysManager(xmlSecKeysMngr* keysManager,
-                                      std::vector<std::string> trustedDers)
+bool NssCrypto::initializeKeysManager(
+    xmlSecKeysMngr* keysManager,
+    const std::vector<std::vector<unsigned char>>& trustedCertificates)
 {
     if (xmlSecNssAppDefaultKeysMngrInit(keysManager) < 0)
     {
         return false;
     }
 
-    return std::all_of(trustedDers.begin(), trustedDers.end(),
-                       [keysManager](const std::string& trustedDer)
-                       {
-                           return xmlSecNssAppKeysMngrCertLoad(
-                                      keysManager, trustedDer.c_str(),
-                                      xmlSecKeyDataFormatDer,
-                                      xmlSecKeyDataTypeTrusted) >= 0;
-                       });
-
-    return true;
+    // NSS keeps the loaded certificates in its hashed certificate store, so
+    // issuer lookups during chain building don't scan them.
+    return std::all_of(
+        trustedCertificates.begin(), trustedCertificates.end(),
+        [keysManager](const std::vector<unsigned char>& trustedCertificate)
+        {
+            return xmlSecNssAppKeysMngrCertLoadMemory(
+                       keysManager, trustedCertificate.data(),
+                       static_cast<xmlSecSize>(trustedCertificate.size()),
+                       xmlSecKeyDataFormatDer, xmlSecKeyDataTypeTrusted) >= 0;
+        });
 }
 
 bool NssCrypto::initializeSignatureContext(
@@ -165,6 +278,122 @@ std::string NssCrypto::getCertificateSubjectName(unsigned char* certificate,
     return cert->subjectName;
 }
 
+xmlSecKey* NssCrypto::createCertificateKey(unsigned char* certificate,
+                                           size_t size)
+{
+    return xmlSecNssAppKeyLoadMemory(
+        certificate, static_cast<xmlSecSize>(size), xmlSecKeyDataFormatCertDer,
+        nullptr, nullptr, nullptr);
+}
+
+namespace
+{
+/// Returns the certificate of a key with X509 data, or nullptr.
+CERTCertificate* getKeyCertificate(xmlSecKey* key)
+{
+    xmlSecKeyData* data = xmlSecKeyGetData(key, xmlSecNssKeyDataX509Id);
+    if (data == nullptr)
+    {
+        return nullptr;
+    }
+
+    return xmlSecNssKeyDataX509GetKeyCert(data);
+}
+} // namespace
+
+bool NssCrypto::verifyCertificateKey(_xmlSecDSigCtx* signatureContext,
+                                     xmlSecKey* key)
+{
+    CERTCertificate* certificate = getKeyCertificate(key);
+    xmlSecKeyDataStore* store = xmlSecKeysMngrGetDataStore(
+        signatureContext->keyInfoReadCtx.keysMngr, xmlSecNssX509StoreId);
+    if (certificate == nullptr || store == nullptr)
+    {
+        return false;
+    }
+
+    std::unique_ptr<CERTCertList> certificates(CERT_NewCertList());
+    if (!certificates ||
+        CERT_AddCertToListTail(certificates.get(),
+                               CERT_DupCertificate(certificate)) != SECSuccess)
+    {
+        return false;
+    }
+
+    // The same validation as the one of the X509 key data.
+    return xmlSecNssX509StoreVerify(store, certificates.get(),
+                                    &signatureContext->keyInfoReadCtx) !=
+           nullptr;
+}
+
+std::vector<std::vector<unsigned char>>
+NssCrypto::getCertificateChain(xmlSecKey* key)
+{
+    CERTCertificate* certificate = getKeyCertificate(key);
+    if (certificate == nullptr)
+    {
+        return {};
+    }
+
+    std::unique_ptr<CERTCertList> certificates(
+        CERT_GetCertChainFromCert(certificate, PR_Now(), certUsageAnyCA));
+    if (!certificates)
+    {
+        return {};
+    }
+
+    std::vector<std::vector<unsigned char>> chain;
+    for (CERTCertListNode* node = CERT_LIST_HEAD(certificates.get());
+         !CERT_LIST_END(node, certificates.get()); node = CERT_LIST_NEXT(node))
+    {
+        const SECItem& der = node->cert->derCert;
+        chain.emplace_back(der.data, der.data + der.len);
+    }
+    return chain;
+}
+
+bool NssCrypto::getCertificateNotAfter(
+    unsigned char* certificate, size_t size,
+    std::chrono::system_clock::time_point& notAfter)
+{
+    SECItem certItem;
+    certItem.data = certificate;
+    certItem.len = size;
+
+    std::unique_ptr<CERTCertificate> cert(CERT_NewTempCertificate(
+        CERT_GetDefaultCertDB(), &certItem, nullptr, PR_FALSE, PR_TRUE));
+    if (!cert)
+    {
+        return false;
+    }
+
+    PRTime notBeforeTime;
+    PRTime notAfterTime;
+    if (CERT_GetCertTimes(cert.get(), &notBeforeTime, &notAfterTime) !=
+        SECSuccess)
+    {
+        return false;
+    }
+
+    // PRTime is microseconds since the epoch.
+    notAfter = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::microseconds(notAfterTime)));
+    return true;
+}
+
+std::vector<std::string>
+NssCrypto::getTrustStoreFiles(const std::string& cryptoConfig)
+{
+    const std::string nssDb = getNssDb(cryptoConfig);
+    if (nssDb.empty())
+    {
+        return {};
+    }
+
+    return {nssDb + "/cert9.db", nssDb + "/cert8.db"};
+}
+
 std::unique_ptr<Crypto> Crypto::create()
 {
     return std::unique_ptr<Crypto>(new NssCrypto());
@@ -0,0 +1,18 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "digest.hxx"
+
+namespace odfsig
+{
+DigestKernels getCpuDigestKernels(DigestKernel /*kernel*/)
+{
+    // No CPU specific kernels, the portable one is used.
+    return DigestKernels();
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,517 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "digest.hxx"
+
+#include <array>
+#include <utility>
+
+#include <immintrin.h>
+
+#include "cpu.hxx"
+
+namespace
+{
+template <int Bits> __m128i rotr32(__m128i x)
+{
+    return _mm_or_si128(_mm_srli_epi32(x, Bits), _mm_slli_epi32(x, 32 - Bits));
+}
+
+__m128i sha256Sigma0(__m128i x)
+{
+    return _mm_xor_si128(_mm_xor_si128(rotr32<7>(x), rotr32<18>(x)),
+                         _mm_srli_epi32(x, 3));
+}
+
+__m128i sha256Sigma1(__m128i x)
+{
+    return _mm_xor_si128(_mm_xor_si128(rotr32<17>(x), rotr32<19>(x)),
+                         _mm_srli_epi32(x, 10));
+}
+
+template <int Bits> __attribute__((target("avx2"))) __m256i rotr64(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi64(x, Bits),
+                           _mm256_slli_epi64(x, 64 - Bits));
+}
+
+__attribute__((target("avx2"))) __m256i sha512Sigma0(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr64<1>(x), rotr64<8>(x)),
+                            _mm256_srli_epi64(x, 7));
+}
+
+__attribute__((target("avx2"))) __m256i sha512Sigma1(__m256i x)
+{
+    return _mm256_xor_si256(_mm256_xor_si256(rotr64<19>(x), rotr64<61>(x)),
+                            _mm256_srli_epi64(x, 6));
+}
+
+/// Words 1..4 of the 8 words in low and high.
+__attribute__((target("avx2"))) __m256i shiftWords64(__m256i low,
+                                                     __m256i high)
+{
+    return _mm256_alignr_epi8(_mm256_permute2x128_si256(low, high, 0x21), low,
+                              8);
+}
+
+/**
+ * Calculates the message schedule 4 words at a time, keeping the last 16 words
+ * in registers. The last 2 new words depend on the first 2, so sigma1 is
+ * applied in 2 steps. The rounds are scalar, but use BMI2 rotates.
+ */
+__attribute__((target("avx2,bmi2"))) void
+sha256CompressAvx2(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+    const __m128i byteSwap =
+        _mm_set_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    alignas(16) std::array<uint32_t, 64> w{};
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            const __m128i message = _mm_loadu_si128(
+                reinterpret_cast<const __m128i*>(data + i * 16));
+            _mm_store_si128(reinterpret_cast<__m128i*>(&w[i * 4]),
+                            _mm_shuffle_epi8(message, byteSwap));
+        }
+
+        __m128i x0 = _mm_load_si128(reinterpret_cast<const __m128i*>(&w[0]));
+        __m128i x1 = _mm_load_si128(reinterpret_cast<const __m128i*>(&w[4]));
+        __m128i x2 = _mm_load_si128(reinterpret_cast<const __m128i*>(&w[8]));
+        __m128i x3 = _mm_load_si128(reinterpret_cast<const __m128i*>(&w[12]));
+        for (size_t t = 16; t < 64; t += 4)
+        {
+            // x0 is w[t - 16 .. t - 13], x3 is w[t - 4 .. t - 1].
+            const __m128i w15 = _mm_alignr_epi8(x1, x0, 4);
+            const __m128i w7 = _mm_alignr_epi8(x3, x2, 4);
+            const __m128i w2 = _mm_srli_si128(x3, 8);
+            const __m128i partial =
+                _mm_add_epi32(_mm_add_epi32(x0, sha256Sigma0(w15)), w7);
+            const __m128i low = _mm_add_epi32(partial, sha256Sigma1(w2));
+            const __m128i high = sha256Sigma1(_mm_slli_si128(low, 8));
+            x0 = x1;
+            x1 = x2;
+            x2 = x3;
+            x3 = _mm_add_epi32(low, high);
+            _mm_store_si128(reinterpret_cast<__m128i*>(&w[t]), x3);
+        }
+
+        odfsig::sha256Rounds(state, w.data());
+    }
+}
+
+/// Same as sha256CompressAvx2(), but with 256-bit vectors.
+__attribute__((target("avx2,bmi2"))) void
+sha512CompressAvx2(uint64_t* state, const unsigned char* data, size_t blocks)
+{
+    const __m256i byteSwap = _mm256_set_epi8(
+        8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11,
+        12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7);
+    alignas(32) std::array<uint64_t, 80> w{};
+    for (; blocks > 0; --blocks, data += 128)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            const __m256i message = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(data + i * 32));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(&w[i * 4]),
+                               _mm256_shuffle_epi8(message, byteSwap));
+        }
+
+        __m256i y0 =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(&w[0]));
+        __m256i y1 =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(&w[4]));
+        __m256i y2 =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(&w[8]));
+        __m256i y3 =
+            _mm256_load_si256(reinterpret_cast<const __m256i*>(&w[12]));
+        for (size_t t = 16; t < 80; t += 4)
+        {
+            // y0 is w[t - 16 .. t - 13], y3 is w[t - 4 .. t - 1].
+            const __m256i w15 = shiftWords64(y0, y1);
+            const __m256i w7 = shiftWords64(y2, y3);
+            // The high 128 bits to the low ones, zeroing the high ones.
+            const __m256i w2 = _mm256_permute2x128_si256(y3, y3, 0x81);
+            const __m256i partial =
+                _mm256_add_epi64(_mm256_add_epi64(y0, sha512Sigma0(w15)), w7);
+            const __m256i low = _mm256_add_epi64(partial, sha512Sigma1(w2));
+            // The low 128 bits to the high ones, zeroing the low ones.
+            const __m256i high =
+                sha512Sigma1(_mm256_permute2x128_si256(low, low, 0x08));
+            y0 = y1;
+            y1 = y2;
+            y2 = y3;
+            y3 = _mm256_add_epi64(low, high);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(&w[t]), y3);
+        }
+
+        odfsig::sha512Rounds(state, w.data());
+    }
+}
+
+template <int Bits> __attribute__((target("avx2"))) __m256i rotr32x8(__m256i x)
+{
+    return _mm256_or_si256(_mm256_srli_epi32(x, Bits),
+                           _mm256_slli_epi32(x, 32 - Bits));
+}
+
+/// One round of SHA-256 in 8 lanes, the caller rotates the roles.
+__attribute__((target("avx2"), always_inline)) inline void
+sha256RoundX8(__m256i a, __m256i b, __m256i c, __m256i& d, __m256i e,
+              __m256i f, __m256i g, __m256i& h, __m256i kw)
+{
+    const __m256i sum1 = _mm256_xor_si256(
+        _mm256_xor_si256(rotr32x8<6>(e), rotr32x8<11>(e)), rotr32x8<25>(e));
+    const __m256i choose =
+        _mm256_xor_si256(g, _mm256_and_si256(e, _mm256_xor_si256(f, g)));
+    const __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, sum1),
+                                        _mm256_add_epi32(choose, kw));
+    d = _mm256_add_epi32(d, t1);
+    const __m256i sum0 = _mm256_xor_si256(
+        _mm256_xor_si256(rotr32x8<2>(a), rotr32x8<13>(a)), rotr32x8<22>(a));
+    const __m256i majority = _mm256_or_si256(
+        _mm256_and_si256(a, b), _mm256_and_si256(c, _mm256_or_si256(a, b)));
+    h = _mm256_add_epi32(t1, _mm256_add_epi32(sum0, majority));
+}
+
+/**
+ * Loads 8 words at offset from the block of each lane and stores them
+ * transposed to w: w[word * 8 + lane].
+ */
+__attribute__((target("avx2"), always_inline)) inline void
+loadTransposed(const unsigned char* const* blocks, size_t offset, uint32_t* w)
+{
+    const __m256i byteSwap = _mm256_set_epi8(
+        12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3, 12, 13, 14, 15,
+        8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3);
+    const auto load = [&blocks, offset, byteSwap](size_t lane)
+        __attribute__((target("avx2"))) {
+            return _mm256_shuffle_epi8(
+                _mm256_loadu_si256(
+                    reinterpret_cast<const __m256i*>(blocks[lane] + offset)),
+                byteSwap);
+        };
+    const __m256i r0 = load(0);
+    const __m256i r1 = load(1);
+    const __m256i r2 = load(2);
+    const __m256i r3 = load(3);
+    const __m256i r4 = load(4);
+    const __m256i r5 = load(5);
+    const __m256i r6 = load(6);
+    const __m256i r7 = load(7);
+
+    // Pairs of lanes, then quads, both per 128-bit half.
+    const __m256i t0 = _mm256_unpacklo_epi32(r0, r1);
+    const __m256i t1 = _mm256_unpackhi_epi32(r0, r1);
+    const __m256i t2 = _mm256_unpacklo_epi32(r2, r3);
+    const __m256i t3 = _mm256_unpackhi_epi32(r2, r3);
+    const __m256i t4 = _mm256_unpacklo_epi32(r4, r5);
+    const __m256i t5 = _mm256_unpackhi_epi32(r4, r5);
+    const __m256i t6 = _mm256_unpacklo_epi32(r6, r7);
+    const __m256i t7 = _mm256_unpackhi_epi32(r6, r7);
+    const __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+    const __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+    const __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+    const __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+    const __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+    const __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+    const __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+    const __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+    // u0 is word 0 of lanes 0..3 and word 4 of lanes 0..3, etc.
+    const auto store = [w](size_t word, __m256i value)
+        __attribute__((target("avx2"))) {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(w + word * 8),
+                               value);
+        };
+    store(0, _mm256_permute2x128_si256(u0, u4, 0x20));
+    store(1, _mm256_permute2x128_si256(u1, u5, 0x20));
+    store(2, _mm256_permute2x128_si256(u2, u6, 0x20));
+    store(3, _mm256_permute2x128_si256(u3, u7, 0x20));
+    store(4, _mm256_permute2x128_si256(u0, u4, 0x31));
+    store(5, _mm256_permute2x128_si256(u1, u5, 0x31));
+    store(6, _mm256_permute2x128_si256(u2, u6, 0x31));
+    store(7, _mm256_permute2x128_si256(u3, u7, 0x31));
+}
+
+/**
+ * SHA-256 of 8 independent messages, one in each 32-bit lane of the vectors
+ * (multi-buffer): unlike a single message, the rounds are vectorized as well.
+ */
+__attribute__((target("avx2"))) void
+sha256CompressAvx2x8(uint32_t* state, const unsigned char* const* blocks)
+{
+    alignas(32) std::array<uint32_t, 64 * 8> w{};
+    loadTransposed(blocks, 0, w.data());
+    loadTransposed(blocks, 32, w.data() + 64);
+
+    const auto word = [&w](size_t t) __attribute__((target("avx2"))) {
+        return _mm256_load_si256(reinterpret_cast<const __m256i*>(&w[t * 8]));
+    };
+    for (size_t t = 16; t < 64; ++t)
+    {
+        const __m256i w15 = word(t - 15);
+        const __m256i w2 = word(t - 2);
+        const __m256i sigma0 = _mm256_xor_si256(
+            _mm256_xor_si256(rotr32x8<7>(w15), rotr32x8<18>(w15)),
+            _mm256_srli_epi32(w15, 3));
+        const __m256i sigma1 = _mm256_xor_si256(
+            _mm256_xor_si256(rotr32x8<17>(w2), rotr32x8<19>(w2)),
+            _mm256_srli_epi32(w2, 10));
+        _mm256_store_si256(
+            reinterpret_cast<__m256i*>(&w[t * 8]),
+            _mm256_add_epi32(_mm256_add_epi32(word(t - 16), sigma0),
+                             _mm256_add_epi32(word(t - 7), sigma1)));
+    }
+
+    const auto loadState = [state](size_t index)
+        __attribute__((target("avx2"))) {
+            return _mm256_loadu_si256(
+                reinterpret_cast<const __m256i*>(state + index * 8));
+        };
+    __m256i a = loadState(0);
+    __m256i b = loadState(1);
+    __m256i c = loadState(2);
+    __m256i d = loadState(3);
+    __m256i e = loadState(4);
+    __m256i f = loadState(5);
+    __m256i g = loadState(6);
+    __m256i h = loadState(7);
+    const uint32_t* k = odfsig::sha256RoundConstants.data();
+    const auto kw = [&word, k](size_t t) __attribute__((target("avx2"))) {
+        return _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(k[t])),
+                                word(t));
+    };
+    for (size_t t = 0; t < 64; t += 8)
+    {
+        sha256RoundX8(a, b, c, d, e, f, g, h, kw(t));
+        sha256RoundX8(h, a, b, c, d, e, f, g, kw(t + 1));
+        sha256RoundX8(g, h, a, b, c, d, e, f, kw(t + 2));
+        sha256RoundX8(f, g, h, a, b, c, d, e, kw(t + 3));
+        sha256RoundX8(e, f, g, h, a, b, c, d, kw(t + 4));
+        sha256RoundX8(d, e, f, g, h, a, b, c, kw(t + 5));
+        sha256RoundX8(c, d, e, f, g, h, a, b, kw(t + 6));
+        sha256RoundX8(b, c, d, e, f, g, h, a, kw(t + 7));
+    }
+
+    const auto addState = [state](size_t index, __m256i value)
+        __attribute__((target("avx2"))) {
+            auto* pointer = reinterpret_cast<__m256i*>(state + index * 8);
+            _mm256_storeu_si256(
+                pointer, _mm256_add_epi32(_mm256_loadu_si256(pointer), value));
+        };
+    addState(0, a);
+    addState(1, b);
+    addState(2, c);
+    addState(3, d);
+    addState(4, e);
+    addState(5, f);
+    addState(6, g);
+    addState(7, h);
+}
+
+/// 4 rounds of SHA-1, the round function has to be a compile time constant.
+__attribute__((target("sha,sse4.1"), always_inline)) inline __m128i
+sha1Rounds4(__m128i abcd, __m128i e, size_t group)
+{
+    switch (group / 5)
+    {
+    case 0:
+        return _mm_sha1rnds4_epu32(abcd, e, 0);
+    case 1:
+        return _mm_sha1rnds4_epu32(abcd, e, 1);
+    case 2:
+        return _mm_sha1rnds4_epu32(abcd, e, 2);
+    default:
+        return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+/**
+ * Processes 4 rounds per iteration, the message schedule of later groups is
+ * calculated in parallel. message0 is the current group, message1..3 are the
+ * next ones, the E values also rotate.
+ */
+__attribute__((target("sha,sse4.1,ssse3"))) void
+sha1CompressShaNi(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+    const __m128i byteSwap =
+        _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+    __m128i abcd = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1b);
+    __m128i e0 = _mm_set_epi32(static_cast<int>(state[4]), 0, 0, 0);
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        const __m128i abcdSave = abcd;
+        const __m128i eSave = e0;
+        __m128i message0 = _mm_setzero_si128();
+        __m128i message1 = _mm_setzero_si128();
+        __m128i message2 = _mm_setzero_si128();
+        __m128i message3 = _mm_setzero_si128();
+        __m128i eCurrent = e0;
+        __m128i eNext = e0;
+#pragma GCC unroll 20
+        for (size_t group = 0; group < 20; ++group)
+        {
+            if (group < 4)
+            {
+                message0 = _mm_shuffle_epi8(
+                    _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(data + group * 16)),
+                    byteSwap);
+            }
+
+            if (group == 0)
+            {
+                eCurrent = _mm_add_epi32(eCurrent, message0);
+            }
+            else
+            {
+                eCurrent = _mm_sha1nexte_epu32(eCurrent, message0);
+            }
+            eNext = abcd;
+
+            if (group >= 3 && group <= 18)
+            {
+                message1 = _mm_sha1msg2_epu32(message1, message0);
+            }
+
+            abcd = sha1Rounds4(abcd, eCurrent, group);
+
+            if (group >= 1 && group <= 16)
+            {
+                message3 = _mm_sha1msg1_epu32(message3, message0);
+            }
+            if (group >= 2 && group <= 17)
+            {
+                message2 = _mm_xor_si128(message2, message0);
+            }
+
+            const __m128i message = message0;
+            message0 = message1;
+            message1 = message2;
+            message2 = message3;
+            message3 = message;
+            std::swap(eCurrent, eNext);
+        }
+
+        e0 = _mm_sha1nexte_epu32(eCurrent, eSave);
+        abcd = _mm_add_epi32(abcd, abcdSave);
+    }
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+                     _mm_shuffle_epi32(abcd, 0x1b));
+    state[4] = static_cast<uint32_t>(_mm_extract_epi32(e0, 3));
+}
+
+/// Same as sha1CompressShaNi(), 2 rounds per instruction.
+__attribute__((target("sha,sse4.1,ssse3"))) void
+sha256CompressShaNi(uint32_t* state, const unsigned char* data, size_t blocks)
+{
+    const __m128i byteSwap =
+        _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    // The instructions work with the ABEF and CDGH order.
+    __m128i temp = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[0])), 0xb1);
+    __m128i state1 = _mm_shuffle_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&state[4])), 0x1b);
+    __m128i state0 = _mm_alignr_epi8(temp, state1, 8);
+    state1 = _mm_blend_epi16(state1, temp, 0xf0);
+
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        const __m128i state0Save = state0;
+        const __m128i state1Save = state1;
+        __m128i message0 = _mm_setzero_si128();
+        __m128i message1 = _mm_setzero_si128();
+        __m128i message2 = _mm_setzero_si128();
+        __m128i message3 = _mm_setzero_si128();
+#pragma GCC unroll 16
+        for (size_t group = 0; group < 16; ++group)
+        {
+            if (group < 4)
+            {
+                message0 = _mm_shuffle_epi8(
+                    _mm_loadu_si128(
+                        reinterpret_cast<const __m128i*>(data + group * 16)),
+                    byteSwap);
+            }
+
+            __m128i input = _mm_add_epi32(
+                message0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                              &odfsig::sha256RoundConstants[group * 4])));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, input);
+
+            if (group >= 3 && group <= 14)
+            {
+                // message3 is the previous group.
+                message1 = _mm_add_epi32(
+                    message1, _mm_alignr_epi8(message0, message3, 4));
+                message1 = _mm_sha256msg2_epu32(message1, message0);
+            }
+
+            input = _mm_shuffle_epi32(input, 0x0e);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, input);
+
+            if (group >= 1 && group <= 12)
+            {
+                message3 = _mm_sha256msg1_epu32(message3, message0);
+            }
+
+            const __m128i message = message0;
+            message0 = message1;
+            message1 = message2;
+            message2 = message3;
+            message3 = message;
+        }
+
+        state0 = _mm_add_epi32(state0, state0Save);
+        state1 = _mm_add_epi32(state1, state1Save);
+    }
+
+    temp = _mm_shuffle_epi32(state0, 0x1b);
+    state1 = _mm_shuffle_epi32(state1, 0xb1);
+    state0 = _mm_blend_epi16(temp, state1, 0xf0);
+    state1 = _mm_alignr_epi8(state1, temp, 8);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[0]), state0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&state[4]), state1);
+}
+} // namespace
+
+namespace odfsig
+{
+DigestKernels getCpuDigestKernels(DigestKernel kernel)
+{
+    const CpuFeatures& features = getCpuFeatures();
+    DigestKernels kernels;
+    switch (kernel)
+    {
+    case DigestKernel::ShaNi:
+        if (features._shaNi)
+        {
+            kernels._sha1 = sha1CompressShaNi;
+            kernels._sha256 = sha256CompressShaNi;
+        }
+        break;
+    case DigestKernel::Avx2:
+        if (features._avx2)
+        {
+            kernels._sha256 = sha256CompressAvx2;
+            kernels._sha512 = sha512CompressAvx2;
+            kernels._sha256x8 = sha256CompressAvx2x8;
+        }
+        break;
+    default:
+        break;
+    }
+    return kernels;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,1042 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "digest.hxx"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <utility>
+
+#include <xmlsec/buffer.h>
+#include <xmlsec/io.h>
+#include <xmlsec/list.h>
+#include <xmlsec/strings.h>
+#include <xmlsec/transforms.h>
+
+namespace std
+{
+template <> struct default_delete<xmlSecTransformCtx>
+{
+    void operator()(xmlSecTransformCtxPtr ptr)
+    {
+        xmlSecTransformCtxDestroy(ptr);
+    }
+};
+} // namespace std
+
+namespace odfsig
+{
+const std::array<uint32_t, 64> sha256RoundConstants{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+const std::array<uint64_t, 80> sha512RoundConstants{
+    0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+    0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+    0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+    0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+    0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+    0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+    0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+    0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+    0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+    0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+    0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+    0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+    0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+    0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+    0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+    0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+    0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+    0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+    0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+    0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+    0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+    0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+    0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+    0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+    0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+    0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+    0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+    0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+    0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+    0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+    0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+    0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+    0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+    0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+    0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+    0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+    0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+    0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+    0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+    0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL,
+};
+
+namespace
+{
+const std::array<uint32_t, 5> sha1InitialState{0x67452301, 0xefcdab89,
+                                               0x98badcfe, 0x10325476,
+                                               0xc3d2e1f0};
+
+const std::array<uint32_t, 8> sha256InitialState{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+const std::array<uint64_t, 8> sha512InitialState{
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL, 0x3c6ef372fe94f82bULL,
+    0xa54ff53a5f1d36f1ULL, 0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL,
+};
+
+void sha1CompressPortable(uint32_t* state, const unsigned char* data,
+                          size_t blocks)
+{
+    std::array<uint32_t, 80> w{};
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        for (size_t t = 0; t < 16; ++t)
+        {
+            w[t] = loadBigEndian32(data + t * 4);
+        }
+        for (size_t t = 16; t < 80; ++t)
+        {
+            w[t] = std::rotl(w[t - 3] ^ w[t - 8] ^ w[t - 14] ^ w[t - 16], 1);
+        }
+
+        uint32_t a = state[0];
+        uint32_t b = state[1];
+        uint32_t c = state[2];
+        uint32_t d = state[3];
+        uint32_t e = state[4];
+        for (size_t t = 0; t < 80; ++t)
+        {
+            uint32_t f = 0;
+            uint32_t k = 0;
+            if (t < 20)
+            {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (t < 40)
+            {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (t < 60)
+            {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            }
+            else
+            {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            const uint32_t temp = std::rotl(a, 5) + f + e + k + w[t];
+            e = d;
+            d = c;
+            c = std::rotl(b, 30);
+            b = a;
+            a = temp;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+    }
+}
+
+void sha256CompressPortable(uint32_t* state, const unsigned char* data,
+                            size_t blocks)
+{
+    std::array<uint32_t, 64> w{};
+    for (; blocks > 0; --blocks, data += 64)
+    {
+        for (size_t t = 0; t < 16; ++t)
+        {
+            w[t] = loadBigEndian32(data + t * 4);
+        }
+        for (size_t t = 16; t < 64; ++t)
+        {
+            const uint32_t s0 = std::rotr(w[t - 15], 7) ^
+                                std::rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+            const uint32_t s1 = std::rotr(w[t - 2], 17) ^
+                                std::rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        sha256Rounds(state, w.data());
+    }
+}
+
+void sha512CompressPortable(uint64_t* state, const unsigned char* data,
+                            size_t blocks)
+{
+    std::array<uint64_t, 80> w{};
+    for (; blocks > 0; --blocks, data += 128)
+    {
+        for (size_t t = 0; t < 16; ++t)
+        {
+            w[t] = loadBigEndian64(data + t * 8);
+        }
+        for (size_t t = 16; t < 80; ++t)
+        {
+            const uint64_t s0 = std::rotr(w[t - 15], 1) ^
+                                std::rotr(w[t - 15], 8) ^ (w[t - 15] >> 7);
+            const uint64_t s1 = std::rotr(w[t - 2], 19) ^
+                                std::rotr(w[t - 2], 61) ^ (w[t - 2] >> 6);
+            w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+        }
+        sha512Rounds(state, w.data());
+    }
+}
+
+/**
+ * Merkle-Damgard construction shared by the SHA algorithms: buffers partial
+ * blocks, pads the last one and hands full blocks to the kernel.
+ */
+template <typename Word, size_t StateWords, size_t DigestWords>
+class ShaDigest : public Digest
+{
+  public:
+    using Compress = void (*)(Word* state, const unsigned char* data,
+                              size_t blocks);
+
+    ShaDigest(Compress compress, const std::array<Word, StateWords>& state)
+        : _compress(compress), _state(state)
+    {
+    }
+
+    void update(const unsigned char* data, size_t size) override;
+
+    bool finish(std::vector<unsigned char>& digest) override;
+
+  private:
+    static constexpr size_t BlockSize = 16 * sizeof(Word);
+
+    Compress _compress;
+    std::array<Word, StateWords> _state;
+    std::array<unsigned char, BlockSize> _buffer{};
+    size_t _bufferSize = 0;
+    uint64_t _length = 0;
+};
+
+template <typename Word, size_t StateWords, size_t DigestWords>
+void ShaDigest<Word, StateWords, DigestWords>::update(const unsigned char* data,
+                                                      size_t size)
+{
+    _length += size;
+    if (_bufferSize > 0)
+    {
+        const size_t count = std::min(BlockSize - _bufferSize, size);
+        std::memcpy(_buffer.data() + _bufferSize, data, count);
+        _bufferSize += count;
+        data += count;
+        size -= count;
+        if (_bufferSize < BlockSize)
+        {
+            return;
+        }
+
+        _compress(_state.data(), _buffer.data(), 1);
+        _bufferSize = 0;
+    }
+
+    // Full blocks are processed in place, without copying.
+    const size_t blocks = size / BlockSize;
+    if (blocks > 0)
+    {
+        _compress(_state.data(), data, blocks);
+        data += blocks * BlockSize;
+        size -= blocks * BlockSize;
+    }
+
+    if (size > 0)
+    {
+        std::memcpy(_buffer.data(), data, size);
+        _bufferSize = size;
+    }
+}
+
+template <typename Word, size_t StateWords, size_t DigestWords>
+bool ShaDigest<Word, StateWords, DigestWords>::finish(
+    std::vector<unsigned char>& digest)
+{
+    // Pad with 0x80, zeros and the big endian length in bits, which takes
+    // the last 2 words of the block.
+    const uint64_t bits = _length * 8;
+    _buffer[_bufferSize++] = 0x80;
+    if (_bufferSize > BlockSize - 2 * sizeof(Word))
+    {
+        std::fill(_buffer.begin() + _bufferSize, _buffer.end(), 0);
+        _compress(_state.data(), _buffer.data(), 1);
+        _bufferSize = 0;
+    }
+    std::fill(_buffer.begin() + _bufferSize, _buffer.end(), 0);
+    for (size_t i = 0; i < 8; ++i)
+    {
+        _buffer[BlockSize - 1 - i] =
+            static_cast<unsigned char>(bits >> (i * 8));
+    }
+    _compress(_state.data(), _buffer.data(), 1);
+    _bufferSize = 0;
+
+    digest.clear();
+    digest.reserve(DigestWords * sizeof(Word));
+    for (size_t i = 0; i < DigestWords; ++i)
+    {
+        for (size_t j = sizeof(Word); j > 0; --j)
+        {
+            digest.push_back(
+                static_cast<unsigned char>(_state[i] >> ((j - 1) * 8)));
+        }
+    }
+    return true;
+}
+
+/// A lane of the SHA-256 multi-buffer scheduler.
+struct BatchLane
+{
+    /// Index of the message, or -1 if the lane is idle.
+    size_t _message = SIZE_MAX;
+    /// The full blocks of the message are read in place.
+    const unsigned char* _data = nullptr;
+    size_t _dataBlocks = 0;
+    /// The last partial block and the padding, 1 or 2 blocks.
+    std::array<unsigned char, 128> _tail{};
+    size_t _blocks = 0;
+    size_t _block = 0;
+};
+
+/// Starts hashing a message in a lane, the state of the lane is reset.
+void startBatchLane(BatchLane& lane, size_t message,
+                    const std::vector<unsigned char>& data, uint32_t* state,
+                    size_t laneIndex)
+{
+    lane._message = message;
+    lane._data = data.data();
+    lane._dataBlocks = data.size() / 64;
+    const size_t rest = data.size() % 64;
+    std::fill(lane._tail.begin(), lane._tail.end(), 0);
+    if (rest > 0)
+    {
+        std::memcpy(lane._tail.data(), data.data() + lane._dataBlocks * 64,
+                    rest);
+    }
+    lane._tail[rest] = 0x80;
+    const size_t tailBlocks = rest + 1 + 8 > 64 ? 2 : 1;
+    const uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        lane._tail[tailBlocks * 64 - 1 - i] =
+            static_cast<unsigned char>(bits >> (i * 8));
+    }
+    lane._blocks = lane._dataBlocks + tailBlocks;
+    lane._block = 0;
+    for (size_t word = 0; word < 8; ++word)
+    {
+        state[word * 8 + laneIndex] = sha256InitialState[word];
+    }
+}
+
+/**
+ * Hashes SHA-256 messages in 8 lanes: when a message ends, the next one takes
+ * its lane, so short and long messages can be mixed.
+ */
+void hashBatchSha256x8(Compress32x8 compress,
+                       const std::vector<std::vector<unsigned char>>& messages,
+                       std::vector<std::vector<unsigned char>>& digests)
+{
+    constexpr size_t Lanes = 8;
+    // Idle lanes hash this, their result is not used.
+    static const std::array<unsigned char, 64> idleBlock{};
+    std::array<uint32_t, 8 * Lanes> state{};
+    std::array<BatchLane, Lanes> lanes;
+    std::array<const unsigned char*, Lanes> blocks{};
+    size_t next = 0;
+    size_t active = 0;
+    for (size_t i = 0; i < Lanes && next < messages.size(); ++i, ++next)
+    {
+        startBatchLane(lanes[i], next, messages[next], state.data(), i);
+        ++active;
+    }
+
+    while (active > 0)
+    {
+        for (size_t i = 0; i < Lanes; ++i)
+        {
+            const BatchLane& lane = lanes[i];
+            if (lane._message == SIZE_MAX)
+            {
+                blocks[i] = idleBlock.data();
+            }
+            else if (lane._block < lane._dataBlocks)
+            {
+                blocks[i] = lane._data + lane._block * 64;
+            }
+            else
+            {
+                blocks[i] =
+                    lane._tail.data() + (lane._block - lane._dataBlocks) * 64;
+            }
+        }
+        compress(state.data(), blocks.data());
+
+        for (size_t i = 0; i < Lanes; ++i)
+        {
+            BatchLane& lane = lanes[i];
+            if (lane._message == SIZE_MAX || ++lane._block < lane._blocks)
+            {
+                continue;
+            }
+
+            std::vector<unsigned char>& digest = digests[lane._message];
+            digest.clear();
+            digest.reserve(32);
+            for (size_t word = 0; word < 8; ++word)
+            {
+                const uint32_t value = state[word * 8 + i];
+                for (size_t j = 4; j > 0; --j)
+                {
+                    digest.push_back(
+                        static_cast<unsigned char>(value >> ((j - 1) * 8)));
+                }
+            }
+
+            if (next < messages.size())
+            {
+                startBatchLane(lane, next, messages[next], state.data(), i);
+                ++next;
+            }
+            else
+            {
+                lane._message = SIZE_MAX;
+                --active;
+            }
+        }
+    }
+}
+
+/// Digest transforms of the crypto backend, replaced by
+/// registerDigestTransforms().
+std::array<std::atomic<xmlSecTransformId>, 3> backendTransforms;
+
+size_t getAlgorithmIndex(DigestAlgorithm algorithm)
+{
+    return static_cast<size_t>(algorithm);
+}
+
+/// Uses a digest transform of the crypto backend, to compare with it.
+class TransformDigest : public Digest
+{
+  public:
+    static std::unique_ptr<Digest> create(xmlSecTransformId transformId);
+
+    void update(const unsigned char* data, size_t size) override;
+
+    bool finish(std::vector<unsigned char>& digest) override;
+
+  private:
+    std::unique_ptr<xmlSecTransformCtx> _transformCtx;
+    bool _good = true;
+};
+
+std::unique_ptr<Digest> TransformDigest::create(xmlSecTransformId transformId)
+{
+    auto digest = std::make_unique<TransformDigest>();
+    digest->_transformCtx.reset(xmlSecTransformCtxCreate());
+    if (!digest->_transformCtx)
+    {
+        return nullptr;
+    }
+
+    xmlSecTransformPtr transform = xmlSecTransformCtxCreateAndAppend(
+        digest->_transformCtx.get(), transformId);
+    if (transform == nullptr)
+    {
+        return nullptr;
+    }
+
+    transform->operation = xmlSecTransformOperationSign;
+    if (xmlSecTransformCtxPrepare(digest->_transformCtx.get(),
+                                  xmlSecTransformDataTypeBin) < 0)
+    {
+        return nullptr;
+    }
+
+    return digest;
+}
+
+void TransformDigest::update(const unsigned char* data, size_t size)
+{
+    if (_good && xmlSecTransformPushBin(_transformCtx->first, data,
+                                        static_cast<xmlSecSize>(size), 0,
+                                        _transformCtx.get()) < 0)
+    {
+        _good = false;
+    }
+}
+
+bool TransformDigest::finish(std::vector<unsigned char>& digest)
+{
+    if (!_good || xmlSecTransformPushBin(_transformCtx->first, nullptr, 0, 1,
+                                         _transformCtx.get()) < 0)
+    {
+        return false;
+    }
+
+    xmlSecBufferPtr result = _transformCtx->result;
+    digest.assign(xmlSecBufferGetData(result),
+                  xmlSecBufferGetData(result) + xmlSecBufferGetSize(result));
+    return true;
+}
+
+/// State of a digest transform, stored after the xmlSecTransform.
+struct DigestTransformData
+{
+    std::unique_ptr<Digest> _digest;
+    std::vector<unsigned char> _result;
+    /// The result is precomputed, the input is not hashed.
+    bool _precomputed = false;
+};
+
+DigestTransformData* getDigestTransformData(xmlSecTransformPtr transform)
+{
+    return std::launder(reinterpret_cast<DigestTransformData*>(
+        reinterpret_cast<unsigned char*>(transform) + sizeof(xmlSecTransform)));
+}
+
+int digestTransformInitialize(xmlSecTransformPtr transform)
+{
+    DigestTransformData* data =
+        new (reinterpret_cast<unsigned char*>(transform) +
+             sizeof(xmlSecTransform)) DigestTransformData;
+    DigestAlgorithm algorithm{};
+    if (!getDigestAlgorithm(transform->id->href, algorithm))
+    {
+        return -1;
+    }
+
+    data->_digest =
+        Digest::create(algorithm, Digest::getBestKernel(algorithm));
+    return data->_digest ? 0 : -1;
+}
+
+void digestTransformFinalize(xmlSecTransformPtr transform)
+{
+    getDigestTransformData(transform)->~DigestTransformData();
+}
+
+int digestTransformVerify(xmlSecTransformPtr transform, const xmlSecByte* data,
+                          xmlSecSize dataSize,
+                          xmlSecTransformCtxPtr /*transformCtx*/)
+{
+    if (transform->status != xmlSecTransformStatusFinished)
+    {
+        return -1;
+    }
+
+    const std::vector<unsigned char>& result =
+        getDigestTransformData(transform)->_result;
+    const bool equal = dataSize == result.size() &&
+                       std::equal(result.begin(), result.end(), data);
+    transform->status =
+        equal ? xmlSecTransformStatusOk : xmlSecTransformStatusFail;
+    return 0;
+}
+
+/// Identifies the digest of a whole stream, see getStreamTransform().
+struct StreamDigestKey
+{
+    std::string _uri;
+    std::string _transform;
+    DigestAlgorithm _algorithm{};
+};
+
+/// Returns false if the transform doesn't digest a whole stream.
+bool getStreamDigestKey(xmlSecTransformPtr transform,
+                        xmlSecTransformCtxPtr transformCtx,
+                        StreamDigestKey& key)
+{
+    if (transformCtx->uri == nullptr ||
+        !getStreamTransform(transform, key._transform) ||
+        !getDigestAlgorithm(transform->id->href, key._algorithm))
+    {
+        return false;
+    }
+
+    key._uri = reinterpret_cast<const char*>(transformCtx->uri);
+    return true;
+}
+
+/// Looks up the precomputed digest, if the transform digests a whole stream.
+const std::vector<unsigned char>*
+findPrecomputedDigest(xmlSecTransformPtr transform,
+                      xmlSecTransformCtxPtr transformCtx)
+{
+    const PrecomputedDigests* digests = PrecomputedDigests::getCurrent();
+    StreamDigestKey key;
+    if (digests == nullptr || !getStreamDigestKey(transform, transformCtx, key))
+    {
+        return nullptr;
+    }
+
+    return digests->find(key._uri, key._transform, key._algorithm);
+}
+
+/// Records the calculated digest, if the transform digests a whole stream.
+void recordDigest(xmlSecTransformPtr transform,
+                  xmlSecTransformCtxPtr transformCtx,
+                  const std::vector<unsigned char>& digest)
+{
+    const PrecomputedDigests* digests = PrecomputedDigests::getCurrent();
+    StreamDigestKey key;
+    if (digests == nullptr || !getStreamDigestKey(transform, transformCtx, key))
+    {
+        return;
+    }
+
+    digests->record(key._uri, key._transform, key._algorithm, digest);
+}
+
+int digestTransformExecute(xmlSecTransformPtr transform, int last,
+                           xmlSecTransformCtxPtr transformCtx)
+{
+    if (transform->status == xmlSecTransformStatusNone)
+    {
+        transform->status = xmlSecTransformStatusWorking;
+        const std::vector<unsigned char>* precomputed =
+            findPrecomputedDigest(transform, transformCtx);
+        if (precomputed != nullptr)
+        {
+            DigestTransformData* data = getDigestTransformData(transform);
+            data->_result = *precomputed;
+            data->_precomputed = true;
+        }
+    }
+
+    if (transform->status == xmlSecTransformStatusFinished)
+    {
+        // Nothing more to do, the input must be empty.
+        return xmlSecBufferGetSize(&transform->inBuf) == 0 ? 0 : -1;
+    }
+
+    if (transform->status != xmlSecTransformStatusWorking)
+    {
+        return -1;
+    }
+
+    DigestTransformData* data = getDigestTransformData(transform);
+    const xmlSecSize size = xmlSecBufferGetSize(&transform->inBuf);
+    if (size > 0)
+    {
+        if (!data->_precomputed)
+        {
+            data->_digest->update(xmlSecBufferGetData(&transform->inBuf),
+                                  size);
+        }
+        if (xmlSecBufferRemoveHead(&transform->inBuf, size) < 0)
+        {
+            return -1;
+        }
+    }
+
+    if (last == 0)
+    {
+        return 0;
+    }
+
+    if (!data->_precomputed)
+    {
+        if (!data->_digest->finish(data->_result))
+        {
+            return -1;
+        }
+
+        recordDigest(transform, transformCtx, data->_result);
+    }
+
+    if (transform->operation == xmlSecTransformOperationSign &&
+        xmlSecBufferAppend(&transform->outBuf, data->_result.data(),
+                           static_cast<xmlSecSize>(data->_result.size())) < 0)
+    {
+        return -1;
+    }
+
+    transform->status = xmlSecTransformStatusFinished;
+    return 0;
+}
+
+constexpr xmlSecTransformKlass
+createDigestTransformKlass(const xmlChar* name, const xmlChar* href)
+{
+    return xmlSecTransformKlass{
+        .klassSize = sizeof(xmlSecTransformKlass),
+        .objSize = sizeof(xmlSecTransform) + sizeof(DigestTransformData),
+        .name = name,
+        .href = href,
+        .usage = xmlSecTransformUsageDigestMethod,
+        .initialize = digestTransformInitialize,
+        .finalize = digestTransformFinalize,
+        .readNode = nullptr,
+        .writeNode = nullptr,
+        .setKeyReq = nullptr,
+        .setKey = nullptr,
+        .verify = digestTransformVerify,
+        .getDataType = xmlSecTransformDefaultGetDataType,
+        .pushBin = xmlSecTransformDefaultPushBin,
+        .popBin = xmlSecTransformDefaultPopBin,
+        .pushXml = nullptr,
+        .popXml = nullptr,
+        .execute = digestTransformExecute,
+        .reserved0 = nullptr,
+        .reserved1 = nullptr,
+    };
+}
+
+/// Indexed by DigestAlgorithm.
+const std::array<xmlSecTransformKlass, 3> digestTransformKlasses{
+    createDigestTransformKlass(xmlSecNameSha1, xmlSecHrefSha1),
+    createDigestTransformKlass(xmlSecNameSha256, xmlSecHrefSha256),
+    createDigestTransformKlass(xmlSecNameSha512, xmlSecHrefSha512),
+};
+
+DigestKernels getKernels(DigestKernel kernel)
+{
+    if (kernel == DigestKernel::Portable)
+    {
+        DigestKernels kernels;
+        kernels._sha1 = sha1CompressPortable;
+        kernels._sha256 = sha256CompressPortable;
+        kernels._sha512 = sha512CompressPortable;
+        return kernels;
+    }
+
+    return getCpuDigestKernels(kernel);
+}
+} // namespace
+
+bool getDigestAlgorithm(const xmlChar* href, DigestAlgorithm& algorithm)
+{
+    for (size_t i = 0; i < digestTransformKlasses.size(); ++i)
+    {
+        if (xmlStrEqual(href, digestTransformKlasses[i].href) != 0)
+        {
+            algorithm = static_cast<DigestAlgorithm>(i);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool getStreamTransform(xmlSecTransformPtr digestTransform,
+                        std::string& transform)
+{
+    xmlSecTransformPtr prev = digestTransform->prev;
+    transform.clear();
+    if (prev != nullptr && prev->id != xmlSecTransformInputURIId &&
+        (xmlStrEqual(prev->id->href, xmlSecHrefC14N) != 0 ||
+         xmlStrEqual(prev->id->href, xmlSecHrefC14NWithComments) != 0))
+    {
+        transform = reinterpret_cast<const char*>(prev->id->href);
+        prev = prev->prev;
+    }
+
+    return prev != nullptr && prev->id == xmlSecTransformInputURIId;
+}
+
+std::optional<std::vector<unsigned char>>
+StreamDigests::find(const std::string& uri, const std::string& transform,
+                    DigestAlgorithm algorithm) const
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _digests.find(std::make_tuple(uri, transform, algorithm));
+    if (it == _digests.end())
+    {
+        return {};
+    }
+
+    return it->second;
+}
+
+void StreamDigests::add(const std::string& uri, const std::string& transform,
+                        DigestAlgorithm algorithm,
+                        std::vector<unsigned char> digest)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _digests[std::make_tuple(uri, transform, algorithm)] = std::move(digest);
+}
+
+void StreamDigests::clear()
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _digests.clear();
+}
+
+thread_local const PrecomputedDigests* PrecomputedDigests::current;
+
+void PrecomputedDigests::add(const std::string& uri,
+                             const std::string& transform,
+                             DigestAlgorithm algorithm,
+                             std::vector<unsigned char> digest)
+{
+    _digests[uri] = Entry{transform, algorithm, std::move(digest)};
+}
+
+bool PrecomputedDigests::contains(const std::string& uri) const
+{
+    return _digests.find(uri) != _digests.end();
+}
+
+const std::vector<unsigned char>*
+PrecomputedDigests::find(const std::string& uri, const std::string& transform,
+                         DigestAlgorithm algorithm) const
+{
+    auto it = _digests.find(uri);
+    if (it == _digests.end() || it->second._transform != transform ||
+        it->second._algorithm != algorithm)
+    {
+        return nullptr;
+    }
+
+    return &it->second._digest;
+}
+
+void PrecomputedDigests::setStreamDigests(StreamDigests* streamDigests)
+{
+    _streamDigests = streamDigests;
+}
+
+void PrecomputedDigests::record(const std::string& uri,
+                                const std::string& transform,
+                                DigestAlgorithm algorithm,
+                                const std::vector<unsigned char>& digest) const
+{
+    if (_streamDigests != nullptr)
+    {
+        _streamDigests->add(uri, transform, algorithm, digest);
+    }
+}
+
+const PrecomputedDigests* PrecomputedDigests::getCurrent() { return current; }
+
+PrecomputedDigestsScope::PrecomputedDigestsScope(
+    const PrecomputedDigests* digests)
+    : _previous(PrecomputedDigests::current)
+{
+    PrecomputedDigests::current = digests;
+}
+
+PrecomputedDigestsScope::~PrecomputedDigestsScope()
+{
+    PrecomputedDigests::current = _previous;
+}
+
+void registerDigestTransforms()
+{
+    xmlSecPtrListPtr transformIds = xmlSecTransformIdsGet();
+    const xmlSecSize size = xmlSecPtrListGetSize(transformIds);
+    for (xmlSecSize i = 0; i < size; ++i)
+    {
+        auto transformId = static_cast<xmlSecTransformId>(
+            xmlSecPtrListGetItem(transformIds, i));
+        if (transformId == nullptr ||
+            (transformId->usage & xmlSecTransformUsageDigestMethod) == 0)
+        {
+            continue;
+        }
+
+        DigestAlgorithm algorithm{};
+        if (!getDigestAlgorithm(transformId->href, algorithm))
+        {
+            continue;
+        }
+
+        const size_t index = getAlgorithmIndex(algorithm);
+        if (transformId == &digestTransformKlasses[index])
+        {
+            continue;
+        }
+
+        // Replace in place, so lookups by href find this one.
+        backendTransforms[index] = transformId;
+        xmlSecPtrListSet(transformIds,
+                         const_cast<void*>(static_cast<const void*>(
+                             &digestTransformKlasses[index])),
+                         i);
+    }
+}
+
+std::unique_ptr<Digest> Digest::create(DigestAlgorithm algorithm,
+                                       DigestKernel kernel)
+{
+    if (kernel == DigestKernel::Backend)
+    {
+        xmlSecTransformId transformId =
+            backendTransforms[getAlgorithmIndex(algorithm)];
+        if (transformId == nullptr)
+        {
+            return nullptr;
+        }
+
+        return TransformDigest::create(transformId);
+    }
+
+    const DigestKernels kernels = getKernels(kernel);
+    switch (algorithm)
+    {
+    case DigestAlgorithm::Sha1:
+        if (kernels._sha1 == nullptr)
+        {
+            return nullptr;
+        }
+        return std::make_unique<ShaDigest<uint32_t, 5, 5>>(kernels._sha1,
+                                                           sha1InitialState);
+    case DigestAlgorithm::Sha256:
+        if (kernels._sha256 == nullptr)
+        {
+            return nullptr;
+        }
+        return std::make_unique<ShaDigest<uint32_t, 8, 8>>(kernels._sha256,
+                                                           sha256InitialState);
+    case DigestAlgorithm::Sha512:
+        if (kernels._sha512 == nullptr)
+        {
+            return nullptr;
+        }
+        return std::make_unique<ShaDigest<uint64_t, 8, 8>>(kernels._sha512,
+                                                           sha512InitialState);
+    }
+
+    return nullptr;
+}
+
+DigestKernel Digest::getBestKernel(DigestAlgorithm algorithm)
+{
+    // Checked once, the CPU does not change.
+    static const std::array<DigestKernels, 2> cpuKernels{
+        getCpuDigestKernels(DigestKernel::ShaNi),
+        getCpuDigestKernels(DigestKernel::Avx2),
+    };
+    static const std::array<DigestKernel, 2> kernels{DigestKernel::ShaNi,
+                                                     DigestKernel::Avx2};
+    for (size_t i = 0; i < kernels.size(); ++i)
+    {
+        const DigestKernels& cpu = cpuKernels[i];
+        switch (algorithm)
+        {
+        case DigestAlgorithm::Sha1:
+            if (cpu._sha1 != nullptr)
+            {
+                return kernels[i];
+            }
+            break;
+        case DigestAlgorithm::Sha256:
+            if (cpu._sha256 != nullptr)
+            {
+                return kernels[i];
+            }
+            break;
+        case DigestAlgorithm::Sha512:
+            if (cpu._sha512 != nullptr)
+            {
+                return kernels[i];
+            }
+            break;
+        }
+    }
+
+    return DigestKernel::Portable;
+}
+
+bool Digest::hashBatch(DigestAlgorithm algorithm, DigestKernel kernel,
+                       const std::vector<std::vector<unsigned char>>& messages,
+                       std::vector<std::vector<unsigned char>>& digests)
+{
+    digests.resize(messages.size());
+    if (algorithm == DigestAlgorithm::Sha256 && kernel != DigestKernel::Backend)
+    {
+        const DigestKernels kernels = getKernels(kernel);
+        if (kernels._sha256x8 != nullptr)
+        {
+            hashBatchSha256x8(kernels._sha256x8, messages, digests);
+            return true;
+        }
+    }
+
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        std::unique_ptr<Digest> digest = create(algorithm, kernel);
+        if (!digest)
+        {
+            return false;
+        }
+
+        digest->update(messages[i].data(), messages[i].size());
+        if (!digest->finish(digests[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+DigestKernel Digest::getBestBatchKernel(DigestAlgorithm algorithm)
+{
+    // The SHA extensions are faster even compared to 8 lanes of AVX2.
+    const DigestKernel kernel = getBestKernel(algorithm);
+    if (kernel == DigestKernel::ShaNi || algorithm != DigestAlgorithm::Sha256)
+    {
+        return kernel;
+    }
+
+    static const bool multiBuffer =
+        getCpuDigestKernels(DigestKernel::Avx2)._sha256x8 != nullptr;
+    return multiBuffer ? DigestKernel::Avx2 : kernel;
+}
+
+std::string Digest::getKernelName(DigestKernel kernel)
+{
+    switch (kernel)
+    {
+    case DigestKernel::Backend:
+        return "backend";
+    case DigestKernel::Portable:
+        return "portable";
+    case DigestKernel::Avx2:
+        return "avx2";
+    case DigestKernel::ShaNi:
+        return "sha-ni";
+    }
+
+    return std::string();
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,273 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <libxml/xmlstring.h>
+#include <xmlsec/transforms.h>
+
+#include <odfsig/digest.hxx>
+
+namespace odfsig
+{
+/// Processes blocks * 64 bytes of data, SHA-1 and SHA-256.
+using Compress32 = void (*)(uint32_t* state, const unsigned char* data,
+                            size_t blocks);
+
+/// Processes blocks * 128 bytes of data, SHA-512.
+using Compress64 = void (*)(uint64_t* state, const unsigned char* data,
+                            size_t blocks);
+
+/**
+ * Processes one 64 bytes block of 8 independent SHA-256 messages. The state
+ * is word-major: state[word * 8 + lane].
+ */
+using Compress32x8 = void (*)(uint32_t* state,
+                              const unsigned char* const* blocks);
+
+/// Compression functions of a kernel, nullptr if not implemented.
+struct DigestKernels
+{
+    Compress32 _sha1 = nullptr;
+    Compress32 _sha256 = nullptr;
+    Compress64 _sha512 = nullptr;
+    Compress32x8 _sha256x8 = nullptr;
+};
+
+extern const std::array<uint32_t, 64> sha256RoundConstants;
+
+extern const std::array<uint64_t, 80> sha512RoundConstants;
+
+inline uint32_t loadBigEndian32(const unsigned char* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) |
+           (static_cast<uint32_t>(data[1]) << 16) |
+           (static_cast<uint32_t>(data[2]) << 8) |
+           static_cast<uint32_t>(data[3]);
+}
+
+inline uint64_t loadBigEndian64(const unsigned char* data)
+{
+    return (static_cast<uint64_t>(loadBigEndian32(data)) << 32) |
+           loadBigEndian32(data + 4);
+}
+
+/// One round of SHA-256, the caller rotates the roles of the variables.
+inline void sha256Round(uint32_t a, uint32_t b, uint32_t c, uint32_t& d,
+                        uint32_t e, uint32_t f, uint32_t g, uint32_t& h,
+                        uint32_t kw)
+{
+    const uint32_t t1 = h + (std::rotr(e, 6) ^ std::rotr(e, 11) ^
+                             std::rotr(e, 25)) +
+                        (g ^ (e & (f ^ g))) + kw;
+    d += t1;
+    h = t1 + (std::rotr(a, 2) ^ std::rotr(a, 13) ^ std::rotr(a, 22)) +
+        ((a & b) | (c & (a | b)));
+}
+
+/// The 64 rounds of SHA-256 on one block, w is its message schedule.
+inline void sha256Rounds(uint32_t* state, const uint32_t* w)
+{
+    uint32_t a = state[0];
+    uint32_t b = state[1];
+    uint32_t c = state[2];
+    uint32_t d = state[3];
+    uint32_t e = state[4];
+    uint32_t f = state[5];
+    uint32_t g = state[6];
+    uint32_t h = state[7];
+    const uint32_t* k = sha256RoundConstants.data();
+    for (size_t t = 0; t < 64; t += 8)
+    {
+        sha256Round(a, b, c, d, e, f, g, h, k[t] + w[t]);
+        sha256Round(h, a, b, c, d, e, f, g, k[t + 1] + w[t + 1]);
+        sha256Round(g, h, a, b, c, d, e, f, k[t + 2] + w[t + 2]);
+        sha256Round(f, g, h, a, b, c, d, e, k[t + 3] + w[t + 3]);
+        sha256Round(e, f, g, h, a, b, c, d, k[t + 4] + w[t + 4]);
+        sha256Round(d, e, f, g, h, a, b, c, k[t + 5] + w[t + 5]);
+        sha256Round(c, d, e, f, g, h, a, b, k[t + 6] + w[t + 6]);
+        sha256Round(b, c, d, e, f, g, h, a, k[t + 7] + w[t + 7]);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/// One round of SHA-512, the caller rotates the roles of the variables.
+inline void sha512Round(uint64_t a, uint64_t b, uint64_t c, uint64_t& d,
+                        uint64_t e, uint64_t f, uint64_t g, uint64_t& h,
+                        uint64_t kw)
+{
+    const uint64_t t1 = h + (std::rotr(e, 14) ^ std::rotr(e, 18) ^
+                             std::rotr(e, 41)) +
+                        (g ^ (e & (f ^ g))) + kw;
+    d += t1;
+    h = t1 + (std::rotr(a, 28) ^ std::rotr(a, 34) ^ std::rotr(a, 39)) +
+        ((a & b) | (c & (a | b)));
+}
+
+/// The 80 rounds of SHA-512 on one block, w is its message schedule.
+inline void sha512Rounds(uint64_t* state, const uint64_t* w)
+{
+    uint64_t a = state[0];
+    uint64_t b = state[1];
+    uint64_t c = state[2];
+    uint64_t d = state[3];
+    uint64_t e = state[4];
+    uint64_t f = state[5];
+    uint64_t g = state[6];
+    uint64_t h = state[7];
+    const uint64_t* k = sha512RoundConstants.data();
+    for (size_t t = 0; t < 80; t += 8)
+    {
+        sha512Round(a, b, c, d, e, f, g, h, k[t] + w[t]);
+        sha512Round(h, a, b, c, d, e, f, g, k[t + 1] + w[t + 1]);
+        sha512Round(g, h, a, b, c, d, e, f, k[t + 2] + w[t + 2]);
+        sha512Round(f, g, h, a, b, c, d, e, k[t + 3] + w[t + 3]);
+        sha512Round(e, f, g, h, a, b, c, d, k[t + 4] + w[t + 4]);
+        sha512Round(d, e, f, g, h, a, b, c, k[t + 5] + w[t + 5]);
+        sha512Round(c, d, e, f, g, h, a, b, k[t + 6] + w[t + 6]);
+        sha512Round(b, c, d, e, f, g, h, a, k[t + 7] + w[t + 7]);
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+/**
+ * Returns the CPU specific kernels, if the CPU supports them. Implemented in
+ * digest-x86.cxx or digest-generic.cxx.
+ */
+DigestKernels getCpuDigestKernels(DigestKernel kernel);
+
+/// Maps an xmlsec digest method href to an algorithm.
+bool getDigestAlgorithm(const xmlChar* href, DigestAlgorithm& algorithm);
+
+/**
+ * Returns the transform between the stream and the digest transform: an empty
+ * string if the stream is digested as-is, or the href of an inclusive C14N
+ * transform. Returns false for other chains.
+ */
+bool getStreamTransform(xmlSecTransformPtr digestTransform,
+                        std::string& transform);
+
+/**
+ * Digests of whole streams in one document, shared by its signatures, e.g. a
+ * document and a macro signature both sign the scripts. Thread-safe.
+ */
+class StreamDigests
+{
+  public:
+    /// transform is as in getStreamTransform().
+    [[nodiscard]] std::optional<std::vector<unsigned char>>
+    find(const std::string& uri, const std::string& transform,
+         DigestAlgorithm algorithm) const;
+
+    void add(const std::string& uri, const std::string& transform,
+             DigestAlgorithm algorithm, std::vector<unsigned char> digest);
+
+    void clear();
+
+  private:
+    mutable std::mutex _mutex;
+
+    std::map<std::tuple<std::string, std::string, DigestAlgorithm>,
+             std::vector<unsigned char>>
+        _digests;
+};
+
+/**
+ * Digests of whole streams, calculated in advance, e.g. by a batch. While it's
+ * the current one, XmlSecIO gives an empty stream for these URIs, the C14N
+ * transforms don't parse it and the digest transforms use the precomputed
+ * digest instead. Digests calculated by the digest transforms are recorded in
+ * the stream digests of the document.
+ */
+class PrecomputedDigests
+{
+  public:
+    void add(const std::string& uri, const std::string& transform,
+             DigestAlgorithm algorithm, std::vector<unsigned char> digest);
+
+    [[nodiscard]] bool contains(const std::string& uri) const;
+
+    [[nodiscard]] const std::vector<unsigned char>*
+    find(const std::string& uri, const std::string& transform,
+         DigestAlgorithm algorithm) const;
+
+    void setStreamDigests(StreamDigests* streamDigests);
+
+    /// Remembers a digest calculated during verification, if possible.
+    void record(const std::string& uri, const std::string& transform,
+                DigestAlgorithm algorithm,
+                const std::vector<unsigned char>& digest) const;
+
+    /// The digests of the verification running on the current thread.
+    static const PrecomputedDigests* getCurrent();
+
+  private:
+    friend class PrecomputedDigestsScope;
+
+    struct Entry
+    {
+        std::string _transform;
+        DigestAlgorithm _algorithm;
+        std::vector<unsigned char> _digest;
+    };
+
+    std::unordered_map<std::string, Entry> _digests;
+
+    StreamDigests* _streamDigests = nullptr;
+
+    static thread_local const PrecomputedDigests* current;
+};
+
+/// Makes some precomputed digests the current ones on the current thread.
+class PrecomputedDigestsScope
+{
+  public:
+    explicit PrecomputedDigestsScope(const PrecomputedDigests* digests);
+
+    ~PrecomputedDigestsScope();
+
+    PrecomputedDigestsScope(const PrecomputedDigestsScope&) = delete;
+    PrecomputedDigestsScope& operator=(const PrecomputedDigestsScope&) = delete;
+
+  private:
+    const PrecomputedDigests* _previous;
+};
+
+/**
+ * Replaces the SHA-1, SHA-256 and SHA-512 transforms of the xmlsec crypto
+ * backend with ones using the best kernel. Call after the crypto backend of
+ * xmlsec is initialized.
+ */
+void registerDigestTransforms();
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,69 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "inflate.hxx"
+
+#include <utility>
+
+#include <libdeflate.h>
+
+namespace std
+{
+template <> struct default_delete<libdeflate_decompressor>
+{
+    void operator()(libdeflate_decompressor* ptr)
+    {
+        libdeflate_free_decompressor(ptr);
+    }
+};
+} // namespace std
+
+namespace odfsig::zip
+{
+/// Inflater using libdeflate, which is faster than zlib for whole buffers.
+class LibdeflateInflater : public Inflater
+{
+  public:
+    explicit LibdeflateInflater(
+        std::unique_ptr<libdeflate_decompressor> decompressor);
+
+    bool inflate(const unsigned char* input, size_t inputSize,
+                 unsigned char* output, size_t size) override;
+
+  private:
+    std::unique_ptr<libdeflate_decompressor> _decompressor;
+};
+
+LibdeflateInflater::LibdeflateInflater(
+    std::unique_ptr<libdeflate_decompressor> decompressor)
+    : _decompressor(std::move(decompressor))
+{
+}
+
+bool LibdeflateInflater::inflate(const unsigned char* input, size_t inputSize,
+                                 unsigned char* output, size_t size)
+{
+    size_t actualSize = 0;
+    return libdeflate_deflate_decompress(_decompressor.get(), input,
+                                         inputSize, output, size,
+                                         &actualSize) == LIBDEFLATE_SUCCESS &&
+           actualSize == size;
+}
+
+std::unique_ptr<Inflater> Inflater::create()
+{
+    std::unique_ptr<libdeflate_decompressor> decompressor(
+        libdeflate_alloc_decompressor());
+    if (!decompressor)
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<LibdeflateInflater>(std::move(decompressor));
+}
+} // namespace odfsig::zip
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
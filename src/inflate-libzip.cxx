@@ -0,0 +1,18 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "inflate.hxx"
+
+namespace odfsig::zip
+{
+std::unique_ptr<Inflater> Inflater::create()
+{
+    // Streams are decompressed by libzip, as they are read.
+    return nullptr;
+}
+} // namespace odfsig::zip
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
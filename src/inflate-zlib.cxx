@@ -0,0 +1,83 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "inflate.hxx"
+
+#include <limits>
+
+#include <zlib.h>
+
+namespace odfsig::zip
+{
+/// Inflater using zlib, the z_stream is reused between entries.
+class ZlibInflater : public Inflater
+{
+  public:
+    ZlibInflater();
+
+    ~ZlibInflater() override;
+
+    ZlibInflater(const ZlibInflater&) = delete;
+    ZlibInflater& operator=(const ZlibInflater&) = delete;
+
+    bool inflate(const unsigned char* input, size_t inputSize,
+                 unsigned char* output, size_t size) override;
+
+    [[nodiscard]] bool isValid() const;
+
+  private:
+    z_stream _stream{};
+    bool _valid = false;
+};
+
+ZlibInflater::ZlibInflater()
+{
+    // Negative window bits: raw deflate, ZIP has no zlib header.
+    _valid = inflateInit2(&_stream, -MAX_WBITS) == Z_OK;
+}
+
+ZlibInflater::~ZlibInflater()
+{
+    if (_valid)
+    {
+        inflateEnd(&_stream);
+    }
+}
+
+bool ZlibInflater::inflate(const unsigned char* input, size_t inputSize,
+                           unsigned char* output, size_t size)
+{
+    if (inputSize > std::numeric_limits<uInt>::max() ||
+        size > std::numeric_limits<uInt>::max() ||
+        inflateReset(&_stream) != Z_OK)
+    {
+        return false;
+    }
+
+    _stream.next_in = const_cast<Bytef*>(input);
+    _stream.avail_in = static_cast<uInt>(inputSize);
+    _stream.next_out = output;
+    _stream.avail_out = static_cast<uInt>(size);
+    // All output fits, so this is a single call.
+    return ::inflate(&_stream, Z_FINISH) == Z_STREAM_END &&
+           _stream.avail_out == 0;
+}
+
+bool ZlibInflater::isValid() const { return _valid; }
+
+std::unique_ptr<Inflater> Inflater::create()
+{
+    auto inflater = std::make_unique<ZlibInflater>();
+    if (!inflater->isValid())
+    {
+        return nullptr;
+    }
+
+    return inflater;
+}
+} // namespace odfsig::zip
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,36 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace odfsig::zip
+{
+/**
+ * Decompresses a whole raw deflate stream in one call, when the size of the
+ * result is known from the central directory.
+ */
+class Inflater
+{
+  public:
+    virtual ~Inflater() = default;
+
+    /// Fails if the data is corrupt or doesn't decompress to exactly size.
+    virtual bool inflate(const unsigned char* input, size_t inputSize,
+                         unsigned char* output, size_t size) = 0;
+
+    /**
+     * Factory for this interface, implemented in inflate-zlib.cxx,
+     * inflate-libdeflate.cxx or inflate-libzip.cxx. Returns nullptr if
+     * streams are only decompressed by libzip.
+     */
+    static std::unique_ptr<Inflater> create();
+};
+} // namespace odfsig::zip
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -7,31 +7,60 @@
 #include <odfsig/lib.hxx>
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <cctype>
+#include <chrono>
+#include <climits>
 #include <cstdint>
 #include <cstring>
+#include <filesystem>
 #include <fstream>
+#include <ios>
 #include <iterator>
+#include <list>
+#include <map>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <set>
 #include <sstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
+#include <libxml/c14n.h>
+#include <libxml/dict.h>
+#include <libxml/SAX2.h>
 #include <libxml/parser.h>
 #include <libxml/xmlmemory.h>
 #include <libxml/xmlstring.h>
 #include <libxml/xmlversion.h>
-#include <xmlsec/base64.h>
 #include <xmlsec/buffer.h>
 #include <xmlsec/io.h>
 #include <xmlsec/keyinfo.h>
+#include <xmlsec/keys.h>
 #include <xmlsec/keysmngr.h>
+#include <xmlsec/list.h>
 #include <xmlsec/strings.h>
 #include <xmlsec/transforms.h>
 #include <xmlsec/xmldsig.h>
 #include <xmlsec/xmlsec.h>
 #include <xmlsec/xmltree.h>
 
+#include <odfsig/base64.hxx>
+#include <odfsig/crc32.hxx>
 #include <odfsig/crypto.hxx>
 
+#include "c14n.hxx"
+#include "digest.hxx"
+#include "prefetcher.hxx"
+#include "truststore.hxx"
+#include "verdictstore.hxx"
 #include "zip.hxx"
 
 namespace std
@@ -40,10 +69,34 @@ template <> struct default_delete<xmlDoc>
 {
     void operator()(xmlDocPtr ptr) { xmlFreeDoc(ptr); }
 };
+template <> struct default_delete<xmlParserCtxt>
+{
+    void operator()(xmlParserCtxtPtr ptr)
+    {
+        // Same as in c14n.cxx.
+        xmlFreeDoc(ptr->myDoc);
+        xmlFreeParserCtxt(ptr);
+    }
+};
 template <> struct default_delete<xmlSecDSigCtx>
 {
     void operator()(xmlSecDSigCtxPtr ptr) { xmlSecDSigCtxDestroy(ptr); }
 };
+template <> struct default_delete<xmlSecKey>
+{
+    void operator()(xmlSecKeyPtr ptr) { xmlSecKeyDestroy(ptr); }
+};
+template <> struct default_delete<xmlSecDSigReferenceCtx>
+{
+    void operator()(xmlSecDSigReferenceCtxPtr ptr)
+    {
+        xmlSecDSigReferenceCtxDestroy(ptr);
+    }
+};
+template <> struct default_delete<xmlOutputBuffer>
+{
+    void operator()(xmlOutputBufferPtr ptr) { xmlOutputBufferClose(ptr); }
+};
 template <> struct default_delete<xmlSecKeysMngr>
 {
     void operator()(xmlSecKeysMngrPtr ptr) { xmlSecKeysMngrDestroy(ptr); }
@@ -67,6 +120,18 @@ const xmlChar* dateNodeName = BAD_CAST("date");
 const xmlChar* dateNsName = BAD_CAST("http://purl.org/dc/elements/1.1/");
 const xmlChar* xadesNsName = BAD_CAST("http://uri.etsi.org/01903/v1.3.2#");
 const char* signaturesStreamName = "META-INF/documentsignatures.xml";
+const char* macroSignaturesStreamName = "META-INF/macrosignatures.xml";
+/// Storages signed by macro signatures.
+const std::array<const char*, 3> macroStorageNames{"Basic/", "Dialogs/",
+                                                    "Scripts/"};
+/// Larger streams are not worth keeping in memory for a batched digest.
+const uint64_t maxBatchedStreamSize = 64 * 1024;
+/// Smaller signed content is read faster than a thread is started.
+const uint64_t minPrefetchedSize = 256 * 1024;
+/// Default limit of the data read ahead by a prefetcher.
+const size_t defaultPrefetchMemory = 16 * 1024 * 1024;
+/// Smaller entries are not checked against the compression ratio limit.
+const uint64_t minRatioCheckedSize = 64 * 1024;
 
 /// Checks if `big` ends with `suffix`.
 bool ends_with(const std::string& big, const std::string& suffix)
@@ -80,6 +145,89 @@ const char* fromXmlChar(const xmlChar* string)
 {
     return reinterpret_cast<const char*>(string);
 }
+
+/// Element nesting depth limit of a parser context, tracked while parsing.
+struct ParserDepthLimit
+{
+    /// 0 means no limit.
+    uint64_t _maxDepth = 0;
+    uint64_t _depth = 0;
+    bool _exceeded = false;
+};
+
+/// SAX start element handler, stops the parser above the depth limit, so a
+/// deeply nested stream is not built into a tree.
+void startElementLimited(void* context, const xmlChar* localName,
+                         const xmlChar* prefix, const xmlChar* uri,
+                         int namespaceCount, const xmlChar** namespaces,
+                         int attributeCount, int defaultedCount,
+                         const xmlChar** attributes)
+{
+    auto parserContext = static_cast<xmlParserCtxtPtr>(context);
+    auto limit = static_cast<ParserDepthLimit*>(parserContext->_private);
+    if (limit->_maxDepth > 0 && ++limit->_depth > limit->_maxDepth)
+    {
+        limit->_exceeded = true;
+        xmlStopParser(parserContext);
+        return;
+    }
+
+    xmlSAX2StartElementNs(context, localName, prefix, uri, namespaceCount,
+                          namespaces, attributeCount, defaultedCount,
+                          attributes);
+}
+
+/// SAX end element handler, see startElementLimited().
+void endElementLimited(void* context, const xmlChar* localName,
+                       const xmlChar* prefix, const xmlChar* uri)
+{
+    auto parserContext = static_cast<xmlParserCtxtPtr>(context);
+    auto limit = static_cast<ParserDepthLimit*>(parserContext->_private);
+    if (limit->_maxDepth > 0)
+    {
+        --limit->_depth;
+    }
+
+    xmlSAX2EndElementNs(context, localName, prefix, uri);
+}
+
+/**
+ * Returns the transform of a reference to a stream like getStreamTransform():
+ * an empty string if it has no transforms, the href of a sole inclusive C14N
+ * transform, or false for other transforms.
+ */
+bool getReferenceTransform(xmlNode* referenceNode, std::string& transform)
+{
+    transform.clear();
+    xmlNode* transformsNode =
+        xmlSecFindChild(referenceNode, xmlSecNodeTransforms, xmlSecDSigNs);
+    if (transformsNode == nullptr)
+    {
+        return true;
+    }
+
+    xmlNode* transformNode = xmlSecGetNextElementNode(transformsNode->children);
+    if (transformNode == nullptr ||
+        xmlSecCheckNodeName(transformNode, xmlSecNodeTransform,
+                            xmlSecDSigNs) == 0 ||
+        xmlSecGetNextElementNode(transformNode->children) != nullptr ||
+        xmlSecGetNextElementNode(transformNode->next) != nullptr)
+    {
+        return false;
+    }
+
+    const std::unique_ptr<xmlChar> algorithm(
+        xmlGetProp(transformNode, xmlSecAttrAlgorithm));
+    if (!algorithm || (xmlStrEqual(algorithm.get(), xmlSecHrefC14N) == 0 &&
+                       xmlStrEqual(algorithm.get(),
+                                   xmlSecHrefC14NWithComments) == 0))
+    {
+        return false;
+    }
+
+    transform = fromXmlChar(algorithm.get());
+    return true;
+}
 } // namespace
 
 namespace odfsig
@@ -99,15 +247,75 @@ class XmlGuard
 
 namespace
 {
+/// Cancel request and deadline of a verifier, checked while verifying.
+class Cancellation
+{
+  public:
+    void cancel() { _cancelled = true; }
+
+    /// Forgets the cancel request and the deadline.
+    void reset()
+    {
+        _cancelled = false;
+        _deadline = std::chrono::steady_clock::duration::max().count();
+    }
+
+    void setDeadline(std::chrono::steady_clock::time_point deadline)
+    {
+        _deadline = deadline.time_since_epoch().count();
+    }
+
+    /// Returns why verification has to stop, or nullptr.
+    [[nodiscard]] const char* getStopReason() const
+    {
+        if (_cancelled)
+        {
+            return "Verification cancelled";
+        }
+
+        if (std::chrono::steady_clock::now().time_since_epoch().count() >=
+            _deadline)
+        {
+            return "Verification timed out";
+        }
+
+        return nullptr;
+    }
+
+  private:
+    std::atomic<bool> _cancelled{false};
+
+    std::atomic<std::chrono::steady_clock::rep> _deadline{
+        std::chrono::steady_clock::duration::max().count()};
+};
+
 /// Provides libxmlsec IO callbacks.
 namespace XmlSecIO
 {
-/// All callbacks work on this zip package.
+/// All callbacks work on this zip package, see XmlSecIOScope.
 thread_local zip::Archive* zipArchive;
 
+/// Reads fail once this requests a stop, optional.
+thread_local const Cancellation* cancellation;
+
+/// Streams read ahead from zipArchive, optional.
+thread_local Prefetcher* prefetcher;
+
+/// Stream with a precomputed digest, its content is not needed.
+class EmptyFile : public zip::File
+{
+  public:
+    int64_t read(void* /*buffer*/, uint64_t /*length*/) override { return 0; }
+
+    std::string getErrorString() override { return std::string(); }
+};
+
 int match(const char* uri)
 {
-    assert(zipArchive);
+    if (zipArchive == nullptr)
+    {
+        return 0;
+    }
 
     const int64_t signatureZipIndex = zipArchive->locateName(uri);
     if (signatureZipIndex < 0)
@@ -122,6 +330,22 @@ void* open(const char* uri)
 {
     assert(zipArchive);
 
+    const PrecomputedDigests* precomputedDigests =
+        PrecomputedDigests::getCurrent();
+    if (precomputedDigests != nullptr && precomputedDigests->contains(uri))
+    {
+        return std::make_unique<EmptyFile>().release();
+    }
+
+    if (prefetcher != nullptr)
+    {
+        std::unique_ptr<zip::File> prefetchedFile = prefetcher->open(uri);
+        if (prefetchedFile != nullptr)
+        {
+            return prefetchedFile.release();
+        }
+    }
+
     const int64_t signatureZipIndex = zipArchive->locateName(uri);
     if (signatureZipIndex < 0)
     {
@@ -143,6 +367,11 @@ int read(void* context, char* buffer, int len)
     auto* zipFile = static_cast<zip::File*>(context);
     assert(zipFile);
 
+    if (cancellation != nullptr && cancellation->getStopReason() != nullptr)
+    {
+        return -1;
+    }
+
     return static_cast<int>(zipFile->read(buffer, len));
 }
 
@@ -154,14 +383,59 @@ int close(void* context)
     return 0;
 }
 }; // namespace XmlSecIO
+
+/**
+ * Binds the libxmlsec IO callbacks to a zip package on the current thread,
+ * optionally with a prefetcher of its streams and a cancellation.
+ */
+class XmlSecIOScope
+{
+  public:
+    explicit XmlSecIOScope(zip::Archive* zipArchive,
+                           Prefetcher* prefetcher = nullptr,
+                           const Cancellation* cancellation = nullptr)
+        : _previous(XmlSecIO::zipArchive),
+          _previousPrefetcher(XmlSecIO::prefetcher),
+          _previousCancellation(XmlSecIO::cancellation)
+    {
+        XmlSecIO::zipArchive = zipArchive;
+        XmlSecIO::prefetcher = prefetcher;
+        XmlSecIO::cancellation = cancellation;
+    }
+
+    ~XmlSecIOScope()
+    {
+        XmlSecIO::zipArchive = _previous;
+        XmlSecIO::prefetcher = _previousPrefetcher;
+        XmlSecIO::cancellation = _previousCancellation;
+    }
+
+    XmlSecIOScope(const XmlSecIOScope&) = delete;
+    XmlSecIOScope& operator=(const XmlSecIOScope&) = delete;
+
+  private:
+    zip::Archive* _previous;
+    Prefetcher* _previousPrefetcher;
+    const Cancellation* _previousCancellation;
+};
+
+std::atomic<uint64_t> certificateCacheHits;
+std::atomic<uint64_t> certificateCacheMisses;
+std::atomic<uint64_t> chainCacheHits;
+std::atomic<uint64_t> chainCacheMisses;
+std::atomic<uint64_t> verdictStoreHits;
+std::atomic<uint64_t> verdictStoreMisses;
+std::atomic<uint64_t> streamDigestHits;
+std::atomic<uint64_t> streamDigestMisses;
+
+const std::chrono::seconds defaultChainCacheTtl(300);
 };
 
 /// Performs libxmlsec init/deinit.
 class XmlSecGuard
 {
   public:
-    explicit XmlSecGuard(zip::Archive* zipArchive, Crypto& crypto)
-        : _crypto(crypto)
+    explicit XmlSecGuard(Crypto& crypto) : _crypto(crypto)
     {
         // Initialize xmlsec.
         _good = xmlSecInit() >= 0;
@@ -175,7 +449,9 @@ class XmlSecGuard
             return;
         }
 
-        XmlSecIO::zipArchive = zipArchive;
+        registerDigestTransforms();
+        registerC14NTransforms();
+
         xmlSecIOCleanupCallbacks();
         xmlSecIORegisterCallbacks(XmlSecIO::match, XmlSecIO::open,
                                   XmlSecIO::read, XmlSecIO::close);
@@ -190,7 +466,6 @@ class XmlSecGuard
 
         xmlSecIOCleanupCallbacks();
         xmlSecIORegisterDefaultCallbacks();
-        XmlSecIO::zipArchive = nullptr;
 
         if (!_crypto.xmlSecShutdown())
         {
@@ -216,165 +491,1896 @@ class XmlSecGuard
     Crypto& _crypto;
 };
 
-/// Implementation of Signature using libxml.
-class XmlSignature : public Signature
+/// Owns a keys manager and signature contexts using it, so verifying a
+/// signature doesn't have to create and initialize new ones.
+class SignatureContextPool
 {
   public:
-    explicit XmlSignature(xmlNode* signatureNode, Crypto& crypto,
-                          std::vector<std::string> trustedDers, bool insecure);
-    ~XmlSignature() override;
+    SignatureContextPool(Crypto& crypto, const TrustStore& trustStore);
 
-    [[nodiscard]] const std::string& getErrorString() const override;
+    /**
+     * Hands out an initialized signature context, the caller has exclusive
+     * access to it till checkin(). Returns nullptr on failure, and sets
+     * errorString.
+     */
+    std::unique_ptr<xmlSecDSigCtx> checkout(bool insecure,
+                                            std::string& errorString);
 
-    bool verify() override;
+    /// Resets a checked out context and makes it available for reuse.
+    void checkin(std::unique_ptr<xmlSecDSigCtx> signatureContext);
 
-    bool verifyXAdES() override;
+  private:
+    static void reset(xmlSecDSigCtx* signatureContext);
 
-    [[nodiscard]] std::string getSubjectName() const override;
+    Crypto& _crypto;
 
-    [[nodiscard]] std::string getDate() const override;
+    const TrustStore& _trustStore;
 
-    [[nodiscard]] std::string getMethod() const override;
+    std::mutex _mutex;
 
-    [[nodiscard]] std::string getType() const override;
+    std::unique_ptr<xmlSecKeysMngr> _keysManager;
 
-    [[nodiscard]] std::set<std::string> getSignedStreams() const override;
+    std::vector<std::unique_ptr<xmlSecDSigCtx>> _signatureContexts;
+};
 
-  private:
-    static std::string getObjectDate(xmlNode* objectNode);
+SignatureContextPool::SignatureContextPool(Crypto& crypto,
+                                           const TrustStore& trustStore)
+    : _crypto(crypto), _trustStore(trustStore)
+{
+}
 
-    static std::string
-    getSignaturePropertiesDate(xmlNode* signaturePropertiesNode);
+std::unique_ptr<xmlSecDSigCtx>
+SignatureContextPool::checkout(bool insecure, std::string& errorString)
+{
+    std::unique_ptr<xmlSecDSigCtx> dsigCtx;
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        if (!_signatureContexts.empty())
+        {
+            dsigCtx = std::move(_signatureContexts.back());
+            _signatureContexts.pop_back();
+        }
+        else
+        {
+            if (!_keysManager)
+            {
+                std::unique_ptr<xmlSecKeysMngr> keysManager(
+                    xmlSecKeysMngrCreate());
+                if (!keysManager)
+                {
+                    errorString = "Keys manager creation failed";
+                    return nullptr;
+                }
+
+                if (!_crypto.initializeKeysManager(
+                        keysManager.get(), _trustStore.getCertificates()))
+                {
+                    errorString =
+                        "Keys manager crypto init or cert load failed";
+                    return nullptr;
+                }
+
+                _keysManager = std::move(keysManager);
+            }
+
+            dsigCtx.reset(xmlSecDSigCtxCreate(_keysManager.get()));
+            if (!dsigCtx)
+            {
+                errorString = "DSig context initialize failed";
+                return nullptr;
+            }
+
+            if (!_crypto.initializeSignatureContext(dsigCtx.get()))
+            {
+                errorString = "signature context crypto init failed";
+                return nullptr;
+            }
+        }
+    }
 
-    static std::string getSignaturePropertyDate(xmlNode* signaturePropertyNode);
+    if (insecure)
+    {
+        dsigCtx->keyInfoReadCtx.flags |=
+            XMLSEC_KEYINFO_FLAGS_X509DATA_DONT_VERIFY_CERTS;
+    }
+    else
+    {
+        dsigCtx->keyInfoReadCtx.flags &=
+            ~XMLSEC_KEYINFO_FLAGS_X509DATA_DONT_VERIFY_CERTS;
+    }
 
-    static std::string getDateContent(xmlNode* dateNode);
+    return dsigCtx;
+}
 
-    static xmlNodePtr getObjectCertDigestNode(xmlNode* objectNode);
+void SignatureContextPool::checkin(
+    std::unique_ptr<xmlSecDSigCtx> signatureContext)
+{
+    assert(signatureContext);
 
-    [[nodiscard]] xmlNodePtr getCertDigestNode() const;
+    reset(signatureContext.get());
 
-    [[nodiscard]] xmlNodePtr getX509CertificateNode() const;
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _signatureContexts.push_back(std::move(signatureContext));
+}
 
-    bool getCertificateBinary(std::vector<xmlChar>& certificate) const;
+void SignatureContextPool::reset(xmlSecDSigCtx* signatureContext)
+{
+    // Like xmlSecDSigCtxFinalize() + xmlSecDSigCtxInitialize(), but keeps the
+    // keys manager, the flags and the enabled key data.
+    xmlSecTransformCtxReset(&signatureContext->transformCtx);
+    xmlSecKeyInfoCtxReset(&signatureContext->keyInfoReadCtx);
+    xmlSecKeyInfoCtxReset(&signatureContext->keyInfoWriteCtx);
+    xmlSecPtrListEmpty(&signatureContext->signedInfoReferences);
+    xmlSecPtrListEmpty(&signatureContext->manifestReferences);
+    if (signatureContext->signKey != nullptr)
+    {
+        xmlSecKeyDestroy(signatureContext->signKey);
+        signatureContext->signKey = nullptr;
+    }
+    if (signatureContext->id != nullptr)
+    {
+        xmlFree(signatureContext->id);
+        signatureContext->id = nullptr;
+    }
+    signatureContext->result = nullptr;
+    signatureContext->status = xmlSecDSigStatusUnknown;
+    signatureContext->signMethod = nullptr;
+    signatureContext->c14nMethod = nullptr;
+    signatureContext->preSignMemBufMethod = nullptr;
+    signatureContext->signValueNode = nullptr;
+}
 
-    static bool getDigestValue(xmlNodePtr certDigest,
-                               std::vector<xmlChar>& value);
+/// Thread-safe, size-bounded cache, evicting the least recently used entry.
+template <typename Value> class LruCache
+{
+  public:
+    explicit LruCache(size_t capacity) : _capacity(capacity) {}
 
-    static std::unique_ptr<xmlChar> getDigestAlgo(xmlNodePtr certDigest);
+    /// Returns the value of key, or nullptr if it's not cached.
+    std::shared_ptr<const Value> get(const std::string& key)
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(key);
+        if (it == _index.end())
+        {
+            return nullptr;
+        }
 
-    static bool hash(const std::vector<xmlChar>& input,
-                     std::unique_ptr<xmlChar> algo,
-                     std::vector<unsigned char>& out);
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->second;
+    }
 
-    std::string _errorString;
+    /// Inserts value, unless key is already cached. Returns the cached value.
+    std::shared_ptr<const Value> insert(const std::string& key,
+                                        std::shared_ptr<const Value> value)
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(key);
+        if (it != _index.end())
+        {
+            return it->second->second;
+        }
 
-    xmlNode* _signatureNode = nullptr;
+        _entries.emplace_front(key, std::move(value));
+        _index[key] = _entries.begin();
+        if (_entries.size() > _capacity)
+        {
+            _index.erase(_entries.back().first);
+            _entries.pop_back();
+        }
 
-    std::vector<std::string> _trustedDers;
+        return _entries.front().second;
+    }
 
-    bool _insecure = false;
+    void erase(const std::string& key)
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        auto it = _index.find(key);
+        if (it == _index.end())
+        {
+            return;
+        }
 
-    Crypto& _crypto;
+        _entries.erase(it->second);
+        _index.erase(it);
+    }
+
+    void clear()
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _index.clear();
+        _entries.clear();
+    }
+
+  private:
+    using Entry = std::pair<std::string, std::shared_ptr<const Value>>;
+
+    size_t _capacity;
+
+    std::mutex _mutex;
+
+    /// Most recently used entry first.
+    std::list<Entry> _entries;
+
+    std::unordered_map<std::string, typename std::list<Entry>::iterator>
+        _index;
 };
 
-XmlSignature::XmlSignature(xmlNode* signatureNode, Crypto& crypto,
-                           std::vector<std::string> trustedDers, bool insecure)
-    : _signatureNode(signatureNode), _trustedDers(std::move(trustedDers)),
-      _insecure(insecure), _crypto(crypto)
+/// A decoded certificate in CertificateCache.
+struct CachedCertificate
 {
-}
+    std::string _subjectName;
 
-XmlSignature::~XmlSignature() = default;
+    /// Public key of the certificate, also owning the certificate itself.
+    std::unique_ptr<xmlSecKey> _key;
 
-const std::string& XmlSignature::getErrorString() const { return _errorString; }
+    /// End of the validity period, if it could be extracted.
+    std::optional<std::chrono::system_clock::time_point> _notAfter;
+};
 
-bool XmlSignature::verify()
+/// Size-bounded LRU cache of signing certificates, keyed by their SHA-256
+/// fingerprint.
+class CertificateCache
 {
-    const std::unique_ptr<xmlSecKeysMngr> pKeysMngr(xmlSecKeysMngrCreate());
-    if (!pKeysMngr)
-    {
-        _errorString = "Keys manager creation failed";
-        return false;
-    }
+  public:
+    CertificateCache(Crypto& crypto, size_t capacity);
 
-    if (!_crypto.initializeKeysManager(pKeysMngr.get(), _trustedDers))
-    {
-        _errorString = "Keys manager crypto init or cert load failed";
-        return false;
-    }
+    /// Looks up a DER certificate, decodes it on a cache miss.
+    std::shared_ptr<const CachedCertificate>
+    get(const std::string& fingerprint, std::vector<xmlChar>& certificate);
 
-    std::unique_ptr<xmlSecDSigCtx> dsigCtx(
-        xmlSecDSigCtxCreate(pKeysMngr.get()));
-    if (!dsigCtx)
-    {
-        _errorString = "DSig context initialize failed";
-        return false;
-    }
+  private:
+    Crypto& _crypto;
 
-    if (_insecure)
-    {
-        dsigCtx->keyInfoReadCtx.flags |=
-            XMLSEC_KEYINFO_FLAGS_X509DATA_DONT_VERIFY_CERTS;
-    }
+    LruCache<CachedCertificate> _entries;
+};
 
-    if (!_crypto.initializeSignatureContext(dsigCtx.get()))
+CertificateCache::CertificateCache(Crypto& crypto, size_t capacity)
+    : _crypto(crypto), _entries(capacity)
+{
+}
+
+std::shared_ptr<const CachedCertificate>
+CertificateCache::get(const std::string& fingerprint,
+                      std::vector<xmlChar>& certificate)
+{
+    std::shared_ptr<const CachedCertificate> cached = _entries.get(fingerprint);
+    if (cached)
     {
-        _errorString = "signature context crypto init failed";
-        return false;
+        ++certificateCacheHits;
+        return cached;
     }
 
-    if (xmlSecDSigCtxVerify(dsigCtx.get(), _signatureNode) < 0)
+    ++certificateCacheMisses;
+    auto cachedCertificate = std::make_shared<CachedCertificate>();
+    cachedCertificate->_subjectName = _crypto.getCertificateSubjectName(
+        certificate.data(), certificate.size());
+    cachedCertificate->_key.reset(_crypto.createCertificateKey(
+        certificate.data(), certificate.size()));
+    std::chrono::system_clock::time_point notAfter;
+    if (_crypto.getCertificateNotAfter(certificate.data(), certificate.size(),
+                                       notAfter))
     {
-        _errorString = "DSig context verify failed";
-        return false;
+        cachedCertificate->_notAfter = notAfter;
     }
 
-    return dsigCtx->status == xmlSecDSigStatusSucceeded;
+    // Some other thread may have decoded the same certificate in the
+    // meantime, then that one is returned.
+    return _entries.insert(fingerprint, std::move(cachedCertificate));
 }
 
-bool XmlSignature::getCertificateBinary(std::vector<xmlChar>& certificate) const
+/// A successfully validated certificate chain in ChainCache.
+struct ValidatedChain
 {
-    // Look up the encoded certificate.
-    xmlNode* x509Certificate = getX509CertificateNode();
-    if (x509Certificate == nullptr)
+    /// The signing key, as extracted by the chain validation.
+    std::unique_ptr<xmlSecKey> _key;
+
+    /// The entry is not used from this point in time.
+    std::chrono::system_clock::time_point _validUntil;
+};
+
+/**
+ * Size-bounded LRU cache of successful certificate chain validations, keyed by
+ * the certificates of the key info, the trust store identity, the TTL and the
+ * validation time bucket.
+ */
+class ChainCache
+{
+  public:
+    explicit ChainCache(size_t capacity);
+
+    /// Looks up a validated chain, returns nullptr on a cache miss.
+    std::shared_ptr<const ValidatedChain> get(const std::string& key);
+
+    void insert(const std::string& key,
+                std::shared_ptr<const ValidatedChain> chain);
+
+    /// Drops all entries if the trust store changed since the last call.
+    void setTrustStoreIdentity(const std::string& identity);
+
+  private:
+    LruCache<ValidatedChain> _entries;
+
+    std::mutex _mutex;
+
+    std::string _trustStoreIdentity;
+};
+
+ChainCache::ChainCache(size_t capacity) : _entries(capacity) {}
+
+std::shared_ptr<const ValidatedChain> ChainCache::get(const std::string& key)
+{
+    std::shared_ptr<const ValidatedChain> chain = _entries.get(key);
+    if (chain && std::chrono::system_clock::now() >= chain->_validUntil)
     {
-        return false;
+        _entries.erase(key);
+        chain.reset();
     }
 
-    const std::unique_ptr<xmlChar> certificateContent(
-        xmlNodeGetContent(x509Certificate));
-    if (!certificateContent ||
-        (xmlSecIsEmptyString(certificateContent.get()) != 0))
+    if (chain)
     {
-        return false;
+        ++chainCacheHits;
     }
-
-    // Decode the certificate in-place.
-    xmlSecSize certSize;
-    if (xmlSecBase64Decode_ex(
-            certificateContent.get(), (xmlSecByte*)certificateContent.get(),
-            xmlStrlen(certificateContent.get()), &certSize) < 0)
+    else
     {
-        return false;
+        ++chainCacheMisses;
     }
+    return chain;
+}
 
-    std::copy(certificateContent.get(), certificateContent.get() + certSize,
-              std::back_inserter(certificate));
-    return true;
+void ChainCache::insert(const std::string& key,
+                        std::shared_ptr<const ValidatedChain> chain)
+{
+    _entries.insert(key, std::move(chain));
 }
 
-xmlNodePtr XmlSignature::getCertDigestNode() const
+void ChainCache::setTrustStoreIdentity(const std::string& identity)
 {
-    xmlNodePtr certDigestNode = nullptr;
-    for (xmlNode* signatureChild = _signatureNode->children;
-         signatureChild != nullptr; signatureChild = signatureChild->next)
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (identity == _trustStoreIdentity)
     {
-        if (xmlSecCheckNodeName(signatureChild, xmlSecNodeObject,
-                                xmlSecDSigNs) == 0)
-        {
-            continue;
-        }
+        return;
+    }
+
+    _trustStoreIdentity = identity;
+    _entries.clear();
+}
+
+/**
+ * Process-wide libxml2, libxmlsec and crypto state, shared by the crypto
+ * sessions. It's shut down when the last session goes away.
+ */
+class CryptoBackend
+{
+  public:
+    CryptoBackend() = default;
+
+    CryptoBackend(const CryptoBackend&) = delete;
+    CryptoBackend& operator=(const CryptoBackend&) = delete;
+
+    /// Initializes the state, with the crypto DB of cryptoConfig.
+    bool initialize(const std::string& cryptoConfig, std::string& errorString);
+
+    /// Opens the crypto DB of cryptoConfig, next to the one in use.
+    bool openDatabase(const std::string& cryptoConfig);
+
+    Crypto& getCrypto();
+
+    /// Certificates don't depend on the trust settings, so it's shared.
+    CertificateCache& getCertificateCache();
+
+    /**
+     * Registers the trusted certificates of a live session: the trust of the
+     * certificates in a keys manager is visible to the whole crypto backend.
+     */
+    void addTrustStore(const TrustStore& trustStore);
+
+    void removeTrustStore(const TrustStore& trustStore);
+
+    /// Checks if trustStore and the crypto DB of cryptoConfig are all trust.
+    bool isSoleTrust(const TrustStore& trustStore,
+                     const std::string& cryptoConfig);
+
+    /// Checks if an other trust store than trustStore contains certificate.
+    bool isTrustedElsewhere(const TrustStore& trustStore,
+                            const std::vector<unsigned char>& certificate);
+
+  private:
+    std::mutex _mutex;
+
+    std::vector<const TrustStore*> _trustStores;
+
+    /// Crypto configs of the opened crypto DBs.
+    std::set<std::string> _cryptoConfigs;
+
+    std::unique_ptr<XmlGuard> _xmlGuard;
+
+    std::unique_ptr<Crypto> _crypto;
+
+    std::unique_ptr<XmlSecGuard> _xmlSecGuard;
+
+    std::unique_ptr<CertificateCache> _certificateCache;
+};
+
+/**
+ * Trust settings of verifiers: trusted certificates and caches of trust
+ * decisions, on top of the crypto backend. Sessions with different settings
+ * can be alive at the same time.
+ */
+class CryptoSession
+{
+  public:
+    CryptoSession(std::string cryptoConfig,
+                  std::vector<std::string> trustedDers,
+                  std::shared_ptr<CryptoBackend> backend);
+
+    ~CryptoSession();
+
+    CryptoSession(const CryptoSession&) = delete;
+    CryptoSession& operator=(const CryptoSession&) = delete;
+
+    /**
+     * Returns the live session with these settings or creates a new one.
+     * Returns nullptr on failure, and sets errorString.
+     */
+    static std::shared_ptr<CryptoSession>
+    acquire(const std::string& cryptoConfig,
+            const std::vector<std::string>& trustedDers,
+            std::string& errorString);
+
+    /// Checks if the session was acquired with these settings.
+    [[nodiscard]] bool
+    hasSettings(const std::string& cryptoConfig,
+                const std::vector<std::string>& trustedDers) const;
+
+    Crypto& getCrypto();
+
+    SignatureContextPool& getSignatureContextPool();
+
+    CertificateCache& getCertificateCache();
+
+    ChainCache& getChainCache();
+
+    /**
+     * Checks if the certificate chain of a key, validated with the backend,
+     * is trusted by this session, not only by an other live one.
+     */
+    bool isChainTrusted(xmlSecKey* key);
+
+  private:
+    bool initialize(std::string& errorString);
+
+    std::string _cryptoConfig;
+
+    std::vector<std::string> _trustedDers;
+
+    /// Declared first, so it's shut down after the rest is gone.
+    std::shared_ptr<CryptoBackend> _backend;
+
+    std::unique_ptr<TrustStore> _trustStore;
+
+    std::unique_ptr<SignatureContextPool> _signatureContextPool;
+
+    std::unique_ptr<ChainCache> _chainCache;
+};
+
+namespace
+{
+const size_t certificateCacheCapacity = 1024;
+
+const size_t chainCacheCapacity = 1024;
+
+/// Guards the below variables and the creation / destruction of sessions.
+std::mutex sessionMutex;
+
+std::weak_ptr<CryptoBackend> currentBackend;
+
+using SessionSettings = std::pair<std::string, std::vector<std::string>>;
+
+/// Live sessions, by their crypto config and trusted DERs.
+std::map<SessionSettings, std::weak_ptr<CryptoSession>> liveSessions;
+
+/// Number of live Session instances.
+size_t sessionPins = 0;
+
+/// Keeps the live sessions alive while sessionPins is positive.
+std::vector<std::shared_ptr<CryptoSession>> pinnedSessions;
+} // namespace
+
+bool CryptoBackend::initialize(const std::string& cryptoConfig,
+                               std::string& errorString)
+{
+    _xmlGuard = std::make_unique<XmlGuard>();
+
+    _crypto = Crypto::create();
+    if (!_crypto->initialize(cryptoConfig))
+    {
+        errorString = "Failed to initialize crypto";
+        return false;
+    }
+
+    _xmlSecGuard = std::make_unique<XmlSecGuard>(*_crypto);
+    if (!_xmlSecGuard->isGood())
+    {
+        errorString = "Failed to initialize libxmlsec";
+        return false;
+    }
+
+    _certificateCache =
+        std::make_unique<CertificateCache>(*_crypto, certificateCacheCapacity);
+    _cryptoConfigs.insert(cryptoConfig);
+    return true;
+}
+
+bool CryptoBackend::openDatabase(const std::string& cryptoConfig)
+{
+    if (!_crypto->openDatabase(cryptoConfig))
+    {
+        return false;
+    }
+
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _cryptoConfigs.insert(cryptoConfig);
+    return true;
+}
+
+Crypto& CryptoBackend::getCrypto() { return *_crypto; }
+
+CertificateCache& CryptoBackend::getCertificateCache()
+{
+    return *_certificateCache;
+}
+
+void CryptoBackend::addTrustStore(const TrustStore& trustStore)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _trustStores.push_back(&trustStore);
+}
+
+void CryptoBackend::removeTrustStore(const TrustStore& trustStore)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    std::erase(_trustStores, &trustStore);
+}
+
+bool CryptoBackend::isSoleTrust(const TrustStore& trustStore,
+                                const std::string& cryptoConfig)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    return _trustStores.size() == 1 && _trustStores[0] == &trustStore &&
+           _cryptoConfigs.size() == 1 &&
+           *_cryptoConfigs.begin() == cryptoConfig;
+}
+
+bool CryptoBackend::isTrustedElsewhere(
+    const TrustStore& trustStore, const std::vector<unsigned char>& certificate)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    return std::any_of(_trustStores.begin(), _trustStores.end(),
+                       [&trustStore, &certificate](const TrustStore* other)
+                       {
+                           return other != &trustStore &&
+                                  other->contains(certificate);
+                       });
+}
+
+CryptoSession::CryptoSession(std::string cryptoConfig,
+                             std::vector<std::string> trustedDers,
+                             std::shared_ptr<CryptoBackend> backend)
+    : _cryptoConfig(std::move(cryptoConfig)),
+      _trustedDers(std::move(trustedDers)), _backend(std::move(backend))
+{
+}
+
+CryptoSession::~CryptoSession()
+{
+    if (_trustStore)
+    {
+        _backend->removeTrustStore(*_trustStore);
+    }
+}
+
+std::shared_ptr<CryptoSession>
+CryptoSession::acquire(const std::string& cryptoConfig,
+                       const std::vector<std::string>& trustedDers,
+                       std::string& errorString)
+{
+    const std::lock_guard<std::mutex> lock(sessionMutex);
+    const SessionSettings settings(cryptoConfig, trustedDers);
+    auto it = liveSessions.find(settings);
+    if (it != liveSessions.end())
+    {
+        std::shared_ptr<CryptoSession> session = it->second.lock();
+        if (session)
+        {
+            return session;
+        }
+    }
+
+    std::shared_ptr<CryptoBackend> backend = currentBackend.lock();
+    if (!backend)
+    {
+        backend = std::make_shared<CryptoBackend>();
+        if (!backend->initialize(cryptoConfig, errorString))
+        {
+            return nullptr;
+        }
+        currentBackend = backend;
+    }
+    else if (!backend->openDatabase(cryptoConfig))
+    {
+        errorString = "Failed to open the crypto database of '" +
+                      cryptoConfig + "' next to the one in use";
+        return nullptr;
+    }
+
+    auto newSession =
+        std::make_unique<CryptoSession>(cryptoConfig, trustedDers, backend);
+    backend.reset();
+    if (!newSession->initialize(errorString))
+    {
+        return nullptr;
+    }
+
+    // Destroy under the lock, so a new backend is not initialized while the
+    // old one is still shutting down.
+    std::shared_ptr<CryptoSession> session(
+        newSession.release(),
+        [](CryptoSession* ptr)
+        {
+            const std::lock_guard<std::mutex> deleterLock(sessionMutex);
+            std::default_delete<CryptoSession>()(ptr);
+            std::erase_if(liveSessions, [](const auto& entry)
+                          { return entry.second.expired(); });
+        });
+    liveSessions[settings] = session;
+    if (sessionPins > 0)
+    {
+        pinnedSessions.push_back(session);
+    }
+    return session;
+}
+
+bool CryptoSession::hasSettings(
+    const std::string& cryptoConfig,
+    const std::vector<std::string>& trustedDers) const
+{
+    return _cryptoConfig == cryptoConfig && _trustedDers == trustedDers;
+}
+
+bool CryptoSession::initialize(std::string& errorString)
+{
+    // Parse the trusted certificates once, not for each keys manager.
+    _trustStore = std::make_unique<TrustStore>();
+    if (!_trustStore->load(_trustedDers, errorString))
+    {
+        _trustStore.reset();
+        return false;
+    }
+    _backend->addTrustStore(*_trustStore);
+
+    _signatureContextPool = std::make_unique<SignatureContextPool>(
+        _backend->getCrypto(), *_trustStore);
+    _chainCache = std::make_unique<ChainCache>(chainCacheCapacity);
+    return true;
+}
+
+Crypto& CryptoSession::getCrypto() { return _backend->getCrypto(); }
+
+SignatureContextPool& CryptoSession::getSignatureContextPool()
+{
+    return *_signatureContextPool;
+}
+
+CertificateCache& CryptoSession::getCertificateCache()
+{
+    return _backend->getCertificateCache();
+}
+
+ChainCache& CryptoSession::getChainCache() { return *_chainCache; }
+
+bool CryptoSession::isChainTrusted(xmlSecKey* key)
+{
+    if (_backend->isSoleTrust(*_trustStore, _cryptoConfig))
+    {
+        return true;
+    }
+
+    const std::vector<std::vector<unsigned char>> chain =
+        getCrypto().getCertificateChain(key);
+    if (std::any_of(chain.begin(), chain.end(),
+                    [this](const std::vector<unsigned char>& certificate)
+                    { return _trustStore->contains(certificate); }))
+    {
+        return true;
+    }
+
+    // Without an own crypto DB, the trust came from an other session. The
+    // crypto DBs can't be told apart, so with one, only the trusted DERs of
+    // the other sessions are excluded.
+    if (chain.empty() || getCrypto().getTrustStoreFiles(_cryptoConfig).empty())
+    {
+        return false;
+    }
+
+    return std::none_of(chain.begin(), chain.end(),
+                        [this](const std::vector<unsigned char>& certificate)
+                        {
+                            return _backend->isTrustedElsewhere(*_trustStore,
+                                                                certificate);
+                        });
+}
+
+/// Implementation of Session, pinning the live CryptoSessions.
+class PinningSession : public Session
+{
+  public:
+    PinningSession();
+
+    ~PinningSession() override;
+
+    PinningSession(const PinningSession&) = delete;
+    PinningSession& operator=(const PinningSession&) = delete;
+};
+
+PinningSession::PinningSession()
+{
+    const std::lock_guard<std::mutex> lock(sessionMutex);
+    ++sessionPins;
+    if (sessionPins > 1)
+    {
+        return;
+    }
+
+    for (const auto& entry : liveSessions)
+    {
+        std::shared_ptr<CryptoSession> session = entry.second.lock();
+        if (session)
+        {
+            pinnedSessions.push_back(std::move(session));
+        }
+    }
+}
+
+PinningSession::~PinningSession()
+{
+    // Release the last references outside the lock, the deleter locks it.
+    std::vector<std::shared_ptr<CryptoSession>> unpinned;
+    const std::lock_guard<std::mutex> lock(sessionMutex);
+    --sessionPins;
+    if (sessionPins == 0)
+    {
+        unpinned = std::move(pinnedSessions);
+        pinnedSessions.clear();
+    }
+}
+
+std::unique_ptr<Session> Session::create()
+{
+    return std::make_unique<PinningSession>();
+}
+
+Statistics Verifier::getStatistics()
+{
+    Statistics statistics;
+    statistics._certificateCache._hits = certificateCacheHits;
+    statistics._certificateCache._misses = certificateCacheMisses;
+    statistics._chainCache._hits = chainCacheHits;
+    statistics._chainCache._misses = chainCacheMisses;
+    statistics._verdictStore._hits = verdictStoreHits;
+    statistics._streamDigests._hits = streamDigestHits;
+    statistics._streamDigests._misses = streamDigestMisses;
+    statistics._verdictStore._misses = verdictStoreMisses;
+    return statistics;
+}
+
+/// Results of reference digest checks in one document, shared by its
+/// signatures.
+class ReferenceResults
+{
+  public:
+    std::optional<bool> get(const std::string& reference);
+
+    void set(const std::string& reference, bool result);
+
+    void clear();
+
+  private:
+    std::mutex _mutex;
+
+    /// Canonical Reference element -> digest matches.
+    std::unordered_map<std::string, bool> _results;
+};
+
+std::optional<bool> ReferenceResults::get(const std::string& reference)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _results.find(reference);
+    if (it == _results.end())
+    {
+        return {};
+    }
+
+    return it->second;
+}
+
+void ReferenceResults::set(const std::string& reference, bool result)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _results[reference] = result;
+}
+
+void ReferenceResults::clear()
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _results.clear();
+}
+
+/// Verifier settings, affecting the verification of its signatures.
+struct SignatureOptions
+{
+    bool _insecure = false;
+
+    std::chrono::seconds _chainCacheTtl = defaultChainCacheTtl;
+
+    /**
+     * Describes the trust inputs, used as part of the chain cache key and the
+     * signature identity.
+     */
+    std::string _trustStoreIdentity;
+
+    /// Set in incremental mode, owned by the verifier.
+    VerdictStore* _verdictStore = nullptr;
+
+    /// Set in incremental mode, owned by the verifier.
+    ReferenceResults* _referenceResults = nullptr;
+
+    /// Owned by the verifier.
+    StreamDigests* _streamDigests = nullptr;
+
+    /// Limit of the data read ahead, 0 disables the prefetcher.
+    size_t _prefetchMemory = defaultPrefetchMemory;
+
+    /// The data of the zip package, a prefetcher opens its own archive on it.
+    const void* _zipData = nullptr;
+
+    size_t _zipSize = 0;
+
+    /// Owned by the verifier.
+    const Cancellation* _cancellation = nullptr;
+};
+
+namespace
+{
+/**
+ * Stream name -> transform and digest algorithm, if all references to the
+ * stream digest it the same way.
+ */
+using StreamMethods =
+    std::map<std::string,
+             std::optional<std::pair<std::string, DigestAlgorithm>>>;
+
+/// Digests a stream like a reference with a transform of
+/// getReferenceTransform() does.
+class StreamHasher
+{
+  public:
+    StreamHasher(const std::string& transform, DigestAlgorithm algorithm)
+        : _digest(Digest::create(algorithm, Digest::getBestKernel(algorithm)))
+    {
+        if (!transform.empty())
+        {
+            const bool withComments =
+                transform == fromXmlChar(xmlSecHrefC14NWithComments);
+            _canonicalizer = Canonicalizer::create(
+                CanonicalizerKind::Streaming, withComments);
+        }
+    }
+
+    void update(const char* data, size_t size, bool final)
+    {
+        if (!_digest)
+        {
+            return;
+        }
+
+        if (!_canonicalizer)
+        {
+            _digest->update(reinterpret_cast<const unsigned char*>(data),
+                            size);
+            return;
+        }
+
+        _output.clear();
+        if (!_canonicalizer->push(data, size, final, _output))
+        {
+            // Not well-formed, verification reports it.
+            _digest.reset();
+            return;
+        }
+        _digest->update(reinterpret_cast<const unsigned char*>(_output.data()),
+                        _output.size());
+    }
+
+    bool finish(std::vector<unsigned char>& digest)
+    {
+        return _digest && _digest->finish(digest);
+    }
+
+  private:
+    std::unique_ptr<Digest> _digest;
+
+    std::unique_ptr<Canonicalizer> _canonicalizer;
+
+    std::string _output;
+};
+} // namespace
+
+/// Implementation of Signature using libxml.
+class XmlSignature : public Signature
+{
+  public:
+    explicit XmlSignature(xmlNode* signatureNode, CryptoSession& cryptoSession,
+                          SignatureContextPool& signatureContextPool,
+                          zip::Archive* zipArchive,
+                          const SignatureOptions& options, SignatureKind kind);
+    ~XmlSignature() override;
+
+    [[nodiscard]] const std::string& getErrorString() const override;
+
+    bool verify() override;
+
+    /// Like verify(), but reads the signed streams from zipArchive.
+    bool verifyWithArchive(zip::Archive* zipArchive);
+
+    /// Marks the signature as failed without verifying it.
+    bool fail(const std::string& errorString);
+
+    /// Verifies the signature value, the certificate and the references.
+    bool verifySignature(zip::Archive* zipArchive);
+
+    /// Only checks the digests of the references.
+    bool verifyReferences(zip::Archive* zipArchive);
+
+    /**
+     * Adds how the references of the signature digest the streams. Returns
+     * false if the streams can't be told reliably.
+     */
+    bool getStreamMethods(StreamMethods& streams) const;
+
+    /**
+     * Takes the digests of the streams which were already digested by other
+     * signatures of the document, then hashes the small streams which are
+     * referenced without transforms together, so the multi-buffer digest
+     * kernel can process them at once.
+     */
+    void precomputeDigests(zip::Archive* zipArchive,
+                           PrecomputedDigests& digests) const;
+
+    /**
+     * Starts reading the referenced streams without a precomputed digest in
+     * the background. Returns nullptr if they are too small for that.
+     */
+    [[nodiscard]] std::unique_ptr<Prefetcher>
+    createPrefetcher(zip::Archive* zipArchive,
+                     const PrecomputedDigests& precomputedDigests) const;
+
+    /**
+     * Hashes the canonical SignedInfo, the SignatureValue and the certificates
+     * of the signature, together with the trust inputs. Returns an empty
+     * string if there are no certificates. validUntil is set to the end of
+     * the validity of the first expiring certificate.
+     */
+    std::string
+    getIdentity(std::chrono::system_clock::time_point& validUntil) const;
+
+    /// Inclusive C14N 1.0 of the subtree of node.
+    static bool canonicalize(xmlNode* node, std::string& out);
+
+    bool verifyXAdES() override;
+
+    [[nodiscard]] std::string getSubjectName() const override;
+
+    [[nodiscard]] std::string getDate() const override;
+
+    [[nodiscard]] std::string getMethod() const override;
+
+    [[nodiscard]] std::string getType() const override;
+
+    [[nodiscard]] std::set<std::string> getSignedStreams() const override;
+
+    [[nodiscard]] SignatureKind getKind() const override;
+
+  private:
+    static std::string getObjectDate(xmlNode* objectNode);
+
+    static std::string
+    getSignaturePropertiesDate(xmlNode* signaturePropertiesNode);
+
+    static std::string getSignaturePropertyDate(xmlNode* signaturePropertyNode);
+
+    static std::string getDateContent(xmlNode* dateNode);
+
+    static xmlNodePtr getObjectCertDigestNode(xmlNode* objectNode);
+
+    [[nodiscard]] xmlNodePtr getCertDigestNode() const;
+
+    [[nodiscard]] xmlNodePtr getX509CertificateNode() const;
+
+    bool getCertificateBinary(std::vector<xmlChar>& certificate) const;
+
+    static bool decodeCertificate(xmlNode* x509Certificate,
+                                  std::vector<xmlChar>& certificate);
+
+    /// Decodes the signing certificate, using the certificate cache.
+    [[nodiscard]] std::shared_ptr<const CachedCertificate>
+    getCachedCertificate() const;
+
+    /// Decodes a certificate, using the certificate cache.
+    [[nodiscard]] std::shared_ptr<const CachedCertificate>
+    getCachedCertificate(xmlNode* x509Certificate,
+                         std::string& fingerprint) const;
+
+    /// Checks if the key info is a single X509 certificate.
+    [[nodiscard]] bool hasSingleCertificateKeyInfo() const;
+
+    /**
+     * Builds the chain cache key of the signature, returns an empty string if
+     * the key info is not only X509 data with certificates. validUntil is set
+     * to the end of the time bucket or the first expiring certificate.
+     */
+    std::string
+    getChainCacheKey(std::chrono::system_clock::time_point& validUntil) const;
+
+    static bool getDigestValue(xmlNodePtr certDigest,
+                               std::vector<xmlChar>& value);
+
+    static std::unique_ptr<xmlChar> getDigestAlgo(xmlNodePtr certDigest);
+
+    static bool hash(const std::vector<xmlChar>& input, const xmlChar* algo,
+                     std::vector<unsigned char>& out);
+
+    /// Returns if verification has to stop, then sets the error string.
+    bool isStopped();
+
+    std::string _errorString;
+
+    xmlNode* _signatureNode = nullptr;
+
+    SignatureOptions _options;
+
+    CryptoSession& _cryptoSession;
+
+    SignatureContextPool& _signatureContextPool;
+
+    zip::Archive* _zipArchive = nullptr;
+
+    SignatureKind _kind;
+};
+
+XmlSignature::XmlSignature(xmlNode* signatureNode,
+                           CryptoSession& cryptoSession,
+                           SignatureContextPool& signatureContextPool,
+                           zip::Archive* zipArchive,
+                           const SignatureOptions& options, SignatureKind kind)
+    : _signatureNode(signatureNode), _options(options),
+      _cryptoSession(cryptoSession),
+      _signatureContextPool(signatureContextPool), _zipArchive(zipArchive),
+      _kind(kind)
+{
+}
+
+XmlSignature::~XmlSignature() = default;
+
+const std::string& XmlSignature::getErrorString() const { return _errorString; }
+
+bool XmlSignature::verify() { return verifyWithArchive(_zipArchive); }
+
+bool XmlSignature::isStopped()
+{
+    const char* reason = _options._cancellation != nullptr
+                             ? _options._cancellation->getStopReason()
+                             : nullptr;
+    if (reason == nullptr)
+    {
+        return false;
+    }
+
+    _errorString = reason;
+    return true;
+}
+
+bool XmlSignature::fail(const std::string& errorString)
+{
+    _errorString = errorString;
+    return false;
+}
+
+bool XmlSignature::verifyWithArchive(zip::Archive* zipArchive)
+{
+    if (isStopped())
+    {
+        return false;
+    }
+
+    VerdictStore* verdictStore = _options._verdictStore;
+    if (verdictStore == nullptr)
+    {
+        return verifySignature(zipArchive);
+    }
+
+    std::chrono::system_clock::time_point validUntil;
+    const std::string identity = getIdentity(validUntil);
+    if (!identity.empty() && verdictStore->contains(identity))
+    {
+        // Verified earlier: the signature value and the certificates are
+        // unchanged, only the signed content has to be checked.
+        ++verdictStoreHits;
+        return verifyReferences(zipArchive);
+    }
+
+    ++verdictStoreMisses;
+    const bool ret = verifySignature(zipArchive);
+    if (ret && !identity.empty())
+    {
+        verdictStore->add(identity, validUntil);
+    }
+    return ret;
+}
+
+bool XmlSignature::verifySignature(zip::Archive* zipArchive)
+{
+    std::unique_ptr<xmlSecDSigCtx> dsigCtx =
+        _signatureContextPool.checkout(_options._insecure, _errorString);
+    if (!dsigCtx)
+    {
+        return false;
+    }
+
+    std::string chainCacheKey;
+    std::chrono::system_clock::time_point chainValidUntil;
+    if (!_options._insecure && _options._chainCacheTtl.count() > 0)
+    {
+        chainCacheKey = getChainCacheKey(chainValidUntil);
+    }
+
+    bool chainCached = false;
+    if (!chainCacheKey.empty())
+    {
+        // Same certificates and trust inputs: the chain was already validated
+        // and the key it provided can be used without reading the key info.
+        std::shared_ptr<const ValidatedChain> chain =
+            _cryptoSession.getChainCache().get(chainCacheKey);
+        if (chain)
+        {
+            dsigCtx->signKey = xmlSecKeyDuplicate(chain->_key.get());
+            chainCached = dsigCtx->signKey != nullptr;
+        }
+    }
+    if (!chainCached && hasSingleCertificateKeyInfo())
+    {
+        // Use the key of a cached certificate, without reading the key info.
+        // In secure mode, its chain is validated the same way first; on
+        // failure, reading the key info reports the error.
+        std::shared_ptr<const CachedCertificate> certificate =
+            getCachedCertificate();
+        if (certificate && certificate->_key &&
+            (_options._insecure ||
+             _cryptoSession.getCrypto().verifyCertificateKey(
+                 dsigCtx.get(), certificate->_key.get())))
+        {
+            dsigCtx->signKey = xmlSecKeyDuplicate(certificate->_key.get());
+        }
+    }
+
+    PrecomputedDigests precomputedDigests;
+    precomputeDigests(zipArchive, precomputedDigests);
+    const std::unique_ptr<Prefetcher> prefetcher =
+        createPrefetcher(zipArchive, precomputedDigests);
+    const XmlSecIOScope ioScope(zipArchive, prefetcher.get(),
+                                _options._cancellation);
+    const PrecomputedDigestsScope precomputedScope(&precomputedDigests);
+    bool ret = false;
+    if (xmlSecDSigCtxVerify(dsigCtx.get(), _signatureNode) < 0)
+    {
+        if (!isStopped())
+        {
+            _errorString = "DSig context verify failed";
+        }
+    }
+    else
+    {
+        // A stopped read makes a reference invalid.
+        ret = dsigCtx->status == xmlSecDSigStatusSucceeded && !isStopped();
+
+        // The backend also knows the trusted certificates of other sessions.
+        bool chainTrusted = true;
+        if (!_options._insecure && !chainCached &&
+            dsigCtx->signKey != nullptr &&
+            !_cryptoSession.isChainTrusted(dsigCtx->signKey))
+        {
+            chainTrusted = false;
+            ret = false;
+            _errorString = "certificate chain is only trusted by an other "
+                           "verifier";
+        }
+
+        // A key is only extracted from the key info if the chain is valid,
+        // regardless of the signature itself being valid.
+        if (!chainCacheKey.empty() && !chainCached && chainTrusted &&
+            dsigCtx->signKey != nullptr)
+        {
+            auto chain = std::make_shared<ValidatedChain>();
+            chain->_key.reset(xmlSecKeyDuplicate(dsigCtx->signKey));
+            chain->_validUntil = chainValidUntil;
+            if (chain->_key)
+            {
+                _cryptoSession.getChainCache().insert(chainCacheKey,
+                                                      std::move(chain));
+            }
+        }
+    }
+
+    _signatureContextPool.checkin(std::move(dsigCtx));
+    return ret;
+}
+
+bool XmlSignature::verifyReferences(zip::Archive* zipArchive)
+{
+    xmlNode* signedInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeSignedInfo, xmlSecDSigNs);
+    if (signedInfoNode == nullptr)
+    {
+        _errorString = "could not find signed info";
+        return false;
+    }
+
+    std::unique_ptr<xmlSecDSigCtx> dsigCtx =
+        _signatureContextPool.checkout(_options._insecure, _errorString);
+    if (!dsigCtx)
+    {
+        return false;
+    }
+
+    // Reference processing compares the digests in verify mode.
+    dsigCtx->operation = xmlSecTransformOperationVerify;
+    PrecomputedDigests precomputedDigests;
+    precomputeDigests(zipArchive, precomputedDigests);
+    const std::unique_ptr<Prefetcher> prefetcher =
+        createPrefetcher(zipArchive, precomputedDigests);
+    const XmlSecIOScope ioScope(zipArchive, prefetcher.get(),
+                                _options._cancellation);
+    const PrecomputedDigestsScope precomputedScope(&precomputedDigests);
+    bool ret = false;
+    for (xmlNode* referenceNode =
+             xmlSecGetNextElementNode(signedInfoNode->children);
+         referenceNode != nullptr;
+         referenceNode = xmlSecGetNextElementNode(referenceNode->next))
+    {
+        if (xmlSecCheckNodeName(referenceNode, xmlSecNodeReference,
+                                xmlSecDSigNs) == 0)
+        {
+            continue;
+        }
+
+        if (isStopped())
+        {
+            ret = false;
+            break;
+        }
+
+        // Other signatures typically have the same references, check each
+        // stream only once.
+        std::string reference;
+        if (!canonicalize(referenceNode, reference))
+        {
+            ret = false;
+            break;
+        }
+
+        std::optional<bool> result =
+            _options._referenceResults->get(reference);
+        if (!result)
+        {
+            std::unique_ptr<xmlSecDSigReferenceCtx> referenceCtx(
+                xmlSecDSigReferenceCtxCreate(
+                    dsigCtx.get(), xmlSecDSigReferenceOriginSignedInfo));
+            result = referenceCtx &&
+                     xmlSecDSigReferenceCtxProcessNode(referenceCtx.get(),
+                                                       referenceNode) >= 0 &&
+                     referenceCtx->status == xmlSecDSigStatusSucceeded;
+            if (isStopped())
+            {
+                // The stream was not read completely, don't remember that.
+                ret = false;
+                break;
+            }
+
+            _options._referenceResults->set(reference, *result);
+        }
+
+        ret = *result;
+        if (!ret)
+        {
+            const std::unique_ptr<xmlChar> uri(
+                xmlGetProp(referenceNode, xmlSecAttrURI));
+            _errorString = "digest mismatch for reference '" +
+                           std::string(uri ? fromXmlChar(uri.get()) : "") +
+                           "'";
+            break;
+        }
+    }
+
+    _signatureContextPool.checkin(std::move(dsigCtx));
+    return ret;
+}
+
+std::unique_ptr<Prefetcher> XmlSignature::createPrefetcher(
+    zip::Archive* zipArchive,
+    const PrecomputedDigests& precomputedDigests) const
+{
+    if (_options._prefetchMemory == 0 || _options._zipData == nullptr)
+    {
+        return nullptr;
+    }
+
+    xmlNode* signedInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeSignedInfo, xmlSecDSigNs);
+    if (signedInfoNode == nullptr)
+    {
+        return nullptr;
+    }
+
+    // Same order as xmlsec opens them.
+    std::vector<std::string> names;
+    uint64_t totalSize = 0;
+    for (xmlNode* referenceNode =
+             xmlSecGetNextElementNode(signedInfoNode->children);
+         referenceNode != nullptr;
+         referenceNode = xmlSecGetNextElementNode(referenceNode->next))
+    {
+        if (xmlSecCheckNodeName(referenceNode, xmlSecNodeReference,
+                                xmlSecDSigNs) == 0)
+        {
+            continue;
+        }
+
+        const std::unique_ptr<xmlChar> uriProp(
+            xmlGetProp(referenceNode, xmlSecAttrURI));
+        if (!uriProp || uriProp.get()[0] == '\0' || uriProp.get()[0] == '#')
+        {
+            continue;
+        }
+
+        // xmlsec may open the unescaped name, such streams are read directly.
+        const std::string uri(fromXmlChar(uriProp.get()));
+        if (uri.find('%') != std::string::npos ||
+            precomputedDigests.contains(uri) ||
+            std::find(names.begin(), names.end(), uri) != names.end())
+        {
+            continue;
+        }
+
+        const int64_t index = zipArchive->locateName(uri.c_str());
+        uint64_t size = 0;
+        if (index < 0 || !zipArchive->getSize(index, size))
+        {
+            continue;
+        }
+
+        names.push_back(uri);
+        totalSize += size;
+    }
+
+    if (totalSize < minPrefetchedSize)
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<Prefetcher>(_options._zipData, _options._zipSize,
+                                        std::move(names),
+                                        _options._prefetchMemory);
+}
+
+bool XmlSignature::getStreamMethods(StreamMethods& streams) const
+{
+    xmlNode* signedInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeSignedInfo, xmlSecDSigNs);
+    if (signedInfoNode == nullptr)
+    {
+        return true;
+    }
+
+    for (xmlNode* referenceNode =
+             xmlSecGetNextElementNode(signedInfoNode->children);
+         referenceNode != nullptr;
+         referenceNode = xmlSecGetNextElementNode(referenceNode->next))
+    {
+        if (xmlSecCheckNodeName(referenceNode, xmlSecNodeReference,
+                                xmlSecDSigNs) == 0)
+        {
+            continue;
+        }
+
+        const std::unique_ptr<xmlChar> uriProp(
+            xmlGetProp(referenceNode, xmlSecAttrURI));
+        if (!uriProp || uriProp.get()[0] == '\0' || uriProp.get()[0] == '#')
+        {
+            continue;
+        }
+
+        const std::string uri(fromXmlChar(uriProp.get()));
+        if (uri.find('%') != std::string::npos)
+        {
+            // xmlsec may open the unescaped name, don't guess.
+            return false;
+        }
+
+        std::optional<std::pair<std::string, DigestAlgorithm>> method =
+            std::make_pair(std::string(), DigestAlgorithm{});
+        const std::unique_ptr<xmlChar> algo = getDigestAlgo(referenceNode);
+        if (!getReferenceTransform(referenceNode, method->first) || !algo ||
+            !getDigestAlgorithm(algo.get(), method->second))
+        {
+            method.reset();
+        }
+
+        auto it = streams.find(uri);
+        if (it == streams.end())
+        {
+            streams.emplace(uri, method);
+        }
+        else if (it->second != method)
+        {
+            it->second.reset();
+        }
+    }
+
+    return true;
+}
+
+void XmlSignature::precomputeDigests(zip::Archive* zipArchive,
+                                     PrecomputedDigests& digests) const
+{
+    StreamMethods streams;
+    if (!getStreamMethods(streams))
+    {
+        return;
+    }
+
+    // Other signatures of the document may have digested the stream already,
+    // e.g. the document signature signs the macros as well.
+    StreamDigests* streamDigests = _options._streamDigests;
+    digests.setStreamDigests(streamDigests);
+    std::map<DigestAlgorithm, std::vector<std::string>> batches;
+    for (const auto& stream : streams)
+    {
+        if (!stream.second)
+        {
+            continue;
+        }
+
+        const auto& [transform, algorithm] = *stream.second;
+        if (streamDigests != nullptr)
+        {
+            std::optional<std::vector<unsigned char>> digest =
+                streamDigests->find(stream.first, transform, algorithm);
+            if (digest)
+            {
+                ++streamDigestHits;
+                digests.add(stream.first, transform, algorithm,
+                            std::move(*digest));
+                continue;
+            }
+
+            ++streamDigestMisses;
+        }
+
+        if (transform.empty())
+        {
+            batches[algorithm].push_back(stream.first);
+        }
+    }
+
+    for (const auto& batch : batches)
+    {
+        if (batch.second.size() < 2)
+        {
+            continue;
+        }
+
+        std::vector<std::string> uris;
+        std::vector<std::vector<unsigned char>> messages;
+        for (const std::string& uri : batch.second)
+        {
+            if (_options._cancellation != nullptr &&
+                _options._cancellation->getStopReason() != nullptr)
+            {
+                // Verification will stop on its first read.
+                return;
+            }
+
+            const int64_t index = zipArchive->locateName(uri.c_str());
+            uint64_t size = 0;
+            if (index < 0 || !zipArchive->getSize(index, size) ||
+                size > maxBatchedStreamSize)
+            {
+                continue;
+            }
+
+            std::unique_ptr<zip::File> zipFile =
+                zip::File::create(zipArchive, index);
+            if (!zipFile)
+            {
+                continue;
+            }
+
+            std::vector<unsigned char> message(size);
+            int64_t read = 0;
+            if (size > 0)
+            {
+                read = zipFile->read(message.data(), size);
+            }
+            // Reading past the end also checks the CRC.
+            unsigned char extra = 0;
+            if (read != static_cast<int64_t>(size) ||
+                zipFile->read(&extra, 1) != 0)
+            {
+                continue;
+            }
+
+            uris.push_back(uri);
+            messages.push_back(std::move(message));
+        }
+
+        std::vector<std::vector<unsigned char>> results;
+        if (messages.size() < 2 ||
+            !Digest::hashBatch(batch.first,
+                               Digest::getBestBatchKernel(batch.first),
+                               messages, results))
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < uris.size(); ++i)
+        {
+            digests.record(uris[i], std::string(), batch.first, results[i]);
+            digests.add(uris[i], std::string(), batch.first,
+                        std::move(results[i]));
+        }
+    }
+}
+
+namespace
+{
+/// Selects the subtree of the root passed as user data for C14N.
+int isInSubtree(void* userData, xmlNodePtr node, xmlNodePtr parent)
+{
+    auto* root = static_cast<xmlNode*>(userData);
+    xmlNode* current = parent;
+    if (node != nullptr && node->type != XML_NAMESPACE_DECL)
+    {
+        current = node;
+    }
+
+    for (; current != nullptr; current = current->parent)
+    {
+        if (current == root)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+} // namespace
+
+bool XmlSignature::canonicalize(xmlNode* node, std::string& out)
+{
+    std::unique_ptr<xmlOutputBuffer> buffer(xmlAllocOutputBuffer(nullptr));
+    if (!buffer)
+    {
+        return false;
+    }
+
+    if (xmlC14NExecute(node->doc, isInSubtree, node, XML_C14N_1_0, nullptr,
+                       0, buffer.get()) < 0)
+    {
+        return false;
+    }
+
+    out.assign(reinterpret_cast<const char*>(xmlOutputBufferGetContent(
+                   buffer.get())),
+               xmlOutputBufferGetSize(buffer.get()));
+    return true;
+}
+
+std::string XmlSignature::getIdentity(
+    std::chrono::system_clock::time_point& validUntil) const
+{
+    std::vector<xmlChar> input;
+    auto append = [&input](const std::string& part)
+    {
+        // Length-prefixed, so parts can't be shifted into each other.
+        const std::string size = std::to_string(part.size()) + ':';
+        input.insert(input.end(), size.begin(), size.end());
+        input.insert(input.end(), part.begin(), part.end());
+    };
+    append(_options._trustStoreIdentity);
+    append(_options._insecure ? "insecure" : "secure");
+
+    xmlNode* signedInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeSignedInfo, xmlSecDSigNs);
+    std::string signedInfo;
+    if (signedInfoNode == nullptr || !canonicalize(signedInfoNode, signedInfo))
+    {
+        return {};
+    }
+    append(signedInfo);
+
+    xmlNode* signatureValueNode = xmlSecFindChild(
+        _signatureNode, xmlSecNodeSignatureValue, xmlSecDSigNs);
+    if (signatureValueNode == nullptr)
+    {
+        return {};
+    }
+    const std::unique_ptr<xmlChar> signatureValueContent(
+        xmlNodeGetContent(signatureValueNode));
+    if (!signatureValueContent)
+    {
+        return {};
+    }
+    std::string signatureValue;
+    std::copy_if(
+        signatureValueContent.get(),
+        signatureValueContent.get() + xmlStrlen(signatureValueContent.get()),
+        std::back_inserter(signatureValue),
+        [](xmlChar ch) { return std::isspace(ch) == 0; });
+    append(signatureValue);
+
+    validUntil = std::chrono::system_clock::time_point::max();
+    bool hasCertificate = false;
+    xmlNode* keyInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeKeyInfo, xmlSecDSigNs);
+    for (xmlNode* x509Data = xmlSecFindChild(keyInfoNode, xmlSecNodeX509Data,
+                                             xmlSecDSigNs);
+         x509Data != nullptr;
+         x509Data = xmlSecGetNextElementNode(x509Data->next))
+    {
+        for (xmlNode* x509Certificate = xmlSecFindChild(
+                 x509Data, xmlSecNodeX509Certificate, xmlSecDSigNs);
+             x509Certificate != nullptr;
+             x509Certificate = xmlSecGetNextElementNode(x509Certificate->next))
+        {
+            if (xmlSecCheckNodeName(x509Certificate, xmlSecNodeX509Certificate,
+                                    xmlSecDSigNs) == 0)
+            {
+                continue;
+            }
+
+            std::string fingerprint;
+            std::shared_ptr<const CachedCertificate> certificate =
+                getCachedCertificate(x509Certificate, fingerprint);
+            if (!certificate || !certificate->_notAfter)
+            {
+                return {};
+            }
+
+            append(fingerprint);
+            validUntil = std::min(validUntil, *certificate->_notAfter);
+            hasCertificate = true;
+        }
+    }
+    if (!hasCertificate)
+    {
+        return {};
+    }
+
+    std::vector<unsigned char> digest;
+    if (!hash(input, xmlSecHrefSha256, digest))
+    {
+        return {};
+    }
+
+    std::string identity;
+    const char* hexDigits = "0123456789abcdef";
+    for (const unsigned char byte : digest)
+    {
+        identity += hexDigits[byte >> 4];
+        identity += hexDigits[byte & 0xf];
+    }
+    return identity;
+}
+
+bool XmlSignature::getCertificateBinary(std::vector<xmlChar>& certificate) const
+{
+    // Look up the encoded certificate.
+    xmlNode* x509Certificate = getX509CertificateNode();
+    if (x509Certificate == nullptr)
+    {
+        return false;
+    }
+
+    return decodeCertificate(x509Certificate, certificate);
+}
+
+bool XmlSignature::decodeCertificate(xmlNode* x509Certificate,
+                                     std::vector<xmlChar>& certificate)
+{
+    const std::unique_ptr<xmlChar> certificateContent(
+        xmlNodeGetContent(x509Certificate));
+    if (!certificateContent ||
+        (xmlSecIsEmptyString(certificateContent.get()) != 0))
+    {
+        return false;
+    }
+
+    // Certificate chains may be large, use the vectorized decoder.
+    return base64Decode(fromXmlChar(certificateContent.get()), certificate);
+}
+
+std::shared_ptr<const CachedCertificate>
+XmlSignature::getCachedCertificate() const
+{
+    std::vector<xmlChar> certificate;
+    if (!getCertificateBinary(certificate))
+    {
+        return nullptr;
+    }
+
+    std::vector<unsigned char> fingerprint;
+    if (!hash(certificate, xmlSecHrefSha256, fingerprint))
+    {
+        return nullptr;
+    }
+
+    return _cryptoSession.getCertificateCache().get(
+        std::string(fingerprint.begin(), fingerprint.end()), certificate);
+}
+
+std::shared_ptr<const CachedCertificate>
+XmlSignature::getCachedCertificate(xmlNode* x509Certificate,
+                                   std::string& fingerprint) const
+{
+    std::vector<xmlChar> certificate;
+    if (!decodeCertificate(x509Certificate, certificate))
+    {
+        return nullptr;
+    }
+
+    std::vector<unsigned char> digest;
+    if (!hash(certificate, xmlSecHrefSha256, digest))
+    {
+        return nullptr;
+    }
+
+    fingerprint.assign(digest.begin(), digest.end());
+    return _cryptoSession.getCertificateCache().get(fingerprint, certificate);
+}
+
+std::string XmlSignature::getChainCacheKey(
+    std::chrono::system_clock::time_point& validUntil) const
+{
+    xmlNode* keyInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeKeyInfo, xmlSecDSigNs);
+    if (keyInfoNode == nullptr)
+    {
+        return {};
+    }
+
+    const std::chrono::system_clock::time_point now =
+        std::chrono::system_clock::now();
+    const int64_t bucket = std::chrono::duration_cast<std::chrono::seconds>(
+                               now.time_since_epoch())
+                               .count() /
+                           _options._chainCacheTtl.count();
+    validUntil = std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            _options._chainCacheTtl * (bucket + 1)));
+
+    std::stringstream key;
+    key << _options._trustStoreIdentity << '\n'
+        << _options._chainCacheTtl.count() << '\n'
+        << bucket << '\n';
+    bool hasCertificate = false;
+    for (xmlNode* x509Data = xmlSecGetNextElementNode(keyInfoNode->children);
+         x509Data != nullptr;
+         x509Data = xmlSecGetNextElementNode(x509Data->next))
+    {
+        // Other kinds of key info may provide a key without a chain.
+        if (xmlSecCheckNodeName(x509Data, xmlSecNodeX509Data, xmlSecDSigNs) ==
+            0)
+        {
+            return {};
+        }
+
+        for (xmlNode* x509DataChild =
+                 xmlSecGetNextElementNode(x509Data->children);
+             x509DataChild != nullptr;
+             x509DataChild = xmlSecGetNextElementNode(x509DataChild->next))
+        {
+            std::string value;
+            if (xmlSecCheckNodeName(x509DataChild, xmlSecNodeX509Certificate,
+                                    xmlSecDSigNs) != 0)
+            {
+                std::shared_ptr<const CachedCertificate> certificate =
+                    getCachedCertificate(x509DataChild, value);
+                if (!certificate || !certificate->_notAfter)
+                {
+                    return {};
+                }
+
+                validUntil = std::min(validUntil, *certificate->_notAfter);
+                hasCertificate = true;
+            }
+            else
+            {
+                // Issuer serial, subject name, etc: affects the certificate
+                // lookup.
+                const std::unique_ptr<xmlChar> content(
+                    xmlNodeGetContent(x509DataChild));
+                if (content)
+                {
+                    value = fromXmlChar(content.get());
+                }
+            }
+
+            key << fromXmlChar(x509DataChild->name) << ' ' << value.size()
+                << ' ' << value;
+        }
+    }
+
+    if (!hasCertificate)
+    {
+        return {};
+    }
+
+    return key.str();
+}
+
+bool XmlSignature::hasSingleCertificateKeyInfo() const
+{
+    xmlNode* keyInfoNode =
+        xmlSecFindChild(_signatureNode, xmlSecNodeKeyInfo, xmlSecDSigNs);
+    if (keyInfoNode == nullptr)
+    {
+        return false;
+    }
+
+    xmlNode* x509Data = xmlSecGetNextElementNode(keyInfoNode->children);
+    if (x509Data == nullptr ||
+        xmlSecCheckNodeName(x509Data, xmlSecNodeX509Data, xmlSecDSigNs) == 0 ||
+        xmlSecGetNextElementNode(x509Data->next) != nullptr)
+    {
+        return false;
+    }
+
+    int certificates = 0;
+    for (xmlNode* x509DataChild = xmlSecGetNextElementNode(x509Data->children);
+         x509DataChild != nullptr;
+         x509DataChild = xmlSecGetNextElementNode(x509DataChild->next))
+    {
+        if (xmlSecCheckNodeName(x509DataChild, xmlSecNodeX509Certificate,
+                                xmlSecDSigNs) != 0)
+        {
+            ++certificates;
+        }
+    }
+
+    return certificates == 1;
+}
+
+xmlNodePtr XmlSignature::getCertDigestNode() const
+{
+    xmlNodePtr certDigestNode = nullptr;
+    for (xmlNode* signatureChild = _signatureNode->children;
+         signatureChild != nullptr; signatureChild = signatureChild->next)
+    {
+        if (xmlSecCheckNodeName(signatureChild, xmlSecNodeObject,
+                                xmlSecDSigNs) == 0)
+        {
+            continue;
+        }
 
         certDigestNode = getObjectCertDigestNode(signatureChild);
         if (certDigestNode != nullptr)
@@ -404,20 +2410,7 @@ bool XmlSignature::getDigestValue(xmlNodePtr certDigest,
         return false;
     }
 
-    // Decode the expected hash in-place.
-    xmlSecSize expectedDigestSize;
-    if (xmlSecBase64Decode_ex(digestValueNodeContent.get(),
-                              (xmlSecByte*)digestValueNodeContent.get(),
-                              xmlStrlen(digestValueNodeContent.get()),
-                              &expectedDigestSize) < 0)
-    {
-        return false;
-    }
-
-    std::copy(digestValueNodeContent.get(),
-              digestValueNodeContent.get() + expectedDigestSize,
-              std::back_inserter(value));
-    return true;
+    return base64Decode(fromXmlChar(digestValueNodeContent.get()), value);
 }
 
 std::unique_ptr<xmlChar> XmlSignature::getDigestAlgo(xmlNodePtr certDigest)
@@ -440,9 +2433,30 @@ std::unique_ptr<xmlChar> XmlSignature::getDigestAlgo(xmlNodePtr certDigest)
 }
 
 bool XmlSignature::hash(const std::vector<xmlChar>& input,
-                        std::unique_ptr<xmlChar> algo,
-                        std::vector<unsigned char>& out)
+                        const xmlChar* algo, std::vector<unsigned char>& out)
 {
+    DigestAlgorithm algorithm{};
+    if (getDigestAlgorithm(algo, algorithm))
+    {
+        // No need for a transform context to hash a small buffer.
+        std::unique_ptr<Digest> digest =
+            Digest::create(algorithm, Digest::getBestKernel(algorithm));
+        if (!digest)
+        {
+            return false;
+        }
+
+        digest->update(input.data(), input.size());
+        std::vector<unsigned char> result;
+        if (!digest->finish(result))
+        {
+            return false;
+        }
+
+        out.insert(out.end(), result.begin(), result.end());
+        return true;
+    }
+
     std::unique_ptr<xmlSecTransformCtx> transform(xmlSecTransformCtxCreate());
     if (!transform)
     {
@@ -450,7 +2464,7 @@ bool XmlSignature::hash(const std::vector<xmlChar>& input,
     }
 
     xmlSecTransformId transformId = xmlSecTransformIdListFindByHref(
-        xmlSecTransformIdsGet(), algo.get(), xmlSecTransformUsageDigestMethod);
+        xmlSecTransformIdsGet(), algo, xmlSecTransformUsageDigestMethod);
     if (transformId == xmlSecTransformIdUnknown)
     {
         return false;
@@ -508,7 +2522,7 @@ bool XmlSignature::verifyXAdES()
     }
 
     std::vector<unsigned char> actualDigest;
-    if (!hash(certificate, std::move(algo), actualDigest))
+    if (!hash(certificate, algo.get(), actualDigest))
     {
         _errorString = "could not hash certificate";
         return false;
@@ -529,14 +2543,14 @@ xmlNode* XmlSignature::getX509CertificateNode() const
 
 std::string XmlSignature::getSubjectName() const
 {
-    std::vector<xmlChar> certificate;
-    if (!getCertificateBinary(certificate))
+    std::shared_ptr<const CachedCertificate> certificate =
+        getCachedCertificate();
+    if (!certificate)
     {
         return {};
     }
 
-    return _crypto.getCertificateSubjectName(certificate.data(),
-                                             certificate.size());
+    return certificate->_subjectName;
 }
 
 std::string XmlSignature::getMethod() const
@@ -606,6 +2620,8 @@ std::set<std::string> XmlSignature::getSignedStreams() const
     return signedStreams;
 }
 
+SignatureKind XmlSignature::getKind() const { return _kind; }
+
 std::string XmlSignature::getType() const
 {
     if (getCertDigestNode() != nullptr)
@@ -764,189 +2780,737 @@ class ZipVerifier : public Verifier
 
     bool openZip(const std::string& path) override;
 
+    bool openStream(std::istream& stream, size_t sizeHint) override;
+
     bool openZipMemory(const void* data, size_t size) override;
 
     [[nodiscard]] const std::string& getErrorString() const override;
 
+    [[nodiscard]] bool isLimitExceeded() const override;
+
+    [[nodiscard]] bool isDamaged() const override;
+
     void setTrustedDers(const std::vector<std::string>& trustedDers) override;
 
     void setInsecure(bool insecure) override;
 
+    void setChainCacheTtl(std::chrono::seconds ttl) override;
+
+    void setVerdictStore(const std::string& path) override;
+
+    void setPrefetchMemory(size_t bytes) override;
+
+    void setLimits(const Limits& limits) override;
+
+    void setIntegrityCheck(bool integrityCheck) override;
+
+    void setDeadline(std::chrono::steady_clock::time_point deadline) override;
+
+    void cancel() override;
+
     bool parseSignatures() override;
 
     std::vector<std::unique_ptr<Signature>>& getSignatures() override;
 
+    std::vector<bool> verifyAll(size_t parallelism) override;
+
     [[nodiscard]] std::set<std::string> getStreams() const override;
 
+    [[nodiscard]] std::set<std::string> getMacroStreams() const override;
+
+    void reset() override;
+
+    bool initializeCrypto() override;
+
   private:
+    /// Locates the signature streams, returns false if there are none.
     bool locateSignatures();
 
+    /**
+     * Reads the signatures stream at zipIndex to bytes. With the integrity
+     * check, also checks its CRC-32, before anything is parsed.
+     */
+    bool readSignaturesStream(int64_t zipIndex, std::vector<char>& bytes);
+
+    /// Parses the signatures of one kind to doc.
+    bool parseSignaturesStream(const std::vector<char>& bytes,
+                               SignatureKind kind,
+                               std::unique_ptr<xmlDoc>& doc);
+
+    /// Checks the zip limits, using only the central directory.
+    bool checkArchiveLimits();
+
+    /// Checks the limits of the parsed signatures stream.
+    bool checkSignaturesLimits(xmlNode* signaturesRoot);
+
+    /// Fails with a limit error, what describes the exceeded limit.
+    bool failLimit(const std::string& what);
+
+    /**
+     * Reads all zip entries and checks their CRC-32, digesting the signed
+     * streams in the same pass. The signatures streams are checked earlier,
+     * by readSignaturesStream().
+     */
+    bool checkIntegrity();
+
+    /// Fails with a damaged package error, what describes the damage.
+    bool failDamaged(const std::string& what);
+
+    /// Sets the error string if the deadline passed or cancel() was called.
+    bool isStopped();
+
+    /**
+     * Describes the trust inputs (crypto config, trusted DERs, certificate
+     * database), so changes of them can be detected.
+     */
+    [[nodiscard]] std::string getTrustStoreIdentity() const;
+
     std::vector<char> _zipContents;
 
+    /// The data passed to openZipMemory(), to create more archives from it.
+    const void* _zipData = nullptr;
+
+    size_t _zipSize = 0;
+
     std::unique_ptr<zip::Source> _zipSource;
 
-    std::unique_ptr<zip::Archive> _zipArchive;
+    std::unique_ptr<zip::Archive> _zipArchive;
+
+    std::string _errorString;
+
+    Limits _limits;
+
+    bool _limitExceeded = false;
+
+    bool _integrityCheck = false;
+
+    bool _damaged = false;
+
+    /// Reused by checkIntegrity().
+    std::vector<unsigned char> _integrityBuffer;
+
+    int64_t _signaturesZipIndex = -1;
+
+    int64_t _macroSignaturesZipIndex = -1;
+
+    std::shared_ptr<CryptoSession> _cryptoSession;
+
+    std::unique_ptr<zip::File> _zipFile;
+
+    std::vector<char> _signaturesBytes;
+
+    std::vector<char> _macroSignaturesBytes;
+
+    std::unique_ptr<xmlParserCtxt> _parserContext;
+
+    /// The _private data of _parserContext.
+    ParserDepthLimit _parserDepthLimit;
+
+    std::unique_ptr<xmlDoc> _signaturesDoc;
+
+    std::unique_ptr<xmlDoc> _macroSignaturesDoc;
+
+    std::vector<std::unique_ptr<Signature>> _signatures;
+
+    std::string _cryptoConfig;
+
+    std::vector<std::string> _trustedDers;
+
+    SignatureOptions _signatureOptions;
+
+    std::string _verdictStorePath;
+
+    std::unique_ptr<VerdictStore> _verdictStore;
+
+    ReferenceResults _referenceResults;
+
+    StreamDigests _streamDigests;
+
+    Cancellation _cancellation;
+};
+
+std::unique_ptr<Verifier> Verifier::create(const std::string& cryptoConfig)
+{
+    return std::unique_ptr<Verifier>(new ZipVerifier(cryptoConfig));
+}
+
+ZipVerifier::ZipVerifier(const std::string& cryptoConfig)
+{
+    _cryptoConfig = cryptoConfig;
+    _signatureOptions._streamDigests = &_streamDigests;
+    _signatureOptions._cancellation = &_cancellation;
+}
+
+bool ZipVerifier::openZip(const std::string& path)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        return false;
+    }
+
+    // Size the buffer from the file size, if it's known.
+    std::error_code errorCode;
+    const std::uintmax_t fileSize = std::filesystem::file_size(path, errorCode);
+    size_t sizeHint = 0;
+    if (!errorCode)
+    {
+        sizeHint = static_cast<size_t>(fileSize);
+    }
+
+    return openStream(stream, sizeHint);
+}
+
+bool ZipVerifier::openStream(std::istream& stream, size_t sizeHint)
+{
+    try
+    {
+        // Read directly into the final buffer, so the data is copied only
+        // once. The extra byte allows detecting EOF without growing the
+        // buffer when the hint is exact. The hint may be wrong, so larger
+        // inputs grow the buffer as they are read.
+        const size_t minBufferSize = 65536;
+        const size_t maxUpfrontSize = 64 * 1024 * 1024;
+        _zipContents.resize(
+            std::max(std::min(sizeHint, maxUpfrontSize) + 1, minBufferSize));
+        size_t size = 0;
+        while (stream)
+        {
+            if (size == _zipContents.size())
+            {
+                _zipContents.resize(_zipContents.size() * 2);
+            }
+
+            stream.read(_zipContents.data() + size,
+                        static_cast<std::streamsize>(_zipContents.size() -
+                                                     size));
+            size += static_cast<size_t>(stream.gcount());
+        }
+        if (stream.bad())
+        {
+            _errorString = "Failed to read the input stream";
+            return false;
+        }
+
+        _zipContents.resize(size);
+        return openZipMemory(_zipContents.data(), _zipContents.size());
+    }
+    catch (std::ios_base::failure& failure)
+    {
+        _errorString = failure.what();
+        return false;
+    }
+    catch (const std::length_error&)
+    {
+        _errorString = "The input stream is too large";
+        return false;
+    }
+    catch (const std::bad_alloc&)
+    {
+        _errorString = "Out of memory reading the input stream";
+        return false;
+    }
+}
+
+bool ZipVerifier::openZipMemory(const void* data, size_t size)
+{
+    _limitExceeded = false;
+    _damaged = false;
+    // The digests and reference results of an other document don't apply.
+    _streamDigests.clear();
+    _referenceResults.clear();
+    _zipData = data;
+    _zipSize = size;
+    _signatureOptions._zipData = data;
+    _signatureOptions._zipSize = size;
+    std::unique_ptr<zip::Error> zipError = zip::Error::create();
+    _zipSource = zip::Source::create(data, size, zipError.get());
+    if (!_zipSource)
+    {
+        _errorString = zipError->getString();
+        return false;
+    }
+
+    _zipArchive = zip::Archive::create(_zipSource.get(), zipError.get());
+    if (!_zipArchive)
+    {
+        _errorString = zipError->getString();
+        return false;
+    }
+
+    return checkArchiveLimits();
+}
+
+bool ZipVerifier::checkArchiveLimits()
+{
+    const int64_t numEntries = _zipArchive->getNumEntries();
+    if (numEntries < 0)
+    {
+        return true;
+    }
+
+    if (_limits._maxEntries > 0 &&
+        static_cast<uint64_t>(numEntries) > _limits._maxEntries)
+    {
+        return failLimit(std::to_string(numEntries) + " zip entries");
+    }
+
+    if (_limits._maxTotalSize == 0 && _limits._maxCompressionRatio == 0)
+    {
+        return true;
+    }
+
+    uint64_t totalSize = 0;
+    for (int64_t entry = 0; entry < numEntries; ++entry)
+    {
+        uint64_t size = 0;
+        uint64_t compressedSize = 0;
+        if (!_zipArchive->getSize(entry, size) ||
+            !_zipArchive->getCompressedSize(entry, compressedSize))
+        {
+            continue;
+        }
+
+        totalSize += std::min(size, UINT64_MAX - totalSize);
+        if (_limits._maxTotalSize > 0 && totalSize > _limits._maxTotalSize)
+        {
+            return failLimit("more than " +
+                             std::to_string(_limits._maxTotalSize) +
+                             " uncompressed bytes");
+        }
+
+        if (_limits._maxCompressionRatio > 0 && size >= minRatioCheckedSize &&
+            size / _limits._maxCompressionRatio > compressedSize)
+        {
+            return failLimit("compression ratio of '" +
+                             _zipArchive->getName(entry) + "'");
+        }
+    }
+
+    return true;
+}
+
+bool ZipVerifier::failLimit(const std::string& what)
+{
+    _limitExceeded = true;
+    _errorString = "Resource limit exceeded: " + what;
+    return false;
+}
+
+bool ZipVerifier::checkIntegrity()
+{
+    // The streams are decompressed anyway, so digest the signed ones in the
+    // same pass, then verification finds them in the stream digests.
+    StreamMethods streams;
+    for (const auto& signature : _signatures)
+    {
+        if (!static_cast<XmlSignature*>(signature.get())
+                 ->getStreamMethods(streams))
+        {
+            streams.clear();
+            break;
+        }
+    }
+
+    const int64_t numEntries = _zipArchive->getNumEntries();
+    const size_t bufferSize = 64 * 1024;
+    _integrityBuffer.resize(bufferSize);
+    for (int64_t entry = 0; entry < numEntries; ++entry)
+    {
+        if (isStopped())
+        {
+            return false;
+        }
+
+        if (entry == _signaturesZipIndex || entry == _macroSignaturesZipIndex)
+        {
+            continue;
+        }
 
-    std::string _errorString;
+        const std::string name = _zipArchive->getName(entry);
+        uint32_t crc = 0;
+        if (!_zipArchive->getCrc(entry, crc))
+        {
+            return failDamaged("no CRC-32 for '" + name + "'");
+        }
 
-    int64_t _signaturesZipIndex = 0;
+        // The zip reader compares the CRC-32 at the end of the stream.
+        std::unique_ptr<zip::File> file =
+            zip::File::create(_zipArchive.get(), entry);
+        if (!file)
+        {
+            return failDamaged("can't open '" + name + "': " +
+                               _zipArchive->getErrorString());
+        }
 
-    std::unique_ptr<XmlGuard> _xmlGuard;
+        std::optional<StreamHasher> hasher;
+        auto it = streams.find(name);
+        if (it != streams.end() && it->second)
+        {
+            hasher.emplace(it->second->first, it->second->second);
+        }
 
-    std::unique_ptr<Crypto> _crypto;
+        while (true)
+        {
+            const int64_t read =
+                file->read(_integrityBuffer.data(), _integrityBuffer.size());
+            if (read < 0)
+            {
+                return failDamaged("can't read '" + name + "': " +
+                                   file->getErrorString());
+            }
+
+            if (hasher)
+            {
+                hasher->update(
+                    reinterpret_cast<const char*>(_integrityBuffer.data()),
+                    static_cast<size_t>(read), /*final=*/read == 0);
+            }
+
+            if (read == 0)
+            {
+                break;
+            }
+
+            // Large entries take long to inflate.
+            if (isStopped())
+            {
+                return false;
+            }
+        }
 
-    std::unique_ptr<XmlSecGuard> _xmlSecGuard;
+        std::vector<unsigned char> digest;
+        if (hasher && hasher->finish(digest))
+        {
+            _streamDigests.add(name, it->second->first, it->second->second,
+                               std::move(digest));
+        }
+    }
 
-    std::unique_ptr<zip::File> _zipFile;
+    return true;
+}
 
-    std::vector<char> _signaturesBytes;
+bool ZipVerifier::failDamaged(const std::string& what)
+{
+    _damaged = true;
+    _errorString = "Package is damaged: " + what;
+    return false;
+}
 
-    std::unique_ptr<xmlDoc> _signaturesDoc;
+bool ZipVerifier::isStopped()
+{
+    const char* reason = _cancellation.getStopReason();
+    if (reason == nullptr)
+    {
+        return false;
+    }
 
-    std::vector<std::unique_ptr<Signature>> _signatures;
+    _errorString = reason;
+    return true;
+}
 
-    std::string _cryptoConfig;
+const std::string& ZipVerifier::getErrorString() const { return _errorString; }
 
-    std::vector<std::string> _trustedDers;
+bool ZipVerifier::isLimitExceeded() const { return _limitExceeded; }
 
-    bool _insecure = false;
-};
+bool ZipVerifier::isDamaged() const { return _damaged; }
 
-std::unique_ptr<Verifier> Verifier::create(const std::string& cryptoConfig)
+void ZipVerifier::setTrustedDers(const std::vector<std::string>& trustedDers)
 {
-    return std::unique_ptr<Verifier>(new ZipVerifier(cryptoConfig));
+    _trustedDers = trustedDers;
 }
 
-ZipVerifier::ZipVerifier(const std::string& cryptoConfig)
+void ZipVerifier::setInsecure(bool insecure)
 {
-    _cryptoConfig = cryptoConfig;
+    _signatureOptions._insecure = insecure;
 }
 
-bool ZipVerifier::openZip(const std::string& path)
+void ZipVerifier::setChainCacheTtl(std::chrono::seconds ttl)
 {
-    std::ifstream stream(path, std::ios::binary);
-    if (!stream.is_open())
-    {
-        return false;
-    }
+    _signatureOptions._chainCacheTtl = ttl;
+}
 
-    try
-    {
-        _zipContents =
-            std::vector<char>((std::istreambuf_iterator<char>(stream)),
-                              std::istreambuf_iterator<char>());
-        return openZipMemory(_zipContents.data(), _zipContents.size());
-    }
-    catch (std::ios_base::failure& failure)
+void ZipVerifier::setVerdictStore(const std::string& path)
+{
+    if (path != _verdictStorePath)
     {
-        _errorString = failure.what();
-        return false;
+        // Loaded again by the next parseSignatures().
+        _verdictStore.reset();
+        _signatureOptions._verdictStore = nullptr;
+        _signatureOptions._referenceResults = nullptr;
     }
+    _verdictStorePath = path;
 }
 
-bool ZipVerifier::openZipMemory(const void* data, size_t size)
+void ZipVerifier::setPrefetchMemory(size_t bytes)
 {
-    std::unique_ptr<zip::Error> zipError = zip::Error::create();
-    _zipSource = zip::Source::create(data, size, zipError.get());
-    if (!_zipSource)
-    {
-        _errorString = zipError->getString();
-        return false;
-    }
+    _signatureOptions._prefetchMemory = bytes;
+}
 
-    _zipArchive = zip::Archive::create(_zipSource.get(), zipError.get());
-    if (!_zipArchive)
-    {
-        _errorString = zipError->getString();
-        return false;
-    }
+void ZipVerifier::setLimits(const Limits& limits) { _limits = limits; }
 
-    return true;
+void ZipVerifier::setIntegrityCheck(bool integrityCheck)
+{
+    _integrityCheck = integrityCheck;
 }
 
-const std::string& ZipVerifier::getErrorString() const { return _errorString; }
-
-void ZipVerifier::setTrustedDers(const std::vector<std::string>& trustedDers)
+void ZipVerifier::setDeadline(std::chrono::steady_clock::time_point deadline)
 {
-    _trustedDers = trustedDers;
+    _cancellation.setDeadline(deadline);
 }
 
-void ZipVerifier::setInsecure(bool insecure) { _insecure = insecure; }
+void ZipVerifier::cancel() { _cancellation.cancel(); }
+
+std::string ZipVerifier::getTrustStoreIdentity() const
+{
+    std::vector<std::string> paths = _trustedDers;
+    std::vector<std::string> trustStoreFiles =
+        _cryptoSession->getCrypto().getTrustStoreFiles(_cryptoConfig);
+    paths.insert(paths.end(), trustStoreFiles.begin(), trustStoreFiles.end());
+
+    std::stringstream identity;
+    identity << _cryptoConfig;
+    for (const auto& path : paths)
+    {
+        identity << '\n' << path;
+
+        // The modification time of a directory changes when files are added
+        // or removed.
+        std::error_code errorCode;
+        const std::filesystem::file_time_type time =
+            std::filesystem::last_write_time(path, errorCode);
+        if (errorCode)
+        {
+            continue;
+        }
+
+        identity << ' ' << time.time_since_epoch().count();
+        const std::uintmax_t size = std::filesystem::file_size(path, errorCode);
+        if (!errorCode)
+        {
+            identity << ' ' << size;
+        }
+    }
+
+    return identity.str();
+}
 
 bool ZipVerifier::parseSignatures()
 {
+    _limitExceeded = false;
+    _damaged = false;
     if (!locateSignatures())
     {
         // No problem, later getSignatures() will return an empty list.
-        return true;
+        return !_integrityCheck || checkIntegrity();
     }
 
-    _xmlGuard = std::make_unique<XmlGuard>();
+    for (const int64_t zipIndex :
+         {_signaturesZipIndex, _macroSignaturesZipIndex})
+    {
+        uint64_t signaturesSize = 0;
+        if (zipIndex >= 0 && _limits._maxSignaturesSize > 0 &&
+            _zipArchive->getSize(zipIndex, signaturesSize) &&
+            signaturesSize > _limits._maxSignaturesSize)
+        {
+            return failLimit(std::to_string(signaturesSize) +
+                             " bytes of signatures");
+        }
+    }
 
-    _crypto = Crypto::create();
-    if (!_crypto->initialize(_cryptoConfig))
+    // A damaged signatures stream is reported as such, not as bad XML.
+    if (!(_signaturesZipIndex < 0 ||
+          readSignaturesStream(_signaturesZipIndex, _signaturesBytes)) ||
+        !(_macroSignaturesZipIndex < 0 ||
+          readSignaturesStream(_macroSignaturesZipIndex,
+                               _macroSignaturesBytes)))
     {
-        _errorString = "Failed to initialize crypto";
         return false;
     }
 
-    _xmlSecGuard = std::make_unique<XmlSecGuard>(_zipArchive.get(), *_crypto);
-    if (!_xmlSecGuard->isGood())
+    if (!initializeCrypto())
+    {
+        return false;
+    }
+
+    if (!_signatureOptions._insecure)
+    {
+        _signatureOptions._trustStoreIdentity = getTrustStoreIdentity();
+        if (_signatureOptions._chainCacheTtl.count() > 0)
+        {
+            _cryptoSession->getChainCache().setTrustStoreIdentity(
+                _signatureOptions._trustStoreIdentity);
+        }
+    }
+
+    if (!_verdictStorePath.empty() && !_verdictStore)
+    {
+        _verdictStore = std::make_unique<VerdictStore>(_verdictStorePath);
+        if (!_verdictStore->load(_errorString))
+        {
+            return false;
+        }
+
+        _signatureOptions._verdictStore = _verdictStore.get();
+        _signatureOptions._referenceResults = &_referenceResults;
+    }
+
+    // Both kinds share the archive, the crypto session and the stream
+    // digests.
+    if (!(_signaturesZipIndex < 0 ||
+          parseSignaturesStream(_signaturesBytes, SignatureKind::Document,
+                                _signaturesDoc)) ||
+        !(_macroSignaturesZipIndex < 0 ||
+          parseSignaturesStream(_macroSignaturesBytes, SignatureKind::Macro,
+                                _macroSignaturesDoc)))
     {
-        _errorString = "Failed to initialize libxmlsec";
         return false;
     }
 
-    _zipFile = zip::File::create(_zipArchive.get(), _signaturesZipIndex);
+    // After parsing, so the signed streams are known.
+    return !_integrityCheck || checkIntegrity();
+}
+
+bool ZipVerifier::readSignaturesStream(int64_t zipIndex,
+                                       std::vector<char>& bytes)
+{
+    _zipFile = zip::File::create(_zipArchive.get(), zipIndex);
     if (!_zipFile)
     {
         std::stringstream stream;
-        stream << "Can't open file at index " << _signaturesZipIndex << ":"
+        stream << "Can't open file at index " << zipIndex << ":"
                << _zipArchive->getErrorString();
         _errorString = stream.str();
         return false;
     }
 
-    const int bufferSize = 8192;
-    std::vector<char> readBuffer(bufferSize);
+    // Read in place, so a reset verifier reuses the capacity of the buffer.
+    const size_t bufferSize = 8192;
+    bytes.clear();
     int64_t readSize;
-    while ((readSize = _zipFile->read(readBuffer.data(), readBuffer.size())) >
-           0)
+    while (true)
     {
-        _signaturesBytes.insert(_signaturesBytes.end(), readBuffer.begin(),
-                                readBuffer.begin() + readSize);
+        const size_t size = bytes.size();
+        bytes.resize(size + bufferSize);
+        readSize = _zipFile->read(bytes.data() + size, bufferSize);
+        bytes.resize(size + std::max<int64_t>(readSize, 0));
+        if (readSize <= 0)
+        {
+            break;
+        }
+
+        if (_limits._maxSignaturesSize > 0 &&
+            bytes.size() > _limits._maxSignaturesSize)
+        {
+            return failLimit("more than " +
+                             std::to_string(_limits._maxSignaturesSize) +
+                             " bytes of signatures");
+        }
     }
+
+    const std::string name = _zipArchive->getName(zipIndex);
     if (readSize == -1)
     {
-        std::stringstream stream;
-        stream << "Can't read file at index " << _signaturesZipIndex << ": "
-               << _zipFile->getErrorString();
-        _errorString = stream.str();
+        return failDamaged("can't read '" + name +
+                           "': " + _zipFile->getErrorString());
+    }
+
+    if (!_integrityCheck)
+    {
+        return true;
+    }
+
+    // Don't depend on the zip reader to notice a truncated stream.
+    uint64_t expectedSize = 0;
+    uint32_t expectedCrc = 0;
+    if (!_zipArchive->getSize(zipIndex, expectedSize) ||
+        !_zipArchive->getCrc(zipIndex, expectedCrc))
+    {
+        return failDamaged("no size or CRC-32 for '" + name + "'");
+    }
+
+    uint32_t crc = 0;
+    crc32Update(reinterpret_cast<const unsigned char*>(bytes.data()),
+                bytes.size(), crc);
+    if (bytes.size() != expectedSize || crc != expectedCrc)
+    {
+        return failDamaged("CRC-32 mismatch in '" + name + "'");
+    }
+
+    return true;
+}
+
+bool ZipVerifier::parseSignaturesStream(const std::vector<char>& bytes,
+                                        SignatureKind kind,
+                                        std::unique_ptr<xmlDoc>& doc)
+{
+    if (bytes.size() > static_cast<size_t>(INT_MAX))
+    {
+        _errorString = "Signatures stream is too large";
         return false;
     }
 
-    // xmlParseDoc() expects a zero-terminated string.
-    _signaturesBytes.push_back(0);
-    _signaturesDoc.reset(
-        xmlParseDoc(reinterpret_cast<xmlChar*>(_signaturesBytes.data())));
-    if (!_signaturesDoc)
+    // A reused parser context also reuses its dictionary of names. The
+    // dictionary never shrinks, so start over once documents with many
+    // distinct names grew it. Parsed documents keep a reference to it.
+    const int maxParserDictSize = 4096;
+    if (_parserContext &&
+        xmlDictSize(_parserContext->dict) > maxParserDictSize)
+    {
+        _parserContext.reset();
+    }
+    if (!_parserContext)
+    {
+        _parserContext.reset(xmlNewParserCtxt());
+        _parserContext->sax->startElementNs = startElementLimited;
+        _parserContext->sax->endElementNs = endElementLimited;
+        _parserContext->_private = &_parserDepthLimit;
+    }
+    _parserDepthLimit = ParserDepthLimit();
+    _parserDepthLimit._maxDepth = _limits._maxXmlDepth;
+    doc.reset(xmlCtxtReadMemory(
+        _parserContext.get(), bytes.data(), static_cast<int>(bytes.size()),
+        nullptr, nullptr, 0));
+    if (_parserDepthLimit._exceeded)
+    {
+        // The stopped parser may still return the partial tree.
+        doc.reset();
+        return failLimit("signatures nested more than " +
+                         std::to_string(_limits._maxXmlDepth) +
+                         " elements deep");
+    }
+
+    if (!doc)
     {
         _errorString = "Parsing the signatures file failed";
         return false;
     }
 
-    xmlNode* signaturesRoot = xmlDocGetRootElement(_signaturesDoc.get());
+    xmlNode* signaturesRoot = xmlDocGetRootElement(doc.get());
     if (signaturesRoot == nullptr)
     {
         _errorString = "Could not get the signatures root";
         return false;
     }
 
+    if (!checkSignaturesLimits(signaturesRoot))
+    {
+        return false;
+    }
+
+    // Register the IDs upfront: verification does it as well, but then it only
+    // reads the document, so signatures can be verified concurrently.
+    const xmlChar* idAttributes[] = {xmlSecAttrId, nullptr};
+    xmlSecAddIDs(doc.get(), signaturesRoot, idAttributes);
+
+    SignatureContextPool& signatureContextPool =
+        _cryptoSession->getSignatureContextPool();
     for (xmlNode* signatureNode = signaturesRoot->children;
          signatureNode != nullptr; signatureNode = signatureNode->next)
     {
         _signatures.push_back(std::unique_ptr<Signature>(new XmlSignature(
-            signatureNode, *_crypto, _trustedDers, _insecure)));
+            signatureNode, *_cryptoSession, signatureContextPool,
+            _zipArchive.get(), _signatureOptions, kind)));
     }
 
     return true;
@@ -957,6 +3521,89 @@ std::vector<std::unique_ptr<Signature>>& ZipVerifier::getSignatures()
     return _signatures;
 }
 
+std::vector<bool> ZipVerifier::verifyAll(size_t parallelism)
+{
+    if (parallelism == 0)
+    {
+        parallelism = std::max(std::thread::hardware_concurrency(), 1U);
+    }
+    parallelism = std::min(parallelism, _signatures.size());
+
+    std::vector<bool> results;
+    if (parallelism <= 1)
+    {
+        for (const auto& signature : _signatures)
+        {
+            results.push_back(signature->verify());
+        }
+        return results;
+    }
+
+    // std::vector<bool> elements can't be written concurrently.
+    std::vector<char> verdicts(_signatures.size());
+    std::atomic<size_t> next(0);
+    // The libxml2 error handlers are per thread, pass the caller's ones on.
+    // The default xmlsec error callback reports via the generic one, and a
+    // custom xmlsec callback is process-wide already.
+    xmlGenericErrorFunc genericError = xmlGenericError;
+    void* genericErrorContext = xmlGenericErrorContext;
+    xmlStructuredErrorFunc structuredError = xmlStructuredError;
+    void* structuredErrorContext = xmlStructuredErrorContext;
+    auto worker = [this, &verdicts, &next, genericError, genericErrorContext,
+                   structuredError, structuredErrorContext]()
+    {
+        xmlSetGenericErrorFunc(genericErrorContext, genericError);
+        xmlSetStructuredErrorFunc(structuredErrorContext, structuredError);
+
+        // A libzip archive can't be used concurrently, so each thread opens
+        // its own one from the same memory.
+        std::unique_ptr<zip::Error> zipError = zip::Error::create();
+        std::unique_ptr<zip::Source> zipSource =
+            zip::Source::create(_zipData, _zipSize, zipError.get());
+        std::unique_ptr<zip::Archive> zipArchive;
+        if (zipSource)
+        {
+            zipArchive = zip::Archive::create(zipSource.get(), zipError.get());
+        }
+        std::string archiveError;
+        if (!zipArchive)
+        {
+            archiveError = zipError->getString();
+        }
+
+        for (size_t index = next++; index < _signatures.size();
+             index = next++)
+        {
+            // All signatures are created by parseSignatures().
+            auto* signature =
+                static_cast<XmlSignature*>(_signatures[index].get());
+            if (!zipArchive)
+            {
+                verdicts[index] = signature->fail(archiveError);
+                continue;
+            }
+
+            verdicts[index] = signature->verifyWithArchive(zipArchive.get());
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < parallelism; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::transform(verdicts.begin(), verdicts.end(),
+                   std::back_inserter(results),
+                   [](char verdict) { return verdict != 0; });
+    return results;
+}
+
 std::set<std::string> ZipVerifier::getStreams() const
 {
     std::set<std::string> streams;
@@ -984,11 +3631,188 @@ std::set<std::string> ZipVerifier::getStreams() const
     return streams;
 }
 
+std::set<std::string> ZipVerifier::getMacroStreams() const
+{
+    std::set<std::string> macroStreams;
+    for (const auto& stream : getStreams())
+    {
+        if (std::any_of(macroStorageNames.begin(), macroStorageNames.end(),
+                        [&stream](const char* storageName)
+                        { return stream.starts_with(storageName); }))
+        {
+            macroStreams.insert(stream);
+        }
+    }
+    return macroStreams;
+}
+
+bool ZipVerifier::initializeCrypto()
+{
+    // A reset verifier keeps its session, unless the settings changed.
+    if (!_cryptoSession ||
+        !_cryptoSession->hasSettings(_cryptoConfig, _trustedDers))
+    {
+        _cryptoSession.reset();
+        _cryptoSession =
+            CryptoSession::acquire(_cryptoConfig, _trustedDers, _errorString);
+        if (!_cryptoSession)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void ZipVerifier::reset()
+{
+    // The signatures refer to the document, which refers to the zip file.
+    _signatures.clear();
+    _signaturesDoc.reset();
+    _macroSignaturesDoc.reset();
+    _zipFile.reset();
+    _zipArchive.reset();
+    _zipSource.reset();
+    // Keeps the capacity.
+    _signaturesBytes.clear();
+    _macroSignaturesBytes.clear();
+    _zipContents.clear();
+    _zipData = nullptr;
+    _zipSize = 0;
+    _signatureOptions._zipData = nullptr;
+    _signatureOptions._zipSize = 0;
+    _errorString.clear();
+    _limitExceeded = false;
+    _damaged = false;
+    _signaturesZipIndex = -1;
+    _macroSignaturesZipIndex = -1;
+    _referenceResults.clear();
+    _streamDigests.clear();
+    _cancellation.reset();
+}
+
+/// Implementation of VerifierPool, keeping the idle verifiers in a vector.
+class ZipVerifierPool : public VerifierPool
+{
+  public:
+    ZipVerifierPool(std::string cryptoConfig,
+                    std::function<void(Verifier&)> configure, size_t capacity);
+
+    std::unique_ptr<Verifier> checkout() override;
+
+    void checkin(std::unique_ptr<Verifier> verifier) override;
+
+  private:
+    std::string _cryptoConfig;
+
+    std::function<void(Verifier&)> _configure;
+
+    size_t _capacity;
+
+    std::mutex _mutex;
+
+    std::vector<std::unique_ptr<Verifier>> _idle;
+};
+
+ZipVerifierPool::ZipVerifierPool(std::string cryptoConfig,
+                                 std::function<void(Verifier&)> configure,
+                                 size_t capacity)
+    : _cryptoConfig(std::move(cryptoConfig)), _configure(std::move(configure)),
+      _capacity(capacity)
+{
+}
+
+std::unique_ptr<Verifier> ZipVerifierPool::checkout()
+{
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        if (!_idle.empty())
+        {
+            std::unique_ptr<Verifier> verifier = std::move(_idle.back());
+            _idle.pop_back();
+            return verifier;
+        }
+    }
+
+    std::unique_ptr<Verifier> verifier = Verifier::create(_cryptoConfig);
+    if (_configure)
+    {
+        _configure(*verifier);
+    }
+    return verifier;
+}
+
+void ZipVerifierPool::checkin(std::unique_ptr<Verifier> verifier)
+{
+    if (!verifier)
+    {
+        return;
+    }
+
+    // Not under the lock, this frees the document.
+    verifier->reset();
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (_idle.size() < _capacity)
+    {
+        _idle.push_back(std::move(verifier));
+    }
+}
+
+std::unique_ptr<VerifierPool>
+VerifierPool::create(const std::string& cryptoConfig,
+                     std::function<void(Verifier&)> configure, size_t capacity)
+{
+    return std::make_unique<ZipVerifierPool>(cryptoConfig, std::move(configure),
+                                             capacity);
+}
+
+bool ZipVerifier::checkSignaturesLimits(xmlNode* signaturesRoot)
+{
+    // The XML depth is checked while parsing.
+    if (_limits._maxReferences == 0)
+    {
+        return true;
+    }
+
+    for (xmlNode* signatureNode = signaturesRoot->children;
+         signatureNode != nullptr; signatureNode = signatureNode->next)
+    {
+        xmlNode* signedInfoNode =
+            xmlSecFindChild(signatureNode, xmlSecNodeSignedInfo, xmlSecDSigNs);
+        if (signedInfoNode == nullptr)
+        {
+            continue;
+        }
+
+        uint64_t references = 0;
+        for (xmlNode* referenceNode =
+                 xmlSecGetNextElementNode(signedInfoNode->children);
+             referenceNode != nullptr;
+             referenceNode = xmlSecGetNextElementNode(referenceNode->next))
+        {
+            if (xmlSecCheckNodeName(referenceNode, xmlSecNodeReference,
+                                    xmlSecDSigNs) != 0)
+            {
+                ++references;
+            }
+        }
+        if (references > _limits._maxReferences)
+        {
+            return failLimit(std::to_string(references) +
+                             " references in a signature");
+        }
+    }
+
+    return true;
+}
+
 bool ZipVerifier::locateSignatures()
 {
     _signaturesZipIndex = _zipArchive->locateName(signaturesStreamName);
+    _macroSignaturesZipIndex =
+        _zipArchive->locateName(macroSignaturesStreamName);
 
-    return _signaturesZipIndex >= 0;
+    return _signaturesZipIndex >= 0 || _macroSignaturesZipIndex >= 0;
 }
 } // namespace odfsig
 
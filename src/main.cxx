@@ -5,22 +5,62 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
 #include <cstdlib>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <set>
 #include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
 #include <vector>
 
 #include <odfsig/lib.hxx>
+#include <odfsig/reader.hxx>
 #include <odfsig/version.hxx>
 
+#include "output.hxx"
+#include "watcher.hxx"
+#include "workers.hxx"
+
 namespace
 {
+/**
+ * Checks if a signature signs all streams it has to: all streams for a
+ * document signature, the macro streams for a macro signature.
+ */
+bool isCompletelySigned(odfsig::SignatureKind kind,
+                        const std::set<std::string>& signedStreams,
+                        const std::set<std::string>& streams,
+                        const std::set<std::string>& macroStreams)
+{
+    if (kind == odfsig::SignatureKind::Macro)
+    {
+        return std::includes(signedStreams.begin(), signedStreams.end(),
+                             macroStreams.begin(), macroStreams.end());
+    }
+
+    return signedStreams == streams;
+}
+
 bool printSignatures(
     const std::string& odfPath, const std::set<std::string>& streams,
+    const std::set<std::string>& macroStreams,
     std::vector<std::unique_ptr<odfsig::Signature>>& signatures,
-    std::ostream& ostream)
+    const std::vector<bool>& verdicts, std::ostream& ostream)
 {
     if (signatures.empty())
     {
@@ -29,11 +69,21 @@ bool printSignatures(
     }
 
     ostream << "Digital Signature Info of: " << odfPath << '\n';
+    // Macro signatures are numbered separately, after the document ones.
+    size_t macroSignatures = 0;
     for (size_t signatureIndex = 0; signatureIndex < signatures.size();
          ++signatureIndex)
     {
         odfsig::Signature* signature = signatures[signatureIndex].get();
-        ostream << "Signature #" << (signatureIndex + 1) << ":\n";
+        const odfsig::SignatureKind kind = signature->getKind();
+        if (kind == odfsig::SignatureKind::Macro)
+        {
+            ostream << "Macro Signature #" << ++macroSignatures << ":\n";
+        }
+        else
+        {
+            ostream << "Signature #" << (signatureIndex + 1) << ":\n";
+        }
 
         const std::string subjectName = signature->getSubjectName();
         if (!subjectName.empty())
@@ -82,17 +132,20 @@ bool printSignatures(
             ostream << '\n';
         }
 
-        if (signedStreams == streams)
+        const bool macro = kind == odfsig::SignatureKind::Macro;
+        if (isCompletelySigned(kind, signedStreams, streams, macroStreams))
         {
-            ostream << "  - Total document signed.\n";
+            ostream << (macro ? "  - All macros signed.\n"
+                              : "  - Total document signed.\n");
         }
         else
         {
-            ostream << "  - Only part of the document is signed.\n";
+            ostream << (macro ? "  - Only part of the macros is signed.\n"
+                              : "  - Only part of the document is signed.\n");
             return false;
         }
 
-        if (!signature->verify())
+        if (!verdicts[signatureIndex])
         {
             if (!signature->getErrorString().empty())
             {
@@ -125,16 +178,94 @@ struct Options
 {
     std::vector<std::string> _odfPaths;
     std::vector<std::string> _trustedDers;
+    std::string _nssDb;
+    std::string _incremental;
+    std::string _format = "text";
+    std::string _output;
+    std::string _watch;
+    std::string _manifest;
+    /// 1-based index and count of shards, 0/0 means no sharding.
+    uint64_t _shardIndex = 0;
+    uint64_t _shardCount = 0;
+    uint64_t _watchCount = 0;
+    size_t _workers = 0;
+    /// Documents read ahead of the verification, 0 means no read-ahead.
+    size_t _readAhead = 0;
+    size_t _sizeHint = 0;
+    std::optional<size_t> _prefetchMemory;
+    std::optional<std::chrono::seconds> _chainCacheTtl;
+    std::optional<std::chrono::milliseconds> _timeout;
+    odfsig::Limits _limits;
     bool _insecure = false;
+    bool _noSystemTrust = false;
+    bool _checkIntegrity = false;
+    bool _isolate = false;
+    bool _statistics = false;
+    /// The paths are result files to combine, not documents to verify.
+    bool _merge = false;
     bool _help = false;
     bool _version = false;
 };
 
+/// Returns the field of odfsig::Limits set by an option, or nullptr.
+uint64_t odfsig::Limits::*getLimitField(const std::string& option)
+{
+    const std::pair<const char*, uint64_t odfsig::Limits::*> fields[] = {
+        {"--max-entries", &odfsig::Limits::_maxEntries},
+        {"--max-total-size", &odfsig::Limits::_maxTotalSize},
+        {"--max-compression-ratio", &odfsig::Limits::_maxCompressionRatio},
+        {"--max-signatures-size", &odfsig::Limits::_maxSignaturesSize},
+        {"--max-xml-depth", &odfsig::Limits::_maxXmlDepth},
+        {"--max-references", &odfsig::Limits::_maxReferences},
+    };
+    for (const auto& field : fields)
+    {
+        if (option == field.first)
+        {
+            return field.second;
+        }
+    }
+
+    return nullptr;
+}
+
+/// Parses the i/N argument of --shard, 1 <= i <= N.
+bool parseShard(const std::string& argString, Options& options)
+{
+    const char* begin = argString.data();
+    const char* end = argString.data() + argString.size();
+    auto result = std::from_chars(begin, end, options._shardIndex);
+    if (result.ec != std::errc() || result.ptr == end || *result.ptr != '/')
+    {
+        return false;
+    }
+
+    begin = result.ptr + 1;
+    result = std::from_chars(begin, end, options._shardCount);
+    return result.ec == std::errc() && result.ptr == end &&
+           options._shardIndex >= 1 &&
+           options._shardIndex <= options._shardCount;
+}
+
 /// Minimal option parser to avoid Boost.Program_options dependency.
 bool parseOptions(const std::vector<const char*>& args, Options& options,
                   std::ostream& ostream)
 {
     bool inTrustedDer = false;
+    bool inNssDb = false;
+    bool inIncremental = false;
+    bool inSizeHint = false;
+    bool inPrefetchMemory = false;
+    bool inChainCacheTtl = false;
+    bool inTimeout = false;
+    bool inOutput = false;
+    bool inWatch = false;
+    bool inManifest = false;
+    bool inShard = false;
+    bool inWatchCount = false;
+    bool inWorkers = false;
+    bool inReadAhead = false;
+    uint64_t odfsig::Limits::*inLimit = nullptr;
     bool first = true;
     for (const auto& arg : args)
     {
@@ -145,7 +276,7 @@ bool parseOptions(const std::vector<const char*>& args, Options& options,
         }
 
         const std::string argString(arg);
-        if (argString == "--trusted-der")
+        if (argString == "--trusted-der" || argString == "--trusted-dir")
         {
             inTrustedDer = true;
         }
@@ -154,10 +285,240 @@ bool parseOptions(const std::vector<const char*>& args, Options& options,
             inTrustedDer = false;
             options._trustedDers.push_back(argString);
         }
+        else if (argString == "--nss-db")
+        {
+            inNssDb = true;
+        }
+        else if (inNssDb)
+        {
+            inNssDb = false;
+            options._nssDb = argString;
+        }
+        else if (argString == "--incremental")
+        {
+            inIncremental = true;
+        }
+        else if (inIncremental)
+        {
+            inIncremental = false;
+            options._incremental = argString;
+        }
+        else if (argString == "--size-hint")
+        {
+            inSizeHint = true;
+        }
+        else if (inSizeHint)
+        {
+            inSizeHint = false;
+            const char* end = argString.data() + argString.size();
+            auto result =
+                std::from_chars(argString.data(), end, options._sizeHint);
+            if (result.ec != std::errc() || result.ptr != end)
+            {
+                ostream << "Error: invalid size hint: " << argString << '\n';
+                return false;
+            }
+        }
+        else if (argString == "--prefetch-memory")
+        {
+            inPrefetchMemory = true;
+        }
+        else if (inPrefetchMemory)
+        {
+            inPrefetchMemory = false;
+            const char* end = argString.data() + argString.size();
+            size_t bytes = 0;
+            auto result = std::from_chars(argString.data(), end, bytes);
+            if (result.ec != std::errc() || result.ptr != end)
+            {
+                ostream << "Error: invalid prefetch memory: " << argString
+                        << '\n';
+                return false;
+            }
+            options._prefetchMemory = bytes;
+        }
+        else if (argString == "--chain-cache-ttl")
+        {
+            inChainCacheTtl = true;
+        }
+        else if (inChainCacheTtl)
+        {
+            inChainCacheTtl = false;
+            const char* end = argString.data() + argString.size();
+            uint64_t seconds = 0;
+            auto result = std::from_chars(argString.data(), end, seconds);
+            if (result.ec != std::errc() || result.ptr != end)
+            {
+                ostream << "Error: invalid chain cache TTL: " << argString
+                        << '\n';
+                return false;
+            }
+            options._chainCacheTtl = std::chrono::seconds(seconds);
+        }
+        else if (argString == "--timeout")
+        {
+            inTimeout = true;
+        }
+        else if (inTimeout)
+        {
+            inTimeout = false;
+            const char* end = argString.data() + argString.size();
+            uint64_t milliseconds = 0;
+            auto result = std::from_chars(argString.data(), end, milliseconds);
+            // Larger timeouts would overflow the deadline.
+            const std::chrono::milliseconds maxTimeout =
+                std::chrono::hours(24 * 7);
+            if (result.ec != std::errc() || result.ptr != end ||
+                milliseconds > static_cast<uint64_t>(maxTimeout.count()))
+            {
+                ostream << "Error: invalid timeout: " << argString << '\n';
+                return false;
+            }
+            options._timeout = std::chrono::milliseconds(milliseconds);
+        }
+        else if (argString == "--output")
+        {
+            inOutput = true;
+        }
+        else if (inOutput)
+        {
+            inOutput = false;
+            options._output = argString;
+        }
+        else if (argString == "--watch")
+        {
+            inWatch = true;
+        }
+        else if (inWatch)
+        {
+            inWatch = false;
+            options._watch = argString;
+        }
+        else if (argString == "--manifest")
+        {
+            inManifest = true;
+        }
+        else if (inManifest)
+        {
+            inManifest = false;
+            options._manifest = argString;
+        }
+        else if (argString == "--shard")
+        {
+            inShard = true;
+        }
+        else if (inShard)
+        {
+            inShard = false;
+            if (!parseShard(argString, options))
+            {
+                ostream << "Error: invalid shard: " << argString << '\n';
+                return false;
+            }
+        }
+        else if (argString == "--watch-count")
+        {
+            inWatchCount = true;
+        }
+        else if (inWatchCount)
+        {
+            inWatchCount = false;
+            const char* end = argString.data() + argString.size();
+            auto result =
+                std::from_chars(argString.data(), end, options._watchCount);
+            if (result.ec != std::errc() || result.ptr != end)
+            {
+                ostream << "Error: invalid watch count: " << argString << '\n';
+                return false;
+            }
+        }
+        else if (argString == "--workers")
+        {
+            inWorkers = true;
+        }
+        else if (inWorkers)
+        {
+            inWorkers = false;
+            const char* end = argString.data() + argString.size();
+            auto result =
+                std::from_chars(argString.data(), end, options._workers);
+            if (result.ec != std::errc() || result.ptr != end)
+            {
+                ostream << "Error: invalid worker count: " << argString
+                        << '\n';
+                return false;
+            }
+        }
+        else if (inLimit != nullptr)
+        {
+            const char* end = argString.data() + argString.size();
+            uint64_t limit = 0;
+            auto result = std::from_chars(argString.data(), end, limit);
+            if (result.ec != std::errc() || result.ptr != end)
+            {
+                ostream << "Error: invalid limit: " << argString << '\n';
+                return false;
+            }
+            options._limits.*inLimit = limit;
+            inLimit = nullptr;
+        }
+        else if (getLimitField(argString) != nullptr)
+        {
+            inLimit = getLimitField(argString);
+        }
         else if (argString == "--insecure")
         {
             options._insecure = true;
         }
+        else if (argString == "--no-system-trust")
+        {
+            options._noSystemTrust = true;
+        }
+        else if (argString == "--check-integrity")
+        {
+            options._checkIntegrity = true;
+        }
+        else if (argString.starts_with("--format="))
+        {
+            options._format = argString.substr(std::string("--format=").size());
+            if (options._format != "text" &&
+                !odfsig::ResultFormat::create(options._format))
+            {
+                ostream << "Error: unknown format: " << options._format
+                        << '\n';
+                return false;
+            }
+        }
+        else if (argString == "--read-ahead")
+        {
+            inReadAhead = true;
+        }
+        else if (inReadAhead)
+        {
+            inReadAhead = false;
+            const char* end = argString.data() + argString.size();
+            auto result =
+                std::from_chars(argString.data(), end, options._readAhead);
+            if (result.ec != std::errc() || result.ptr != end ||
+                options._readAhead > odfsig::maxReadsInFlight)
+            {
+                ostream << "Error: invalid read-ahead count: " << argString
+                        << '\n';
+                return false;
+            }
+        }
+        else if (argString == "--isolate")
+        {
+            options._isolate = true;
+        }
+        else if (argString == "--statistics")
+        {
+            options._statistics = true;
+        }
+        else if (argString == "--merge")
+        {
+            options._merge = true;
+        }
         else if (argString == "--help")
         {
             options._help = true;
@@ -177,21 +538,652 @@ bool parseOptions(const std::vector<const char*>& args, Options& options,
         }
     }
 
+    // The caches and their counters are per worker process.
+    if (options._isolate && (!options._watch.empty() || options._statistics))
+    {
+        ostream << "Error: --isolate can't be combined with --watch or "
+                   "--statistics\n";
+        return false;
+    }
+
+    // Otherwise the library would take it as a home directory and look for a
+    // Firefox profile in it.
+    std::error_code errorCode;
+    if (!options._nssDb.empty() &&
+        !std::filesystem::exists(options._nssDb + "/cert9.db", errorCode) &&
+        !std::filesystem::exists(options._nssDb + "/cert8.db", errorCode))
+    {
+        ostream << "Error: no NSS database in '" << options._nssDb << "'\n";
+        return false;
+    }
+
+    if (options._merge &&
+        (!options._output.empty() || !options._watch.empty() ||
+         !options._manifest.empty() || options._shardCount > 0 ||
+         options._isolate))
+    {
+        ostream << "Error: --merge can't be combined with --output, --watch, "
+                   "--manifest, --shard or --isolate\n";
+        return false;
+    }
+
+    // The text format is always written to the standard error.
+    if (!options._output.empty() && options._format == "text")
+    {
+        ostream << "Error: --output needs a machine-readable --format\n";
+        return false;
+    }
+
     return true;
 }
 
+/// Adds the paths of the manifest, one per line, to the document paths.
+bool readManifest(Options& options, std::ostream& ostream)
+{
+    std::ifstream manifest(options._manifest);
+    if (!manifest.is_open())
+    {
+        ostream << "Error: can't open manifest: " << options._manifest << '\n';
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+        {
+            line.pop_back();
+        }
+        if (!line.empty())
+        {
+            options._odfPaths.push_back(line);
+        }
+    }
+    return true;
+}
+
+/**
+ * Stable hash of a document path, so each node running a shard picks the same
+ * documents without coordination: 64-bit FNV-1a of the path bytes.
+ */
+uint64_t getShardHash(const std::string& path)
+{
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const char ch : path)
+    {
+        hash ^= static_cast<unsigned char>(ch);
+        hash *= 0x100000001b3;
+    }
+    return hash;
+}
+
+/// Keeps the documents of the selected shard.
+void selectShard(Options& options)
+{
+    if (options._shardCount == 0)
+    {
+        return;
+    }
+
+    std::erase_if(options._odfPaths,
+                  [&options](const std::string& path)
+                  {
+                      return getShardHash(path) % options._shardCount !=
+                             options._shardIndex - 1;
+                  });
+}
+
+/**
+ * Implements 'odfsig --merge': combines the result files of shards into one
+ * report.
+ */
+int mergeResults(const Options& options, std::ostream& ostream)
+{
+    std::unique_ptr<odfsig::ResultFormat> format = odfsig::ResultFormat::create(
+        options._format == "text" ? "ndjson" : options._format);
+
+    odfsig::ResultSummary summary;
+    for (const auto& path : options._odfPaths)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream.is_open())
+        {
+            ostream << "Error: can't open result file: " << path << '\n';
+            return 2;
+        }
+
+        const std::string contents((std::istreambuf_iterator<char>(stream)),
+                                   std::istreambuf_iterator<char>());
+        std::string_view input(contents);
+        while (!input.empty())
+        {
+            odfsig::DocumentResult result;
+            if (!format->parse(input, result))
+            {
+                ostream << "Error: invalid result file: " << path << '\n';
+                return 2;
+            }
+            summary.add(result);
+        }
+    }
+
+    summary.print(ostream);
+    return summary.isValid() ? 0 : 1;
+}
+
+void printCacheStatistics(const std::string& name,
+                          const odfsig::CacheStatistics& statistics,
+                          std::ostream& ostream)
+{
+    const uint64_t lookups = statistics._hits + statistics._misses;
+    ostream << name << ": " << statistics._hits << " hits, "
+            << statistics._misses << " misses";
+    if (lookups > 0)
+    {
+        ostream << " (" << (statistics._hits * 100 / lookups)
+                << "% hit rate)";
+    }
+    ostream << '\n';
+}
+
+void printStatistics(std::ostream& ostream)
+{
+    const odfsig::Statistics statistics = odfsig::Verifier::getStatistics();
+    printCacheStatistics("Certificate cache", statistics._certificateCache,
+                         ostream);
+    printCacheStatistics("Chain cache", statistics._chainCache, ostream);
+    printCacheStatistics("Verdict store", statistics._verdictStore, ostream);
+    printCacheStatistics("Stream digests", statistics._streamDigests, ostream);
+}
+
+/// Applies the options which are kept when a verifier is reset.
+void configureVerifier(odfsig::Verifier& verifier, const Options& options)
+{
+    verifier.setTrustedDers(options._trustedDers);
+    verifier.setInsecure(options._insecure);
+    if (options._chainCacheTtl)
+    {
+        verifier.setChainCacheTtl(*options._chainCacheTtl);
+    }
+    if (!options._incremental.empty())
+    {
+        verifier.setVerdictStore(options._incremental);
+    }
+    if (options._prefetchMemory)
+    {
+        verifier.setPrefetchMemory(*options._prefetchMemory);
+    }
+    verifier.setLimits(options._limits);
+    verifier.setIntegrityCheck(options._checkIntegrity);
+}
+
+/**
+ * NDJSON is consumed line by line while it's written, e.g. with tail -f, so
+ * each record is written right away. Binary records are batched.
+ */
+size_t getResultBufferSize(const Options& options)
+{
+    return options._format == "binary" ? 65536 : 0;
+}
+
+/// Starts the timeout of the next document, if there is one.
+void setDeadline(odfsig::Verifier& verifier, const Options& options)
+{
+    if (options._timeout)
+    {
+        verifier.setDeadline(std::chrono::steady_clock::now() +
+                             *options._timeout);
+    }
+}
+
+std::unique_ptr<odfsig::Verifier>
+createVerifier(const Options& options, const std::string& cryptoConfig)
+{
+    std::unique_ptr<odfsig::Verifier> verifier(
+        odfsig::Verifier::create(cryptoConfig));
+    configureVerifier(*verifier, options);
+    setDeadline(*verifier, options);
+    return verifier;
+}
+
+bool openDocument(odfsig::Verifier& verifier, const std::string& odfPath,
+                  const Options& options)
+{
+    if (odfPath == "-")
+    {
+        return verifier.openStream(std::cin, options._sizeHint);
+    }
+
+    return verifier.openZip(odfPath);
+}
+
+std::chrono::microseconds
+getElapsed(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start);
+}
+
+/**
+ * Parses and verifies the signatures of an opened document into result, on
+ * parallelism threads (0: one per CPU).
+ */
+void verifySignatures(odfsig::Verifier& verifier, size_t parallelism,
+                      odfsig::DocumentResult& result)
+{
+    auto start = std::chrono::steady_clock::now();
+    const bool parsed = verifier.parseSignatures();
+    result._parseTime = getElapsed(start);
+    if (!parsed)
+    {
+        result._error =
+            "Failed to parse signatures: " + verifier.getErrorString();
+        return;
+    }
+
+    start = std::chrono::steady_clock::now();
+    const std::vector<bool> verdicts = verifier.verifyAll(parallelism);
+    std::vector<std::unique_ptr<odfsig::Signature>>& signatures =
+        verifier.getSignatures();
+    const std::set<std::string> streams = verifier.getStreams();
+    const std::set<std::string> macroStreams = verifier.getMacroStreams();
+    result._valid = !signatures.empty();
+    for (size_t signatureIndex = 0; signatureIndex < signatures.size();
+         ++signatureIndex)
+    {
+        odfsig::Signature* signature = signatures[signatureIndex].get();
+        odfsig::SignatureResult signatureResult;
+        signatureResult._kind = signature->getKind();
+        signatureResult._subjectName = signature->getSubjectName();
+        signatureResult._date = signature->getDate();
+        signatureResult._method = signature->getMethod();
+        signatureResult._type = signature->getType();
+        signatureResult._signedStreams = signature->getSignedStreams();
+        signatureResult._totalDocumentSigned =
+            isCompletelySigned(signatureResult._kind,
+                               signatureResult._signedStreams, streams,
+                               macroStreams);
+        signatureResult._verified = verdicts[signatureIndex];
+        signatureResult._error = signature->getErrorString();
+        if (signatureResult._verified && signatureResult._type == "XAdES")
+        {
+            signatureResult._certificateHashVerified =
+                signature->verifyXAdES();
+        }
+
+        if (!signatureResult._totalDocumentSigned ||
+            !signatureResult._verified ||
+            !signatureResult._certificateHashVerified.value_or(true))
+        {
+            result._valid = false;
+        }
+        result._signatures.push_back(std::move(signatureResult));
+    }
+    result._verifyTime = getElapsed(start);
+}
+
+/**
+ * Verifies a document, collecting the results instead of printing them. A
+ * pool of workers passes a parallelism of 1, it keeps the CPUs busy already.
+ */
+odfsig::DocumentResult verifyDocument(odfsig::Verifier& verifier,
+                                      const Options& options,
+                                      const std::string& odfPath,
+                                      size_t parallelism)
+{
+    odfsig::DocumentResult result;
+    result._path = odfPath;
+
+    const auto start = std::chrono::steady_clock::now();
+    const bool opened = openDocument(verifier, odfPath, options);
+    result._openTime = getElapsed(start);
+    if (!opened)
+    {
+        result._error = "Can't open zip archive";
+        if (!verifier.getErrorString().empty())
+        {
+            result._error += ": " + verifier.getErrorString();
+        }
+        return result;
+    }
+
+    verifySignatures(verifier, parallelism, result);
+    return result;
+}
+
+/**
+ * Verifies the next document of reader, like verifyDocument(). Waiting for the
+ * read is part of the open time. The verifier uses the buffer of document.
+ */
+odfsig::DocumentResult verifyReadDocument(odfsig::Verifier& verifier,
+                                          odfsig::DocumentReader& reader,
+                                          odfsig::ReadDocument& document)
+{
+    odfsig::DocumentResult result;
+    const auto start = std::chrono::steady_clock::now();
+    reader.next(document);
+    result._path = document._path;
+    const bool opened =
+        document._error.empty() &&
+        verifier.openZipMemory(document._buffer.data(), document._size);
+    result._openTime = getElapsed(start);
+    if (!opened)
+    {
+        result._error = "Can't open zip archive";
+        const std::string& error = document._error.empty()
+                                       ? verifier.getErrorString()
+                                       : document._error;
+        if (!error.empty())
+        {
+            result._error += ": " + error;
+        }
+        return result;
+    }
+
+    verifySignatures(verifier, /*parallelism=*/0, result);
+    return result;
+}
+
+/// Set by SIGINT and SIGTERM, to stop watching.
+volatile std::sig_atomic_t watchStopRequested = 0;
+
+extern "C" void requestWatchStop(int /*signal*/) { watchStopRequested = 1; }
+
+/// Documents found by the watcher, waiting for a worker.
+struct WatchQueue
+{
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    std::deque<std::string> _paths;
+    bool _stop = false;
+};
+
+/**
+ * Verifies the documents landing in the watched directory on a pool of
+ * workers, sharing the crypto state, and appends their results to results.
+ * Runs till SIGINT or SIGTERM, or till the watch count is reached.
+ */
+int watchDirectory(const Options& options, const std::string& cryptoConfig,
+                   std::ostream& results, std::ostream& ostream)
+{
+    std::string errorString;
+    std::unique_ptr<odfsig::DirectoryWatcher> watcher =
+        odfsig::DirectoryWatcher::create(options._watch, errorString);
+    if (!watcher)
+    {
+        ostream << "Error: " << errorString << '\n';
+        return 2;
+    }
+
+    size_t workerCount = options._workers;
+    if (workerCount == 0)
+    {
+        workerCount = std::max(1U, std::thread::hardware_concurrency());
+    }
+    std::unique_ptr<odfsig::VerifierPool> pool = odfsig::VerifierPool::create(
+        cryptoConfig,
+        [&options](odfsig::Verifier& verifier)
+        { configureVerifier(verifier, options); },
+        workerCount);
+    // Text is for humans, the results of a watch are appended to a log.
+    const std::string formatName =
+        options._format == "text" ? "ndjson" : options._format;
+    odfsig::SharedOutput output(results);
+    WatchQueue queue;
+    std::atomic<bool> valid = true;
+
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        workers.emplace_back(
+            [&]()
+            {
+                std::unique_ptr<odfsig::ResultFormat> format =
+                    odfsig::ResultFormat::create(formatName);
+                while (true)
+                {
+                    std::unique_lock<std::mutex> lock(queue._mutex);
+                    queue._condition.wait(
+                        lock, [&queue]()
+                        { return queue._stop || !queue._paths.empty(); });
+                    if (queue._paths.empty())
+                    {
+                        return;
+                    }
+                    const std::string path = std::move(queue._paths.front());
+                    queue._paths.pop_front();
+                    lock.unlock();
+
+                    std::unique_ptr<odfsig::Verifier> verifier =
+                        pool->checkout();
+                    setDeadline(*verifier, options);
+                    const odfsig::DocumentResult result = verifyDocument(
+                        *verifier, options, path, /*parallelism=*/1);
+                    pool->checkin(std::move(verifier));
+                    if (!result._valid)
+                    {
+                        valid = false;
+                    }
+
+                    // Written right away, a watch has no batches.
+                    std::string record;
+                    format->format(result, record);
+                    output.write(record);
+                }
+            });
+    }
+
+    watchStopRequested = 0;
+    auto* previousInt = std::signal(SIGINT, requestWatchStop);
+    auto* previousTerm = std::signal(SIGTERM, requestWatchStop);
+    int status = 0;
+    uint64_t queued = 0;
+    // Only bounds how long a stop request waits, files are not polled.
+    const std::chrono::milliseconds stopCheckInterval(200);
+    while (watchStopRequested == 0 &&
+           (options._watchCount == 0 || queued < options._watchCount))
+    {
+        std::vector<std::string> paths;
+        if (!watcher->wait(stopCheckInterval, paths, errorString))
+        {
+            ostream << "Error: " << errorString << '\n';
+            status = 2;
+            break;
+        }
+
+        if (paths.empty())
+        {
+            continue;
+        }
+
+        {
+            const std::lock_guard<std::mutex> lock(queue._mutex);
+            for (auto& path : paths)
+            {
+                if (options._watchCount > 0 && queued == options._watchCount)
+                {
+                    break;
+                }
+                queue._paths.push_back(std::move(path));
+                ++queued;
+            }
+        }
+        queue._condition.notify_all();
+    }
+    std::signal(SIGINT, previousInt);
+    std::signal(SIGTERM, previousTerm);
+
+    // The queued documents are still verified.
+    {
+        const std::lock_guard<std::mutex> lock(queue._mutex);
+        queue._stop = true;
+    }
+    queue._condition.notify_all();
+    for (auto& worker : workers)
+    {
+        worker.join();
+    }
+
+    if (status != 0)
+    {
+        return status;
+    }
+    return valid ? 0 : 1;
+}
+
+/**
+ * Verifies the documents in worker processes, which inherit the initialized
+ * crypto state: a document crashing or hanging its worker only fails itself.
+ * The results are written in the order the documents complete.
+ */
+int verifyIsolated(const Options& options, const std::string& cryptoConfig,
+                   std::ostream& results, std::ostream& ostream)
+{
+    std::unique_ptr<odfsig::VerifierPool> pool = odfsig::VerifierPool::create(
+        cryptoConfig,
+        [&options](odfsig::Verifier& verifier)
+        { configureVerifier(verifier, options); },
+        1);
+    std::unique_ptr<odfsig::Verifier> verifier = pool->checkout();
+    if (!verifier->initializeCrypto())
+    {
+        ostream << "Error: " << verifier->getErrorString() << '\n';
+        return 2;
+    }
+    pool->checkin(std::move(verifier));
+
+    size_t workerCount = options._workers;
+    if (workerCount == 0)
+    {
+        workerCount = std::max(1U, std::thread::hardware_concurrency());
+    }
+    // More workers than documents would be forked just to idle.
+    workerCount =
+        std::max<size_t>(std::min(workerCount, options._odfPaths.size()), 1);
+    // The deadline is only checked between steps, a worker stuck in one is
+    // killed.
+    std::chrono::milliseconds hangTimeout = std::chrono::minutes(5);
+    if (options._timeout)
+    {
+        hangTimeout = *options._timeout + std::chrono::seconds(1);
+    }
+    std::string errorString;
+    std::unique_ptr<odfsig::WorkerProcesses> workers =
+        odfsig::WorkerProcesses::create(
+            workerCount, hangTimeout,
+            [&options, &pool](const std::string& path)
+            {
+                std::unique_ptr<odfsig::Verifier> worker = pool->checkout();
+                setDeadline(*worker, options);
+                odfsig::DocumentResult result =
+                    verifyDocument(*worker, options, path, /*parallelism=*/1);
+                pool->checkin(std::move(worker));
+                return result;
+            },
+            errorString);
+    if (!workers)
+    {
+        ostream << "Error: " << errorString << '\n';
+        return 2;
+    }
+
+    // Text needs the signatures, the workers only return results.
+    std::unique_ptr<odfsig::ResultFormat> format =
+        odfsig::ResultFormat::create(
+            options._format == "text" ? "ndjson" : options._format);
+    odfsig::SharedOutput output(results);
+    odfsig::BufferedWriter writer(output, *format,
+                                  getResultBufferSize(options));
+    bool valid = true;
+    const bool ok = workers->run(
+        options._odfPaths,
+        [&valid, &writer](const odfsig::DocumentResult& result)
+        {
+            valid = valid && result._valid;
+            writer.write(result);
+        },
+        errorString);
+    writer.flush();
+    if (!ok)
+    {
+        ostream << "Error: " << errorString << '\n';
+        return 2;
+    }
+
+    return valid ? 0 : 1;
+}
+
 void usage(const std::string& self, std::ostream& ostream)
 {
     ostream << "Usage: " << self << " [options] <ODF-file>\n";
+    ostream << "       " << self
+            << " --merge [--format=<format>] <result-file>...\n";
+    ostream << "<ODF-file> can be '-' to read from the standard input\n";
     ostream << "--trusted-der <file>: load trusted (root) certificate from "
                "DER file <file>\n";
+    ostream << "--trusted-dir <dir>: load trusted certificates from DER or "
+               "PEM files in <dir>\n";
     ostream << "--insecure: do not validate certificates\n";
+    ostream << "--no-system-trust: only trust the --trusted-der and "
+               "--trusted-dir certificates\n";
+    ostream << "--nss-db <dir>: use the NSS database in <dir> instead of the "
+               "Firefox one\n";
+    ostream << "--chain-cache-ttl <seconds>: reuse certificate chain "
+               "validation results for this long (0: disable)\n";
+    ostream << "--incremental <file>: remember valid signatures in <file>, "
+               "only check the digests of known ones\n";
+    ostream << "--size-hint <bytes>: expected size of the standard input\n";
+    ostream << "--prefetch-memory <bytes>: read ahead at most this much of "
+               "the signed streams (0: disable)\n";
+    ostream << "--max-entries <count>: reject packages with more zip "
+               "entries\n";
+    ostream << "--max-total-size <bytes>: reject packages with more "
+               "uncompressed data\n";
+    ostream << "--max-compression-ratio <ratio>: reject packages with "
+               "entries whose compression ratio exceeds <ratio>\n";
+    ostream << "--max-signatures-size <bytes>: reject larger signatures "
+               "streams\n";
+    ostream << "--max-xml-depth <depth>: reject more deeply nested "
+               "signatures\n";
+    ostream << "--max-references <count>: reject signatures with more "
+               "references\n";
+    ostream << "--check-integrity: check the CRC-32 of all zip entries "
+               "before verifying the signatures\n";
+    ostream << "--timeout <milliseconds>: stop verifying a document after "
+               "this long (at most a week)\n";
+    ostream << "--format=<format>: output format: text (default), ndjson or "
+               "binary\n";
+    ostream << "--manifest <file>: also verify the documents listed in "
+               "<file>, one per line\n";
+    ostream << "--shard <i>/<N>: only verify the i-th of N disjoint, stable "
+               "subsets of the documents\n";
+    ostream << "--output <file>: append the results of a machine-readable "
+               "format to <file>\n";
+    ostream << "--watch <dir>: verify the documents written to <dir>, till "
+               "interrupted\n";
+    ostream << "--watch-count <count>: stop watching after this many "
+               "documents\n";
+    ostream << "--workers <count>: verify this many documents concurrently "
+               "in watch or isolate mode\n";
+    ostream << "--read-ahead <count>: keep the reads of this many documents "
+               "in flight, with a machine-readable format\n";
+    ostream << "--isolate: verify the documents in worker processes, "
+               "restarting crashed or hung ones\n";
+    ostream << "--statistics: print cache statistics after verification\n";
+    ostream << "--merge: combine result files written with a "
+               "machine-readable format into one report\n";
 }
 } // namespace
 
 namespace odfsig
 {
 int main(const std::vector<const char*>& args, std::ostream& ostream)
+{
+    return main(args, ostream, ostream);
+}
+
+int main(const std::vector<const char*>& args, std::ostream& ostream,
+         std::ostream& resultStream)
 {
     if (args.size() < 2)
     {
@@ -209,6 +1201,23 @@ int main(const std::vector<const char*>& args, std::ostream& ostream)
         usage(args[0], ostream);
         return 0;
     }
+    if (options._merge)
+    {
+        return mergeResults(options, ostream);
+    }
+
+    if (!options._manifest.empty() && !readManifest(options, ostream))
+    {
+        return 2;
+    }
+    selectShard(options);
+    if (options._readAhead > 0 &&
+        std::find(options._odfPaths.begin(), options._odfPaths.end(), "-") !=
+            options._odfPaths.end())
+    {
+        ostream << "Error: the standard input can't be read ahead\n";
+        return 2;
+    }
 
     if (options._version)
     {
@@ -221,21 +1230,101 @@ int main(const std::vector<const char*>& args, std::ostream& ostream)
         return 0;
     }
 
+    // No crypto config means no database to open, that's the fastest.
     std::string cryptoConfig;
-    const char* home = getenv("HOME");
-    if (home != nullptr)
+    if (!options._nssDb.empty())
     {
-        cryptoConfig = home;
+        cryptoConfig = options._nssDb;
+    }
+    else if (!options._noSystemTrust)
+    {
+        const char* home = getenv("HOME");
+        if (home != nullptr)
+        {
+            cryptoConfig = home;
+        }
     }
 
-    for (const auto& odfPath : options._odfPaths)
+    // Share crypto init and caches between the files.
+    std::unique_ptr<odfsig::Session> session = odfsig::Session::create();
+    std::ostream* results = &resultStream;
+    std::ofstream outputFile;
+    if (!options._output.empty())
+    {
+        outputFile.open(options._output, std::ios::binary | std::ios::app);
+        if (!outputFile.is_open())
+        {
+            ostream << "Error: can't open output: " << options._output << '\n';
+            return 2;
+        }
+        results = &outputFile;
+    }
+
+    if (!options._watch.empty())
+    {
+        const int status =
+            watchDirectory(options, cryptoConfig, *results, ostream);
+        if (options._statistics)
+        {
+            printStatistics(ostream);
+        }
+        return status;
+    }
+
+    if (options._isolate)
     {
-        std::unique_ptr<odfsig::Verifier> verifier(
-            odfsig::Verifier::create(cryptoConfig));
-        verifier->setTrustedDers(options._trustedDers);
-        verifier->setInsecure(options._insecure);
+        return verifyIsolated(options, cryptoConfig, *results, ostream);
+    }
 
-        if (!verifier->openZip(odfPath))
+    if (options._format != "text")
+    {
+        // Machine-readable formats report all documents, even after a failure.
+        std::unique_ptr<odfsig::ResultFormat> format =
+            odfsig::ResultFormat::create(options._format);
+        odfsig::SharedOutput output(*results);
+        odfsig::BufferedWriter writer(output, *format,
+                                      getResultBufferSize(options));
+        std::unique_ptr<odfsig::DocumentReader> reader;
+        if (options._readAhead > 0)
+        {
+            // Without a reader the documents are read one by one.
+            reader = odfsig::DocumentReader::create(options._odfPaths,
+                                                    options._readAhead);
+        }
+        bool valid = true;
+        for (const auto& odfPath : options._odfPaths)
+        {
+            std::unique_ptr<odfsig::Verifier> verifier =
+                createVerifier(options, cryptoConfig);
+            odfsig::ReadDocument document;
+            const odfsig::DocumentResult result =
+                reader ? verifyReadDocument(*verifier, *reader, document)
+                       : verifyDocument(*verifier, options, odfPath,
+                                        /*parallelism=*/0);
+            valid = valid && result._valid;
+            writer.write(result);
+            if (reader)
+            {
+                // The verifier refers to the buffer till it's destroyed.
+                verifier.reset();
+                reader->recycle(std::move(document._buffer));
+            }
+        }
+        writer.flush();
+
+        if (options._statistics)
+        {
+            printStatistics(ostream);
+        }
+
+        return valid ? 0 : 1;
+    }
+
+    for (const auto& odfPath : options._odfPaths)
+    {
+        std::unique_ptr<odfsig::Verifier> verifier =
+            createVerifier(options, cryptoConfig);
+        if (!openDocument(*verifier, odfPath, options))
         {
             ostream << "Can't open zip archive '" << odfPath
                     << "': " << verifier->getErrorString() << ".\n";
@@ -249,14 +1338,21 @@ int main(const std::vector<const char*>& args, std::ostream& ostream)
             return 1;
         }
 
+        // Verify the signatures concurrently, then print them in order.
+        const std::vector<bool> verdicts = verifier->verifyAll(0);
         const std::set<std::string> streams = verifier->getStreams();
-        if (!printSignatures(odfPath, streams, verifier->getSignatures(),
-                             ostream))
+        if (!printSignatures(odfPath, streams, verifier->getMacroStreams(),
+                             verifier->getSignatures(), verdicts, ostream))
         {
             return 1;
         }
     }
 
+    if (options._statistics)
+    {
+        printStatistics(ostream);
+    }
+
     return 0;
 }
 } // namespace odfsig
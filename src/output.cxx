@@ -0,0 +1,850 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "output.hxx"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+
+namespace
+{
+/// Appends a JSON string literal.
+void appendJsonString(const std::string& value, std::string& out)
+{
+    out += '"';
+    for (const char ch : value)
+    {
+        switch (ch)
+        {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            if (static_cast<unsigned char>(ch) < 0x20)
+            {
+                char escaped[7];
+                std::snprintf(escaped, sizeof(escaped), "\\u%04x",
+                              static_cast<unsigned char>(ch));
+                out += escaped;
+            }
+            else
+            {
+                out += ch;
+            }
+            break;
+        }
+    }
+    out += '"';
+}
+
+void appendJsonBool(bool value, std::string& out)
+{
+    out += value ? "true" : "false";
+}
+
+/// Appends a duration in milliseconds, with microsecond precision.
+void appendJsonMilliseconds(std::chrono::microseconds value, std::string& out)
+{
+    char formatted[32];
+    std::snprintf(formatted, sizeof(formatted), "%.3f",
+                  static_cast<double>(value.count()) / 1000);
+    out += formatted;
+}
+
+/// Reads the subset of JSON written by NdjsonFormat.
+class JsonReader
+{
+  public:
+    explicit JsonReader(std::string_view input) : _input(input) {}
+
+    /// Skips whitespace, then consumes ch if it's next.
+    bool consume(char ch)
+    {
+        skipWhitespace();
+        if (_offset < _input.size() && _input[_offset] == ch)
+        {
+            ++_offset;
+            return true;
+        }
+        return false;
+    }
+
+    bool readString(std::string& value)
+    {
+        if (!consume('"'))
+        {
+            return false;
+        }
+
+        value.clear();
+        while (_offset < _input.size())
+        {
+            const char ch = _input[_offset++];
+            if (ch == '"')
+            {
+                return true;
+            }
+            if (ch != '\\')
+            {
+                value += ch;
+                continue;
+            }
+            if (_offset == _input.size())
+            {
+                return false;
+            }
+            switch (_input[_offset++])
+            {
+            case '"':
+                value += '"';
+                break;
+            case '\\':
+                value += '\\';
+                break;
+            case '/':
+                value += '/';
+                break;
+            case 'n':
+                value += '\n';
+                break;
+            case 'r':
+                value += '\r';
+                break;
+            case 't':
+                value += '\t';
+                break;
+            case 'u':
+            {
+                // Only control characters are escaped this way.
+                unsigned code = 0;
+                const char* begin = _input.data() + _offset;
+                if (_input.size() - _offset < 4 ||
+                    std::from_chars(begin, begin + 4, code, 16).ptr !=
+                        begin + 4 ||
+                    code >= 0x80)
+                {
+                    return false;
+                }
+                _offset += 4;
+                value += static_cast<char>(code);
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+        return false;
+    }
+
+    bool readBool(bool& value)
+    {
+        skipWhitespace();
+        for (const bool candidate : {true, false})
+        {
+            const std::string_view literal = candidate ? "true" : "false";
+            if (_input.substr(_offset, literal.size()) == literal)
+            {
+                _offset += literal.size();
+                value = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Reads a duration written by appendJsonMilliseconds().
+    bool readMilliseconds(std::chrono::microseconds& value)
+    {
+        skipWhitespace();
+        const char* begin = _input.data() + _offset;
+        const char* end = _input.data() + _input.size();
+        double milliseconds = 0;
+        auto result = std::from_chars(begin, end, milliseconds);
+        if (result.ec != std::errc() || milliseconds < 0)
+        {
+            return false;
+        }
+        _offset += result.ptr - begin;
+        value = std::chrono::microseconds(
+            static_cast<int64_t>(std::llround(milliseconds * 1000)));
+        return true;
+    }
+
+    /// Reads the members of an object, calling member for each key.
+    template <typename Member> bool readObject(Member member)
+    {
+        if (!consume('{'))
+        {
+            return false;
+        }
+        if (consume('}'))
+        {
+            return true;
+        }
+        do
+        {
+            std::string key;
+            if (!readString(key) || !consume(':') || !member(key))
+            {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}');
+    }
+
+    /// Reads the elements of an array, calling element for each.
+    template <typename Element> bool readArray(Element element)
+    {
+        if (!consume('['))
+        {
+            return false;
+        }
+        if (consume(']'))
+        {
+            return true;
+        }
+        do
+        {
+            if (!element())
+            {
+                return false;
+            }
+        } while (consume(','));
+        return consume(']');
+    }
+
+    /// Checks that only whitespace is left.
+    bool atEnd()
+    {
+        skipWhitespace();
+        return _offset == _input.size();
+    }
+
+  private:
+    void skipWhitespace()
+    {
+        while (_offset < _input.size() &&
+               (_input[_offset] == ' ' || _input[_offset] == '\t' ||
+                _input[_offset] == '\r' || _input[_offset] == '\n'))
+        {
+            ++_offset;
+        }
+    }
+
+    std::string_view _input;
+
+    size_t _offset = 0;
+};
+
+/// One JSON object per line.
+class NdjsonFormat : public odfsig::ResultFormat
+{
+  public:
+    void format(const odfsig::DocumentResult& result,
+                std::string& out) override;
+
+    bool parse(std::string_view& input,
+               odfsig::DocumentResult& result) override;
+
+  private:
+    static bool parseSignature(JsonReader& reader,
+                               odfsig::SignatureResult& signature);
+};
+
+void NdjsonFormat::format(const odfsig::DocumentResult& result,
+                          std::string& out)
+{
+    out += "{\"path\":";
+    appendJsonString(result._path, out);
+    if (!result._error.empty())
+    {
+        out += ",\"error\":";
+        appendJsonString(result._error, out);
+    }
+    out += ",\"valid\":";
+    appendJsonBool(result._valid, out);
+
+    out += ",\"signatures\":[";
+    bool firstSignature = true;
+    for (const auto& signature : result._signatures)
+    {
+        if (!firstSignature)
+        {
+            out += ',';
+        }
+        firstSignature = false;
+
+        out += "{\"kind\":";
+        appendJsonString(
+            signature._kind == odfsig::SignatureKind::Macro ? "macro"
+                                                            : "document",
+            out);
+        out += ",\"subjectName\":";
+        appendJsonString(signature._subjectName, out);
+        out += ",\"date\":";
+        appendJsonString(signature._date, out);
+        out += ",\"method\":";
+        appendJsonString(signature._method, out);
+        out += ",\"type\":";
+        appendJsonString(signature._type, out);
+        out += ",\"signedStreams\":[";
+        bool firstStream = true;
+        for (const auto& signedStream : signature._signedStreams)
+        {
+            if (!firstStream)
+            {
+                out += ',';
+            }
+            firstStream = false;
+            appendJsonString(signedStream, out);
+        }
+        out += "],\"totalDocumentSigned\":";
+        appendJsonBool(signature._totalDocumentSigned, out);
+        out += ",\"verified\":";
+        appendJsonBool(signature._verified, out);
+        if (!signature._error.empty())
+        {
+            out += ",\"error\":";
+            appendJsonString(signature._error, out);
+        }
+        if (signature._certificateHashVerified)
+        {
+            out += ",\"certificateHashVerified\":";
+            appendJsonBool(*signature._certificateHashVerified, out);
+        }
+        out += '}';
+    }
+
+    out += "],\"timings\":{\"openMs\":";
+    appendJsonMilliseconds(result._openTime, out);
+    out += ",\"parseMs\":";
+    appendJsonMilliseconds(result._parseTime, out);
+    out += ",\"verifyMs\":";
+    appendJsonMilliseconds(result._verifyTime, out);
+    out += "}}\n";
+}
+
+bool NdjsonFormat::parse(std::string_view& input,
+                         odfsig::DocumentResult& result)
+{
+    const size_t end = input.find('\n');
+    if (end == std::string_view::npos)
+    {
+        return false;
+    }
+
+    result = odfsig::DocumentResult();
+    JsonReader reader(input.substr(0, end));
+    const bool parsed = reader.readObject(
+        [&reader, &result](const std::string& key)
+        {
+            if (key == "path")
+            {
+                return reader.readString(result._path);
+            }
+            if (key == "error")
+            {
+                return reader.readString(result._error);
+            }
+            if (key == "valid")
+            {
+                return reader.readBool(result._valid);
+            }
+            if (key == "signatures")
+            {
+                return reader.readArray(
+                    [&reader, &result]()
+                    {
+                        result._signatures.emplace_back();
+                        return parseSignature(reader,
+                                              result._signatures.back());
+                    });
+            }
+            if (key == "timings")
+            {
+                return reader.readObject(
+                    [&reader, &result](const std::string& timing)
+                    {
+                        if (timing == "openMs")
+                        {
+                            return reader.readMilliseconds(result._openTime);
+                        }
+                        if (timing == "parseMs")
+                        {
+                            return reader.readMilliseconds(result._parseTime);
+                        }
+                        if (timing == "verifyMs")
+                        {
+                            return reader.readMilliseconds(
+                                result._verifyTime);
+                        }
+                        return false;
+                    });
+            }
+            return false;
+        });
+    if (!parsed || !reader.atEnd())
+    {
+        return false;
+    }
+
+    input.remove_prefix(end + 1);
+    return true;
+}
+
+bool NdjsonFormat::parseSignature(JsonReader& reader,
+                                  odfsig::SignatureResult& signature)
+{
+    return reader.readObject(
+        [&reader, &signature](const std::string& key)
+        {
+            if (key == "kind")
+            {
+                std::string kind;
+                if (!reader.readString(kind))
+                {
+                    return false;
+                }
+                signature._kind = kind == "macro"
+                                      ? odfsig::SignatureKind::Macro
+                                      : odfsig::SignatureKind::Document;
+                return true;
+            }
+            if (key == "subjectName")
+            {
+                return reader.readString(signature._subjectName);
+            }
+            if (key == "date")
+            {
+                return reader.readString(signature._date);
+            }
+            if (key == "method")
+            {
+                return reader.readString(signature._method);
+            }
+            if (key == "type")
+            {
+                return reader.readString(signature._type);
+            }
+            if (key == "signedStreams")
+            {
+                return reader.readArray(
+                    [&reader, &signature]()
+                    {
+                        std::string signedStream;
+                        if (!reader.readString(signedStream))
+                        {
+                            return false;
+                        }
+                        signature._signedStreams.insert(signedStream);
+                        return true;
+                    });
+            }
+            if (key == "totalDocumentSigned")
+            {
+                return reader.readBool(signature._totalDocumentSigned);
+            }
+            if (key == "verified")
+            {
+                return reader.readBool(signature._verified);
+            }
+            if (key == "error")
+            {
+                return reader.readString(signature._error);
+            }
+            if (key == "certificateHashVerified")
+            {
+                bool verified = false;
+                if (!reader.readBool(verified))
+                {
+                    return false;
+                }
+                signature._certificateHashVerified = verified;
+                return true;
+            }
+            return false;
+        });
+}
+
+void appendUint32(uint32_t value, std::string& out)
+{
+    // Little-endian.
+    for (int i = 0; i < 4; ++i)
+    {
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+void appendUint64(uint64_t value, std::string& out)
+{
+    for (int i = 0; i < 8; ++i)
+    {
+        out += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+void appendBinaryString(const std::string& value, std::string& out)
+{
+    appendUint32(static_cast<uint32_t>(value.size()), out);
+    out += value;
+}
+
+/// Reads the little-endian fields of a binary record.
+class BinaryReader
+{
+  public:
+    explicit BinaryReader(std::string_view input) : _input(input) {}
+
+    bool readUint8(uint8_t& value)
+    {
+        if (_input.empty())
+        {
+            return false;
+        }
+        value = static_cast<uint8_t>(_input[0]);
+        _input.remove_prefix(1);
+        return true;
+    }
+
+    bool readUint32(uint32_t& value)
+    {
+        uint64_t wide = 0;
+        if (!readInteger(4, wide))
+        {
+            return false;
+        }
+        value = static_cast<uint32_t>(wide);
+        return true;
+    }
+
+    bool readUint64(uint64_t& value) { return readInteger(8, value); }
+
+    bool readBool(bool& value)
+    {
+        uint8_t byte = 0;
+        if (!readUint8(byte) || byte > 1)
+        {
+            return false;
+        }
+        value = byte == 1;
+        return true;
+    }
+
+    bool readString(std::string& value)
+    {
+        uint32_t size = 0;
+        if (!readUint32(size) || size > _input.size())
+        {
+            return false;
+        }
+        value.assign(_input.substr(0, size));
+        _input.remove_prefix(size);
+        return true;
+    }
+
+    bool readMicroseconds(std::chrono::microseconds& value)
+    {
+        uint64_t count = 0;
+        if (!readUint64(count))
+        {
+            return false;
+        }
+        value = std::chrono::microseconds(count);
+        return true;
+    }
+
+    [[nodiscard]] bool atEnd() const { return _input.empty(); }
+
+  private:
+    bool readInteger(size_t size, uint64_t& value)
+    {
+        if (_input.size() < size)
+        {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < size; ++i)
+        {
+            value |= static_cast<uint64_t>(static_cast<uint8_t>(_input[i]))
+                     << (8 * i);
+        }
+        _input.remove_prefix(size);
+        return true;
+    }
+
+    std::string_view _input;
+};
+
+/**
+ * Length-prefixed records, see the FORMATS section of the manpage for the
+ * layout.
+ */
+class BinaryFormat : public odfsig::ResultFormat
+{
+  public:
+    void format(const odfsig::DocumentResult& result,
+                std::string& out) override;
+
+    bool parse(std::string_view& input,
+               odfsig::DocumentResult& result) override;
+};
+
+void BinaryFormat::format(const odfsig::DocumentResult& result,
+                          std::string& out)
+{
+    // Reserve the length prefix, fill it in when the size is known.
+    const size_t start = out.size();
+    appendUint32(0, out);
+
+    appendBinaryString(result._path, out);
+    appendBinaryString(result._error, out);
+    out += static_cast<char>(result._valid);
+    appendUint64(result._openTime.count(), out);
+    appendUint64(result._parseTime.count(), out);
+    appendUint64(result._verifyTime.count(), out);
+    appendUint32(static_cast<uint32_t>(result._signatures.size()), out);
+    for (const auto& signature : result._signatures)
+    {
+        appendBinaryString(signature._subjectName, out);
+        appendBinaryString(signature._date, out);
+        appendBinaryString(signature._method, out);
+        appendBinaryString(signature._type, out);
+        appendUint32(static_cast<uint32_t>(signature._signedStreams.size()),
+                     out);
+        for (const auto& signedStream : signature._signedStreams)
+        {
+            appendBinaryString(signedStream, out);
+        }
+        out += static_cast<char>(signature._totalDocumentSigned);
+        out += static_cast<char>(signature._verified);
+        appendBinaryString(signature._error, out);
+        // 0: failed, 1: succeeded, 2: not checked.
+        char certificateHash = 2;
+        if (signature._certificateHashVerified)
+        {
+            certificateHash =
+                static_cast<char>(*signature._certificateHashVerified);
+        }
+        out += certificateHash;
+        // 0: document, 1: macro.
+        out += static_cast<char>(signature._kind ==
+                                 odfsig::SignatureKind::Macro);
+    }
+
+    std::string length;
+    appendUint32(static_cast<uint32_t>(out.size() - start - 4), length);
+    out.replace(start, 4, length);
+}
+
+bool BinaryFormat::parse(std::string_view& input,
+                         odfsig::DocumentResult& result)
+{
+    uint32_t length = 0;
+    if (!BinaryReader(input).readUint32(length) ||
+        input.size() - 4 < length)
+    {
+        return false;
+    }
+
+    result = odfsig::DocumentResult();
+    BinaryReader reader(input.substr(4, length));
+    uint32_t signatureCount = 0;
+    if (!reader.readString(result._path) ||
+        !reader.readString(result._error) || !reader.readBool(result._valid) ||
+        !reader.readMicroseconds(result._openTime) ||
+        !reader.readMicroseconds(result._parseTime) ||
+        !reader.readMicroseconds(result._verifyTime) ||
+        !reader.readUint32(signatureCount))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < signatureCount; ++i)
+    {
+        odfsig::SignatureResult signature;
+        uint32_t streamCount = 0;
+        if (!reader.readString(signature._subjectName) ||
+            !reader.readString(signature._date) ||
+            !reader.readString(signature._method) ||
+            !reader.readString(signature._type) ||
+            !reader.readUint32(streamCount))
+        {
+            return false;
+        }
+
+        for (uint32_t j = 0; j < streamCount; ++j)
+        {
+            std::string signedStream;
+            if (!reader.readString(signedStream))
+            {
+                return false;
+            }
+            signature._signedStreams.insert(signedStream);
+        }
+
+        uint8_t certificateHash = 0;
+        bool macro = false;
+        if (!reader.readBool(signature._totalDocumentSigned) ||
+            !reader.readBool(signature._verified) ||
+            !reader.readString(signature._error) ||
+            !reader.readUint8(certificateHash) || certificateHash > 2 ||
+            !reader.readBool(macro))
+        {
+            return false;
+        }
+        if (certificateHash < 2)
+        {
+            signature._certificateHashVerified = certificateHash == 1;
+        }
+        signature._kind = macro ? odfsig::SignatureKind::Macro
+                                : odfsig::SignatureKind::Document;
+        result._signatures.push_back(std::move(signature));
+    }
+
+    if (!reader.atEnd())
+    {
+        return false;
+    }
+
+    input.remove_prefix(4 + length);
+    return true;
+}
+} // namespace
+
+namespace odfsig
+{
+std::unique_ptr<ResultFormat> ResultFormat::create(const std::string& name)
+{
+    if (name == "ndjson")
+    {
+        return std::make_unique<NdjsonFormat>();
+    }
+
+    if (name == "binary")
+    {
+        return std::make_unique<BinaryFormat>();
+    }
+
+    return nullptr;
+}
+
+SharedOutput::SharedOutput(std::ostream& ostream) : _ostream(ostream) {}
+
+void SharedOutput::write(const std::string& batch)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _ostream.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+    _ostream.flush();
+}
+
+void ResultSummary::add(const DocumentResult& result)
+{
+    ++_documents;
+    if (!_paths.insert(result._path).second)
+    {
+        ++_duplicates;
+    }
+    if (result._valid)
+    {
+        ++_valid;
+    }
+    else if (!result._error.empty())
+    {
+        ++_failed;
+    }
+    _latencies.push_back(result._openTime + result._parseTime +
+                         result._verifyTime);
+}
+
+void ResultSummary::print(std::ostream& ostream)
+{
+    ostream << "Documents: " << _documents << '\n';
+    ostream << "Valid: " << _valid << '\n';
+    ostream << "Invalid: " << (_documents - _valid - _failed) << '\n';
+    ostream << "Failed to open or parse: " << _failed << '\n';
+    ostream << "Duplicates: " << _duplicates << '\n';
+    if (_latencies.empty())
+    {
+        return;
+    }
+
+    // Nearest-rank percentiles.
+    std::sort(_latencies.begin(), _latencies.end());
+    ostream << "Latency:";
+    const char* separator = " ";
+    for (const int percentile : {50, 90, 99, 100})
+    {
+        const size_t rank = (_latencies.size() * percentile + 99) / 100;
+        std::string formatted;
+        appendJsonMilliseconds(_latencies[std::max<size_t>(rank, 1) - 1],
+                               formatted);
+        ostream << separator;
+        if (percentile == 100)
+        {
+            ostream << "max";
+        }
+        else
+        {
+            ostream << 'p' << percentile;
+        }
+        ostream << ' ' << formatted << " ms";
+        separator = ", ";
+    }
+    ostream << '\n';
+}
+
+bool ResultSummary::isValid() const
+{
+    return _valid == _documents && _duplicates == 0;
+}
+
+BufferedWriter::BufferedWriter(SharedOutput& output, ResultFormat& format,
+                               size_t capacity)
+    : _output(output), _format(format), _capacity(capacity)
+{
+    _buffer.reserve(capacity);
+}
+
+BufferedWriter::~BufferedWriter() { flush(); }
+
+void BufferedWriter::write(const DocumentResult& result)
+{
+    _format.format(result, _buffer);
+    if (_buffer.size() >= _capacity)
+    {
+        flush();
+    }
+}
+
+void BufferedWriter::flush()
+{
+    if (_buffer.empty())
+    {
+        return;
+    }
+
+    _output.write(_buffer);
+    _buffer.clear();
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,152 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <odfsig/lib.hxx>
+
+namespace odfsig
+{
+/// Verification result of one signature, for machine-readable output.
+struct SignatureResult
+{
+    SignatureKind _kind = SignatureKind::Document;
+    std::string _subjectName;
+    std::string _date;
+    std::string _method;
+    std::string _type;
+    std::set<std::string> _signedStreams;
+    /// For a macro signature: all macro streams are signed.
+    bool _totalDocumentSigned = false;
+    bool _verified = false;
+    std::string _error;
+    /// Only set for verified XAdES signatures.
+    std::optional<bool> _certificateHashVerified;
+};
+
+/// Verification result of one document, for machine-readable output.
+struct DocumentResult
+{
+    std::string _path;
+    /// Set if the document could not be opened or parsed.
+    std::string _error;
+    bool _valid = false;
+    std::vector<SignatureResult> _signatures;
+    std::chrono::microseconds _openTime{0};
+    std::chrono::microseconds _parseTime{0};
+    std::chrono::microseconds _verifyTime{0};
+};
+
+/// Serializes document results to a machine-readable format.
+class ResultFormat
+{
+  public:
+    virtual ~ResultFormat() = default;
+
+    /// Appends one complete record for result to out.
+    virtual void format(const DocumentResult& result, std::string& out) = 0;
+
+    /**
+     * Reads the first record of input, written by format(), and removes it
+     * from input. Returns false if input doesn't start with a valid record.
+     */
+    virtual bool parse(std::string_view& input, DocumentResult& result) = 0;
+
+    /// Returns nullptr for unknown format names.
+    static std::unique_ptr<ResultFormat> create(const std::string& name);
+};
+
+/// Output stream shared by multiple writers, written in batches.
+class SharedOutput
+{
+  public:
+    explicit SharedOutput(std::ostream& ostream);
+
+    /// Writes a batch of complete records at once.
+    void write(const std::string& batch);
+
+  private:
+    std::mutex _mutex;
+
+    std::ostream& _ostream;
+};
+
+/**
+ * Totals and latency percentiles of document results, e.g. of the result files
+ * of several shards.
+ */
+class ResultSummary
+{
+  public:
+    void add(const DocumentResult& result);
+
+    /// Writes a human-readable report.
+    void print(std::ostream& ostream);
+
+    /// All documents are valid, and each one is reported once.
+    [[nodiscard]] bool isValid() const;
+
+  private:
+    uint64_t _documents = 0;
+
+    uint64_t _valid = 0;
+
+    /// Documents which could not be opened or parsed.
+    uint64_t _failed = 0;
+
+    uint64_t _duplicates = 0;
+
+    std::unordered_set<std::string> _paths;
+
+    /// Open, parse and verify time of each document.
+    std::vector<std::chrono::microseconds> _latencies;
+};
+
+/**
+ * Formats records into a buffer owned by one worker, so no lock is taken per
+ * record. The buffer is written to the shared output when it's full and on
+ * destruction, records are never split between batches. A capacity of 0
+ * writes each record right away.
+ */
+class BufferedWriter
+{
+  public:
+    BufferedWriter(SharedOutput& output, ResultFormat& format,
+                   size_t capacity);
+
+    ~BufferedWriter();
+
+    BufferedWriter(const BufferedWriter&) = delete;
+    BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+    void write(const DocumentResult& result);
+
+    void flush();
+
+  private:
+    SharedOutput& _output;
+
+    ResultFormat& _format;
+
+    size_t _capacity;
+
+    std::string _buffer;
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,257 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "prefetcher.hxx"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+namespace odfsig
+{
+namespace
+{
+/// Size of the reads of the background thread.
+const size_t prefetchChunkSize = 64 * 1024;
+} // namespace
+
+/// Stream of a prefetcher, reads the buffers filled by its thread.
+class PrefetchedFile : public zip::File
+{
+  public:
+    PrefetchedFile(Prefetcher& prefetcher, size_t index)
+        : _prefetcher(prefetcher), _index(index)
+    {
+    }
+
+    ~PrefetchedFile() override { _prefetcher.close(_index); }
+
+    PrefetchedFile(const PrefetchedFile&) = delete;
+    PrefetchedFile& operator=(const PrefetchedFile&) = delete;
+
+    int64_t read(void* buffer, uint64_t length) override
+    {
+        return _prefetcher.read(_index, buffer, length);
+    }
+
+    std::string getErrorString() override { return "read-ahead failed"; }
+
+  private:
+    Prefetcher& _prefetcher;
+    size_t _index;
+};
+
+Prefetcher::Prefetcher(const void* data, size_t size,
+                       std::vector<std::string> names, size_t memoryLimit)
+    : _memoryLimit(memoryLimit)
+{
+    for (auto& name : names)
+    {
+        Stream stream;
+        stream._name = std::move(name);
+        _streams.push_back(std::move(stream));
+    }
+
+    _thread = std::thread([this, data, size]() { run(data, size); });
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+    _thread.join();
+}
+
+std::unique_ptr<zip::File> Prefetcher::open(const std::string& name)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto it = std::find_if(_streams.begin(), _streams.end(),
+                           [&name](const Stream& stream)
+                           { return !stream._opened && stream._name == name; });
+    if (it == _streams.end())
+    {
+        return nullptr;
+    }
+
+    // The reader skipped the earlier streams, e.g. they have a precomputed
+    // digest.
+    for (auto skipped = _streams.begin(); skipped != it; ++skipped)
+    {
+        if (!skipped->_opened)
+        {
+            skipped->_opened = true;
+            skipped->_closed = true;
+            release(*skipped);
+        }
+    }
+    it->_opened = true;
+    _condition.notify_all();
+
+    const auto index = static_cast<size_t>(std::distance(_streams.begin(), it));
+    return std::make_unique<PrefetchedFile>(*this, index);
+}
+
+void Prefetcher::run(const void* data, size_t size)
+{
+    // A libzip archive can't be used concurrently.
+    std::unique_ptr<zip::Error> zipError = zip::Error::create();
+    std::unique_ptr<zip::Source> zipSource =
+        zip::Source::create(data, size, zipError.get());
+    std::unique_ptr<zip::Archive> zipArchive;
+    if (zipSource)
+    {
+        zipArchive = zip::Archive::create(zipSource.get(), zipError.get());
+    }
+
+    for (size_t index = 0; index < _streams.size(); ++index)
+    {
+        {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            if (_stop)
+            {
+                break;
+            }
+
+            if (_streams[index]._closed)
+            {
+                continue;
+            }
+
+            _streams[index]._state = State::Reading;
+        }
+
+        const bool ok = zipArchive && readStream(zipArchive.get(), index);
+        {
+            const std::lock_guard<std::mutex> lock(_mutex);
+            _streams[index]._state = ok ? State::Done : State::Failed;
+        }
+        _condition.notify_all();
+    }
+
+    // Don't let a reader wait for streams which will not be read.
+    const std::lock_guard<std::mutex> lock(_mutex);
+    for (auto& stream : _streams)
+    {
+        if (stream._state == State::Pending)
+        {
+            stream._state = State::Failed;
+        }
+    }
+    _condition.notify_all();
+}
+
+bool Prefetcher::readStream(zip::Archive* archive, size_t index)
+{
+    const int64_t zipIndex = archive->locateName(_streams[index]._name.c_str());
+    if (zipIndex < 0)
+    {
+        return false;
+    }
+
+    std::unique_ptr<zip::File> file = zip::File::create(archive, zipIndex);
+    if (!file)
+    {
+        return false;
+    }
+
+    while (true)
+    {
+        std::vector<unsigned char> chunk(prefetchChunkSize);
+        const int64_t read = file->read(chunk.data(), chunk.size());
+        if (read <= 0)
+        {
+            return read == 0;
+        }
+
+        chunk.resize(read);
+        std::unique_lock<std::mutex> lock(_mutex);
+        Stream& stream = _streams[index];
+        // Always allow one chunk, the reader may wait for it.
+        _condition.wait(lock,
+                        [this, &stream, &chunk]()
+                        {
+                            return _stop || stream._closed ||
+                                   stream._chunks.empty() ||
+                                   _buffered + chunk.size() <= _memoryLimit;
+                        });
+        if (_stop || stream._closed)
+        {
+            // Not needed anymore, so not a read error.
+            return true;
+        }
+
+        _buffered += chunk.size();
+        stream._chunks.push_back(std::move(chunk));
+        lock.unlock();
+        _condition.notify_all();
+    }
+}
+
+int64_t Prefetcher::read(size_t index, void* buffer, uint64_t length)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    Stream& stream = _streams[index];
+    _condition.wait(lock,
+                    [&stream]()
+                    {
+                        return !stream._chunks.empty() ||
+                               stream._state == State::Done ||
+                               stream._state == State::Failed;
+                    });
+    if (stream._chunks.empty())
+    {
+        return stream._state == State::Failed ? -1 : 0;
+    }
+
+    auto* out = static_cast<unsigned char*>(buffer);
+    uint64_t count = 0;
+    while (count < length && !stream._chunks.empty())
+    {
+        std::vector<unsigned char>& chunk = stream._chunks.front();
+        const size_t size = std::min(static_cast<size_t>(length - count),
+                                     chunk.size() - stream._offset);
+        std::memcpy(out + count, chunk.data() + stream._offset, size);
+        count += size;
+        stream._offset += size;
+        if (stream._offset == chunk.size())
+        {
+            _buffered -= chunk.size();
+            stream._chunks.pop_front();
+            stream._offset = 0;
+        }
+    }
+    lock.unlock();
+    _condition.notify_all();
+
+    return static_cast<int64_t>(count);
+}
+
+void Prefetcher::close(size_t index)
+{
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        Stream& stream = _streams[index];
+        stream._closed = true;
+        release(stream);
+    }
+    _condition.notify_all();
+}
+
+void Prefetcher::release(Stream& stream)
+{
+    for (const auto& chunk : stream._chunks)
+    {
+        _buffered -= chunk.size();
+    }
+    stream._chunks.clear();
+    stream._offset = 0;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,98 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "zip.hxx"
+
+namespace odfsig
+{
+/**
+ * Decompresses streams of a zip package ahead of their reader, on a background
+ * thread. The streams are read in the given order, from a separate archive on
+ * the same data, into buffers of at most a memory limit: the thread waits while
+ * the reader is behind.
+ */
+class Prefetcher
+{
+  public:
+    Prefetcher(const void* data, size_t size, std::vector<std::string> names,
+               size_t memoryLimit);
+
+    ~Prefetcher();
+
+    Prefetcher(const Prefetcher&) = delete;
+    Prefetcher& operator=(const Prefetcher&) = delete;
+
+    /**
+     * Returns the next not yet opened stream named name, or nullptr if there is
+     * none. Streams before it are not needed anymore and are not read.
+     */
+    std::unique_ptr<zip::File> open(const std::string& name);
+
+  private:
+    friend class PrefetchedFile;
+
+    enum class State
+    {
+        Pending,
+        Reading,
+        Done,
+        Failed,
+    };
+
+    struct Stream
+    {
+        std::string _name;
+        State _state = State::Pending;
+        /// Set by the reader.
+        bool _opened = false;
+        /// Set by the reader, the remaining data is not needed.
+        bool _closed = false;
+        std::deque<std::vector<unsigned char>> _chunks;
+        /// Offset in the first chunk.
+        size_t _offset = 0;
+    };
+
+    /// Reads the streams, runs on the background thread.
+    void run(const void* data, size_t size);
+
+    bool readStream(zip::Archive* archive, size_t index);
+
+    int64_t read(size_t index, void* buffer, uint64_t length);
+
+    void close(size_t index);
+
+    /// Drops the buffered data of a stream, call with the mutex locked.
+    void release(Stream& stream);
+
+    std::mutex _mutex;
+
+    std::condition_variable _condition;
+
+    std::vector<Stream> _streams;
+
+    /// Bytes in the chunks of all streams.
+    size_t _buffered = 0;
+
+    size_t _memoryLimit;
+
+    bool _stop = false;
+
+    std::thread _thread;
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
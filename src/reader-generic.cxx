@@ -0,0 +1,19 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "reader.hxx"
+
+namespace odfsig
+{
+std::unique_ptr<DocumentReader>
+createUringReader(std::vector<std::string>& /*paths*/, size_t /*inFlight*/)
+{
+    // No io_uring, the thread pool is used.
+    return nullptr;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
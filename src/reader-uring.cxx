@@ -0,0 +1,542 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "reader.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <mutex>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace
+{
+std::string getErrnoString(int error)
+{
+    return std::error_code(error, std::generic_category()).message();
+}
+
+unsigned loadAcquire(unsigned* value)
+{
+    return std::atomic_ref<unsigned>(*value).load(std::memory_order_acquire);
+}
+
+void storeRelease(unsigned* value, unsigned newValue)
+{
+    std::atomic_ref<unsigned>(*value).store(newValue,
+                                            std::memory_order_release);
+}
+
+/// Keeps a buffer which the kernel may still write, till the process exits.
+void keepAbandonedBuffer(std::vector<char> buffer)
+{
+    static std::mutex mutex;
+    static std::vector<std::vector<char>> buffers;
+    const std::lock_guard<std::mutex> lock(mutex);
+    buffers.push_back(std::move(buffer));
+}
+
+/**
+ * The mapped submission and completion queues of an io_uring instance, using
+ * the system calls directly: liburing is not a dependency.
+ */
+class Ring
+{
+  public:
+    Ring() = default;
+
+    ~Ring();
+
+    Ring(const Ring&) = delete;
+    Ring& operator=(const Ring&) = delete;
+
+    /// Creates a ring for at least entries submissions at a time.
+    bool setup(unsigned entries);
+
+    /// Queues a submission, returns false if the queue is full.
+    bool queue(const io_uring_sqe& entry);
+
+    /**
+     * Submits the queued entries, then waits till at least minComplete
+     * completions are available.
+     */
+    bool enter(unsigned minComplete);
+
+    /// Takes the next completion, returns false if there is none.
+    bool pop(io_uring_cqe& completion);
+
+  private:
+    int _fd = -1;
+
+    void* _sqRing = MAP_FAILED;
+
+    size_t _sqRingSize = 0;
+
+    void* _cqRing = MAP_FAILED;
+
+    size_t _cqRingSize = 0;
+
+    io_uring_sqe* _sqes = nullptr;
+
+    size_t _sqesSize = 0;
+
+    unsigned _sqEntries = 0;
+
+    unsigned* _sqHead = nullptr;
+
+    unsigned* _sqTail = nullptr;
+
+    unsigned* _sqMask = nullptr;
+
+    unsigned* _sqArray = nullptr;
+
+    unsigned* _cqHead = nullptr;
+
+    unsigned* _cqTail = nullptr;
+
+    unsigned* _cqMask = nullptr;
+
+    io_uring_cqe* _cqes = nullptr;
+
+    /// Queued, but not yet submitted entries.
+    unsigned _toSubmit = 0;
+};
+
+Ring::~Ring()
+{
+    if (_sqes != nullptr)
+    {
+        munmap(_sqes, _sqesSize);
+    }
+    if (_cqRing != MAP_FAILED && _cqRing != _sqRing)
+    {
+        munmap(_cqRing, _cqRingSize);
+    }
+    if (_sqRing != MAP_FAILED)
+    {
+        munmap(_sqRing, _sqRingSize);
+    }
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+bool Ring::setup(unsigned entries)
+{
+    io_uring_params params = {};
+    _fd = static_cast<int>(syscall(SYS_io_uring_setup, entries, &params));
+    if (_fd < 0)
+    {
+        return false;
+    }
+
+    _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    const bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap)
+    {
+        _sqRingSize = std::max(_sqRingSize, _cqRingSize);
+        _cqRingSize = _sqRingSize;
+    }
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED)
+    {
+        return false;
+    }
+    if (singleMmap)
+    {
+        _cqRing = _sqRing;
+    }
+    else
+    {
+        _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+        if (_cqRing == MAP_FAILED)
+        {
+            return false;
+        }
+    }
+    _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, _sqesSize, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+    {
+        return false;
+    }
+    _sqes = static_cast<io_uring_sqe*>(sqes);
+
+    auto* sq = static_cast<char*>(_sqRing);
+    _sqEntries = params.sq_entries;
+    _sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    _sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    _sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    auto* cq = static_cast<char*>(_cqRing);
+    _cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    _cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    return true;
+}
+
+bool Ring::queue(const io_uring_sqe& entry)
+{
+    // Only this process writes the tail.
+    const unsigned tail = *_sqTail;
+    if (tail - loadAcquire(_sqHead) == _sqEntries)
+    {
+        return false;
+    }
+
+    const unsigned index = tail & *_sqMask;
+    _sqes[index] = entry;
+    _sqArray[index] = index;
+    storeRelease(_sqTail, tail + 1);
+    ++_toSubmit;
+    return true;
+}
+
+bool Ring::enter(unsigned minComplete)
+{
+    if (_toSubmit == 0 && minComplete == 0)
+    {
+        return true;
+    }
+
+    const unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    while (true)
+    {
+        const long submitted = syscall(SYS_io_uring_enter, _fd, _toSubmit,
+                                       minComplete, flags, nullptr, 0);
+        if (submitted < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (submitted < 0)
+        {
+            return false;
+        }
+        _toSubmit -= static_cast<unsigned>(submitted);
+        return true;
+    }
+}
+
+bool Ring::pop(io_uring_cqe& completion)
+{
+    // Only this process writes the head.
+    const unsigned head = *_cqHead;
+    if (head == loadAcquire(_cqTail))
+    {
+        return false;
+    }
+
+    completion = _cqes[head & *_cqMask];
+    storeRelease(_cqHead, head + 1);
+    return true;
+}
+} // namespace
+
+namespace odfsig
+{
+/**
+ * Implementation of DocumentReader using io_uring: the reads are submitted from
+ * the thread calling next(), and run while the previous document is verified.
+ * Document i uses slot i modulo the number of reads in flight.
+ */
+class UringReader : public DocumentReader
+{
+  public:
+    UringReader(std::unique_ptr<Ring> ring, std::vector<std::string> paths,
+                size_t inFlight);
+
+    ~UringReader() override;
+
+    UringReader(const UringReader&) = delete;
+    UringReader& operator=(const UringReader&) = delete;
+
+    bool next(ReadDocument& document) override;
+
+    void recycle(std::vector<char> buffer) override;
+
+  private:
+    struct Slot
+    {
+        ReadDocument _document;
+        int _fd = -1;
+        /// The size is known, a short read means the end of the file.
+        bool _regular = false;
+        /// Size of the read in flight.
+        size_t _requested = 0;
+        bool _done = false;
+    };
+
+    /// Opens the documents which fit in the free slots and queues their reads.
+    void start();
+
+    /// Queues the next read of the document in slot index.
+    void queueRead(size_t index);
+
+    /// Handles the available completions.
+    void reap();
+
+    /// Closes the file of a slot, its document is complete.
+    void finish(Slot& slot);
+
+    /**
+     * Fails the documents being read, after io_uring failed: their reads can't
+     * be waited for, so their buffers are never reused.
+     */
+    void abandon(const std::string& error);
+
+    std::unique_ptr<Ring> _ring;
+
+    std::vector<std::string> _paths;
+
+    std::vector<Slot> _slots;
+
+    /// Index of the next document to open.
+    size_t _started = 0;
+
+    /// Index of the next document to return.
+    size_t _next = 0;
+
+    /// Reads submitted to the kernel, writing into the buffers.
+    size_t _pending = 0;
+
+    /// Set after io_uring failed, the later documents fail with it.
+    std::string _failure;
+
+    /// Recycled buffers.
+    std::vector<std::vector<char>> _buffers;
+};
+
+UringReader::UringReader(std::unique_ptr<Ring> ring,
+                         std::vector<std::string> paths, size_t inFlight)
+    : _ring(std::move(ring)), _paths(std::move(paths)), _slots(inFlight)
+{
+}
+
+UringReader::~UringReader()
+{
+    // The buffers can't be freed while the kernel writes them.
+    while (_pending > 0 && _failure.empty())
+    {
+        if (!_ring->enter(1))
+        {
+            abandon("io_uring_enter() failed: " + getErrnoString(errno));
+            break;
+        }
+
+        io_uring_cqe completion = {};
+        while (_ring->pop(completion))
+        {
+            --_pending;
+        }
+    }
+
+    for (auto& slot : _slots)
+    {
+        if (slot._fd >= 0)
+        {
+            close(slot._fd);
+        }
+    }
+}
+
+bool UringReader::next(ReadDocument& document)
+{
+    if (_next == _paths.size())
+    {
+        return false;
+    }
+
+    start();
+    Slot& slot = _slots[_next % _slots.size()];
+    while (!slot._done)
+    {
+        if (!_ring->enter(1))
+        {
+            abandon("io_uring_enter() failed: " + getErrnoString(errno));
+            break;
+        }
+        reap();
+    }
+
+    document = std::move(slot._document);
+    slot = Slot();
+    ++_next;
+
+    // Read the next documents while this one is verified.
+    start();
+    _ring->enter(0);
+    return true;
+}
+
+void UringReader::recycle(std::vector<char> buffer)
+{
+    if (_buffers.size() < _slots.size())
+    {
+        _buffers.push_back(std::move(buffer));
+    }
+}
+
+void UringReader::start()
+{
+    for (; _started < _paths.size() && _started < _next + _slots.size();
+         ++_started)
+    {
+        Slot& slot = _slots[_started % _slots.size()];
+        slot._document._path = _paths[_started];
+        if (!_failure.empty())
+        {
+            slot._document._error = _failure;
+            slot._done = true;
+            continue;
+        }
+
+        if (!_buffers.empty())
+        {
+            slot._document._buffer = std::move(_buffers.back());
+            _buffers.pop_back();
+        }
+
+        slot._fd = open(slot._document._path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (slot._fd < 0)
+        {
+            slot._document._error = "can't open '" + slot._document._path +
+                                    "': " + getErrnoString(errno);
+            slot._done = true;
+            continue;
+        }
+
+        // The extra byte allows detecting EOF without growing the buffer.
+        size_t sizeHint = 0;
+        struct stat status = {};
+        if (fstat(slot._fd, &status) == 0 && S_ISREG(status.st_mode))
+        {
+            slot._regular = true;
+            sizeHint = static_cast<size_t>(status.st_size);
+        }
+        slot._document._buffer.resize(
+            std::max(sizeHint + 1, minReadBufferSize));
+        queueRead(_started);
+    }
+}
+
+void UringReader::queueRead(size_t index)
+{
+    Slot& slot = _slots[index % _slots.size()];
+    std::vector<char>& buffer = slot._document._buffer;
+    if (slot._document._size == buffer.size())
+    {
+        buffer.resize(buffer.size() * 2);
+    }
+
+    // One read is at most 2 GiB, like read().
+    const size_t maxRead = 0x7ffff000;
+    slot._requested = std::min(buffer.size() - slot._document._size, maxRead);
+    io_uring_sqe entry = {};
+    entry.opcode = IORING_OP_READ;
+    entry.fd = slot._fd;
+    entry.off = slot._document._size;
+    entry.addr = reinterpret_cast<uint64_t>(buffer.data() +
+                                            slot._document._size);
+    entry.len = static_cast<uint32_t>(slot._requested);
+    entry.user_data = index;
+    // There is room: each slot has at most one read in flight.
+    if (!_ring->queue(entry))
+    {
+        slot._document._error = "the submission queue is full";
+        finish(slot);
+        return;
+    }
+    ++_pending;
+}
+
+void UringReader::reap()
+{
+    io_uring_cqe completion = {};
+    while (_ring->pop(completion))
+    {
+        --_pending;
+        const size_t index = completion.user_data;
+        Slot& slot = _slots[index % _slots.size()];
+        if (completion.res == -EINTR || completion.res == -EAGAIN)
+        {
+            queueRead(index);
+            continue;
+        }
+
+        if (completion.res < 0)
+        {
+            slot._document._error = "can't read '" + slot._document._path +
+                                    "': " + getErrnoString(-completion.res);
+            finish(slot);
+            continue;
+        }
+
+        const auto count = static_cast<size_t>(completion.res);
+        slot._document._size += count;
+        if (count == 0 || (slot._regular && count < slot._requested))
+        {
+            finish(slot);
+            continue;
+        }
+        queueRead(index);
+    }
+}
+
+void UringReader::finish(Slot& slot)
+{
+    close(slot._fd);
+    slot._fd = -1;
+    slot._done = true;
+}
+
+void UringReader::abandon(const std::string& error)
+{
+    _failure = error;
+    for (auto& slot : _slots)
+    {
+        if (slot._done || slot._fd < 0)
+        {
+            continue;
+        }
+
+        keepAbandonedBuffer(std::move(slot._document._buffer));
+        slot._document._buffer = std::vector<char>();
+        slot._document._size = 0;
+        slot._document._error = error;
+        finish(slot);
+    }
+}
+
+std::unique_ptr<DocumentReader>
+createUringReader(std::vector<std::string>& paths, size_t inFlight)
+{
+    auto ring = std::make_unique<Ring>();
+    if (!ring->setup(static_cast<unsigned>(inFlight)))
+    {
+        return nullptr;
+    }
+
+    return std::make_unique<UringReader>(std::move(ring), std::move(paths),
+                                         inFlight);
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
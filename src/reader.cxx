@@ -0,0 +1,259 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "reader.hxx"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace
+{
+/// Reads a whole file into the buffer of document, like Verifier::openZip().
+void readFile(odfsig::ReadDocument& document)
+{
+    std::ifstream stream(document._path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        document._error = "can't open '" + document._path + "'";
+        return;
+    }
+
+    std::error_code errorCode;
+    const std::uintmax_t fileSize =
+        std::filesystem::file_size(document._path, errorCode);
+    size_t sizeHint = 0;
+    if (!errorCode)
+    {
+        sizeHint = static_cast<size_t>(fileSize);
+    }
+
+    // The extra byte allows detecting EOF without growing the buffer.
+    std::vector<char>& buffer = document._buffer;
+    buffer.resize(std::max(sizeHint + 1, odfsig::minReadBufferSize));
+    while (stream)
+    {
+        if (document._size == buffer.size())
+        {
+            buffer.resize(buffer.size() * 2);
+        }
+
+        stream.read(buffer.data() + document._size,
+                    static_cast<std::streamsize>(buffer.size() -
+                                                 document._size));
+        document._size += static_cast<size_t>(stream.gcount());
+    }
+
+    if (stream.bad())
+    {
+        document._error = "can't read '" + document._path + "'";
+    }
+}
+} // namespace
+
+namespace odfsig
+{
+/// Implementation of DocumentReader, using one thread for each read in flight.
+class ThreadedReader : public DocumentReader
+{
+  public:
+    ThreadedReader(std::vector<std::string> paths, size_t inFlight);
+
+    ~ThreadedReader() override;
+
+    /// Starts the threads, returns false if none could be started.
+    bool start();
+
+    ThreadedReader(const ThreadedReader&) = delete;
+    ThreadedReader& operator=(const ThreadedReader&) = delete;
+
+    bool next(ReadDocument& document) override;
+
+    void recycle(std::vector<char> buffer) override;
+
+  private:
+    /// Reads documents, runs on the threads.
+    void run();
+
+    std::mutex _mutex;
+
+    std::condition_variable _condition;
+
+    std::vector<std::string> _paths;
+
+    size_t _inFlight;
+
+    /// Index of the next document to read.
+    size_t _started = 0;
+
+    /// Index of the next document to return.
+    size_t _next = 0;
+
+    /// Read documents which are not returned yet, by index.
+    std::map<size_t, ReadDocument> _done;
+
+    /// Recycled buffers.
+    std::vector<std::vector<char>> _buffers;
+
+    bool _stop = false;
+
+    std::vector<std::thread> _threads;
+};
+
+ThreadedReader::ThreadedReader(std::vector<std::string> paths,
+                               size_t inFlight)
+    : _paths(std::move(paths)), _inFlight(inFlight)
+{
+}
+
+bool ThreadedReader::start()
+{
+    for (size_t i = 0; i < _inFlight; ++i)
+    {
+        try
+        {
+            _threads.emplace_back([this]() { run(); });
+        }
+        catch (const std::system_error&)
+        {
+            // Out of threads, fewer reads are in flight.
+            break;
+        }
+    }
+    return !_threads.empty();
+}
+
+ThreadedReader::~ThreadedReader()
+{
+    {
+        const std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _condition.notify_all();
+    for (auto& thread : _threads)
+    {
+        thread.join();
+    }
+}
+
+void ThreadedReader::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        // A read document counts as in flight till it's returned.
+        _condition.wait(lock,
+                        [this]()
+                        {
+                            return _stop || _started == _paths.size() ||
+                                   _started < _next + _inFlight;
+                        });
+        if (_stop || _started == _paths.size())
+        {
+            return;
+        }
+
+        const size_t index = _started++;
+        ReadDocument document;
+        document._path = _paths[index];
+        if (!_buffers.empty())
+        {
+            document._buffer = std::move(_buffers.back());
+            _buffers.pop_back();
+        }
+        lock.unlock();
+
+        readFile(document);
+
+        lock.lock();
+        _done.emplace(index, std::move(document));
+        _condition.notify_all();
+    }
+}
+
+bool ThreadedReader::next(ReadDocument& document)
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (_next == _paths.size())
+    {
+        return false;
+    }
+
+    _condition.wait(lock, [this]() { return _done.count(_next) > 0; });
+    auto it = _done.find(_next);
+    document = std::move(it->second);
+    _done.erase(it);
+    ++_next;
+    lock.unlock();
+    _condition.notify_all();
+    return true;
+}
+
+void ThreadedReader::recycle(std::vector<char> buffer)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    if (_buffers.size() < _inFlight)
+    {
+        _buffers.push_back(std::move(buffer));
+    }
+}
+
+namespace
+{
+/// Clamps the reads in flight, more than the documents would be idle.
+size_t clampReadsInFlight(size_t inFlight, size_t documents)
+{
+    const size_t limit = std::min(documents, maxReadsInFlight);
+    return std::clamp<size_t>(inFlight, 1, std::max<size_t>(limit, 1));
+}
+
+std::unique_ptr<DocumentReader>
+createThreadedReader(std::vector<std::string> paths, size_t inFlight)
+{
+    auto reader = std::make_unique<ThreadedReader>(std::move(paths), inFlight);
+    if (!reader->start())
+    {
+        return nullptr;
+    }
+    return reader;
+}
+} // namespace
+
+std::unique_ptr<DocumentReader>
+DocumentReader::create(ReaderKind kind, std::vector<std::string> paths,
+                       size_t inFlight)
+{
+    inFlight = clampReadsInFlight(inFlight, paths.size());
+    if (kind == ReaderKind::Uring)
+    {
+        return createUringReader(paths, inFlight);
+    }
+    return createThreadedReader(std::move(paths), inFlight);
+}
+
+std::unique_ptr<DocumentReader>
+DocumentReader::create(std::vector<std::string> paths, size_t inFlight)
+{
+    inFlight = clampReadsInFlight(inFlight, paths.size());
+    // The paths are kept if io_uring is not available.
+    std::unique_ptr<DocumentReader> reader =
+        createUringReader(paths, inFlight);
+    if (reader)
+    {
+        return reader;
+    }
+    return createThreadedReader(std::move(paths), inFlight);
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
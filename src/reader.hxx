@@ -0,0 +1,23 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <odfsig/reader.hxx>
+
+namespace odfsig
+{
+/// Minimal size of a read buffer, the file size is not always known.
+const size_t minReadBufferSize = 65536;
+
+/**
+ * Returns the io_uring reader, nullptr if io_uring is not available.
+ * Implemented in reader-uring.cxx or reader-generic.cxx.
+ */
+std::unique_ptr<DocumentReader>
+createUringReader(std::vector<std::string>& paths, size_t inFlight);
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
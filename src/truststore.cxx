@@ -0,0 +1,315 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "truststore.hxx"
+
+#include <algorithm>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+#include <odfsig/base64.hxx>
+
+namespace
+{
+const unsigned char derSequenceTag = 0x30;
+
+/**
+ * Parses a DER tag and length at offset. On success, headerSize is the size
+ * of the tag and the length, and size is the size of the value.
+ */
+bool parseDerHeader(const std::string& contents, size_t offset,
+                    size_t& headerSize, size_t& size)
+{
+    if (offset > contents.size())
+    {
+        return false;
+    }
+
+    // Compare against the remaining length, so a huge size can't overflow.
+    const size_t length = contents.size() - offset;
+    if (length < 2)
+    {
+        return false;
+    }
+
+    const auto firstLengthByte =
+        static_cast<unsigned char>(contents[offset + 1]);
+    if ((firstLengthByte & 0x80) == 0)
+    {
+        headerSize = 2;
+        size = firstLengthByte;
+    }
+    else
+    {
+        // Long form, allow up to 4 length bytes.
+        const size_t lengthBytes = firstLengthByte & 0x7f;
+        if (lengthBytes == 0 || lengthBytes > 4 || lengthBytes > length - 2)
+        {
+            return false;
+        }
+
+        headerSize = 2 + lengthBytes;
+        size = 0;
+        for (size_t i = 0; i < lengthBytes; ++i)
+        {
+            size = (size << 8) |
+                   static_cast<unsigned char>(contents[offset + 2 + i]);
+        }
+    }
+
+    return headerSize <= length && size <= length - headerSize;
+}
+
+/**
+ * Checks if the DER value at offset looks like a certificate: a sequence,
+ * starting with two sequences (the TBS certificate and the signature
+ * algorithm). Sets size to the size of the whole certificate.
+ */
+bool isDerCertificate(const std::string& contents, size_t offset, size_t& size)
+{
+    size_t headerSize = 0;
+    size_t valueSize = 0;
+    if (static_cast<unsigned char>(contents[offset]) != derSequenceTag ||
+        !parseDerHeader(contents, offset, headerSize, valueSize))
+    {
+        return false;
+    }
+
+    size_t child = offset + headerSize;
+    const size_t end = child + valueSize;
+    for (int i = 0; i < 2; ++i)
+    {
+        size_t childHeaderSize = 0;
+        size_t childSize = 0;
+        if (child >= end ||
+            static_cast<unsigned char>(contents[child]) != derSequenceTag ||
+            !parseDerHeader(contents, child, childHeaderSize, childSize))
+        {
+            return false;
+        }
+        child += childHeaderSize + childSize;
+    }
+
+    if (child > end)
+    {
+        return false;
+    }
+
+    size = headerSize + valueSize;
+    return true;
+}
+} // namespace
+
+namespace odfsig
+{
+bool TrustStore::load(const std::vector<std::string>& paths,
+                      std::string& errorString)
+{
+    for (const auto& path : paths)
+    {
+        std::error_code errorCode;
+        if (!std::filesystem::is_directory(path, errorCode))
+        {
+            if (!loadFile(path, /*inDirectory=*/false, errorString))
+            {
+                return false;
+            }
+            continue;
+        }
+
+        // Sort the entries, so the load order doesn't depend on the file
+        // system.
+        std::vector<std::string> entryPaths;
+        std::filesystem::directory_iterator it(path, errorCode);
+        for (; !errorCode && it != std::filesystem::directory_iterator();
+             it.increment(errorCode))
+        {
+            if (it->is_regular_file(errorCode))
+            {
+                entryPaths.push_back(it->path().string());
+            }
+        }
+        if (errorCode)
+        {
+            errorString = "Can't read trusted directory '" + path +
+                          "': " + errorCode.message();
+            return false;
+        }
+
+        std::sort(entryPaths.begin(), entryPaths.end());
+        for (const auto& entryPath : entryPaths)
+        {
+            if (!loadFile(entryPath, /*inDirectory=*/true, errorString))
+            {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+const std::vector<std::vector<unsigned char>>&
+TrustStore::getCertificates() const
+{
+    return _certificates;
+}
+
+bool TrustStore::contains(const std::vector<unsigned char>& certificate) const
+{
+    return _certificateSet.count(
+               std::string(certificate.begin(), certificate.end())) > 0;
+}
+
+bool TrustStore::loadFile(const std::string& path, bool inDirectory,
+                          std::string& errorString)
+{
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream.is_open())
+    {
+        errorString = "Can't open trusted certificate file '" + path + "'";
+        return false;
+    }
+
+    std::stringstream buffer;
+    buffer << stream.rdbuf();
+    const std::string contents = buffer.str();
+
+    size_t count = 0;
+    if (contents.find("-----BEGIN") != std::string::npos)
+    {
+        if (!loadPem(contents, path, count, errorString))
+        {
+            return false;
+        }
+    }
+    else if (!loadDer(contents, path, count, errorString))
+    {
+        return false;
+    }
+
+    // Directories may contain other files, e.g. keys or a README.
+    if (count == 0 && !inDirectory)
+    {
+        errorString = "No certificates found in '" + path + "'";
+        return false;
+    }
+
+    return true;
+}
+
+bool TrustStore::loadPem(const std::string& contents, const std::string& path,
+                         size_t& count, std::string& errorString)
+{
+    const std::string beginPrefix("-----BEGIN ");
+    const std::string dashes("-----");
+    size_t offset = 0;
+    while ((offset = contents.find(beginPrefix, offset)) != std::string::npos)
+    {
+        const size_t labelOffset = offset + beginPrefix.size();
+        const size_t labelEnd = contents.find(dashes, labelOffset);
+        const size_t lineEnd = contents.find('\n', labelOffset);
+        if (labelEnd == std::string::npos || labelEnd > lineEnd)
+        {
+            errorString = "Invalid PEM header in '" + path + "'";
+            return false;
+        }
+
+        const std::string label =
+            contents.substr(labelOffset, labelEnd - labelOffset);
+        const std::string end = "-----END " + label + dashes;
+        const size_t dataOffset = labelEnd + dashes.size();
+        const size_t endOffset = contents.find(end, dataOffset);
+        if (endOffset == std::string::npos)
+        {
+            errorString =
+                "Missing PEM footer for " + label + " in '" + path + "'";
+            return false;
+        }
+
+        // Only whitespace may follow the footer on its line.
+        offset = endOffset + end.size();
+        const size_t footerEnd =
+            std::min(contents.find('\n', offset), contents.size());
+        if (contents.find_first_not_of(" \t\r", offset) < footerEnd)
+        {
+            errorString = "Invalid PEM footer in '" + path + "'";
+            return false;
+        }
+
+        // Its trust settings would be ignored, so don't trust it at all.
+        if (label == "TRUSTED CERTIFICATE")
+        {
+            errorString =
+                "Unsupported TRUSTED CERTIFICATE PEM block in '" + path + "'";
+            return false;
+        }
+
+        if (label != "CERTIFICATE")
+        {
+            continue;
+        }
+
+        std::vector<unsigned char> certificate;
+        if (!base64Decode(std::string_view(contents).substr(
+                              dataOffset, endOffset - dataOffset),
+                          certificate))
+        {
+            errorString = "Invalid PEM data in '" + path + "'";
+            return false;
+        }
+
+        addCertificate(std::move(certificate));
+        ++count;
+    }
+
+    return true;
+}
+
+bool TrustStore::loadDer(const std::string& contents, const std::string& path,
+                         size_t& count, std::string& errorString)
+{
+    size_t offset = 0;
+    size_t size = 0;
+    while (offset < contents.size() &&
+           isDerCertificate(contents, offset, size))
+    {
+        addCertificate(std::vector<unsigned char>(
+            contents.begin() + static_cast<std::ptrdiff_t>(offset),
+            contents.begin() + static_cast<std::ptrdiff_t>(offset + size)));
+        offset += size;
+        ++count;
+    }
+
+    // No certificates at all is not DER, that's decided by the caller.
+    if (count > 0 && offset < contents.size())
+    {
+        errorString = "Trailing data after the certificates in '" + path + "'";
+        return false;
+    }
+
+    return true;
+}
+
+void TrustStore::addCertificate(std::vector<unsigned char> certificate)
+{
+    if (!_certificateSet.emplace(certificate.begin(), certificate.end())
+             .second)
+    {
+        return;
+    }
+
+    _certificates.push_back(std::move(certificate));
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
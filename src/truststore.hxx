@@ -0,0 +1,63 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstddef>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace odfsig
+{
+/// Trusted certificates, read once from DER / PEM files and directories.
+class TrustStore
+{
+  public:
+    /**
+     * Reads each path: a DER or PEM file with one or more certificates, or a
+     * directory of such files. Files in a directory without certificates are
+     * ignored. Returns false on failure, and sets errorString.
+     */
+    bool load(const std::vector<std::string>& paths, std::string& errorString);
+
+    /// DER encoded certificates, in load order, without duplicates.
+    [[nodiscard]] const std::vector<std::vector<unsigned char>>&
+    getCertificates() const;
+
+    /// Checks if a DER encoded certificate was loaded.
+    [[nodiscard]] bool
+    contains(const std::vector<unsigned char>& certificate) const;
+
+  private:
+    bool loadFile(const std::string& path, bool inDirectory,
+                  std::string& errorString);
+
+    /**
+     * Extracts certificates from PEM blocks, count is increased with the
+     * number of found certificates. Blocks of other types, e.g. keys, are
+     * skipped. Returns false on malformed blocks and on trusted certificates,
+     * and sets errorString.
+     */
+    bool loadPem(const std::string& contents, const std::string& path,
+                 size_t& count, std::string& errorString);
+
+    /**
+     * Extracts concatenated DER certificates, count is their number. Returns
+     * false if data follows the certificates, and sets errorString.
+     */
+    bool loadDer(const std::string& contents, const std::string& path,
+                 size_t& count, std::string& errorString);
+
+    void addCertificate(std::vector<unsigned char> certificate);
+
+    std::vector<std::vector<unsigned char>> _certificates;
+
+    /// Contents of _certificates, to detect duplicates.
+    std::unordered_set<std::string> _certificateSet;
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
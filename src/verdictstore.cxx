@@ -0,0 +1,138 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "verdictstore.hxx"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <system_error>
+#include <utility>
+
+namespace
+{
+std::string formatLine(const std::string& identity,
+                       std::chrono::system_clock::time_point validUntil)
+{
+    std::ostringstream line;
+    line << identity << ' '
+         << std::chrono::duration_cast<std::chrono::seconds>(
+                validUntil.time_since_epoch())
+                .count()
+         << '\n';
+    return line.str();
+}
+} // namespace
+
+namespace odfsig
+{
+VerdictStore::VerdictStore(std::string path) : _path(std::move(path)) {}
+
+bool VerdictStore::load(std::string& errorString)
+{
+    std::ifstream stream(_path);
+    if (!stream.is_open())
+    {
+        // Nothing verified yet.
+        return true;
+    }
+
+    const std::lock_guard<std::mutex> lock(_mutex);
+    const std::chrono::system_clock::time_point now =
+        std::chrono::system_clock::now();
+    size_t lines = 0;
+    std::string line;
+    while (std::getline(stream, line))
+    {
+        ++lines;
+        std::istringstream lineStream(line);
+        std::string identity;
+        int64_t validUntil = 0;
+        if (!(lineStream >> identity >> validUntil))
+        {
+            errorString = "Invalid line in verdict store '" + _path + "'";
+            return false;
+        }
+
+        const auto end = std::chrono::system_clock::time_point(
+            std::chrono::seconds(validUntil));
+        if (end <= now)
+        {
+            continue;
+        }
+
+        std::chrono::system_clock::time_point& verdict = _verdicts[identity];
+        verdict = std::max(verdict, end);
+    }
+    stream.close();
+
+    // Verdicts are only appended, so expired and repeated ones pile up.
+    if (_verdicts.size() < lines)
+    {
+        compact();
+    }
+
+    return true;
+}
+
+void VerdictStore::compact()
+{
+    // Write a new file and rename it over the old one, so readers see either
+    // the old or the new one. Lines appended by others in the meantime are
+    // lost, those verdicts are then just not reused.
+    std::error_code errorCode;
+    const std::string newPath =
+        _path + "." + std::to_string(std::random_device()());
+    {
+        std::ofstream stream(newPath, std::ios::trunc);
+        for (const auto& verdict : _verdicts)
+        {
+            stream << formatLine(verdict.first, verdict.second);
+        }
+        stream.flush();
+        if (!stream)
+        {
+            stream.close();
+            std::filesystem::remove(newPath, errorCode);
+            return;
+        }
+    }
+
+    std::filesystem::rename(newPath, _path, errorCode);
+    if (errorCode)
+    {
+        std::filesystem::remove(newPath, errorCode);
+    }
+}
+
+bool VerdictStore::contains(const std::string& identity)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _verdicts.find(identity);
+    if (it == _verdicts.end())
+    {
+        return false;
+    }
+
+    return std::chrono::system_clock::now() < it->second;
+}
+
+void VerdictStore::add(const std::string& identity,
+                       std::chrono::system_clock::time_point validUntil)
+{
+    const std::lock_guard<std::mutex> lock(_mutex);
+    _verdicts[identity] = validUntil;
+
+    // Append a complete line at once, so concurrent writers don't mix lines.
+    std::ofstream stream(_path, std::ios::app);
+    stream << formatLine(identity, validUntil);
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,54 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace odfsig
+{
+/**
+ * Earlier positive verdicts of signatures, persisted in a local file. Each
+ * line is a hex signature identity and the end of its validity as UNIX time.
+ */
+class VerdictStore
+{
+  public:
+    explicit VerdictStore(std::string path);
+
+    /**
+     * Reads the file, a missing file is an empty store. Expired and repeated
+     * verdicts are dropped, also from the file.
+     */
+    bool load(std::string& errorString);
+
+    /// Checks if identity was valid and the verdict is not expired yet.
+    bool contains(const std::string& identity);
+
+    /**
+     * Records a valid signature, also appending it to the file. Write errors
+     * are ignored, the verdict is then just not reused by later runs.
+     */
+    void add(const std::string& identity,
+             std::chrono::system_clock::time_point validUntil);
+
+  private:
+    /// Rewrites the file with the verdicts in memory.
+    void compact();
+
+    std::string _path;
+
+    std::mutex _mutex;
+
+    /// Hex identity -> end of validity.
+    std::unordered_map<std::string, std::chrono::system_clock::time_point>
+        _verdicts;
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
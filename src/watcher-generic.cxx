@@ -0,0 +1,19 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "watcher.hxx"
+
+namespace odfsig
+{
+std::unique_ptr<DirectoryWatcher>
+DirectoryWatcher::create(const std::string& /*path*/, std::string& errorString)
+{
+    errorString = "watching a directory is not supported on this platform";
+    return nullptr;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
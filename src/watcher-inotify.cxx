@@ -0,0 +1,259 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "watcher.hxx"
+
+#include <cerrno>
+#include <filesystem>
+#include <map>
+#include <system_error>
+#include <utility>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+/// Device and inode number.
+using Inode = std::pair<dev_t, ino_t>;
+
+/// Size and modification time.
+using Version = std::pair<off_t, std::pair<time_t, long>>;
+
+std::string getErrnoString()
+{
+    return std::error_code(errno, std::generic_category()).message();
+}
+} // namespace
+
+namespace odfsig
+{
+/// Implementation of DirectoryWatcher using inotify, events are not polled.
+class InotifyWatcher : public DirectoryWatcher
+{
+  public:
+    InotifyWatcher(std::string path, int fd);
+
+    ~InotifyWatcher() override;
+
+    InotifyWatcher(const InotifyWatcher&) = delete;
+    InotifyWatcher& operator=(const InotifyWatcher&) = delete;
+
+    bool wait(std::chrono::milliseconds timeout,
+              std::vector<std::string>& paths,
+              std::string& errorString) override;
+
+  private:
+    /// Reports all files, at the start and when events were lost.
+    bool scan(std::vector<std::string>& paths, std::string& errorString);
+
+    /// Reports name, if it's a new version of a regular file.
+    void report(const std::string& name, std::vector<std::string>& paths);
+
+    /// Forgets a deleted or moved away file.
+    void forget(const std::string& name);
+
+    std::string _path;
+
+    int _fd;
+
+    bool _scanned = false;
+
+    /// Inodes of the reported files, by name.
+    std::map<std::string, Inode> _inodes;
+
+    /// Versions of the reported inodes.
+    std::map<Inode, Version> _versions;
+};
+
+InotifyWatcher::InotifyWatcher(std::string path, int fd)
+    : _path(std::move(path)), _fd(fd)
+{
+}
+
+InotifyWatcher::~InotifyWatcher() { close(_fd); }
+
+bool InotifyWatcher::wait(std::chrono::milliseconds timeout,
+                          std::vector<std::string>& paths,
+                          std::string& errorString)
+{
+    if (!_scanned)
+    {
+        // The watch is already added, so no file is missed in between.
+        _scanned = true;
+        return scan(paths, errorString);
+    }
+
+    pollfd pollFd{};
+    pollFd.fd = _fd;
+    pollFd.events = POLLIN;
+    const int ready = poll(&pollFd, 1, static_cast<int>(timeout.count()));
+    if (ready <= 0)
+    {
+        // Interrupted by a signal is like a timeout, the caller may stop.
+        if (ready < 0 && errno != EINTR)
+        {
+            errorString = "poll() failed: " + getErrnoString();
+            return false;
+        }
+        return true;
+    }
+
+    bool overflow = false;
+    alignas(inotify_event) char buffer[4096];
+    while (true)
+    {
+        const ssize_t length = read(_fd, buffer, sizeof(buffer));
+        if (length < 0)
+        {
+            if (errno == EAGAIN)
+            {
+                break;
+            }
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            errorString = "reading inotify events failed: " + getErrnoString();
+            return false;
+        }
+
+        for (ssize_t offset = 0; offset < length;)
+        {
+            const auto* event =
+                reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+            if ((event->mask & IN_Q_OVERFLOW) != 0)
+            {
+                overflow = true;
+                continue;
+            }
+
+            if ((event->mask & IN_IGNORED) != 0)
+            {
+                errorString = "the watched directory was removed";
+                return false;
+            }
+
+            if (event->len == 0 || (event->mask & IN_ISDIR) != 0)
+            {
+                continue;
+            }
+
+            const std::string name(event->name);
+            if ((event->mask & (IN_DELETE | IN_MOVED_FROM)) != 0)
+            {
+                forget(name);
+            }
+            else
+            {
+                report(name, paths);
+            }
+        }
+    }
+
+    if (overflow)
+    {
+        return scan(paths, errorString);
+    }
+
+    return true;
+}
+
+bool InotifyWatcher::scan(std::vector<std::string>& paths,
+                          std::string& errorString)
+{
+    std::error_code errorCode;
+    std::filesystem::directory_iterator it(_path, errorCode);
+    if (errorCode)
+    {
+        errorString = "can't list '" + _path + "': " + errorCode.message();
+        return false;
+    }
+
+    for (const auto& entry : it)
+    {
+        report(entry.path().filename().string(), paths);
+    }
+    return true;
+}
+
+void InotifyWatcher::report(const std::string& name,
+                            std::vector<std::string>& paths)
+{
+    if (name.empty() || name[0] == '.')
+    {
+        return;
+    }
+
+    const std::string path = _path + "/" + name;
+    struct stat status = {};
+    if (stat(path.c_str(), &status) != 0 || !S_ISREG(status.st_mode))
+    {
+        return;
+    }
+
+    const Inode inode(status.st_dev, status.st_ino);
+    const Version version(
+        status.st_size,
+        std::make_pair(status.st_mtim.tv_sec, status.st_mtim.tv_nsec));
+    auto [nameIt, inserted] = _inodes.try_emplace(name, inode);
+    if (!inserted && nameIt->second != inode)
+    {
+        // The name was replaced, e.g. renamed over, the old inode is gone.
+        _versions.erase(nameIt->second);
+        nameIt->second = inode;
+    }
+
+    auto it = _versions.find(inode);
+    if (it != _versions.end() && it->second == version)
+    {
+        return;
+    }
+
+    _versions[inode] = version;
+    paths.push_back(path);
+}
+
+void InotifyWatcher::forget(const std::string& name)
+{
+    auto it = _inodes.find(name);
+    if (it == _inodes.end())
+    {
+        return;
+    }
+
+    _versions.erase(it->second);
+    _inodes.erase(it);
+}
+
+std::unique_ptr<DirectoryWatcher>
+DirectoryWatcher::create(const std::string& path, std::string& errorString)
+{
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        errorString = "inotify_init1() failed: " + getErrnoString();
+        return nullptr;
+    }
+
+    // Completely written files, directly or by renaming them.
+    const uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE |
+                          IN_MOVED_FROM | IN_ONLYDIR;
+    if (inotify_add_watch(fd, path.c_str(), mask) < 0)
+    {
+        errorString = "can't watch '" + path + "': " + getErrnoString();
+        close(fd);
+        return nullptr;
+    }
+
+    return std::make_unique<InotifyWatcher>(path, fd);
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,44 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace odfsig
+{
+/**
+ * Reports the files which are completely written to a directory, e.g. a drop
+ * folder. A file is reported again only if its inode, size or modification time
+ * changed. Hidden files (starting with '.') are ignored, they are typically
+ * partial uploads, renamed when they are complete.
+ */
+class DirectoryWatcher
+{
+  public:
+    virtual ~DirectoryWatcher() = default;
+
+    /**
+     * Waits at most timeout for new files, then appends their paths to paths.
+     * The files already in the directory are reported by the first call.
+     * Returns false on failure, and sets errorString.
+     */
+    virtual bool wait(std::chrono::milliseconds timeout,
+                      std::vector<std::string>& paths,
+                      std::string& errorString) = 0;
+
+    /**
+     * Factory for this interface, implemented in watcher-inotify.cxx or
+     * watcher-generic.cxx. Returns nullptr on failure, and sets errorString.
+     */
+    static std::unique_ptr<DirectoryWatcher> create(const std::string& path,
+                                                    std::string& errorString);
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,21 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "workers.hxx"
+
+namespace odfsig
+{
+std::unique_ptr<WorkerProcesses>
+WorkerProcesses::create(size_t /*count*/,
+                        std::chrono::milliseconds /*hangTimeout*/,
+                        Verify /*verify*/, std::string& errorString)
+{
+    errorString = "worker processes are not supported on this platform";
+    return nullptr;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,551 @@
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "workers.hxx"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+/// Capacity of the result ring of one worker, a result is much smaller.
+const size_t ringCapacity = 1024 * 1024;
+
+std::string getErrnoString()
+{
+    return std::error_code(errno, std::generic_category()).message();
+}
+
+/**
+ * Lock-free single-producer, single-consumer ring in shared memory: the worker
+ * appends binary result records, the parent consumes them. The positions only
+ * grow, their difference is the used space.
+ */
+struct ResultRing
+{
+    std::atomic<uint64_t> _head{0};
+    std::atomic<uint64_t> _tail{0};
+    char _data[ringCapacity];
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free,
+              "the ring is shared between processes");
+
+void copyToRing(ResultRing& ring, uint64_t position, const char* data,
+                size_t size)
+{
+    const size_t offset = position % ringCapacity;
+    const size_t first = std::min(size, ringCapacity - offset);
+    std::memcpy(ring._data + offset, data, first);
+    std::memcpy(ring._data, data + first, size - first);
+}
+
+void copyFromRing(const ResultRing& ring, uint64_t position, char* data,
+                  size_t size)
+{
+    const size_t offset = position % ringCapacity;
+    const size_t first = std::min(size, ringCapacity - offset);
+    std::memcpy(data, ring._data + offset, first);
+    std::memcpy(data + first, ring._data, size - first);
+}
+
+/// Appends a record, waits while the parent is behind. Called in the worker.
+void pushRecord(ResultRing& ring, std::string_view record)
+{
+    const uint64_t head = ring._head.load(std::memory_order_relaxed);
+    while (head + record.size() -
+               ring._tail.load(std::memory_order_acquire) >
+           ringCapacity)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    copyToRing(ring, head, record.data(), record.size());
+    ring._head.store(head + record.size(), std::memory_order_release);
+}
+
+/// Takes all appended records. Called in the parent.
+void popRecords(ResultRing& ring, std::string& records)
+{
+    const uint64_t tail = ring._tail.load(std::memory_order_relaxed);
+    const uint64_t head = ring._head.load(std::memory_order_acquire);
+    records.resize(head - tail);
+    copyFromRing(ring, tail, records.data(), records.size());
+    ring._tail.store(head, std::memory_order_release);
+}
+
+bool readAll(int fd, void* buffer, size_t size)
+{
+    auto* data = static_cast<char*>(buffer);
+    while (size > 0)
+    {
+        const ssize_t count = read(fd, data, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count <= 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+bool writeAll(int fd, const void* buffer, size_t size)
+{
+    const auto* data = static_cast<const char*>(buffer);
+    while (size > 0)
+    {
+        const ssize_t count = write(fd, data, size);
+        if (count < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (count < 0)
+        {
+            return false;
+        }
+        data += count;
+        size -= static_cast<size_t>(count);
+    }
+    return true;
+}
+
+void closeFd(int& fd)
+{
+    if (fd >= 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+}
+
+/// Describes the wait() status of a worker which exited unexpectedly.
+std::string describeExit(int status)
+{
+    if (WIFSIGNALED(status))
+    {
+        return "killed by signal " + std::to_string(WTERMSIG(status));
+    }
+
+    return "exited with status " + std::to_string(WEXITSTATUS(status));
+}
+
+/// One worker process, as seen by the parent.
+struct Worker
+{
+    Worker() = default;
+
+    ~Worker();
+
+    Worker(const Worker&) = delete;
+    Worker& operator=(const Worker&) = delete;
+
+    /// Shared with the process, kept when the process is replaced.
+    ResultRing* _ring = nullptr;
+
+    pid_t _pid = -1;
+
+    /// Write end of the pipe of the paths.
+    int _requests = -1;
+
+    /// Read end of the pipe of the completion notifications.
+    int _completions = -1;
+
+    /// Index of the document being verified, if any.
+    std::optional<size_t> _document;
+
+    std::chrono::steady_clock::time_point _start;
+};
+
+Worker::~Worker()
+{
+    closeFd(_requests);
+    closeFd(_completions);
+    if (_ring != nullptr)
+    {
+        munmap(_ring, sizeof(ResultRing));
+    }
+}
+} // namespace
+
+namespace odfsig
+{
+/// Implementation of WorkerProcesses using fork(), pipes and shared mappings.
+class ForkedWorkers : public WorkerProcesses
+{
+  public:
+    ForkedWorkers(std::chrono::milliseconds hangTimeout, Verify verify);
+
+    ~ForkedWorkers() override;
+
+    ForkedWorkers(const ForkedWorkers&) = delete;
+    ForkedWorkers& operator=(const ForkedWorkers&) = delete;
+
+    /// Forks count workers.
+    bool start(size_t count, std::string& errorString);
+
+    bool run(const std::vector<std::string>& paths, const Report& report,
+             std::string& errorString) override;
+
+  private:
+    /// Forks the process of worker.
+    bool spawn(Worker& worker, std::string& errorString);
+
+    /// Verifies the requested documents, runs in the forked process.
+    [[noreturn]] void serve(int requests, int completions, ResultRing& ring);
+
+    bool dispatch(const std::vector<std::string>& paths, const Report& report,
+                  std::string& errorString);
+
+    /**
+     * Reports the result of the document of worker from the ring, or a failure
+     * with reason if there is none, e.g. the worker crashed.
+     */
+    void complete(Worker& worker, const std::vector<std::string>& paths,
+                  const std::string& reason, const Report& report);
+
+    /// Closes the pipes of an exited or killed worker, returns its status.
+    int reap(Worker& worker);
+
+    std::chrono::milliseconds _hangTimeout;
+
+    Verify _verify;
+
+    std::unique_ptr<ResultFormat> _format;
+
+    std::vector<std::unique_ptr<Worker>> _workers;
+
+    /// Reused by complete().
+    std::string _records;
+};
+
+ForkedWorkers::ForkedWorkers(std::chrono::milliseconds hangTimeout,
+                             Verify verify)
+    : _hangTimeout(hangTimeout), _verify(std::move(verify)),
+      _format(ResultFormat::create("binary"))
+{
+}
+
+ForkedWorkers::~ForkedWorkers()
+{
+    // An idle worker exits at the end of its requests.
+    for (auto& worker : _workers)
+    {
+        if (worker->_pid < 0)
+        {
+            continue;
+        }
+
+        if (worker->_document)
+        {
+            kill(worker->_pid, SIGKILL);
+        }
+        closeFd(worker->_requests);
+        reap(*worker);
+    }
+}
+
+bool ForkedWorkers::start(size_t count, std::string& errorString)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        auto worker = std::make_unique<Worker>();
+        void* memory = mmap(nullptr, sizeof(ResultRing), PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+        {
+            errorString = "mmap() failed: " + getErrnoString();
+            return false;
+        }
+        worker->_ring = new (memory) ResultRing();
+        _workers.push_back(std::move(worker));
+        if (!spawn(*_workers.back(), errorString))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ForkedWorkers::spawn(Worker& worker, std::string& errorString)
+{
+    int requests[2];
+    int completions[2];
+    if (pipe2(requests, O_CLOEXEC) != 0)
+    {
+        errorString = "pipe() failed: " + getErrnoString();
+        return false;
+    }
+    if (pipe2(completions, O_CLOEXEC) != 0)
+    {
+        errorString = "pipe() failed: " + getErrnoString();
+        close(requests[0]);
+        close(requests[1]);
+        return false;
+    }
+
+    // A replaced worker may have left a partial record.
+    worker._ring->_head.store(0, std::memory_order_relaxed);
+    worker._ring->_tail.store(0, std::memory_order_relaxed);
+    const pid_t pid = fork();
+    if (pid < 0)
+    {
+        errorString = "fork() failed: " + getErrnoString();
+        for (const int fd : {requests[0], requests[1], completions[0],
+                             completions[1]})
+        {
+            close(fd);
+        }
+        return false;
+    }
+
+    if (pid == 0)
+    {
+        close(requests[1]);
+        close(completions[0]);
+        // Otherwise the other workers would not see the end of their requests.
+        for (auto& other : _workers)
+        {
+            closeFd(other->_requests);
+            closeFd(other->_completions);
+        }
+        serve(requests[0], completions[1], *worker._ring);
+    }
+
+    close(requests[0]);
+    close(completions[1]);
+    worker._pid = pid;
+    worker._requests = requests[1];
+    worker._completions = completions[0];
+    return true;
+}
+
+void ForkedWorkers::serve(int requests, int completions, ResultRing& ring)
+{
+    // The parent ignores it while it dispatches.
+    signal(SIGPIPE, SIG_DFL);
+    std::string path;
+    std::string record;
+    while (true)
+    {
+        uint32_t size = 0;
+        if (!readAll(requests, &size, sizeof(size)))
+        {
+            break;
+        }
+        path.resize(size);
+        if (!readAll(requests, path.data(), size))
+        {
+            break;
+        }
+
+        const DocumentResult result = _verify(path);
+        record.clear();
+        _format->format(result, record);
+        if (record.size() > ringCapacity)
+        {
+            DocumentResult tooLarge;
+            tooLarge._path = path;
+            tooLarge._error = "Result is too large";
+            record.clear();
+            _format->format(tooLarge, record);
+        }
+        pushRecord(ring, record);
+
+        const char completion = 0;
+        if (!writeAll(completions, &completion, sizeof(completion)))
+        {
+            break;
+        }
+    }
+
+    // Skip the exit handlers, the state belongs to the parent.
+    _exit(0);
+}
+
+bool ForkedWorkers::run(const std::vector<std::string>& paths,
+                        const Report& report, std::string& errorString)
+{
+    // A request to a crashed worker fails with EPIPE instead.
+    struct sigaction ignore = {};
+    ignore.sa_handler = SIG_IGN;
+    struct sigaction previous = {};
+    sigaction(SIGPIPE, &ignore, &previous);
+    const bool ok = dispatch(paths, report, errorString);
+    sigaction(SIGPIPE, &previous, nullptr);
+    return ok;
+}
+
+bool ForkedWorkers::dispatch(const std::vector<std::string>& paths,
+                             const Report& report, std::string& errorString)
+{
+    size_t next = 0;
+    size_t done = 0;
+    std::vector<pollfd> pollFds;
+    while (done < paths.size())
+    {
+        auto now = std::chrono::steady_clock::now();
+        for (auto& worker : _workers)
+        {
+            if (worker->_document || next == paths.size())
+            {
+                continue;
+            }
+
+            // A failed write means a crash, which is noticed below.
+            const std::string& path = paths[next];
+            const auto size = static_cast<uint32_t>(path.size());
+            if (writeAll(worker->_requests, &size, sizeof(size)))
+            {
+                writeAll(worker->_requests, path.data(), path.size());
+            }
+            worker->_document = next++;
+            worker->_start = now;
+        }
+
+        int timeout = -1;
+        pollFds.clear();
+        for (const auto& worker : _workers)
+        {
+            pollfd pollFd{};
+            pollFd.fd = worker->_completions;
+            pollFd.events = POLLIN;
+            pollFds.push_back(pollFd);
+            if (worker->_document)
+            {
+                const auto remaining =
+                    std::chrono::duration_cast<std::chrono::milliseconds>(
+                        worker->_start + _hangTimeout - now);
+                const int remainingMs =
+                    static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+                timeout = timeout < 0 ? remainingMs
+                                      : std::min(timeout, remainingMs);
+            }
+        }
+
+        const int ready =
+            poll(pollFds.data(), static_cast<nfds_t>(pollFds.size()), timeout);
+        if (ready < 0 && errno != EINTR)
+        {
+            errorString = "poll() failed: " + getErrnoString();
+            return false;
+        }
+
+        now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < _workers.size(); ++i)
+        {
+            Worker& worker = *_workers[i];
+            if (ready > 0 && pollFds[i].revents != 0)
+            {
+                char completion = 0;
+                const ssize_t count =
+                    read(worker._completions, &completion, sizeof(completion));
+                if (count < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (count == 1)
+                {
+                    complete(worker, paths, "Worker returned no result",
+                             report);
+                    ++done;
+                    continue;
+                }
+
+                // The worker may have died after its result was complete.
+                const int status = reap(worker);
+                if (worker._document)
+                {
+                    complete(worker, paths,
+                             "Worker crashed: " + describeExit(status), report);
+                    ++done;
+                }
+                if (!spawn(worker, errorString))
+                {
+                    return false;
+                }
+            }
+            else if (worker._document && now - worker._start >= _hangTimeout)
+            {
+                kill(worker._pid, SIGKILL);
+                reap(worker);
+                complete(worker, paths,
+                         "Worker hung, killed after " +
+                             std::to_string(_hangTimeout.count()) + " ms",
+                         report);
+                ++done;
+                if (!spawn(worker, errorString))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void ForkedWorkers::complete(Worker& worker,
+                             const std::vector<std::string>& paths,
+                             const std::string& reason, const Report& report)
+{
+    popRecords(*worker._ring, _records);
+    std::string_view input(_records);
+    DocumentResult result;
+    if (input.empty() || !_format->parse(input, result))
+    {
+        result = DocumentResult();
+        result._path = paths[*worker._document];
+        result._error = reason;
+    }
+    report(result);
+    worker._document.reset();
+}
+
+int ForkedWorkers::reap(Worker& worker)
+{
+    closeFd(worker._requests);
+    closeFd(worker._completions);
+    int status = 0;
+    while (waitpid(worker._pid, &status, 0) < 0 && errno == EINTR)
+    {
+    }
+    worker._pid = -1;
+    return status;
+}
+
+std::unique_ptr<WorkerProcesses>
+WorkerProcesses::create(size_t count, std::chrono::milliseconds hangTimeout,
+                        Verify verify, std::string& errorString)
+{
+    auto workers =
+        std::make_unique<ForkedWorkers>(hangTimeout, std::move(verify));
+    if (!workers->start(count, errorString))
+    {
+        return nullptr;
+    }
+    return workers;
+}
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -0,0 +1,56 @@
+#pragma once
+/*
+ * Copyright 2018 Miklos Vajna
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "output.hxx"
+
+namespace odfsig
+{
+/**
+ * Verifies documents in forked worker processes, so a document crashing or
+ * hanging its worker only fails itself. The workers are forked upfront, they
+ * inherit the initialized crypto state of the parent. Paths are sent to them
+ * over pipes, their results are returned in shared memory.
+ */
+class WorkerProcesses
+{
+  public:
+    /// Verifies one document, called in a worker.
+    using Verify = std::function<DocumentResult(const std::string& path)>;
+
+    /// Receives one result, called in the parent.
+    using Report = std::function<void(const DocumentResult& result)>;
+
+    virtual ~WorkerProcesses() = default;
+
+    /**
+     * Verifies paths in the workers and reports the results in the order the
+     * documents complete. A crashed worker, or one busy with a document for
+     * longer than the hang timeout is replaced with a new one. Returns false
+     * on failure, and sets errorString.
+     */
+    virtual bool run(const std::vector<std::string>& paths,
+                     const Report& report, std::string& errorString) = 0;
+
+    /**
+     * Factory for this interface, implemented in workers-posix.cxx or
+     * workers-generic.cxx. Forks count workers, which call verify. Returns
+     * nullptr on failure, and sets errorString.
+     */
+    static std::unique_ptr<WorkerProcesses>
+    create(size_t count, std::chrono::milliseconds hangTimeout, Verify verify,
+           std::string& errorString);
+};
+} // namespace odfsig
+
+/* vim:set shiftwidth=4 softtabstop=4 expandtab: */
@@ -6,12 +6,26 @@
 
 #include "zip.hxx"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <optional>
+#include <vector>
 
 #include <zip.h>
 
+#include <odfsig/crc32.hxx>
+
+#include "inflate.hxx"
+
 namespace odfsig::zip
 {
+namespace
+{
+/// Larger entries are decompressed by libzip as they are read.
+const uint64_t maxInflatedSize = 4 * 1024 * 1024;
+} // namespace
+
 /// Wrapper around libzip's zip_error_t.
 class ZipError : public Error
 {
@@ -95,6 +109,12 @@ class ZipArchive : public Archive
 
     std::string getName(int64_t index) override;
 
+    bool getSize(int64_t index, uint64_t& size) override;
+
+    bool getCompressedSize(int64_t index, uint64_t& size) override;
+
+    bool getCrc(int64_t index, uint32_t& crc) override;
+
     zip_t* get();
 
   private:
@@ -162,6 +182,54 @@ std::string ZipArchive::getName(int64_t index)
     return name;
 }
 
+bool ZipArchive::getSize(int64_t index, uint64_t& size)
+{
+    assert(_archive);
+
+    zip_stat_t stat;
+    zip_stat_init(&stat);
+    if (zip_stat_index(_archive, index, 0, &stat) < 0 ||
+        (stat.valid & ZIP_STAT_SIZE) == 0)
+    {
+        return false;
+    }
+
+    size = stat.size;
+    return true;
+}
+
+bool ZipArchive::getCompressedSize(int64_t index, uint64_t& size)
+{
+    assert(_archive);
+
+    zip_stat_t stat;
+    zip_stat_init(&stat);
+    if (zip_stat_index(_archive, index, 0, &stat) < 0 ||
+        (stat.valid & ZIP_STAT_COMP_SIZE) == 0)
+    {
+        return false;
+    }
+
+    size = stat.comp_size;
+    return true;
+}
+
+bool ZipArchive::getCrc(int64_t index, uint32_t& crc)
+{
+    assert(_archive);
+
+    zip_stat_t stat;
+    zip_stat_init(&stat);
+    if (zip_stat_index(_archive, index, 0, &stat) < 0 ||
+        (stat.valid & ZIP_STAT_CRC) == 0)
+    {
+        return false;
+    }
+
+    crc = stat.crc;
+    return true;
+}
+
 zip_t* ZipArchive::get() { return _archive; }
 
 std::unique_ptr<Archive> Archive::create(Source* source, Error* error)
@@ -181,7 +249,8 @@ std::unique_ptr<Archive> Archive::create(Source* source, Error* error)
 class ZipFile : public File
 {
   public:
-    ZipFile(Archive* archive, int64_t index);
+    /// If compressed is true, the raw data of the entry is read.
+    ZipFile(Archive* archive, int64_t index, bool compressed = false);
 
     ~ZipFile() override;
 
@@ -193,9 +262,14 @@ class ZipFile : public File
 
   private:
     zip_file_t* _file = nullptr;
+
+    /// The uncompressed size from the central directory, if known.
+    std::optional<uint64_t> _size;
+
+    uint64_t _read = 0;
 };
 
-ZipFile::ZipFile(Archive* archive, int64_t index)
+ZipFile::ZipFile(Archive* archive, int64_t index, bool compressed)
 {
     auto* zipArchive = dynamic_cast<zip::ZipArchive*>(archive);
     if (zipArchive == nullptr)
@@ -203,7 +277,13 @@ ZipFile::ZipFile(Archive* archive, int64_t index)
         return;
     }
 
-    _file = zip_fopen_index(zipArchive->get(), index, 0);
+    _file = zip_fopen_index(zipArchive->get(), index,
+                            compressed ? ZIP_FL_COMPRESSED : 0);
+    uint64_t size = 0;
+    if (!compressed && zipArchive->getSize(index, size))
+    {
+        _size = size;
+    }
 }
 
 ZipFile::~ZipFile()
@@ -218,20 +298,141 @@ int64_t ZipFile::read(void* buffer, uint64_t length)
 {
     assert(_file);
 
-    return zip_fread(_file, buffer, length);
+    if (_size && _read > *_size)
+    {
+        return -1;
+    }
+
+    // Read one byte more than the declared size, so a zip bomb with a lying
+    // central directory is detected without decompressing all of it.
+    if (_size)
+    {
+        length = std::min(length, *_size - _read + 1);
+    }
+
+    const int64_t read = zip_fread(_file, buffer, length);
+    if (read > 0)
+    {
+        _read += read;
+    }
+    if (_size && _read > *_size)
+    {
+        return -1;
+    }
+
+    return read;
 }
 
 std::string ZipFile::getErrorString()
 {
     assert(_file);
 
+    if (_size && _read > *_size)
+    {
+        return "Stream is larger than its size in the central directory";
+    }
+
     return zip_file_strerror(_file);
 }
 
 zip_file_t* ZipFile::get() { return _file; }
 
+/**
+ * Small deflated entry, decompressed in one call into a buffer of the right
+ * size, instead of in the chunks the reader asks for.
+ */
+class InflatedFile : public File
+{
+  public:
+    /// Returns nullptr if the entry has to be read with ZipFile.
+    static std::unique_ptr<File> create(Archive* archive, int64_t index);
+
+    int64_t read(void* buffer, uint64_t length) override;
+
+    std::string getErrorString() override;
+
+  private:
+    std::vector<unsigned char> _data;
+    size_t _offset = 0;
+};
+
+std::unique_ptr<File> InflatedFile::create(Archive* archive, int64_t index)
+{
+    // Created on first use, reused by the next entries on the thread.
+    thread_local std::unique_ptr<Inflater> inflater = Inflater::create();
+    thread_local std::vector<unsigned char> compressed;
+    auto* zipArchive = dynamic_cast<zip::ZipArchive*>(archive);
+    if (!inflater || zipArchive == nullptr)
+    {
+        return nullptr;
+    }
+
+    zip_stat_t stat;
+    zip_stat_init(&stat);
+    const zip_uint64_t required = ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE |
+                                  ZIP_STAT_CRC | ZIP_STAT_COMP_METHOD |
+                                  ZIP_STAT_ENCRYPTION_METHOD;
+    if (zip_stat_index(zipArchive->get(), index, 0, &stat) < 0 ||
+        (stat.valid & required) != required ||
+        stat.comp_method != ZIP_CM_DEFLATE ||
+        stat.encryption_method != ZIP_EM_NONE || stat.size == 0 ||
+        stat.size > maxInflatedSize || stat.comp_size > maxInflatedSize)
+    {
+        return nullptr;
+    }
+
+    ZipFile compressedFile(archive, index, /*compressed=*/true);
+    if (compressedFile.get() == nullptr)
+    {
+        return nullptr;
+    }
+
+    compressed.resize(stat.comp_size);
+    if (compressedFile.read(compressed.data(), compressed.size()) !=
+        static_cast<int64_t>(compressed.size()))
+    {
+        return nullptr;
+    }
+
+    auto file = std::make_unique<InflatedFile>();
+    file->_data.resize(stat.size);
+    if (!inflater->inflate(compressed.data(), compressed.size(),
+                           file->_data.data(), file->_data.size()))
+    {
+        // Let libzip report the error.
+        return nullptr;
+    }
+
+    uint32_t crc = 0;
+    crc32Update(file->_data.data(), file->_data.size(), crc);
+    if (crc != stat.crc)
+    {
+        // Let libzip report the error.
+        return nullptr;
+    }
+
+    return file;
+}
+
+int64_t InflatedFile::read(void* buffer, uint64_t length)
+{
+    const size_t count =
+        std::min(static_cast<size_t>(length), _data.size() - _offset);
+    std::memcpy(buffer, _data.data() + _offset, count);
+    _offset += count;
+    return static_cast<int64_t>(count);
+}
+
+std::string InflatedFile::getErrorString() { return std::string(); }
+
 std::unique_ptr<File> File::create(Archive* archive, int64_t index)
 {
+    std::unique_ptr<File> inflated = InflatedFile::create(archive, index);
+    if (inflated)
+    {
+        return inflated;
+    }
+
     auto file = std::make_unique<ZipFile>(archive, index);
     if (file->get() != nullptr)
     {
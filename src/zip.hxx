@@ -49,6 +49,15 @@ class Archive
 
     virtual std::string getName(int64_t index) = 0;
 
+    /// Gets the uncompressed size of the stream at index.
+    virtual bool getSize(int64_t index, uint64_t& size) = 0;
+
+    /// Gets the compressed size of the stream at index.
+    virtual bool getCompressedSize(int64_t index, uint64_t& size) = 0;
+
+    /// Gets the CRC-32 of the uncompressed stream at index.
+    virtual bool getCrc(int64_t index, uint32_t& crc) = 0;
+
     /// Factory for this interface. If returns nullptr, error is set.
     static std::unique_ptr<Archive> create(Source* source, Error* error);
 };